@@ -1,6 +1,10 @@
 #include "Accelerator.h"
+#include "Trace.h"
+#include <chrono>
 #include <cmath>
-#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 
 namespace AutoBug
 {
@@ -18,16 +22,40 @@ Accelerator& Accelerator::instance() noexcept
 Accelerator::~Accelerator() noexcept
 {
     clFinish(m_cmd);
+    m_profiler.report();
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        m_stagingBusy[i] = Future{};
+        if (m_staging[i] != nullptr)
+        {
+            clEnqueueUnmapMemObject(m_cmd, m_staging[i], m_stagingPtr[i], 0, nullptr, nullptr);
+            clReleaseMemObject(m_staging[i]);
+        }
+    }
+    clFinish(m_cmd);
     
     for (auto& kernel : m_kernels)
     {
         clReleaseKernel(kernel.second);
     }
 
+    for (auto& program : m_programs)
+    {
+        if (program.second != nullptr)
+            clReleaseProgram(program.second);
+    }
+
+    // 不属于缓存池的是直接使用主机内存的缓存
     for (auto& buff : m_buffers)
     {
-        clReleaseMemObject(buff.second);
+        if (m_pool.capacity(buff.second) > 0)
+            m_pool.release(buff.second);
+        else
+            clReleaseMemObject(buff.second);
     }
+    m_buffers.clear();
+    m_pool.clear();
 
     clReleaseProgram(m_program);
     clReleaseCommandQueue(m_cmd);
@@ -36,31 +64,35 @@ Accelerator::~Accelerator() noexcept
 }
 
 Accelerator::Accelerator() noexcept :
+    Accelerator(m_default().platform, m_default().device)
+{
+
+}
+
+Accelerator::Accelerator(cl_platform_id pid, cl_device_id did) noexcept :
     m_enable(true),
-    m_pid(nullptr),
-    m_did(nullptr),
+    m_pid(pid),
+    m_did(did),
     m_ctx(nullptr),
     m_cmd(nullptr),
     m_program(nullptr),
     m_name(""),
-    m_maxLocalSize(64)
+    m_maxLocalSize(64),
+    m_localMemSize(16 * 1024),
+    m_computeUnits(1),
+    m_tiled(false),
+    m_unified(false),
+    m_staging{nullptr, nullptr},
+    m_stagingPtr{nullptr, nullptr}
 {
-    // 获取平台
-    cl_int state = clGetPlatformIDs(1, &m_pid, nullptr);
-    if (state != CL_SUCCESS)
-    {
-        fprintf(stderr, "failed to get platform id\n");
+    // 选择设备时已经输出了错误信息
+    if (m_pid == nullptr || m_did == nullptr)
         return;
-    }
 
-    // 获取设备
-    state = clGetDeviceIDs(m_pid, CL_DEVICE_TYPE_GPU, 1, &m_did, nullptr);
-    if (state != CL_SUCCESS)
-    {
-        fprintf(stderr, "failed to get device id\n");
-        return;
-    }
+    // 析构时释放,子设备由调用者和本对象各持有一个引用
+    clRetainDevice(m_did);
 
+    cl_int state;
     // 创建上下文
     m_ctx = clCreateContext(nullptr, 1, &m_did, nullptr, nullptr, &state);
     if (state != CL_SUCCESS)
@@ -68,36 +100,23 @@ Accelerator::Accelerator() noexcept :
         fprintf(stderr, "failed to create context\n");
         return;
     }
+    m_pool.setContext(m_ctx);
 
-    // 创建指令队列
-    m_cmd = clCreateCommandQueueWithProperties(m_ctx, m_did, nullptr, &state);
+    // 创建指令队列,性能分析时记录每条命令的时间
+    bool profile = Profiler::requested();
+    cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    m_cmd = clCreateCommandQueueWithProperties(m_ctx, m_did, profile ? properties : nullptr, &state);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to create command queue\n");
         return;
     }
+    m_profiler.setEnable(profile);
 
-    // 创建OpenCL程序
-    size_t len = strlen(Accelerator::source);
-    m_program = clCreateProgramWithSource(m_ctx, 1, &Accelerator::source, &len, &state);
-    if (state != CL_SUCCESS)
-    {
-        fprintf(stderr, "failed to create program\n");
+    // 创建OpenCL程序,优先使用缓存的二进制
+    m_program = m_cache.build(m_ctx, m_pid, m_did, Accelerator::source, nullptr);
+    if (m_program == nullptr)
         return;
-    }
-
-    // 构建OpenCL程序
-    state = clBuildProgram(m_program, 1, &m_did, nullptr, nullptr, nullptr);
-    if (state != CL_SUCCESS)
-    {
-        size_t len = 0;
-        clGetProgramBuildInfo(m_program, m_did, CL_PROGRAM_BUILD_LOG, 0, nullptr, &len);
-        char* msg = new char[len];
-        clGetProgramBuildInfo(m_program, m_did, CL_PROGRAM_BUILD_LOG, len, msg, &len);
-        fprintf(stderr, "failed to build program: %*s\n", static_cast<unsigned int>(len), msg);
-        delete[] msg;
-        return;
-    }
 
     // 读取设备名称
     size_t n = 0;
@@ -113,6 +132,15 @@ Accelerator::Accelerator() noexcept :
         m_name = buffer;
         delete[] buffer;
     }
+    m_profiler.setDevice(m_name);
+
+    // 读取计算单元数量,多设备时按比例分配样本
+    cl_uint computeUnits = 0;
+    state = clGetDeviceInfo(m_did, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, nullptr);
+    if (state == CL_SUCCESS && computeUnits > 0)
+    {
+        m_computeUnits = computeUnits;
+    }
 
     // 读取设备上一组任务的最大工作数量
     state = clGetDeviceInfo(m_did, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &m_maxLocalSize, nullptr);
@@ -120,6 +148,157 @@ Accelerator::Accelerator() noexcept :
     {
         m_maxLocalSize = 64;
     }
+
+    // 读取局部内存的大小,用于确定特化程序的分块大小
+    cl_ulong localMemSize = 0;
+    state = clGetDeviceInfo(m_did, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMemSize), &localMemSize, nullptr);
+    if (state == CL_SUCCESS && localMemSize > 0)
+    {
+        m_localMemSize = localMemSize;
+    }
+
+    // 有独立局部内存的设备(通常是GPU)上分块版本更快,CPU上局部内存只是普通内存
+    cl_device_local_mem_type memType = CL_GLOBAL;
+    state = clGetDeviceInfo(m_did, CL_DEVICE_LOCAL_MEM_TYPE, sizeof(memType), &memType, nullptr);
+    m_tiled = (state == CL_SUCCESS && memType == CL_LOCAL);
+
+    const char* findNearest = getenv("AUTO_BUG_FIND_NEAREST");
+    if (findNearest != nullptr && strcmp(findNearest, "tiled") == 0)
+        m_tiled = true;
+    else if (findNearest != nullptr && strcmp(findNearest, "simple") == 0)
+        m_tiled = false;
+
+    // 集成显卡和CPU与主机共享内存,支持细粒度SVM的设备也可以直接访问
+    // 映射的内存,这些设备上传数据时不需要中转
+    cl_bool hostUnified = CL_FALSE;
+    state = clGetDeviceInfo(m_did, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(hostUnified), &hostUnified, nullptr);
+    m_unified = (state == CL_SUCCESS && hostUnified);
+
+    cl_device_svm_capabilities svm = 0;
+    state = clGetDeviceInfo(m_did, CL_DEVICE_SVM_CAPABILITIES, sizeof(svm), &svm, nullptr);
+    if (state == CL_SUCCESS && (svm & CL_DEVICE_SVM_FINE_GRAIN_BUFFER))
+        m_unified = true;
+
+    const char* upload = getenv("AUTO_BUG_UPLOAD");
+    if (upload != nullptr && strcmp(upload, "map") == 0)
+        m_unified = true;
+    else if (upload != nullptr && strcmp(upload, "staging") == 0)
+        m_unified = false;
+
+    // 预先加载所有核函数,const成员函数中直接查表
+    for (const auto& name : Accelerator::functions)
+    {
+        kernel(name);
+    }
+}
+
+/*******************************************
+ * @brief 列出所有平台上指定类型的设备
+ * @param[in] type 设备类型
+ * @return 设备列表
+ * ****************************************/
+std::vector<Accelerator::Device> Accelerator::enumerate(cl_device_type type) noexcept
+{
+    std::vector<Device> devices;
+
+    cl_uint n = 0;
+    cl_int state = clGetPlatformIDs(0, nullptr, &n);
+    if (state != CL_SUCCESS || n == 0)
+    {
+        fprintf(stderr, "failed to get platform id\n");
+        return devices;
+    }
+
+    std::vector<cl_platform_id> platforms(n);
+    clGetPlatformIDs(n, platforms.data(), nullptr);
+    for (auto pid : platforms)
+    {
+        // 没有该类型设备的平台返回CL_DEVICE_NOT_FOUND,直接跳过
+        cl_uint m = 0;
+        state = clGetDeviceIDs(pid, type, 0, nullptr, &m);
+        if (state != CL_SUCCESS || m == 0)
+            continue;
+
+        std::vector<cl_device_id> ids(m);
+        clGetDeviceIDs(pid, type, m, ids.data(), nullptr);
+        for (auto did : ids)
+        {
+            devices.push_back(Device{pid, did});
+        }
+    }
+
+    if (devices.empty())
+        fprintf(stderr, "failed to get device id\n");
+    return devices;
+}
+
+/*******************************************
+ * @brief 将一个设备平均划分为多个子设备,例如把多核
+ *        CPU划分为几个互相独立的设备
+ * @param[in] device 设备
+ * @param[in] units 每个子设备的计算单元数量
+ * @return 子设备列表,不支持划分时返回空列表
+ * ****************************************/
+std::vector<Accelerator::Device> Accelerator::partition(const Device& device, cl_uint units) noexcept
+{
+    std::vector<Device> devices;
+    const cl_device_partition_property props[] = {
+        CL_DEVICE_PARTITION_EQUALLY,
+        static_cast<cl_device_partition_property>(units),
+        0
+    };
+
+    cl_uint n = 0;
+    cl_int state = clCreateSubDevices(device.device, props, 0, nullptr, &n);
+    if (state != CL_SUCCESS || n == 0)
+    {
+        fprintf(stderr, "failed to create sub devices\n");
+        return devices;
+    }
+
+    std::vector<cl_device_id> ids(n);
+    state = clCreateSubDevices(device.device, props, n, ids.data(), nullptr);
+    if (state != CL_SUCCESS)
+    {
+        fprintf(stderr, "failed to create sub devices\n");
+        return devices;
+    }
+
+    for (auto did : ids)
+    {
+        devices.push_back(Device{device.platform, did});
+    }
+    return devices;
+}
+
+/*******************************************
+ * @brief 获取选中的所有加速器,第一个即instance(),
+ *        通过环境变量选择设备:
+ *        AUTO_BUG_DEVICE_TYPE  设备类型,gpu(默认)、cpu、
+ *                              accelerator或all
+ *        AUTO_BUG_PLATFORM     只使用名称中包含该字符串
+ *                              的平台
+ *        AUTO_BUG_DEVICES      设备序号列表,如"0,2",或
+ *                              all,默认为0
+ *        AUTO_BUG_SUB_DEVICES  将每个设备平均划分为子设备,
+ *                              值为每个子设备的计算单元数量
+ * @return 加速器列表
+ * ****************************************/
+std::vector<Accelerator*>& Accelerator::devices() noexcept
+{
+    static std::vector<std::unique_ptr<Accelerator>> others;
+    static std::vector<Accelerator*> list = []() {
+        std::vector<Accelerator*> list;
+        const auto& selected = m_selected();
+        list.push_back(&instance());
+        for (size_t i = 1; i < selected.size(); i++)
+        {
+            others.emplace_back(new Accelerator(selected[i].platform, selected[i].device));
+            list.push_back(others.back().get());
+        }
+        return list;
+    }();
+    return list;
 }
 
 /*******************************************
@@ -154,6 +333,15 @@ std::string Accelerator::name() const noexcept
     return m_name;
 }
 
+/*******************************************
+ * @brief 获取设备的计算单元数量
+ * @return 计算单元数量
+ * ****************************************/
+size_t Accelerator::computeUnits() const noexcept
+{
+    return m_computeUnits;
+}
+
 /*******************************************
  * @brief 获取一组任务的工作数量
  * @return 一组任务的工作数量
@@ -163,6 +351,39 @@ size_t Accelerator::maxLocalSize() const noexcept
     return m_maxLocalSize;
 }
 
+/*******************************************
+ * @brief 设备是否与主机共享内存,例如集成显卡、CPU或
+ *        支持细粒度SVM的设备,此时上传数据不需要复制,
+ *        也可以通过环境变量AUTO_BUG_UPLOAD设置为map或
+ *        staging
+ * @return 是否共享内存
+ * ****************************************/
+bool Accelerator::unifiedMemory() const noexcept
+{
+    return m_unified;
+}
+
+/*******************************************
+ * @brief 是否使用分块版本的findNearest核函数
+ * @return 是否使用分块版本
+ * ****************************************/
+bool Accelerator::tiled() const noexcept
+{
+    return m_tiled;
+}
+
+/*******************************************
+ * @brief 设置是否使用分块版本的findNearest核函数,
+ *        默认根据设备是否有独立的局部内存决定,也可
+ *        以通过环境变量AUTO_BUG_FIND_NEAREST设置为
+ *        tiled或simple
+ * @param[in] tiled 是否使用分块版本
+ * ****************************************/
+void Accelerator::setTiled(bool tiled) noexcept
+{
+    m_tiled = tiled;
+}
+
 /*******************************************
  * @brief 计算一组任务的工作数量
  * @param[in] n 任务总数
@@ -218,6 +439,92 @@ cl_kernel Accelerator::kernel(const std::string& name) noexcept
     }
 }
 
+/*******************************************
+ * @brief 创建一个独立的核函数对象,参数绑定不与其他
+ *        调用者共享,由调用者释放
+ * @param[in] name 核函数的名字
+ * @param[in] options 构建选项,为空时使用通用程序
+ * @return 核函数,失败返回nullptr;特化程序构建失败
+ *         时使用通用程序
+ * ****************************************/
+cl_kernel Accelerator::createKernel(const std::string& name, const std::string& options) noexcept
+{
+    cl_kernel fn = nullptr;
+    cl_program program = options.empty() ? m_program : m_programFor(options);
+    if (program != nullptr)
+        fn = clCreateKernel(program, name.c_str(), nullptr);
+    if (fn == nullptr && program != m_program && m_program != nullptr)
+        fn = clCreateKernel(m_program, name.c_str(), nullptr);
+    if (fn == nullptr)
+        fprintf(stderr, "failed to create kernel %s\n", name.c_str());
+    return fn;
+}
+
+/*******************************************
+ * @brief 根据数据的形状生成特化程序的构建选项,将维度、
+ *        分组数量和分块大小编译为常量
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @return 构建选项
+ * ****************************************/
+std::string Accelerator::specialize(int dims, int k) const noexcept
+{
+    // 分组较少时一块放下所有中心点;维度按4对齐,在局部内存
+    // 的一半以内尽量一次放下,减少同步次数
+    size_t tileK = k < 8 ? k : 8;
+    size_t tileDims = (dims + 3) / 4 * 4;
+    tileDims = tileDims < 512 ? tileDims : 512;
+    while (tileDims > 4 && tileK * tileDims * sizeof(float) > m_localMemSize / 2)
+    {
+        tileDims = tileDims / 2 / 4 * 4;
+    }
+
+    char options[128];
+    snprintf(options, sizeof(options), "-D DIMS=%d -D K=%d -D TILE_K=%zu -D TILE_DIMS=%zu", dims, k, tileK, tileDims);
+    return options;
+}
+
+/*******************************************
+ * @brief 检查特化程序是否已经构建,或者可以从程序
+ *        缓存中加载
+ * @param[in] options 构建选项,为空时表示通用程序
+ * @return 是否不需要从源码构建
+ * ****************************************/
+bool Accelerator::built(const std::string& options) const noexcept
+{
+    if (options.empty())
+        return m_program != nullptr;
+
+    auto program = m_programs.find(options);
+    if (program != m_programs.end())
+        return program->second != nullptr;
+
+    return m_cache.contains(m_pid, m_did, Accelerator::source, options.c_str());
+}
+
+/*******************************************
+ * @brief 从源码构建一次特化程序并计时,不使用也不
+ *        写入程序缓存,构建结果随即释放
+ * @param[in] options 构建选项
+ * @return 耗时(秒),失败返回-1
+ * ****************************************/
+double Accelerator::buildSeconds(const std::string& options) const noexcept
+{
+    if (m_ctx == nullptr)
+        return -1;
+
+    ProgramCache cache;
+    cache.setDirectory("");
+    auto start = std::chrono::steady_clock::now();
+    cl_program program = cache.build(m_ctx, m_pid, m_did, Accelerator::source, options.c_str());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (program == nullptr)
+        return -1;
+
+    clReleaseProgram(program);
+    return seconds;
+}
+
 /*******************************************
  * @brief 获取一个缓存
  * @param[in] name 缓存的名字
@@ -236,28 +543,153 @@ cl_mem Accelerator::buffer(const std::string& name) const noexcept
 }
 
 /*******************************************
- * @brief 创建一个缓存
+ * @brief 创建一个缓存,同名缓存容量足够时直接复用,
+ *        否则归还给缓存池并重新获取
  * @param[in] name 缓存的名字
  * @param[in] bytes 缓存的大小
  * @return 创建的缓存
  * ****************************************/
 cl_mem Accelerator::createBuffer(const std::string& name, size_t bytes) noexcept
 {
+    const auto& iter = m_buffers.find(name);
+    if (iter != m_buffers.end())
+    {
+        if (m_pool.capacity(iter->second) >= bytes)
+            return iter->second;
+
+        releaseBuffer(name);
+    }
+
+    cl_mem buff = m_pool.acquire(bytes);
+    if (buff == nullptr)
+        return nullptr;
+
+    m_buffers[name] = buff;
+    return buff;
+}
+
+/*******************************************
+ * @brief 创建一个直接使用主机内存的只读缓存,在共享
+ *        内存的设备上不复制数据;使用期间主机内存必须
+ *        保持有效且不能修改
+ * @param[in] name 缓存的名字
+ * @param[in] ptr 主机内存,必须按HOST_ALIGN对齐,且至少
+ *                有按64字节向上取整的大小
+ * @param[in] bytes 数据大小
+ * @return 创建的缓存,不满足对齐要求或设备不共享内存
+ *         时返回nullptr,此时应使用uploadBuffer
+ * ****************************************/
+cl_mem Accelerator::shareBuffer(const std::string& name, const void* ptr, size_t bytes) noexcept
+{
+    // 驱动只在地址按页对齐、大小按缓存行对齐时才能不复制
+    if (!m_unified || m_ctx == nullptr || bytes == 0 || reinterpret_cast<uintptr_t>(ptr) % HOST_ALIGN != 0)
+        return nullptr;
+
+    releaseBuffer(name);
+
     int state;
-    cl_mem buff = clCreateBuffer(m_ctx, CL_MEM_READ_WRITE, bytes, nullptr, &state);
+    size_t size = (bytes + 63) / 64 * 64;
+    cl_mem buff = clCreateBuffer(m_ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, size, const_cast<void*>(ptr), &state);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to create buffer\n");
         return nullptr;
     }
 
+    m_buffers[name] = buff;
+    return buff;
+}
+
+/*******************************************
+ * @brief 释放一个缓存,缓存池中的缓存归还给缓存池
+ * @param[in] name 缓存的名字
+ * ****************************************/
+void Accelerator::releaseBuffer(const std::string& name) noexcept
+{
     const auto& iter = m_buffers.find(name);
-    if (iter != m_buffers.end())
-    {
+    if (iter == m_buffers.end())
+        return;
+
+    if (m_pool.capacity(iter->second) > 0)
+        m_pool.release(iter->second);
+    else
         clReleaseMemObject(iter->second);
+    m_buffers.erase(iter);
+}
+
+/*******************************************
+ * @brief 由回调函数分段填充数据并上传到一个缓存。共享
+ *        内存的设备上映射缓存直接填充;独立显卡上使用
+ *        两个锁页的中转缓冲区交替填充和传输,返回时数据
+ *        已经复制完,传输可能还在进行
+ * @param[in] name 缓存名字
+ * @param[in] bytes 数据大小
+ * @param[in] fill 填充函数,参数为数据内位置、目标地址
+ *                 和字节数
+ * @return 是否成功
+ * ****************************************/
+bool Accelerator::uploadBuffer(const std::string& name, size_t bytes, const std::function<void(size_t, void*, size_t)>& fill) noexcept
+{
+    TRACE_SCOPE("Accelerator::uploadBuffer");
+    cl_mem target = buffer(name);
+    if (target == nullptr)
+        return false;
+    if (bytes == 0)
+        return true;
+
+    TRACE_COUNT("gpu.bytesWritten", bytes);
+
+    int state;
+    if (m_unified)
+    {
+        cl_event event = nullptr;
+        void* ptr = clEnqueueMapBuffer(m_cmd, target, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, bytes, 0, nullptr, m_profiler.enabled() ? &event : nullptr, &state);
+        if (state != CL_SUCCESS)
+        {
+            fprintf(stderr, "failed to map buffer\n");
+            return false;
+        }
+        m_profiler.record(event, "mapBuffer", bytes);
+        if (event != nullptr)
+            clReleaseEvent(event);
+
+        fill(0, ptr, bytes);
+        state = clEnqueueUnmapMemObject(m_cmd, target, ptr, 0, nullptr, nullptr);
+        if (state != CL_SUCCESS)
+        {
+            fprintf(stderr, "failed to unmap buffer\n");
+            return false;
+        }
+        return true;
     }
-    m_buffers[name] = buff;
-    return buff;
+
+    if (!m_prepareStaging())
+        return false;
+
+    // 填充一个中转缓冲区时,设备从另一个中转缓冲区传输
+    size_t current = 0;
+    for (size_t offset = 0; offset < bytes; offset += STAGING_SIZE)
+    {
+        size_t n = bytes - offset;
+        if (n > STAGING_SIZE)
+            n = STAGING_SIZE;
+        if (!m_stagingBusy[current].wait())
+            return false;
+
+        fill(offset, m_stagingPtr[current], n);
+        cl_event event = nullptr;
+        state = m_enqueueWrite(target, CL_FALSE, offset, n, m_stagingPtr[current], {}, &event);
+        if (state != CL_SUCCESS)
+        {
+            fprintf(stderr, "failed to write buffer\n");
+            return false;
+        }
+        m_stagingBusy[current] = Future{event};
+        clFlush(m_cmd);
+        current = 1 - current;
+    }
+
+    return true;
 }
 
 /*******************************************
@@ -269,11 +701,11 @@ cl_mem Accelerator::createBuffer(const std::string& name, size_t bytes) noexcept
  * @param[in] block 是否阻塞
  * @return 是否成功
  * ****************************************/
-bool Accelerator::writeBuffer(const std::string& name, size_t offset, void* ptr, size_t bytes, bool block) noexcept
+bool Accelerator::writeBuffer(const std::string& name, size_t offset, const void* ptr, size_t bytes, bool block) noexcept
 {
     try
     {
-        int state = clEnqueueWriteBuffer(m_cmd, m_buffers.at(name), block, offset, bytes, ptr, 0, nullptr, nullptr);
+        int state = m_enqueueWrite(m_buffers.at(name), block, offset, bytes, ptr, {}, nullptr);
         if (state != CL_SUCCESS)
         {
             fprintf(stderr, "failed to write buffer\n");
@@ -301,7 +733,7 @@ bool Accelerator::readBuffer(const std::string& name, size_t offset, void* ptr,
 {
     try
     {
-        int state = clEnqueueReadBuffer(m_cmd, m_buffers.at(name), block, offset, bytes, ptr, 0, nullptr, nullptr);
+        int state = m_enqueueRead(m_buffers.at(name), block, offset, bytes, ptr, {}, nullptr);
         if (state != CL_SUCCESS)
         {
             fprintf(stderr, "failed to write buffer\n");
@@ -316,6 +748,81 @@ bool Accelerator::readBuffer(const std::string& name, size_t offset, void* ptr,
     return true;
 }
 
+/*******************************************
+ * @brief 异步写一个缓存,完成前数据必须保持有效
+ * @param[in] name 缓存名字
+ * @param[in] offset 缓存内位置
+ * @param[in] ptr 数据
+ * @param[in] byets 数据大小
+ * @param[in] deps 依赖的结果,全部完成后才开始写
+ * @return 结果
+ * ****************************************/
+Future Accelerator::writeAsync(const std::string& name, size_t offset, const void* ptr, size_t bytes, const std::vector<Future>& deps) noexcept
+{
+    auto waits = Future::events(deps);
+    cl_event event = nullptr;
+    try
+    {
+        int state = m_enqueueWrite(m_buffers.at(name), CL_FALSE, offset, bytes, ptr, waits, &event);
+        if (state != CL_SUCCESS)
+        {
+            fprintf(stderr, "failed to write buffer\n");
+            return Future::failed();
+        }
+    }
+    catch (std::out_of_range&)
+    {
+        return Future::failed();
+    }
+
+    return Future{event};
+}
+
+/*******************************************
+ * @brief 异步读一个缓存,完成前不能访问数据
+ * @param[in] name 缓存名字
+ * @param[in] offset 缓存内位置
+ * @param[out] ptr 数据
+ * @param[in] byets 数据大小
+ * @param[in] deps 依赖的结果,全部完成后才开始读
+ * @return 结果
+ * ****************************************/
+Future Accelerator::readAsync(const std::string& name, size_t offset, void* ptr, size_t bytes, const std::vector<Future>& deps) const noexcept
+{
+    auto waits = Future::events(deps);
+    cl_event event = nullptr;
+    try
+    {
+        int state = m_enqueueRead(m_buffers.at(name), CL_FALSE, offset, bytes, ptr, waits, &event);
+        if (state != CL_SUCCESS)
+        {
+            fprintf(stderr, "failed to read buffer\n");
+            return Future::failed();
+        }
+    }
+    catch (std::out_of_range&)
+    {
+        return Future::failed();
+    }
+
+    return Future{event};
+}
+
+/*******************************************
+ * @brief 将已排队的命令提交给设备,不等待完成
+ * @return 是否成功
+ * ****************************************/
+bool Accelerator::flush() const noexcept
+{
+    int state = clFlush(m_cmd);
+    if (state != CL_SUCCESS)
+    {
+        fprintf(stderr, "failed to flush command queue\n");
+        return false;
+    }
+    return true;
+}
+
 /*******************************************
  * @brief 给核函数设置参数
  * @param[in] kernel 核函数的名字
@@ -324,7 +831,7 @@ bool Accelerator::readBuffer(const std::string& name, size_t offset, void* ptr,
  * @param[in] size 参数的大小
  * @return 是否成功
  * ****************************************/
-bool Accelerator::setArg(cl_kernel kernel, int i, void* arg, size_t size) noexcept
+bool Accelerator::setArg(cl_kernel kernel, int i, const void* arg, size_t size) const noexcept
 {
     int state = clSetKernelArg(kernel, i, size, arg);
     if (state != CL_SUCCESS)
@@ -335,6 +842,28 @@ bool Accelerator::setArg(cl_kernel kernel, int i, void* arg, size_t size) noexce
     return true;
 }
 
+/*******************************************
+ * @brief 设置核函数每次调用的计算量和必须的访存量,
+ *        性能分析时用于计算GFLOP/s和GB/s
+ * @param[in] kernel 核函数
+ * @param[in] flops 浮点运算次数
+ * @param[in] bytes 读写的字节数,都为0时删除
+ * ****************************************/
+void Accelerator::setWork(cl_kernel kernel, double flops, double bytes) const noexcept
+{
+    m_profiler.setWork(kernel, flops, bytes);
+}
+
+/*******************************************
+ * @brief 获取命令队列的性能分析,环境变量
+ *        AUTO_BUG_PROFILE非空时打开,析构时输出报告
+ * @return 性能分析
+ * ****************************************/
+Profiler& Accelerator::profiler() noexcept
+{
+    return m_profiler;
+}
+
 /*******************************************
  * @brief 调用一个核函数
  * @param[in] kernel 运算核函数
@@ -344,7 +873,7 @@ bool Accelerator::setArg(cl_kernel kernel, int i, void* arg, size_t size) noexce
  * ****************************************/
 bool Accelerator::invoke(cl_kernel kernel, size_t localSize, size_t globalSize) const noexcept
 {
-    int state = clEnqueueNDRangeKernel(m_cmd, kernel, 1, nullptr, &globalSize, &localSize, 0, nullptr, nullptr);
+    int state = m_enqueueKernel(kernel, 1, &localSize, &globalSize, {}, nullptr);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to invoke kernel\n");
@@ -354,47 +883,57 @@ bool Accelerator::invoke(cl_kernel kernel, size_t localSize, size_t globalSize)
 }
 
 /*******************************************
- * @brief 调用一个核函数
+ * @brief 调用一个多维的核函数
  * @param[in] kernel 运算核函数
- * @param[in] localSize 一组工作项的数量
- * @param[in] globalSize 总工作项的数量
- * @param[in] argc 参数个数
- * @param[in] ... 传给核函数的参数
+ * @param[in] workDim 维数
+ * @param[in] localSize 每一维一组工作项的数量
+ * @param[in] globalSize 每一维总工作项的数量
  * @return 是否成功
  * ****************************************/
-bool Accelerator::invoke(cl_kernel kernel, size_t localSize, size_t globalSize, size_t argc, ...) const noexcept
+bool Accelerator::invoke(cl_kernel kernel, cl_uint workDim, const size_t* localSize, const size_t* globalSize) const noexcept
 {
-    bool success = true;                    // 返回值
-    int state;
-
-    va_list args;
-    va_start(args, argc);
-
-    // 设置调用参数
-    for (size_t i = 0; i < argc; i++)
+    int state = m_enqueueKernel(kernel, workDim, localSize, globalSize, {}, nullptr);
+    if (state != CL_SUCCESS)
     {
-        cl_mem arg = va_arg(args, cl_mem);
-        state = clSetKernelArg(kernel, i, sizeof(cl_mem), (void*)&arg);
-        if (state != CL_SUCCESS)
-        {
-            fprintf(stderr, "failed to set arg\n");
-            success = false;
-            goto EXIT;
-        }
+        fprintf(stderr, "failed to invoke kernel\n");
+        return false;
     }
+    return true;
+}
+
+/*******************************************
+ * @brief 异步调用一个核函数
+ * @param[in] kernel 运算核函数
+ * @param[in] localSize 一组工作项的数量
+ * @param[in] globalSize 总工作项的数量
+ * @param[in] deps 依赖的结果,全部完成后才开始执行
+ * @return 结果
+ * ****************************************/
+Future Accelerator::invokeAsync(cl_kernel kernel, size_t localSize, size_t globalSize, const std::vector<Future>& deps) const noexcept
+{
+    return invokeAsync(kernel, 1, &localSize, &globalSize, deps);
+}
 
-    // 调用核函数
-    state = clEnqueueNDRangeKernel(m_cmd, kernel, 1, nullptr, &globalSize, &localSize, 0, nullptr, nullptr);
+/*******************************************
+ * @brief 异步调用一个多维的核函数
+ * @param[in] kernel 运算核函数
+ * @param[in] workDim 维数
+ * @param[in] localSize 每一维一组工作项的数量
+ * @param[in] globalSize 每一维总工作项的数量
+ * @param[in] deps 依赖的结果,全部完成后才开始执行
+ * @return 结果
+ * ****************************************/
+Future Accelerator::invokeAsync(cl_kernel kernel, cl_uint workDim, const size_t* localSize, const size_t* globalSize, const std::vector<Future>& deps) const noexcept
+{
+    auto waits = Future::events(deps);
+    cl_event event = nullptr;
+    int state = m_enqueueKernel(kernel, workDim, localSize, globalSize, waits, &event);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to invoke kernel\n");
-        success = false;
-        goto EXIT;
+        return Future::failed();
     }
-
-EXIT:
-    va_end(args);
-    return success;
+    return Future{event};
 }
 
 /*******************************************
@@ -407,10 +946,27 @@ EXIT:
  * @return 是否成功
  * ****************************************/
 bool Accelerator::scalar(const float* v1, const float* v2, size_t n, cl_kernel kernel, float* ret) const noexcept
+{
+    return scalarAsync(v1, v2, n, kernel, ret).wait();
+}
+
+/*******************************************
+ * @brief 异步对向量进行一次标量运算,完成前输入和
+ *        输出都必须保持有效
+ * @param[in] v1 进行运算的向量1
+ * @param[in] v2 进行运算的向量2
+ * @param[in] n 向量长度
+ * @param[in] kernel 运算核函数
+ * @param[out] ret 运算结果
+ * @param[in] deps 依赖的结果
+ * @return 结果,完成时归还临时缓存
+ * ****************************************/
+Future Accelerator::scalarAsync(const float* v1, const float* v2, size_t n, cl_kernel kernel, float* ret, const std::vector<Future>& deps) const noexcept
 {
     size_t localSize = this->localSize(n);
     size_t globalSize = this->globalSize(n);
-    bool success = true;
+    auto waits = Future::events(deps);
+    cl_event event = nullptr;
     int state;
 
     // 参数
@@ -418,67 +974,69 @@ bool Accelerator::scalar(const float* v1, const float* v2, size_t n, cl_kernel k
     cl_mem arg2 = nullptr;
     cl_mem arg3 = nullptr;
     
-    arg1 = clCreateBuffer(m_ctx, CL_MEM_WRITE_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg1 = m_pool.acquire(globalSize * sizeof(float));
+    if (arg1 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
-        success = false;
         goto EXIT;
     }
 
-    arg2 = clCreateBuffer(m_ctx, CL_MEM_WRITE_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg2 = m_pool.acquire(globalSize * sizeof(float));
+    if (arg2 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
-        success = false;
         goto EXIT;
     }
 
-    arg3 = clCreateBuffer(m_ctx, CL_MEM_READ_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg3 = m_pool.acquire(globalSize * sizeof(float));
+    if (arg3 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
-        success = false;
         goto EXIT;
     }
 
-    state = clEnqueueWriteBuffer(m_cmd, arg1, CL_TRUE, 0, n * sizeof(float), v1, 0, nullptr, nullptr);
+    state = m_enqueueWrite(arg1, CL_FALSE, 0, n * sizeof(float), v1, waits, nullptr);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to write arg\n");
-        success = false;
         goto EXIT;
     }
 
-    state = clEnqueueWriteBuffer(m_cmd, arg2, CL_TRUE, 0, n * sizeof(float), v2, 0, nullptr, nullptr);
+    state = m_enqueueWrite(arg2, CL_FALSE, 0, n * sizeof(float), v2, waits, nullptr);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to write arg\n");
-        success = false;
         goto EXIT;
     }
 
-    success = invoke(kernel, localSize, globalSize, 3, arg1, arg2, arg3);
+    if (!setArg(kernel, 0, &arg1, sizeof(cl_mem)) ||
+        !setArg(kernel, 1, &arg2, sizeof(cl_mem)) ||
+        !setArg(kernel, 2, &arg3, sizeof(cl_mem)) ||
+        !invoke(kernel, localSize, globalSize))
+        goto EXIT;
 
-    state = clEnqueueReadBuffer(m_cmd, arg3, CL_TRUE, 0, n * sizeof(float), ret, 0, nullptr, nullptr);
+    state = m_enqueueRead(arg3, CL_FALSE, 0, n * sizeof(float), ret, {}, &event);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to read arg\n");
-        success = false;
         goto EXIT;
     }
 
-EXIT:
-    if (arg1 != nullptr)
-        clReleaseMemObject(arg1);
-
-    if (arg2 != nullptr)
-        clReleaseMemObject(arg2);
+    // 读完成时所有命令都已执行完,再归还临时缓存
+    return Future{event, [this, arg1, arg2, arg3]() {
+        m_pool.release(arg1);
+        m_pool.release(arg2);
+        m_pool.release(arg3);
+    }};
 
-    if (arg3 != nullptr)
-        clReleaseMemObject(arg3);
+EXIT:
+    // 已排队的命令可能还在使用临时缓存
+    clFinish(m_cmd);
+    m_pool.release(arg1);
+    m_pool.release(arg2);
+    m_pool.release(arg3);
 
-    return success;
+    return Future::failed();
 }
 
 /*******************************************
@@ -570,33 +1128,30 @@ bool Accelerator::div(const float* v1, const float* v2, size_t n, float* ret) co
  * ****************************************/
 bool Accelerator::reduction(const float* v, size_t n, float* ret) const noexcept
 {
-    size_t localSize = this->localSize(n);
-    size_t globalSize = this->globalSize(n);
     bool success = true;
     int state;
 
     // 参数
     cl_mem arg1 = nullptr;
     cl_mem arg2 = nullptr;
-    float* temp = new float[n];
 
-    arg1 = clCreateBuffer(m_ctx, CL_MEM_WRITE_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg1 = m_pool.acquire(n * sizeof(float));
+    if (arg1 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
         success = false;
         goto EXIT;
     }
 
-    arg2 = clCreateBuffer(m_ctx, CL_MEM_READ_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg2 = m_pool.acquire(sizeof(float));
+    if (arg2 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
         success = false;
         goto EXIT;
     }
 
-    state = clEnqueueWriteBuffer(m_cmd, arg1, CL_TRUE, 0, n * sizeof(float), v, 0, nullptr, nullptr);
+    state = m_enqueueWrite(arg1, CL_FALSE, 0, n * sizeof(float), v, {}, nullptr);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to write arg\n");
@@ -604,18 +1159,12 @@ bool Accelerator::reduction(const float* v, size_t n, float* ret) const noexcept
         goto EXIT;
     }
 
-    try
-    {
-        success = invoke(m_kernels.at("reduction"), localSize, globalSize, 2, arg1, arg2);
-    }
-    catch (std::out_of_range&)
-    {
-        success = false;
+    success = reduce(arg1, n, arg2, 0);
+    if (!success)
         goto EXIT;
-    }
-    
 
-    state = clEnqueueReadBuffer(m_cmd, arg2, CL_TRUE, 0, n * sizeof(float), temp, 0, nullptr, nullptr);
+    // 只读回一个标量
+    state = m_enqueueRead(arg2, CL_TRUE, 0, sizeof(float), ret, {}, nullptr);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to read arg\n");
@@ -623,27 +1172,15 @@ bool Accelerator::reduction(const float* v, size_t n, float* ret) const noexcept
         goto EXIT;
     }
 
-    *ret = 0.0f;
-    for (size_t i = 0; i < n; i += localSize)
-    {
-        *ret += temp[i];
-    }
-
 EXIT:
-    if (arg1 != nullptr)
-        clReleaseMemObject(arg1);
-
-    if (arg2 != nullptr)
-        clReleaseMemObject(arg2);
-
-    if (temp != nullptr)
-        delete[] temp;
+    m_pool.release(arg1);
+    m_pool.release(arg2);
 
     return success;
 }
 
 /*******************************************
- * @brief 计算两个坐标元素的差的平方
+ * @brief 计算两个坐标之间的距离
  * @param[in] v1 向量1
  * @param[in] v2 向量2
  * @param[in] n 向量长度
@@ -652,8 +1189,23 @@ EXIT:
  * ****************************************/
 bool Accelerator::distance(const float* v1, float* v2, size_t n, float* ret) const noexcept
 {
-    size_t localSize = this->localSize(n);
-    size_t globalSize = this->globalSize(n);
+    return distanceAsync(v1, v2, n, ret).wait();
+}
+
+/*******************************************
+ * @brief 异步计算两个坐标之间的距离,完成前输入和
+ *        输出都必须保持有效
+ * @param[in] v1 向量1
+ * @param[in] v2 向量2
+ * @param[in] n 向量长度
+ * @param[out] ret 运算结果
+ * @param[in] deps 依赖的结果
+ * @return 结果,完成时归还临时缓存
+ * ****************************************/
+Future Accelerator::distanceAsync(const float* v1, const float* v2, size_t n, float* ret, const std::vector<Future>& deps) const noexcept
+{
+    auto waits = Future::events(deps);
+    cl_event event = nullptr;
     bool success = true;
     int state;
 
@@ -662,88 +1214,495 @@ bool Accelerator::distance(const float* v1, float* v2, size_t n, float* ret) con
     cl_mem arg2 = nullptr;
     cl_mem arg3 = nullptr;
     
-    arg1 = clCreateBuffer(m_ctx, CL_MEM_WRITE_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg1 = m_pool.acquire(n * sizeof(float));
+    if (arg1 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
-        success = false;
         goto EXIT;
     }
 
-    arg2 = clCreateBuffer(m_ctx, CL_MEM_WRITE_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg2 = m_pool.acquire(n * sizeof(float));
+    if (arg2 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
-        success = false;
         goto EXIT;
     }
 
-    arg3 = clCreateBuffer(m_ctx, CL_MEM_READ_ONLY, globalSize * sizeof(float), nullptr, &state);
-    if (state != CL_SUCCESS)
+    arg3 = m_pool.acquire(sizeof(float));
+    if (arg3 == nullptr)
     {
         fprintf(stderr, "failed to create arg\n");
-        success = false;
         goto EXIT;
     }
 
-    state = clEnqueueWriteBuffer(m_cmd, arg1, CL_FALSE, 0, n * sizeof(float), v1, 0, nullptr, nullptr);
+    state = m_enqueueWrite(arg1, CL_FALSE, 0, n * sizeof(float), v1, waits, nullptr);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to write arg\n");
-        success = false;
         goto EXIT;
     }
 
-    state = clEnqueueWriteBuffer(m_cmd, arg2, CL_FALSE, 0, n * sizeof(float), v2, 0, nullptr, nullptr);
+    state = m_enqueueWrite(arg2, CL_FALSE, 0, n * sizeof(float), v2, waits, nullptr);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to write arg\n");
-        success = false;
         goto EXIT;
     }
 
     try
     {
-        success = invoke(m_kernels.at("distanceStep1"), localSize, globalSize, 3, arg1, arg2, arg3);
+        success = m_reduce(m_kernels.at("distanceStage1"), arg1, arg2, n, arg3, 0, true);
     }
     catch (std::out_of_range&)
     {
         success = false;
+    }
+    if (!success)
         goto EXIT;
-    }    
 
-    state = clEnqueueReadBuffer(m_cmd, arg3, CL_TRUE, 0, n * sizeof(float), ret, 0, nullptr, nullptr);
+    // 只读回一个标量
+    state = m_enqueueRead(arg3, CL_FALSE, 0, sizeof(float), ret, {}, &event);
     if (state != CL_SUCCESS)
     {
         fprintf(stderr, "failed to read arg\n");
-        success = false;
         goto EXIT;
     }
 
-    for (size_t i = localSize; i < n; i += localSize)
+    return Future{event, [this, arg1, arg2, arg3]() {
+        m_pool.release(arg1);
+        m_pool.release(arg2);
+        m_pool.release(arg3);
+    }};
+
+EXIT:
+    clFinish(m_cmd);
+    m_pool.release(arg1);
+    m_pool.release(arg2);
+    m_pool.release(arg3);
+
+    return Future::failed();
+}
+
+/*******************************************
+ * @brief 在设备上对缓存内的元素求和,结果写入另一个
+ *        缓存,不进行同步
+ * @param[in] input 输入缓存
+ * @param[in] n 元素数量
+ * @param[out] output 输出缓存
+ * @param[in] offset 结果在输出缓存中的位置(元素序号)
+ * @return 是否成功
+ * ****************************************/
+bool Accelerator::reduce(cl_mem input, size_t n, cl_mem output, size_t offset) const noexcept
+{
+    try
+    {
+        return m_reduce(m_kernels.at("reduceStage1"), input, nullptr, n, output, offset, false);
+    }
+    catch (std::out_of_range&)
+    {
+        return false;
+    }
+}
+
+/*******************************************
+ * @brief 获取特化程序,不存在时构建并缓存
+ * @param[in] options 构建选项,为空时使用通用程序
+ * @return 程序,构建失败返回nullptr
+ * ****************************************/
+cl_program Accelerator::m_programFor(const std::string& options) noexcept
+{
+    if (options.empty())
+        return m_program;
+
+    // 构建失败的程序也记录下来,避免重复构建
+    auto program = m_programs.find(options);
+    if (program == m_programs.end())
     {
-        ret[0] += ret[i];
+        cl_program p = m_cache.build(m_ctx, m_pid, m_did, Accelerator::source, options.c_str());
+        program = m_programs.insert(std::make_pair(options, p)).first;
     }
+    return program->second;
+}
+
+/*******************************************
+ * @brief 创建并映射上传用的锁页中转缓冲区,映射一直
+ *        保持到析构
+ * @return 是否成功
+ * ****************************************/
+bool Accelerator::m_prepareStaging() noexcept
+{
+    for (size_t i = 0; i < 2; i++)
+    {
+        if (m_staging[i] != nullptr)
+            continue;
 
-    ret[0] = std::sqrt(ret[0]);
+        int state;
+        cl_mem buff = clCreateBuffer(m_ctx, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, STAGING_SIZE, nullptr, &state);
+        if (state != CL_SUCCESS)
+        {
+            fprintf(stderr, "failed to create staging buffer\n");
+            return false;
+        }
 
-EXIT:
-    if (arg1 != nullptr)
-        clReleaseMemObject(arg1);
+        void* ptr = clEnqueueMapBuffer(m_cmd, buff, CL_TRUE, CL_MAP_WRITE, 0, STAGING_SIZE, 0, nullptr, nullptr, &state);
+        if (state != CL_SUCCESS)
+        {
+            fprintf(stderr, "failed to map staging buffer\n");
+            clReleaseMemObject(buff);
+            return false;
+        }
+
+        m_staging[i] = buff;
+        m_stagingPtr[i] = ptr;
+    }
+    return true;
+}
+
+/*******************************************
+ * @brief 排队写缓存,统计传输量,性能分析时记录事件
+ * @param[in] mem 缓存
+ * @param[in] block 是否阻塞
+ * @param[in] offset 缓存内位置
+ * @param[in] bytes 数据大小
+ * @param[in] ptr 数据
+ * @param[in] waits 依赖的事件
+ * @param[out] event 命令的事件,可以为nullptr
+ * @return OpenCL状态
+ * ****************************************/
+cl_int Accelerator::m_enqueueWrite(cl_mem mem, cl_bool block, size_t offset, size_t bytes, const void* ptr, const std::vector<cl_event>& waits, cl_event* event) const noexcept
+{
+    // 调用者不需要事件时,只在性能分析时临时创建
+    cl_event profiled = nullptr;
+    cl_event* out = event != nullptr ? event : (m_profiler.enabled() ? &profiled : nullptr);
+    cl_int state = clEnqueueWriteBuffer(m_cmd, mem, block, offset, bytes, ptr, waits.size(), waits.empty() ? nullptr : waits.data(), out);
+    if (state == CL_SUCCESS)
+    {
+        TRACE_COUNT("gpu.bytesWritten", bytes);
+        if (out != nullptr)
+            m_profiler.record(*out, "writeBuffer", bytes);
+    }
+
+    if (profiled != nullptr)
+        clReleaseEvent(profiled);
+    return state;
+}
+
+/*******************************************
+ * @brief 排队读缓存,统计传输量,性能分析时记录事件
+ * @param[in] mem 缓存
+ * @param[in] block 是否阻塞
+ * @param[in] offset 缓存内位置
+ * @param[in] bytes 数据大小
+ * @param[out] ptr 数据
+ * @param[in] waits 依赖的事件
+ * @param[out] event 命令的事件,可以为nullptr
+ * @return OpenCL状态
+ * ****************************************/
+cl_int Accelerator::m_enqueueRead(cl_mem mem, cl_bool block, size_t offset, size_t bytes, void* ptr, const std::vector<cl_event>& waits, cl_event* event) const noexcept
+{
+    cl_event profiled = nullptr;
+    cl_event* out = event != nullptr ? event : (m_profiler.enabled() ? &profiled : nullptr);
+    cl_int state = clEnqueueReadBuffer(m_cmd, mem, block, offset, bytes, ptr, waits.size(), waits.empty() ? nullptr : waits.data(), out);
+    if (state == CL_SUCCESS)
+    {
+        TRACE_COUNT("gpu.bytesRead", bytes);
+        if (out != nullptr)
+            m_profiler.record(*out, "readBuffer", bytes);
+    }
+
+    if (profiled != nullptr)
+        clReleaseEvent(profiled);
+    return state;
+}
+
+/*******************************************
+ * @brief 排队调用核函数,性能分析时记录事件
+ * @param[in] kernel 核函数
+ * @param[in] workDim 维数
+ * @param[in] localSize 每一维一组工作项的数量
+ * @param[in] globalSize 每一维总工作项的数量
+ * @param[in] waits 依赖的事件
+ * @param[out] event 命令的事件,可以为nullptr
+ * @return OpenCL状态
+ * ****************************************/
+cl_int Accelerator::m_enqueueKernel(cl_kernel kernel, cl_uint workDim, const size_t* localSize, const size_t* globalSize, const std::vector<cl_event>& waits, cl_event* event) const noexcept
+{
+    cl_event profiled = nullptr;
+    cl_event* out = event != nullptr ? event : (m_profiler.enabled() ? &profiled : nullptr);
+    cl_int state = clEnqueueNDRangeKernel(m_cmd, kernel, workDim, nullptr, globalSize, localSize, waits.size(), waits.empty() ? nullptr : waits.data(), out);
+    if (state == CL_SUCCESS)
+    {
+        TRACE_COUNT("gpu.kernels", 1);
+        if (out != nullptr)
+            m_profiler.record(*out, kernel);
+    }
+
+    if (profiled != nullptr)
+        clReleaseEvent(profiled);
+    return state;
+}
+
+/*******************************************
+ * @brief 两步归约:步骤1每组输出一个部分和,步骤2用
+ *        一个工作组在设备上得出最终结果
+ * @param[in] stage1 步骤1的核函数
+ * @param[in] x 输入缓存
+ * @param[in] y 第二个输入缓存,nullptr表示只有一个输入
+ * @param[in] n 元素数量
+ * @param[out] output 输出缓存
+ * @param[in] offset 结果在输出缓存中的位置(元素序号)
+ * @param[in] root 是否对结果开平方
+ * @return 是否成功
+ * ****************************************/
+bool Accelerator::m_reduce(cl_kernel stage1, cl_mem x, cl_mem y, size_t n, cl_mem output, size_t offset, bool root) const noexcept
+{
+    // 组内树形归约要求工作项数量为2的幂
+    size_t localSize = 1;
+    while (localSize * 2 <= m_maxLocalSize && localSize * 2 <= 256)
+    {
+        localSize *= 2;
+    }
+
+    // 每个工作项至少累加4个元素,组数不超过1024
+    size_t groups = (n + localSize * 4 - 1) / (localSize * 4);
+    if (groups < 1)
+        groups = 1;
+    if (groups > 1024)
+        groups = 1024;
+    size_t globalSize = groups * localSize;
+
+    cl_kernel stage2 = nullptr;
+    try
+    {
+        stage2 = m_kernels.at("reduceStage2");
+    }
+    catch (std::out_of_range&)
+    {
+        return false;
+    }
+
+    cl_mem partial = m_pool.acquire(groups * sizeof(float));
+    if (partial == nullptr)
+        return false;
+
+    int count = n;
+    int partials = groups;
+    int pos = offset;
+    int rootArg = root ? 1 : 0;
+    int i = 0;
+    bool success = setArg(stage1, i++, &x, sizeof(cl_mem));
+    if (y != nullptr)
+        success = success && setArg(stage1, i++, &y, sizeof(cl_mem));
+    success = success &&
+              setArg(stage1, i++, &partial, sizeof(cl_mem)) &&
+              setArg(stage1, i++, nullptr, localSize * sizeof(float)) &&
+              setArg(stage1, i++, &count, sizeof(count)) &&
+              invoke(stage1, localSize, globalSize) &&
+              setArg(stage2, 0, &partial, sizeof(cl_mem)) &&
+              setArg(stage2, 1, &output, sizeof(cl_mem)) &&
+              setArg(stage2, 2, nullptr, localSize * sizeof(float)) &&
+              setArg(stage2, 3, &partials, sizeof(partials)) &&
+              setArg(stage2, 4, &pos, sizeof(pos)) &&
+              setArg(stage2, 5, &rootArg, sizeof(rootArg)) &&
+              invoke(stage2, localSize, localSize);
+
+    // 队列按顺序执行,归还后再次获取时前面的命令已经使用完毕
+    m_pool.release(partial);
+    return success;
+}
+
+/*******************************************
+ * @brief 计算一个坐标与多个坐标之间的距离,一次调用
+ *        完成所有计算
+ * @param[in] query 坐标,长度为dims
+ * @param[in] matrix rows个坐标,按行连续存放
+ * @param[in] rows 坐标数量
+ * @param[in] dims 维度
+ * @param[out] ret rows个距离;为nullptr时结果保留在
+ *                 设备上名为"distanceBatch"的缓存中
+ * @return 是否成功
+ * ****************************************/
+bool Accelerator::distanceBatch(const float* query, const float* matrix, size_t rows, size_t dims, float* ret) noexcept
+{
+    size_t localSize = this->localSize(rows);
+    size_t globalSize = this->globalSize(rows);
+    cl_kernel fn = kernel("distanceBatch");
+    int d = dims;
+    int n = rows;
+
+    cl_mem arg1 = createBuffer("distanceBatchQuery", dims * sizeof(float));
+    cl_mem arg2 = createBuffer("distanceBatchMatrix", rows * dims * sizeof(float));
+    cl_mem arg3 = createBuffer("distanceBatch", rows * sizeof(float));
+    if (fn == nullptr || arg1 == nullptr || arg2 == nullptr || arg3 == nullptr)
+        return false;
+
+    if (!writeBuffer("distanceBatchQuery", 0, query, dims * sizeof(float), false) ||
+        !writeBuffer("distanceBatchMatrix", 0, matrix, rows * dims * sizeof(float), false))
+        return false;
+
+    // 每组共享一段查询坐标,局部缓存大小与组内工作项数量相同
+    bool success = setArg(fn, 0, &arg1, sizeof(cl_mem)) &&
+                   setArg(fn, 1, &arg2, sizeof(cl_mem)) &&
+                   setArg(fn, 2, &arg3, sizeof(cl_mem)) &&
+                   setArg(fn, 3, nullptr, localSize * sizeof(float)) &&
+                   setArg(fn, 4, &d, sizeof(d)) &&
+                   setArg(fn, 5, &n, sizeof(n)) &&
+                   invoke(fn, localSize, globalSize);
+
+    if (success && ret != nullptr)
+        success = readBuffer("distanceBatch", 0, ret, rows * sizeof(float), true);
+
+    return success;
+}
 
-    if (arg2 != nullptr)
-        clReleaseMemObject(arg2);
+/*******************************************
+ * @brief 计算两组坐标两两之间的距离,一次调用完成
+ *        所有计算
+ * @param[in] a na个坐标,按行连续存放
+ * @param[in] na 坐标数量
+ * @param[in] b nb个坐标,按行连续存放
+ * @param[in] nb 坐标数量
+ * @param[in] dims 维度
+ * @param[out] ret na*nb个距离,第i行第j列为a[i]与b[j]
+ *                 的距离;为nullptr时结果保留在设备上
+ *                 名为"distanceMatrix"的缓存中
+ * @return 是否成功
+ * ****************************************/
+bool Accelerator::distanceMatrix(const float* a, size_t na, const float* b, size_t nb, size_t dims, float* ret) noexcept
+{
+    // 二维分块,每组tile*tile个工作项
+    size_t tile = m_maxLocalSize >= 256 ? 16 : 8;
+    size_t localSize[2] = {tile, tile};
+    size_t globalSize[2] = {(nb + tile - 1) / tile * tile, (na + tile - 1) / tile * tile};
+    cl_kernel fn = kernel("distanceMatrix");
+    int d = dims;
+    int n1 = na;
+    int n2 = nb;
+
+    cl_mem arg1 = createBuffer("distanceMatrixA", na * dims * sizeof(float));
+    cl_mem arg2 = createBuffer("distanceMatrixB", nb * dims * sizeof(float));
+    cl_mem arg3 = createBuffer("distanceMatrix", na * nb * sizeof(float));
+    if (fn == nullptr || arg1 == nullptr || arg2 == nullptr || arg3 == nullptr)
+        return false;
 
-    if (arg3 != nullptr)
-        clReleaseMemObject(arg3);
+    if (!writeBuffer("distanceMatrixA", 0, a, na * dims * sizeof(float), false) ||
+        !writeBuffer("distanceMatrixB", 0, b, nb * dims * sizeof(float), false))
+        return false;
+
+    // 局部缓存每行多留一个元素,避免按列读取时的bank冲突
+    size_t tileBytes = tile * (tile + 1) * sizeof(float);
+    bool success = setArg(fn, 0, &arg1, sizeof(cl_mem)) &&
+                   setArg(fn, 1, &arg2, sizeof(cl_mem)) &&
+                   setArg(fn, 2, &arg3, sizeof(cl_mem)) &&
+                   setArg(fn, 3, nullptr, tileBytes) &&
+                   setArg(fn, 4, nullptr, tileBytes) &&
+                   setArg(fn, 5, &d, sizeof(d)) &&
+                   setArg(fn, 6, &n1, sizeof(n1)) &&
+                   setArg(fn, 7, &n2, sizeof(n2)) &&
+                   invoke(fn, 2, localSize, globalSize);
+
+    if (success && ret != nullptr)
+        success = readBuffer("distanceMatrix", 0, ret, na * nb * sizeof(float), true);
 
     return success;
 }
 
 /* 函数列表 */
+/*******************************************
+ * @brief 按环境变量选择设备,只在第一次调用时选择
+ * @return 选中的设备
+ * ****************************************/
+const std::vector<Accelerator::Device>& Accelerator::m_selected() noexcept
+{
+    static const std::vector<Device> selected = []() {
+        cl_device_type type = CL_DEVICE_TYPE_GPU;
+        const char* env = getenv("AUTO_BUG_DEVICE_TYPE");
+        if (env != nullptr && strcmp(env, "cpu") == 0)
+            type = CL_DEVICE_TYPE_CPU;
+        else if (env != nullptr && strcmp(env, "accelerator") == 0)
+            type = CL_DEVICE_TYPE_ACCELERATOR;
+        else if (env != nullptr && strcmp(env, "all") == 0)
+            type = CL_DEVICE_TYPE_ALL;
+
+        // 按平台名称过滤
+        std::vector<Device> all = enumerate(type);
+        std::vector<Device> devices;
+        const char* platform = getenv("AUTO_BUG_PLATFORM");
+        for (const auto& device : all)
+        {
+            if (platform != nullptr)
+            {
+                char name[256] = {0};
+                clGetPlatformInfo(device.platform, CL_PLATFORM_NAME, sizeof(name) - 1, name, nullptr);
+                if (strstr(name, platform) == nullptr)
+                    continue;
+            }
+            devices.push_back(device);
+        }
+
+        // 按序号选择
+        std::vector<Device> selected;
+        env = getenv("AUTO_BUG_DEVICES");
+        if (env != nullptr && strcmp(env, "all") == 0)
+        {
+            selected = devices;
+        }
+        else
+        {
+            std::string list = env != nullptr ? env : "0";
+            size_t pos = 0;
+            while (pos < list.size())
+            {
+                size_t end = list.find(',', pos);
+                end = end == std::string::npos ? list.size() : end;
+                size_t idx = strtoul(list.substr(pos, end - pos).c_str(), nullptr, 10);
+                if (idx < devices.size())
+                    selected.push_back(devices[idx]);
+                pos = end + 1;
+            }
+        }
+
+        // 划分子设备,不支持划分的设备保持原样
+        env = getenv("AUTO_BUG_SUB_DEVICES");
+        cl_uint units = env != nullptr ? strtoul(env, nullptr, 10) : 0;
+        if (units > 0)
+        {
+            std::vector<Device> subDevices;
+            for (const auto& device : selected)
+            {
+                auto parts = partition(device, units);
+                if (parts.empty())
+                    subDevices.push_back(device);
+                else
+                    subDevices.insert(subDevices.end(), parts.begin(), parts.end());
+            }
+            selected.swap(subDevices);
+        }
+
+        if (!all.empty() && selected.empty())
+            fprintf(stderr, "no device selected\n");
+        return selected;
+    }();
+    return selected;
+}
+
+/*******************************************
+ * @brief 获取默认的设备,即第一个选中的设备
+ * @return 设备,没有可用设备时成员都为nullptr
+ * ****************************************/
+Accelerator::Device Accelerator::m_default() noexcept
+{
+    const auto& selected = m_selected();
+    if (selected.empty())
+        return Device{nullptr, nullptr};
+    return selected[0];
+}
+
 const std::vector<std::string> Accelerator::functions = {
-    "add", "sub", "div", "mul", "reduction",
-    "distanceStep1", "findNearest", "updatePoints"
+    "add", "sub", "div", "mul", "reduceStage1", "reduceStage2",
+    "distanceStage1", "findNearest", "findNearestU8", "findNearestHalf",
+    "distanceBatch", "distanceMatrix", "findNearestTiled",
+    "sumPoints", "sumPointsU8", "sumPointsHalf", "mergePoints", "foldPoints"
 };
 
 /* OpenCL源码 */
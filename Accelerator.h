@@ -6,6 +6,12 @@
 #endif // CL_HPP_TARGET_OPENCL_VERSION
 #include <CL/cl2.hpp>
 
+#include "BufferPool.h"
+#include "ProgramCache.h"
+#include "Future.h"
+#include "Profiler.h"
+
+#include <functional>
 #include <map>
 #include <vector>
 #include <string>
@@ -16,14 +22,53 @@ namespace AutoBug
 class Accelerator
 {
 public:
+    /* 一个OpenCL设备 */
+    struct Device
+    {
+        cl_platform_id platform;
+        cl_device_id device;
+    };
+
     /*******************************************
      * @brief 获取一个全局公共实例
      * @return 对象实例
      * ****************************************/
     static Accelerator& instance() noexcept;
 
+    /*******************************************
+     * @brief 列出所有平台上指定类型的设备
+     * @param[in] type 设备类型
+     * @return 设备列表
+     * ****************************************/
+    static std::vector<Device> enumerate(cl_device_type type = CL_DEVICE_TYPE_ALL) noexcept;
+
+    /*******************************************
+     * @brief 将一个设备平均划分为多个子设备,例如把多核
+     *        CPU划分为几个互相独立的设备
+     * @param[in] device 设备
+     * @param[in] units 每个子设备的计算单元数量
+     * @return 子设备列表,不支持划分时返回空列表
+     * ****************************************/
+    static std::vector<Device> partition(const Device& device, cl_uint units) noexcept;
+
+    /*******************************************
+     * @brief 获取选中的所有加速器,第一个即instance(),
+     *        通过环境变量选择设备:
+     *        AUTO_BUG_DEVICE_TYPE  设备类型,gpu(默认)、cpu、
+     *                              accelerator或all
+     *        AUTO_BUG_PLATFORM     只使用名称中包含该字符串
+     *                              的平台
+     *        AUTO_BUG_DEVICES      设备序号列表,如"0,2",或
+     *                              all,默认为0
+     *        AUTO_BUG_SUB_DEVICES  将每个设备平均划分为子设备,
+     *                              值为每个子设备的计算单元数量
+     * @return 加速器列表
+     * ****************************************/
+    static std::vector<Accelerator*>& devices() noexcept;
+
     ~Accelerator() noexcept;
     Accelerator() noexcept;
+    Accelerator(cl_platform_id pid, cl_device_id did) noexcept;
     Accelerator(const Accelerator&) = delete;
     Accelerator(Accelerator&&) = delete;
 
@@ -51,6 +96,34 @@ public:
      * ****************************************/
     size_t maxLocalSize() const noexcept;
 
+    /*******************************************
+     * @brief 获取设备的计算单元数量
+     * @return 计算单元数量
+     * ****************************************/
+    size_t computeUnits() const noexcept;
+
+    /*******************************************
+     * @brief 设备是否与主机共享内存,例如集成显卡、CPU或
+     *        支持细粒度SVM的设备,此时上传数据不需要复制
+     * @return 是否共享内存
+     * ****************************************/
+    bool unifiedMemory() const noexcept;
+
+    /*******************************************
+     * @brief 是否使用分块版本的findNearest核函数
+     * @return 是否使用分块版本
+     * ****************************************/
+    bool tiled() const noexcept;
+
+    /*******************************************
+     * @brief 设置是否使用分块版本的findNearest核函数,
+     *        默认根据设备是否有独立的局部内存决定,也可
+     *        以通过环境变量AUTO_BUG_FIND_NEAREST设置为
+     *        tiled或simple
+     * @param[in] tiled 是否使用分块版本
+     * ****************************************/
+    void setTiled(bool tiled) noexcept;
+
     /*******************************************
      * @brief 计算一组任务的工作数量
      * @param[in] n 任务总数
@@ -72,6 +145,41 @@ public:
      * ****************************************/
     cl_kernel kernel(const std::string& name) noexcept;
 
+    /*******************************************
+     * @brief 创建一个独立的核函数对象,参数绑定不与其他
+     *        调用者共享,由调用者释放
+     * @param[in] name 核函数的名字
+     * @param[in] options 构建选项,为空时使用通用程序
+     * @return 核函数,失败返回nullptr;特化程序构建失败
+     *         时使用通用程序
+     * ****************************************/
+    cl_kernel createKernel(const std::string& name, const std::string& options = "") noexcept;
+
+    /*******************************************
+     * @brief 根据数据的形状生成特化程序的构建选项,将维度、
+     *        分组数量和分块大小编译为常量
+     * @param[in] dims 维度
+     * @param[in] k 分组数量
+     * @return 构建选项
+     * ****************************************/
+    std::string specialize(int dims, int k) const noexcept;
+
+    /*******************************************
+     * @brief 检查特化程序是否已经构建,或者可以从程序
+     *        缓存中加载
+     * @param[in] options 构建选项,为空时表示通用程序
+     * @return 是否不需要从源码构建
+     * ****************************************/
+    bool built(const std::string& options) const noexcept;
+
+    /*******************************************
+     * @brief 从源码构建一次特化程序并计时,不使用也不
+     *        写入程序缓存,构建结果随即释放
+     * @param[in] options 构建选项
+     * @return 耗时(秒),失败返回-1
+     * ****************************************/
+    double buildSeconds(const std::string& options) const noexcept;
+
     /*******************************************
      * @brief 获取一个缓存
      * @param[in] name 缓存的名字
@@ -80,13 +188,46 @@ public:
     cl_mem buffer(const std::string& name) const noexcept;
 
     /*******************************************
-     * @brief 创建一个缓存
+     * @brief 创建一个缓存,同名缓存容量足够时直接复用,
+     *        否则归还给缓存池并重新获取
      * @param[in] name 缓存的名字
      * @param[in] bytes 缓存的大小
      * @return 创建的缓存
      * ****************************************/
     cl_mem createBuffer(const std::string& name, size_t bytes) noexcept;
 
+    /*******************************************
+     * @brief 创建一个直接使用主机内存的只读缓存,在共享
+     *        内存的设备上不复制数据;使用期间主机内存必须
+     *        保持有效且不能修改
+     * @param[in] name 缓存的名字
+     * @param[in] ptr 主机内存,必须按HOST_ALIGN对齐,且至少
+     *                有按64字节向上取整的大小
+     * @param[in] bytes 数据大小
+     * @return 创建的缓存,不满足对齐要求或设备不共享内存
+     *         时返回nullptr,此时应使用uploadBuffer
+     * ****************************************/
+    cl_mem shareBuffer(const std::string& name, const void* ptr, size_t bytes) noexcept;
+
+    /*******************************************
+     * @brief 释放一个缓存,缓存池中的缓存归还给缓存池
+     * @param[in] name 缓存的名字
+     * ****************************************/
+    void releaseBuffer(const std::string& name) noexcept;
+
+    /*******************************************
+     * @brief 由回调函数分段填充数据并上传到一个缓存。共享
+     *        内存的设备上映射缓存直接填充;独立显卡上使用
+     *        两个锁页的中转缓冲区交替填充和传输,返回时数据
+     *        已经复制完,传输可能还在进行
+     * @param[in] name 缓存名字
+     * @param[in] bytes 数据大小
+     * @param[in] fill 填充函数,参数为数据内位置、目标地址
+     *                 和字节数
+     * @return 是否成功
+     * ****************************************/
+    bool uploadBuffer(const std::string& name, size_t bytes, const std::function<void(size_t, void*, size_t)>& fill) noexcept;
+
     /*******************************************
      * @brief 写一个缓存
      * @param[in] name 缓存名字
@@ -96,7 +237,7 @@ public:
      * @param[in] block 是否阻塞
      * @return 是否成功
      * ****************************************/
-    bool writeBuffer(const std::string& name, size_t offset, void* ptr, size_t bytes, bool block) noexcept;
+    bool writeBuffer(const std::string& name, size_t offset, const void* ptr, size_t bytes, bool block) noexcept;
 
     /*******************************************
      * @brief 读一个缓存
@@ -109,6 +250,34 @@ public:
      * ****************************************/
     bool readBuffer(const std::string& name, size_t offset, void* ptr, size_t bytes, bool block) const noexcept;
 
+    /*******************************************
+     * @brief 异步写一个缓存,完成前数据必须保持有效
+     * @param[in] name 缓存名字
+     * @param[in] offset 缓存内位置
+     * @param[in] ptr 数据
+     * @param[in] byets 数据大小
+     * @param[in] deps 依赖的结果,全部完成后才开始写
+     * @return 结果
+     * ****************************************/
+    Future writeAsync(const std::string& name, size_t offset, const void* ptr, size_t bytes, const std::vector<Future>& deps = {}) noexcept;
+
+    /*******************************************
+     * @brief 异步读一个缓存,完成前不能访问数据
+     * @param[in] name 缓存名字
+     * @param[in] offset 缓存内位置
+     * @param[out] ptr 数据
+     * @param[in] byets 数据大小
+     * @param[in] deps 依赖的结果,全部完成后才开始读
+     * @return 结果
+     * ****************************************/
+    Future readAsync(const std::string& name, size_t offset, void* ptr, size_t bytes, const std::vector<Future>& deps = {}) const noexcept;
+
+    /*******************************************
+     * @brief 将已排队的命令提交给设备,不等待完成
+     * @return 是否成功
+     * ****************************************/
+    bool flush() const noexcept;
+
     /*******************************************
      * @brief 给核函数设置参数
      * @param[in] kernel 核函数的名字
@@ -117,7 +286,23 @@ public:
      * @param[in] size 参数的大小
      * @return 是否成功
      * ****************************************/
-    bool setArg(cl_kernel kernel, int i, void* arg, size_t size) noexcept;
+    bool setArg(cl_kernel kernel, int i, const void* arg, size_t size) const noexcept;
+
+    /*******************************************
+     * @brief 设置核函数每次调用的计算量和必须的访存量,
+     *        性能分析时用于计算GFLOP/s和GB/s
+     * @param[in] kernel 核函数
+     * @param[in] flops 浮点运算次数
+     * @param[in] bytes 读写的字节数,都为0时删除
+     * ****************************************/
+    void setWork(cl_kernel kernel, double flops, double bytes) const noexcept;
+
+    /*******************************************
+     * @brief 获取命令队列的性能分析,环境变量
+     *        AUTO_BUG_PROFILE非空时打开,析构时输出报告
+     * @return 性能分析
+     * ****************************************/
+    Profiler& profiler() noexcept;
 
     /*******************************************
      * @brief 调用一个核函数
@@ -129,15 +314,35 @@ public:
     bool invoke(cl_kernel kernel, size_t localSize, size_t globalSize) const noexcept;
 
     /*******************************************
-     * @brief 调用一个核函数
+     * @brief 调用一个多维的核函数
+     * @param[in] kernel 运算核函数
+     * @param[in] workDim 维数
+     * @param[in] localSize 每一维一组工作项的数量
+     * @param[in] globalSize 每一维总工作项的数量
+     * @return 是否成功
+     * ****************************************/
+    bool invoke(cl_kernel kernel, cl_uint workDim, const size_t* localSize, const size_t* globalSize) const noexcept;
+
+    /*******************************************
+     * @brief 异步调用一个核函数
      * @param[in] kernel 运算核函数
      * @param[in] localSize 一组工作项的数量
      * @param[in] globalSize 总工作项的数量
-     * @param[in] argc 参数个数
-     * @param[in] ... 传给核函数的参数,必须是
-     * @return 是否成功
+     * @param[in] deps 依赖的结果,全部完成后才开始执行
+     * @return 结果
+     * ****************************************/
+    Future invokeAsync(cl_kernel kernel, size_t localSize, size_t globalSize, const std::vector<Future>& deps = {}) const noexcept;
+
+    /*******************************************
+     * @brief 异步调用一个多维的核函数
+     * @param[in] kernel 运算核函数
+     * @param[in] workDim 维数
+     * @param[in] localSize 每一维一组工作项的数量
+     * @param[in] globalSize 每一维总工作项的数量
+     * @param[in] deps 依赖的结果,全部完成后才开始执行
+     * @return 结果
      * ****************************************/
-    bool invoke(cl_kernel kernel, size_t localSize, size_t globalSize, size_t argc, ...) const noexcept;
+    Future invokeAsync(cl_kernel kernel, cl_uint workDim, const size_t* localSize, const size_t* globalSize, const std::vector<Future>& deps = {}) const noexcept;
 
     /*******************************************
      * @brief 对向量进行一次标量运算
@@ -151,6 +356,19 @@ public:
     bool scalar(const float* v1, const float* v2, size_t n, cl_kernel kernel, float* ret) const noexcept;
 
 
+    /*******************************************
+     * @brief 异步对向量进行一次标量运算,完成前输入和
+     *        输出都必须保持有效
+     * @param[in] v1 进行运算的向量1
+     * @param[in] v2 进行运算的向量2
+     * @param[in] n 向量长度
+     * @param[in] kernel 运算核函数
+     * @param[out] ret 运算结果
+     * @param[in] deps 依赖的结果
+     * @return 结果
+     * ****************************************/
+    Future scalarAsync(const float* v1, const float* v2, size_t n, cl_kernel kernel, float* ret, const std::vector<Future>& deps = {}) const noexcept;
+
     /*******************************************
      * @brief 对向量进行一次标量加法运算
      * @param[in] v1 向量1
@@ -200,6 +418,17 @@ public:
      * ****************************************/
     bool reduction(const float* v1, size_t n, float* ret) const noexcept;
 
+    /*******************************************
+     * @brief 在设备上对缓存内的元素求和,结果写入另一个
+     *        缓存,不进行同步
+     * @param[in] input 输入缓存
+     * @param[in] n 元素数量
+     * @param[out] output 输出缓存
+     * @param[in] offset 结果在输出缓存中的位置(元素序号)
+     * @return 是否成功
+     * ****************************************/
+    bool reduce(cl_mem input, size_t n, cl_mem output, size_t offset) const noexcept;
+
     /*******************************************
      * @brief 计算两个坐标之间的距离
      * @param[in] v1 向量1
@@ -210,8 +439,135 @@ public:
      * ****************************************/
     bool distance(const float* v, float* v2, size_t n, float* ret) const noexcept;
 
+    /*******************************************
+     * @brief 异步计算两个坐标之间的距离,完成前输入和
+     *        输出都必须保持有效
+     * @param[in] v1 向量1
+     * @param[in] v2 向量2
+     * @param[in] n 向量长度
+     * @param[out] ret 运算结果
+     * @param[in] deps 依赖的结果
+     * @return 结果
+     * ****************************************/
+    Future distanceAsync(const float* v1, const float* v2, size_t n, float* ret, const std::vector<Future>& deps = {}) const noexcept;
+
+    /*******************************************
+     * @brief 计算一个坐标与多个坐标之间的距离,一次调用
+     *        完成所有计算
+     * @param[in] query 坐标,长度为dims
+     * @param[in] matrix rows个坐标,按行连续存放
+     * @param[in] rows 坐标数量
+     * @param[in] dims 维度
+     * @param[out] ret rows个距离;为nullptr时结果保留在
+     *                 设备上名为"distanceBatch"的缓存中
+     * @return 是否成功
+     * ****************************************/
+    bool distanceBatch(const float* query, const float* matrix, size_t rows, size_t dims, float* ret) noexcept;
+
+    /*******************************************
+     * @brief 计算两组坐标两两之间的距离,一次调用完成
+     *        所有计算
+     * @param[in] a na个坐标,按行连续存放
+     * @param[in] na 坐标数量
+     * @param[in] b nb个坐标,按行连续存放
+     * @param[in] nb 坐标数量
+     * @param[in] dims 维度
+     * @param[out] ret na*nb个距离,第i行第j列为a[i]与b[j]
+     *                 的距离;为nullptr时结果保留在设备上
+     *                 名为"distanceMatrix"的缓存中
+     * @return 是否成功
+     * ****************************************/
+    bool distanceMatrix(const float* a, size_t na, const float* b, size_t nb, size_t dims, float* ret) noexcept;
+
+    /* 共享给设备的主机内存的对齐字节数 */
+    static const size_t HOST_ALIGN = 4096;
+
+    /* 独立显卡上传数据时每个中转缓冲区的大小 */
+    static const size_t STAGING_SIZE = 4 << 20;
+
+    /* 分块版本的findNearest中每个线程处理的样本数量,与kernel.cl中的SAMPLES_PER_ITEM一致 */
+    static const size_t SAMPLES_PER_ITEM = 4;
+
 private:
     static const std::vector<std::string> functions;
+
+    /*******************************************
+     * @brief 按环境变量选择设备,只在第一次调用时选择
+     * @return 选中的设备
+     * ****************************************/
+    static const std::vector<Device>& m_selected() noexcept;
+
+    /*******************************************
+     * @brief 获取默认的设备,即第一个选中的设备
+     * @return 设备,没有可用设备时成员都为nullptr
+     * ****************************************/
+    static Device m_default() noexcept;
+
+    /*******************************************
+     * @brief 获取特化程序,不存在时构建并缓存
+     * @param[in] options 构建选项,为空时使用通用程序
+     * @return 程序,构建失败返回nullptr
+     * ****************************************/
+    cl_program m_programFor(const std::string& options) noexcept;
+
+    /*******************************************
+     * @brief 创建并映射上传用的锁页中转缓冲区
+     * @return 是否成功
+     * ****************************************/
+    bool m_prepareStaging() noexcept;
+
+    /*******************************************
+     * @brief 排队写缓存,统计传输量,性能分析时记录事件
+     * @param[in] mem 缓存
+     * @param[in] block 是否阻塞
+     * @param[in] offset 缓存内位置
+     * @param[in] bytes 数据大小
+     * @param[in] ptr 数据
+     * @param[in] waits 依赖的事件
+     * @param[out] event 命令的事件,可以为nullptr
+     * @return OpenCL状态
+     * ****************************************/
+    cl_int m_enqueueWrite(cl_mem mem, cl_bool block, size_t offset, size_t bytes, const void* ptr, const std::vector<cl_event>& waits, cl_event* event) const noexcept;
+
+    /*******************************************
+     * @brief 排队读缓存,统计传输量,性能分析时记录事件
+     * @param[in] mem 缓存
+     * @param[in] block 是否阻塞
+     * @param[in] offset 缓存内位置
+     * @param[in] bytes 数据大小
+     * @param[out] ptr 数据
+     * @param[in] waits 依赖的事件
+     * @param[out] event 命令的事件,可以为nullptr
+     * @return OpenCL状态
+     * ****************************************/
+    cl_int m_enqueueRead(cl_mem mem, cl_bool block, size_t offset, size_t bytes, void* ptr, const std::vector<cl_event>& waits, cl_event* event) const noexcept;
+
+    /*******************************************
+     * @brief 排队调用核函数,性能分析时记录事件
+     * @param[in] kernel 核函数
+     * @param[in] workDim 维数
+     * @param[in] localSize 每一维一组工作项的数量
+     * @param[in] globalSize 每一维总工作项的数量
+     * @param[in] waits 依赖的事件
+     * @param[out] event 命令的事件,可以为nullptr
+     * @return OpenCL状态
+     * ****************************************/
+    cl_int m_enqueueKernel(cl_kernel kernel, cl_uint workDim, const size_t* localSize, const size_t* globalSize, const std::vector<cl_event>& waits, cl_event* event) const noexcept;
+
+    /*******************************************
+     * @brief 两步归约:步骤1每组输出一个部分和,步骤2用
+     *        一个工作组在设备上得出最终结果
+     * @param[in] stage1 步骤1的核函数
+     * @param[in] x 输入缓存
+     * @param[in] y 第二个输入缓存,nullptr表示只有一个输入
+     * @param[in] n 元素数量
+     * @param[out] output 输出缓存
+     * @param[in] offset 结果在输出缓存中的位置(元素序号)
+     * @param[in] root 是否对结果开平方
+     * @return 是否成功
+     * ****************************************/
+    bool m_reduce(cl_kernel stage1, cl_mem x, cl_mem y, size_t n, cl_mem output, size_t offset, bool root) const noexcept;
+
     static const char* source;
 
     bool m_enable;
@@ -224,11 +580,23 @@ private:
 
     std::string m_name;
     size_t m_maxLocalSize;
+    size_t m_localMemSize;
+    size_t m_computeUnits;
+    bool m_tiled;
+    bool m_unified;
+
+    cl_mem m_staging[2];                // 锁页的中转缓冲区
+    void* m_stagingPtr[2];              // 中转缓冲区映射到主机的地址
+    Future m_stagingBusy[2];            // 中转缓冲区正在进行的传输
 
 
+    ProgramCache m_cache;
+    mutable BufferPool m_pool;
+    mutable Profiler m_profiler;
     std::map<std::string, cl_mem> m_buffers;
 
     std::map<std::string, cl_kernel> m_kernels;
+    std::map<std::string, cl_program> m_programs;       // 特化程序,键为构建选项
     
 };
 
@@ -0,0 +1,133 @@
+#include "Arena.h"
+#include <cstdlib>
+#include <cstdint>
+
+namespace AutoBug
+{
+
+Arena::Scope::~Scope() noexcept
+{
+    m_arena.m_current = m_block;
+    m_arena.m_offset = m_offset;
+    m_arena.m_used = m_used;
+}
+
+Arena::Scope::Scope(Arena& arena) noexcept :
+    m_arena(arena),
+    m_block(arena.m_current),
+    m_offset(arena.m_offset),
+    m_used(arena.m_used)
+{
+
+}
+
+/*******************************************
+ * @brief 获取当前线程的临时内存池,用于每轮迭代
+ *        中的临时向量
+ * @return 临时内存池
+ * ****************************************/
+Arena& Arena::scratch() noexcept
+{
+    static thread_local Arena obj;
+    return obj;
+}
+
+Arena::~Arena() noexcept
+{
+    release();
+}
+
+Arena::Arena(size_t blockSize) noexcept :
+    m_blockSize(blockSize),
+    m_current(0),
+    m_offset(0),
+    m_used(0)
+{
+
+}
+
+/*******************************************
+ * @brief 分配一段内存,只能通过reset或release统一释放
+ * @param[in] bytes 字节数
+ * @param[in] align 对齐字节数,必须是2的幂
+ * @return 分配的内存,失败返回nullptr
+ * ****************************************/
+void* Arena::alloc(size_t bytes, size_t align) noexcept
+{
+    if (bytes == 0)
+        return nullptr;
+
+    // 从当前内存块开始查找能容纳的位置,reset后会依次复用已有的内存块
+    for (size_t i = m_current; i < m_blocks.size(); i++)
+    {
+        size_t offset = (i == m_current) ? m_offset : 0;
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_blocks[i].data);
+        uintptr_t ptr = (base + offset + align - 1) & ~static_cast<uintptr_t>(align - 1);
+        if (ptr + bytes <= base + m_blocks[i].size)
+        {
+            m_current = i;
+            m_offset = ptr + bytes - base;
+            m_used += bytes;
+            return reinterpret_cast<void*>(ptr);
+        }
+    }
+
+    // 已有的内存块都放不下,申请新的内存块
+    size_t size = bytes + align > m_blockSize ? bytes + align : m_blockSize;
+    char* data = static_cast<char*>(malloc(size));
+    if (data == nullptr)
+        return nullptr;
+
+    m_blocks.push_back(Block{data, size});
+    m_current = m_blocks.size() - 1;
+    m_offset = 0;
+    return alloc(bytes, align);
+}
+
+/*******************************************
+ * @brief 回退到起始位置,保留已申请的内存块以便复用
+ * ****************************************/
+void Arena::reset() noexcept
+{
+    m_current = 0;
+    m_offset = 0;
+    m_used = 0;
+}
+
+/*******************************************
+ * @brief 一次性释放所有内存块
+ * ****************************************/
+void Arena::release() noexcept
+{
+    for (auto& block : m_blocks)
+    {
+        free(block.data);
+    }
+    m_blocks.clear();
+    reset();
+}
+
+/*******************************************
+ * @brief 获取已分配的字节数
+ * @return 已分配的字节数
+ * ****************************************/
+size_t Arena::used() const noexcept
+{
+    return m_used;
+}
+
+/*******************************************
+ * @brief 获取已向系统申请的字节数
+ * @return 已申请的字节数
+ * ****************************************/
+size_t Arena::capacity() const noexcept
+{
+    size_t n = 0;
+    for (auto& block : m_blocks)
+    {
+        n += block.size;
+    }
+    return n;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,100 @@
+#ifndef AUTO_BUG_ARENA_H
+#define AUTO_BUG_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+namespace AutoBug
+{
+
+class Arena
+{
+public:
+    /*******************************************
+     * @brief 作用域标记,析构时将内存池回退到构造时的位置
+     * ****************************************/
+    class Scope
+    {
+    public:
+        ~Scope() noexcept;
+        explicit Scope(Arena& arena) noexcept;
+        Scope(const Scope&) = delete;
+        Scope(Scope&&) = delete;
+
+    private:
+        Arena& m_arena;
+        size_t m_block;
+        size_t m_offset;
+        size_t m_used;
+    };
+
+    /*******************************************
+     * @brief 获取当前线程的临时内存池,用于每轮迭代
+     *        中的临时向量
+     * @return 临时内存池
+     * ****************************************/
+    static Arena& scratch() noexcept;
+
+    ~Arena() noexcept;
+    explicit Arena(size_t blockSize = 1 << 20) noexcept;
+    Arena(const Arena&) = delete;
+    Arena(Arena&&) = delete;
+
+    /*******************************************
+     * @brief 分配一段内存,只能通过reset或release统一释放
+     * @param[in] bytes 字节数
+     * @param[in] align 对齐字节数,必须是2的幂
+     * @return 分配的内存,失败返回nullptr
+     * ****************************************/
+    void* alloc(size_t bytes, size_t align = 64) noexcept;
+
+    /*******************************************
+     * @brief 分配一个数组
+     * @param[in] n 元素个数
+     * @return 分配的数组,失败返回nullptr
+     * ****************************************/
+    template <typename T>
+    T* alloc(size_t n) noexcept
+    {
+        return static_cast<T*>(alloc(sizeof(T) * n));
+    }
+
+    /*******************************************
+     * @brief 回退到起始位置,保留已申请的内存块以便复用
+     * ****************************************/
+    void reset() noexcept;
+
+    /*******************************************
+     * @brief 一次性释放所有内存块
+     * ****************************************/
+    void release() noexcept;
+
+    /*******************************************
+     * @brief 获取已分配的字节数
+     * @return 已分配的字节数
+     * ****************************************/
+    size_t used() const noexcept;
+
+    /*******************************************
+     * @brief 获取已向系统申请的字节数
+     * @return 已申请的字节数
+     * ****************************************/
+    size_t capacity() const noexcept;
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    size_t m_current;       // 当前使用的内存块
+    size_t m_offset;        // 当前内存块内已使用的位置
+    size_t m_used;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_ARENA_H
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "BufferPool.h"
+#include <cstdio>
+
+namespace AutoBug
+{
+
+BufferPool::~BufferPool() noexcept
+{
+    for (auto& item : m_sizes)
+    {
+        clReleaseMemObject(item.first);
+    }
+    m_sizes.clear();
+    m_free.clear();
+}
+
+BufferPool::BufferPool() noexcept :
+    m_ctx(nullptr),
+    m_allocations(0)
+{
+
+}
+
+/*******************************************
+ * @brief 设置创建缓存使用的上下文
+ * @param[in] ctx OpenCL上下文
+ * ****************************************/
+void BufferPool::setContext(cl_context ctx) noexcept
+{
+    m_ctx = ctx;
+}
+
+/*******************************************
+ * @brief 获取一个缓存,优先复用同一尺寸等级的空闲缓存
+ * @param[in] bytes 需要的字节数
+ * @return 缓存,失败返回nullptr
+ * ****************************************/
+cl_mem BufferPool::acquire(size_t bytes) noexcept
+{
+    size_t size = sizeClass(bytes);
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    auto& list = m_free[size];
+    if (!list.empty())
+    {
+        cl_mem buff = list.back();
+        list.pop_back();
+        return buff;
+    }
+
+    cl_int state;
+    cl_mem buff = clCreateBuffer(m_ctx, CL_MEM_READ_WRITE, size, nullptr, &state);
+    if (state != CL_SUCCESS)
+    {
+        fprintf(stderr, "failed to create buffer\n");
+        return nullptr;
+    }
+    m_sizes[buff] = size;
+    m_allocations += 1;
+    return buff;
+}
+
+/*******************************************
+ * @brief 归还一个缓存,归还后可以被再次获取
+ * @param[in] buffer 通过acquire获取的缓存
+ * ****************************************/
+void BufferPool::release(cl_mem buffer) noexcept
+{
+    if (buffer == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto iter = m_sizes.find(buffer);
+    if (iter == m_sizes.end())
+        return;
+    m_free[iter->second].push_back(buffer);
+}
+
+/*******************************************
+ * @brief 获取缓存的实际容量
+ * @param[in] buffer 通过acquire获取的缓存
+ * @return 实际容量,不属于缓存池时返回0
+ * ****************************************/
+size_t BufferPool::capacity(cl_mem buffer) const noexcept
+{
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto iter = m_sizes.find(buffer);
+    if (iter == m_sizes.end())
+        return 0;
+    return iter->second;
+}
+
+/*******************************************
+ * @brief 将所有空闲缓存释放给驱动
+ * ****************************************/
+void BufferPool::clear() noexcept
+{
+    std::lock_guard<std::mutex> lock{m_mutex};
+    for (auto& list : m_free)
+    {
+        for (cl_mem buff : list.second)
+        {
+            clReleaseMemObject(buff);
+            m_sizes.erase(buff);
+        }
+    }
+    m_free.clear();
+}
+
+/*******************************************
+ * @brief 获取向驱动申请缓存的次数
+ * @return 申请次数
+ * ****************************************/
+size_t BufferPool::allocations() const noexcept
+{
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_allocations;
+}
+
+/*******************************************
+ * @brief 计算字节数对应的尺寸等级
+ * @param[in] bytes 字节数
+ * @return 尺寸等级,每个2的幂区间分为4级,浪费不超过25%
+ * ****************************************/
+size_t BufferPool::sizeClass(size_t bytes) noexcept
+{
+    if (bytes <= MIN_SIZE)
+        return MIN_SIZE;
+
+    size_t base = MIN_SIZE;
+    while (base * 2 < bytes)
+    {
+        base <<= 1;
+    }
+    size_t step = base / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef AUTO_BUG_BUFFER_POOL_H
+#define AUTO_BUG_BUFFER_POOL_H
+
+#ifndef CL_HPP_TARGET_OPENCL_VERSION 
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#endif // CL_HPP_TARGET_OPENCL_VERSION
+#include <CL/cl2.hpp>
+
+#include <map>
+#include <vector>
+#include <mutex>
+
+namespace AutoBug
+{
+
+class BufferPool
+{
+public:
+    /* 最小的尺寸等级 */
+    static const size_t MIN_SIZE = 4096;
+
+    ~BufferPool() noexcept;
+    BufferPool() noexcept;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool(BufferPool&&) = delete;
+
+    /*******************************************
+     * @brief 设置创建缓存使用的上下文
+     * @param[in] ctx OpenCL上下文
+     * ****************************************/
+    void setContext(cl_context ctx) noexcept;
+
+    /*******************************************
+     * @brief 获取一个缓存,优先复用同一尺寸等级的空闲缓存
+     * @param[in] bytes 需要的字节数
+     * @return 缓存,失败返回nullptr
+     * ****************************************/
+    cl_mem acquire(size_t bytes) noexcept;
+
+    /*******************************************
+     * @brief 归还一个缓存,归还后可以被再次获取
+     * @param[in] buffer 通过acquire获取的缓存
+     * ****************************************/
+    void release(cl_mem buffer) noexcept;
+
+    /*******************************************
+     * @brief 获取缓存的实际容量
+     * @param[in] buffer 通过acquire获取的缓存
+     * @return 实际容量,不属于缓存池时返回0
+     * ****************************************/
+    size_t capacity(cl_mem buffer) const noexcept;
+
+    /*******************************************
+     * @brief 将所有空闲缓存释放给驱动
+     * ****************************************/
+    void clear() noexcept;
+
+    /*******************************************
+     * @brief 获取向驱动申请缓存的次数
+     * @return 申请次数
+     * ****************************************/
+    size_t allocations() const noexcept;
+
+    /*******************************************
+     * @brief 计算字节数对应的尺寸等级
+     * @param[in] bytes 字节数
+     * @return 尺寸等级,每个2的幂区间分为4级,浪费不超过25%
+     * ****************************************/
+    static size_t sizeClass(size_t bytes) noexcept;
+
+private:
+    cl_context m_ctx;
+    size_t m_allocations;
+    std::map<size_t, std::vector<cl_mem>> m_free;   // 各个尺寸等级的空闲缓存
+    std::map<cl_mem, size_t> m_sizes;               // 所有缓存及其容量
+    mutable std::mutex m_mutex;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_BUFFER_POOL_H
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "BugGenerator.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+namespace AutoBug
+{
+
+/* 标题的各个部分,取自真实的BUG标题 */
+static const char* scenes[] = {
+    u8"插入耳机后", u8"连接蓝牙耳机后", u8"重启后", u8"注销系统后", u8"休眠唤醒后",
+    u8"升级系统后", u8"拔插HDMI线后", u8"切换用户后", u8"合盖再打开后", u8"中文环境下",
+    u8"开启节能模式后", u8"待机唤醒后", u8"外接显示器后", u8"断开网络后", u8"修改分辨率后",
+    u8"长时间运行后", u8"插入U盘后", u8"切换主题后", u8"开启无密码登录后", u8"拔出适配器后",
+};
+
+static const char* modules[] = {
+    u8"控制中心-声音-输出", u8"控制中心-声音-输入", u8"控制中心-电源管理", u8"控制中心-显示",
+    u8"控制中心-键盘和语言", u8"控制中心-个性化", u8"控制中心-网络", u8"控制中心-鼠标",
+    u8"控制中心-时间日期", u8"控制中心-账户", u8"任务栏", u8"启动器", u8"通知中心",
+    u8"锁屏界面", u8"登录界面", u8"文件管理器", u8"蓝牙设置", u8"音乐播放器",
+    u8"视频播放器", u8"截图录屏", u8"剪切板", u8"窗口管理器", u8"系统监视器", u8"应用商店",
+};
+
+static const char* actions[] = {
+    u8"点击静音按钮", u8"拖动音量滑块", u8"切换输出设备", u8"修改自动降低亮度的百分比",
+    u8"打开噪音抑制开关", u8"使用快捷键切换", u8"设置锁屏壁纸", u8"调整缩放比例",
+    u8"禁用所有输入设备", u8"连接无线网络", u8"修改时区", u8"右键点击图标",
+    u8"打开窗口特效", u8"快速连续点击", u8"拖拽窗口到屏幕边缘", u8"播放本地视频",
+    u8"添加自定义快捷键", u8"卸载应用", u8"切换键盘布局", u8"旋转屏幕方向",
+    u8"设置重复延迟", u8"开启个人热点", u8"新增系统语言", u8"修改左手模式",
+};
+
+static const char* symptoms[] = {
+    u8"没有声音", u8"显示异常", u8"出现屏幕闪烁", u8"设置不生效", u8"功能失效",
+    u8"文案显示为英文", u8"无法正常唤醒", u8"卡顿严重", u8"图标叠加显示", u8"点击无反应",
+    u8"状态与设置不一致", u8"程序崩溃退出", u8"弹出错误的横幅通知", u8"无法取消静音",
+    u8"设备列表显示不全", u8"音量自动变小", u8"出现黑屏", u8"内存占用持续升高",
+    u8"界面显示为空白", u8"快捷键冲突", u8"自动切换为其他设备", u8"有杂音",
+    u8"无法保存", u8"提示权限不足",
+};
+
+/* 现象前的修饰词,不影响分组 */
+static const char* adverbs[] = {
+    u8"", u8"", u8"", u8"概率性", u8"偶现", u8"高概率", u8"必现", u8"有时",
+};
+
+/* 各部分之间的分隔符 */
+static const char* separators[] = {
+    u8"，", u8"，", u8",", u8" ", u8"",
+};
+
+#define COUNT_OF(array) (sizeof(array) / sizeof(array[0]))
+
+/*******************************************
+ * @brief 获取可以生成的不同分组的最大数量
+ * @return 分组数量
+ * ****************************************/
+size_t BugGenerator::maxClusters() noexcept
+{
+    return COUNT_OF(modules) * COUNT_OF(actions) * COUNT_OF(symptoms);
+}
+
+BugGenerator::BugGenerator(size_t clusters, float noise, float skew, uint64_t seed) noexcept :
+    m_clusters(clusters),
+    m_noise(noise),
+    m_skew(skew),
+    m_state(seed)
+{
+    if (m_clusters == 0)
+        m_clusters = 1;
+
+    if (m_clusters > maxClusters())
+    {
+        fprintf(stderr, "at most %zu clusters can be generated\n", maxClusters());
+        m_clusters = maxClusters();
+    }
+}
+
+/*******************************************
+ * @brief 获取分组数量
+ * @return 分组数量
+ * ****************************************/
+size_t BugGenerator::clusters() const noexcept
+{
+    return m_clusters;
+}
+
+/*******************************************
+ * @brief 生成下一条标题
+ * @param[out] title UTF8编码的标题
+ * @return 标题所属的分组序号
+ * ****************************************/
+size_t BugGenerator::next(std::string& title) noexcept
+{
+    // 按倾斜程度选择分组,skew为0时均匀分布
+    double u = m_uniform();
+    size_t cluster = static_cast<size_t>(pow(u, 1.0 + m_skew) * m_clusters);
+    if (cluster >= m_clusters)
+        cluster = m_clusters - 1;
+
+    // 分组序号乘以一个与总数互质的奇数后展开,使相邻分组的三个部分都不同
+    size_t code = (cluster * 2654435761u) % maxClusters();
+    size_t module = code % COUNT_OF(modules);
+    size_t action = code / COUNT_OF(modules) % COUNT_OF(actions);
+    size_t symptom = code / COUNT_OF(modules) / COUNT_OF(actions);
+
+    if (m_uniform() < m_noise)
+        module = m_below(COUNT_OF(modules));
+    if (m_uniform() < m_noise)
+        action = m_below(COUNT_OF(actions));
+    if (m_uniform() < m_noise)
+        symptom = m_below(COUNT_OF(symptoms));
+
+    title.clear();
+    if (m_uniform() < 0.5)
+    {
+        title += scenes[m_below(COUNT_OF(scenes))];
+        title += separators[m_below(COUNT_OF(separators))];
+    }
+    title += modules[module];
+    title += separators[m_below(COUNT_OF(separators))];
+    title += actions[action];
+    title += separators[m_below(COUNT_OF(separators))];
+    title += adverbs[m_below(COUNT_OF(adverbs))];
+    title += symptoms[symptom];
+    return cluster;
+}
+
+/*******************************************
+ * @brief 生成一组样本
+ * @param[in] n 样本数量
+ * @param[in] dimMap 超空间维度映射
+ * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+ * @param[out] labels 各样本所属的分组序号,可以为nullptr
+ * @return 样本集
+ * ****************************************/
+std::vector<Text> BugGenerator::generate(size_t n, const DimMap& dimMap, Arena* arena, std::vector<size_t>* labels) noexcept
+{
+    std::vector<Text> data;
+    data.reserve(n);
+    if (labels != nullptr)
+        labels->clear();
+
+    std::string title;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t cluster = next(title);
+        Text text{0, arena};
+        text.setText(title, dimMap);
+        data.push_back(std::move(text));
+        if (labels != nullptr)
+            labels->push_back(cluster);
+    }
+    return data;
+}
+
+/*******************************************
+ * @brief 将标题逐行写入文件,格式与DataLoader读取的
+ *        一致,不在内存中保存,可以生成千万行
+ * @param[in] file 文件名
+ * @param[in] rows 行数
+ * @return 是否成功
+ * ****************************************/
+bool BugGenerator::write(const char* file, size_t rows) noexcept
+{
+    FILE* fp = fopen(file, "wb");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return false;
+    }
+
+    bool success = true;
+    std::string title;
+    for (size_t i = 0; i < rows; i++)
+    {
+        next(title);
+        title += '\n';
+        if (fwrite(title.data(), 1, title.size(), fp) != title.size())
+        {
+            fprintf(stderr, "%s: %s\n", file, strerror(errno));
+            success = false;
+            goto EXIT;
+        }
+    }
+
+EXIT:
+    if (fclose(fp) != 0)
+        success = false;
+    return success;
+}
+
+/*******************************************
+ * @brief 生成下一个64位随机数,使用splitmix64,
+ *        在所有平台上结果相同
+ * @return 随机数
+ * ****************************************/
+uint64_t BugGenerator::m_random() noexcept
+{
+    uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/*******************************************
+ * @brief 生成[0, 1)之间的随机数
+ * @return 随机数
+ * ****************************************/
+double BugGenerator::m_uniform() noexcept
+{
+    return (m_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*******************************************
+ * @brief 生成[0, n)之间的随机整数
+ * @param[in] n 上限
+ * @return 随机数
+ * ****************************************/
+size_t BugGenerator::m_below(size_t n) noexcept
+{
+    return static_cast<size_t>(m_random() % n);
+}
+
+}; // namespace AutoBug
\ No newline at end of file
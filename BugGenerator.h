@@ -0,0 +1,99 @@
+#ifndef AUTO_BUG_BUG_GENERATOR_H
+#define AUTO_BUG_BUG_GENERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DimMap.h"
+#include "Text.h"
+#include "Arena.h"
+
+namespace AutoBug
+{
+
+/* 合成的BUG标题生成器,每个分组由固定的模块、操作和现象组成,
+ * 相同的参数和种子总是生成相同的序列,可以流式生成任意行数 */
+class BugGenerator
+{
+public:
+    /*******************************************
+     * @brief 获取可以生成的不同分组的最大数量
+     * @return 分组数量
+     * ****************************************/
+    static size_t maxClusters() noexcept;
+
+    ~BugGenerator() noexcept = default;
+
+    /*******************************************
+     * @brief 创建生成器
+     * @param[in] clusters 分组数量,超过maxClusters时截断
+     * @param[in] noise 每个固定部分被随机替换的概率,0~1
+     * @param[in] skew 分组大小的倾斜程度,0表示均匀,越大
+     *                 越集中在序号小的分组
+     * @param[in] seed 随机数种子
+     * ****************************************/
+    BugGenerator(size_t clusters, float noise=0.1f, float skew=0.0f, uint64_t seed=1) noexcept;
+
+    /*******************************************
+     * @brief 获取分组数量
+     * @return 分组数量
+     * ****************************************/
+    size_t clusters() const noexcept;
+
+    /*******************************************
+     * @brief 生成下一条标题
+     * @param[out] title UTF8编码的标题
+     * @return 标题所属的分组序号
+     * ****************************************/
+    size_t next(std::string& title) noexcept;
+
+    /*******************************************
+     * @brief 生成一组样本
+     * @param[in] n 样本数量
+     * @param[in] dimMap 超空间维度映射
+     * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+     * @param[out] labels 各样本所属的分组序号,可以为nullptr
+     * @return 样本集
+     * ****************************************/
+    std::vector<Text> generate(size_t n, const DimMap& dimMap, Arena* arena=nullptr, std::vector<size_t>* labels=nullptr) noexcept;
+
+    /*******************************************
+     * @brief 将标题逐行写入文件,格式与DataLoader读取的
+     *        一致,不在内存中保存,可以生成千万行
+     * @param[in] file 文件名
+     * @param[in] rows 行数
+     * @return 是否成功
+     * ****************************************/
+    bool write(const char* file, size_t rows) noexcept;
+
+private:
+    size_t m_clusters;
+    float m_noise;
+    float m_skew;
+    uint64_t m_state;       // 随机数状态
+
+    /*******************************************
+     * @brief 生成下一个64位随机数
+     * @return 随机数
+     * ****************************************/
+    uint64_t m_random() noexcept;
+
+    /*******************************************
+     * @brief 生成[0, 1)之间的随机数
+     * @return 随机数
+     * ****************************************/
+    double m_uniform() noexcept;
+
+    /*******************************************
+     * @brief 生成[0, n)之间的随机整数
+     * @param[in] n 上限
+     * @return 随机数
+     * ****************************************/
+    size_t m_below(size_t n) noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_BUG_GENERATOR_H
\ No newline at end of file
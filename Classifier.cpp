@@ -0,0 +1,287 @@
+#include "Classifier.h"
+#include "Trace.h"
+#include <cmath>
+#include <cstdio>
+
+namespace AutoBug
+{
+
+// 分组树每个节点最多的子节点数量,超过时插入中间层
+static const size_t MAX_BRANCHING = 32;
+
+Classifier::Classifier() noexcept :
+    m_storage(QuantizedSet::NONE)
+{
+
+}
+
+/*******************************************
+ * @brief 设置学习时样本的存储格式
+ * @param[in] format 存储格式
+ * ****************************************/
+void Classifier::setStorage(QuantizedSet::Format format) noexcept
+{
+    m_storage = format;
+}
+
+/*******************************************
+ * @brief 输入数据集进行学习,会清空以前的数据
+ * @param[in] dataset 数据集
+ * @param[in] n 要计算的样本数量,0表示全部
+ * @return 最终分类数量
+ * ****************************************/
+size_t Classifier::learn(std::vector<Text> dataset, size_t n) noexcept
+{
+    TRACE_SCOPE("Classifier::learn");
+    if (n != 0 && n < dataset.size())
+    {
+        dataset.resize(n);
+    }
+
+    // 上次学习的结果都在内存池中,整体回收
+    m_dataset.clear();
+    m_groupCenters.clear();
+    m_groups.clear();
+    m_nodes.clear();
+    m_groupNodes.clear();
+    m_arena.reset();
+    m_nodes.push_back(Node{Text(), -1, {}});
+
+    size_t preferSize = (dataset.size() / 20);
+    if (preferSize < 3)
+        preferSize = 3;
+    if (preferSize > 10)
+        preferSize = 10;
+    size_t k = (dataset.size() + 4) / preferSize;   // 初始分组数量
+
+    // 样本只在内存池中保存一份,分组和拆分都使用样本序号
+    m_dataset.reserve(dataset.size());
+    std::vector<size_t> samples(dataset.size());
+    for (size_t i = 0; i < dataset.size(); i++)
+    {
+        m_dataset.emplace_back(dataset[i], &m_arena);
+        samples[i] = i;
+    }
+    std::vector<Text>().swap(dataset);
+
+    Kmeans kmeans{m_dataset, k};
+    kmeans.setStorage(m_storage);
+    kmeans.learn(10);
+    m_addGroups(kmeans, samples, 0);
+
+    // 数量超限，进行拆分，可能存在高度相似导致拆分失败，则跳过
+    for (size_t idx = 0; idx < m_groups.size();)
+    {
+        if (m_groups[idx].size() <= preferSize || m_split(idx) == 1)
+        {
+            idx++;
+        }
+    }
+
+    for (size_t idx = 0; idx < m_groups.size(); idx++)
+    {
+        m_nodes[m_groupNodes[idx]].group = static_cast<int>(idx);
+    }
+    m_balance(0);
+
+    return m_groups.size();
+}
+
+/*******************************************
+ * @brief 打印学习后的各个分组
+ * ****************************************/
+void Classifier::print() noexcept
+{
+    for (size_t i = 0; i < m_groups.size(); i++)
+    {
+        printf("Group %zu:\n", i);
+        for (auto sample : m_groups[i])
+        {
+            printf("\t%ls\n", m_dataset[sample].text().c_str());
+        }
+    }
+}
+
+/*******************************************
+ * @brief 获取分组数量
+ * @return 分组数量
+ * ****************************************/
+size_t Classifier::groupCount() const noexcept
+{
+    return m_groups.size();
+}
+
+/*******************************************
+ * @brief 获取指定的分组中心
+ * @param[in] idx 分组序号
+ * @return 分组的中心
+ * ****************************************/
+Text Classifier::groupCenter(size_t idx) const noexcept
+{
+    return m_groupCenters[idx];
+}
+
+/*******************************************
+ * @brief 获取指定的分组
+ * @param[in] idx 分组序号
+ * @return 分组的数据
+ * ****************************************/
+std::vector<Text> Classifier::group(size_t idx) const noexcept
+{
+    std::vector<Text> group;
+    group.reserve(m_groups[idx].size());
+    for (auto sample : m_groups[idx])
+    {
+        group.push_back(m_dataset[sample]);
+    }
+    return group;
+}
+
+/*******************************************
+ * @brief 获取分组树,第0个是根节点
+ * @return 所有节点
+ * ****************************************/
+const std::vector<Classifier::Node>& Classifier::tree() const noexcept
+{
+    return m_nodes;
+}
+
+/*******************************************
+ * @brief 将Kmeans的非空分组添加到末尾,分组只记录
+ *        样本序号,中心复制到内存池中
+ * @param[in] kmeans 学习完成的Kmeans
+ * @param[in] samples 输入Kmeans的各个样本在m_dataset中的序号
+ * @param[in] parent 新叶子节点的父节点
+ * @return 添加的分组数量
+ * ****************************************/
+size_t Classifier::m_addGroups(Kmeans& kmeans, const std::vector<size_t>& samples, size_t parent) noexcept
+{
+    size_t first = m_groups.size();
+    std::vector<size_t> slots(kmeans.groupCount(), 0);
+    for (size_t idx = 0; idx < kmeans.groupCount(); idx++)
+    {
+        if (kmeans.groupSize(idx) == 0)
+            continue;
+
+        slots[idx] = m_groups.size();
+        m_groupCenters.emplace_back(kmeans.groupCenter(idx), &m_arena);
+        m_groupNodes.push_back(m_nodes.size());
+        m_nodes[parent].children.push_back(m_nodes.size());
+        m_nodes.push_back(Node{Text(m_groupCenters.back(), &m_arena), -1, {}});
+        m_groups.emplace_back();
+        m_groups.back().reserve(kmeans.groupSize(idx));
+    }
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        m_groups[slots[kmeans.assignment(i)]].push_back(samples[i]);
+    }
+    return m_groups.size() - first;
+}
+
+/*******************************************
+ * @brief 对一个分组进行拆分,分成多个新的分组,会
+ *        在末尾添加新的分组,并删除当前分组,因此
+ *        当前索引会引用到下一个分组
+ * @param[in] idx 要拆分的分组都序号
+ * @param[in] n 期望的平均分组大小,默认为3
+ * @return 拆分成了几个组
+ * ****************************************/
+size_t Classifier::m_split(size_t idx, int n)
+{
+    TRACE_SCOPE("Classifier::split");
+    TRACE_COUNT("classifier.splits", 1);
+    std::vector<size_t> samples = m_groups[idx];
+    size_t k = (samples.size() + n - 1) / n;
+    Kmeans kmeans;
+    kmeans.setGroupCount(k);
+    kmeans.setStorage(m_storage);
+    {
+        // Kmeans会复制样本,传入的副本放在临时内存池中,用完即回收
+        Arena::Scope scope{Arena::scratch()};
+        std::vector<Text> group;
+        group.reserve(samples.size());
+        for (auto sample : samples)
+        {
+            group.emplace_back(m_dataset[sample], &Arena::scratch());
+        }
+        kmeans.setData(group);
+    }
+    kmeans.learn(10);
+
+    size_t node = m_groupNodes[idx];
+    size_t count = m_addGroups(kmeans, samples, node);
+
+    // 没有拆开时新分组直接替换原来的叶子节点,避免只有一个子节点的链
+    if (count == 1)
+    {
+        m_nodes[node].center = m_nodes.back().center;
+        m_nodes[node].children.clear();
+        m_nodes.pop_back();
+        m_groupNodes.back() = node;
+    }
+
+    m_groupCenters.erase(m_groupCenters.begin() + idx);
+    m_groups.erase(m_groups.begin() + idx);
+    m_groupNodes.erase(m_groupNodes.begin() + idx);
+    return count;
+}
+
+/*******************************************
+ * @brief 子节点超过上限时,对子节点的中心聚类,
+ *        插入一层中间节点,并递归处理中间节点;
+ *        初始分组的数量与样本数量成正比,不插入
+ *        中间层时根节点几乎要与所有分组比较
+ * @param[in] node 节点序号
+ * ****************************************/
+void Classifier::m_balance(size_t node) noexcept
+{
+    if (m_nodes[node].children.size() <= MAX_BRANCHING)
+        return;
+
+    TRACE_SCOPE("Classifier::balance");
+    std::vector<size_t> children = m_nodes[node].children;
+    std::vector<Text> centers;
+    centers.reserve(children.size());
+    for (size_t child : children)
+    {
+        centers.push_back(m_nodes[child].center);
+    }
+
+    size_t k = static_cast<size_t>(ceil(sqrt(static_cast<double>(children.size()))));
+    Kmeans kmeans{centers, k};
+    kmeans.learn(10);
+
+    // 全部落在一个中间节点时无法再分,保持原样
+    size_t nonEmpty = 0;
+    for (size_t i = 0; i < k; i++)
+    {
+        if (kmeans.groupSize(i) > 0)
+            nonEmpty++;
+    }
+    if (nonEmpty < 2)
+        return;
+
+    std::vector<size_t> middles(k, 0);
+    std::vector<size_t> newChildren;
+    for (size_t i = 0; i < k; i++)
+    {
+        if (kmeans.groupSize(i) == 0)
+            continue;
+        middles[i] = m_nodes.size();
+        newChildren.push_back(m_nodes.size());
+        m_nodes.push_back(Node{Text(kmeans.groupCenter(i), &m_arena), -1, {}});
+    }
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        m_nodes[middles[kmeans.assignment(i)]].children.push_back(children[i]);
+    }
+    m_nodes[node].children.swap(newChildren);
+
+    for (size_t middle : m_nodes[node].children)
+    {
+        m_balance(middle);
+    }
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,113 @@
+#ifndef AUTO_BUG_CLASSIFIER_H
+#define AUTO_BUG_CLASSIFIER_H
+
+#include <vector>
+
+#include "Text.h"
+#include "Arena.h"
+#include "Kmeans.h"
+#include "QuantizedSet.h"
+
+namespace AutoBug
+{
+
+class Classifier
+{
+public:
+    /* 分组树的节点,根节点的子节点是初始分组,拆分的分组
+     * 成为内部节点;子节点过多时再聚类出中间层 */
+    struct Node
+    {
+        Text center;                    // 节点中心,根节点为空
+        int group;                      // 叶子节点的分组序号,内部节点为-1
+        std::vector<size_t> children;   // 子节点在tree()中的序号
+    };
+
+    ~Classifier() noexcept = default;
+    Classifier() noexcept;
+
+    /*******************************************
+     * @brief 设置学习时样本的存储格式
+     * @param[in] format 存储格式
+     * ****************************************/
+    void setStorage(QuantizedSet::Format format) noexcept;
+
+    /*******************************************
+     * @brief 输入数据集进行学习,会清空以前的数据
+     * @param[in] dataset 数据集
+     * @param[in] n 要计算的样本数量,0表示全部
+     * @return 最终分类数量
+     * ****************************************/
+    size_t learn(std::vector<Text> dataset, size_t n=0) noexcept;
+
+    /*******************************************
+     * @brief 打印学习后的各个分组
+     * ****************************************/
+    void print() noexcept;
+
+    /*******************************************
+     * @brief 获取分组数量
+     * @return 分组数量
+     * ****************************************/
+    size_t groupCount() const noexcept;
+
+    /*******************************************
+     * @brief 获取指定的分组中心
+     * @param[in] idx 分组序号
+     * @return 分组的中心
+     * ****************************************/
+    Text groupCenter(size_t idx) const noexcept;
+
+    /*******************************************
+     * @brief 获取指定的分组
+     * @param[in] idx 分组序号
+     * @return 分组的数据
+     * ****************************************/
+    std::vector<Text> group(size_t idx) const noexcept;
+
+    /*******************************************
+     * @brief 获取分组树,第0个是根节点
+     * @return 所有节点
+     * ****************************************/
+    const std::vector<Node>& tree() const noexcept;
+
+private:
+    Arena m_arena;          // 一次学习的样本和中心
+    QuantizedSet::Format m_storage;
+    std::vector<Text> m_dataset;
+    std::vector<Text> m_groupCenters;
+    std::vector<std::vector<size_t>> m_groups;  // 各分组的样本在m_dataset中的序号
+    std::vector<Node> m_nodes;          // 分组树
+    std::vector<size_t> m_groupNodes;   // 每个分组对应的叶子节点
+
+    /*******************************************
+     * @brief 将Kmeans的非空分组添加到末尾,分组只记录
+     *        样本序号,中心复制到内存池中
+     * @param[in] kmeans 学习完成的Kmeans
+     * @param[in] samples 输入Kmeans的各个样本在m_dataset中的序号
+     * @param[in] parent 新叶子节点的父节点
+     * @return 添加的分组数量
+     * ****************************************/
+    size_t m_addGroups(Kmeans& kmeans, const std::vector<size_t>& samples, size_t parent) noexcept;
+
+    /*******************************************
+     * @brief 对一个分组进行拆分,分成多个新的分组,会
+     *        在末尾添加新的分组,并删除当前分组,因此
+     *        当前索引会引用到下一个分组
+     * @param[in] idx 要拆分的分组都序号
+     * @param[in] n 期望的平均分组大小,默认为3
+     * @return 拆分成了几个组
+     * ****************************************/
+    size_t m_split(size_t idx, int n=3);
+
+    /*******************************************
+     * @brief 子节点超过上限时,对子节点的中心聚类,
+     *        插入一层中间节点,并递归处理中间节点
+     * @param[in] node 节点序号
+     * ****************************************/
+    void m_balance(size_t node) noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_CLASSIFIER_H
\ No newline at end of file
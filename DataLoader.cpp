@@ -1,7 +1,10 @@
 #include "DataLoader.h"
+#include "FeatureCache.h"
+#include "Trace.h"
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
+#include <iterator>
 
 namespace AutoBug
 {
@@ -10,33 +13,126 @@ namespace AutoBug
  * @brief 从文本文件中加载一个数据集,每行为一个样本
  * @param[in] file 文件名
  * @param[in] dimMap 超空间维度映射
+ * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
  * @return 样本集
  * ****************************************/
-std::vector<Text> DataLoader::load(const char* file, const DimMap& dimMap) noexcept
+std::vector<Text> DataLoader::load(const char* file, const DimMap& dimMap, Arena* arena) noexcept
 {
+    TRACE_SCOPE("DataLoader::load");
     std::vector<Text> data;
+    loadFrom(file, dimMap, 0, data, arena);
+    return data;
+}
 
+/*******************************************
+ * @brief 从文本文件的指定位置读取到末尾,每行为一个
+ *        样本,追加到样本集中,跳过非法的UTF-8行
+ * @param[in] file 文件名
+ * @param[in] dimMap 超空间维度映射
+ * @param[in] offset 起始位置,必须是一行的开头
+ * @param[out] data 样本集
+ * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+ * @return 读取结束的位置,失败时为offset
+ * ****************************************/
+uint64_t DataLoader::loadFrom(const char* file, const DimMap& dimMap, uint64_t offset, std::vector<Text>& data, Arena* arena) noexcept
+{
     FILE* fp = fopen(file, "rb");
     if (fp == nullptr)
     {
         fprintf(stderr, "%s\n", strerror(errno));
-        return data;
+        return offset;
+    }
+
+    if (fseeko(fp, static_cast<off_t>(offset), SEEK_SET) != 0)
+    {
+        fprintf(stderr, "%s\n", strerror(errno));
+        fclose(fp);
+        return offset;
     }
 
+    size_t rows = data.size();
+    size_t invalid = 0;
     do
     {
         auto line = readline(fp);
         if (line == "")
             continue;
-        Text text;
-        text.setText(line, dimMap);
-        data.push_back(text);
+        Text text{0, arena};
+        if (!text.setText(line, dimMap))
+        {
+            invalid++;
+            continue;
+        }
+        data.push_back(std::move(text));
     }while (!feof(fp));
 
+    off_t end = ftello(fp);
     fclose(fp);
+    if (invalid > 0)
+        fprintf(stderr, "skipped %zu lines of invalid UTF-8 in %s\n", invalid, file);
+    TRACE_COUNT("dataloader.rows", data.size() - rows);
+    (void)rows;
+    return end >= 0 ? static_cast<uint64_t>(end) : offset;
+}
+
+/*******************************************
+ * @brief 加载数据集,优先使用特征缓存,缓存不存在
+ *        或失效时解析文本文件并写入缓存;源文件在
+ *        缓存之后追加的部分解析后追加到缓存
+ * @param[in] file 文件名
+ * @param[in] dimMap 超空间维度映射
+ * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+ * @return 样本集
+ * ****************************************/
+std::vector<Text> DataLoader::loadCached(const char* file, const DimMap& dimMap, Arena* arena) noexcept
+{
+    FeatureCache cache;
+    std::vector<Text> data;
+    uint64_t offset = 0;
+    if (cache.load(file, dimMap, data, arena))
+        offset = cache.offset();
+
+    std::vector<Text> delta;
+    uint64_t end = loadFrom(file, dimMap, offset, delta, arena);
+    if (offset > 0 && end == offset)
+    {
+        TRACE_COUNT("dataloader.cache_hits", 1);
+        return data;
+    }
+
+    TRACE_COUNT(offset > 0 ? "dataloader.cache_appends" : "dataloader.cache_misses", 1);
+    if (end > offset)
+        cache.append(file, dimMap, delta, offset, end);
+    data.insert(data.end(), std::make_move_iterator(delta.begin()), std::make_move_iterator(delta.end()));
     return data;
 }
 
+/*******************************************
+ * @brief 从文本文件中读取所有行,去除两端空白,
+ *        保留空行以便按行号对应
+ * @param[in] file 文件名
+ * @return 所有行
+ * ****************************************/
+std::vector<std::string> DataLoader::loadLines(const char* file) noexcept
+{
+    std::vector<std::string> lines;
+
+    FILE* fp = fopen(file, "rb");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "%s\n", strerror(errno));
+        return lines;
+    }
+
+    do
+    {
+        lines.push_back(readline(fp));
+    }while (!feof(fp));
+
+    fclose(fp);
+    return lines;
+}
+
 /*******************************************
  * @brief 从文本文件中读取一行
  * @param[in] fp 文件指针
@@ -1,10 +1,12 @@
 #ifndef AUTO_BUG_DATA_LOADER_H
 #define AUTO_BUG_DATA_LOADER_H
 
+#include <cstdint>
 #include <vector>
 
 #include "DimMap.h"
 #include "Text.h"
+#include "Arena.h"
 
 namespace AutoBug
 {
@@ -16,17 +18,41 @@ public:
      * @brief 从文本文件中加载一个数据集,每行为一个样本
      * @param[in] file 文件名
      * @param[in] dimMap 超空间维度映射
+     * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
      * @return 样本集
      * ****************************************/
-    static std::vector<Text> load(const char* file, const DimMap& dimMap) noexcept;
+    static std::vector<Text> load(const char* file, const DimMap& dimMap, Arena* arena=nullptr) noexcept;
 
-private:
     /*******************************************
-     * @brief 从文本文件中读取一行
-     * @param[in] fp 文件指针
-     * @return 一行数据
+     * @brief 从文本文件的指定位置读取到末尾,每行为一个
+     *        样本,追加到样本集中,跳过非法的UTF-8行
+     * @param[in] file 文件名
+     * @param[in] dimMap 超空间维度映射
+     * @param[in] offset 起始位置,必须是一行的开头
+     * @param[out] data 样本集
+     * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+     * @return 读取结束的位置,失败时为offset
      * ****************************************/
-    static std::string readline(FILE* fp) noexcept;
+    static uint64_t loadFrom(const char* file, const DimMap& dimMap, uint64_t offset, std::vector<Text>& data, Arena* arena=nullptr) noexcept;
+
+    /*******************************************
+     * @brief 加载数据集,优先使用特征缓存,缓存不存在
+     *        或失效时解析文本文件并写入缓存;源文件在
+     *        缓存之后追加的部分解析后追加到缓存
+     * @param[in] file 文件名
+     * @param[in] dimMap 超空间维度映射
+     * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+     * @return 样本集
+     * ****************************************/
+    static std::vector<Text> loadCached(const char* file, const DimMap& dimMap, Arena* arena=nullptr) noexcept;
+
+    /*******************************************
+     * @brief 从文本文件中读取所有行,去除两端空白,
+     *        保留空行以便按行号对应
+     * @param[in] file 文件名
+     * @return 所有行
+     * ****************************************/
+    static std::vector<std::string> loadLines(const char* file) noexcept;
 
     /*******************************************
      * @brief 删除字符串两端的空白字符
@@ -34,6 +60,14 @@ private:
      * @return 去除两端空白后的字符串
      * ****************************************/
     static std::string trimSpace(const std::string& str) noexcept;
+
+private:
+    /*******************************************
+     * @brief 从文本文件中读取一行
+     * @param[in] fp 文件指针
+     * @return 一行数据
+     * ****************************************/
+    static std::string readline(FILE* fp) noexcept;
 };
 
 }; // namespace AutoBug
@@ -0,0 +1,430 @@
+#include "Deduplicator.h"
+#include "Dispatcher.h"
+#include "Trace.h"
+#include <algorithm>
+
+namespace AutoBug
+{
+
+// 不超过这么多文本的桶验证其中的每一对
+static const size_t MAX_BUCKET_SIZE = 256;
+
+// 更大的桶中每个文本最多与之后的这么多个文本组成候选对,
+// 避免大量相同标题的桶产生平方数量的候选对
+static const size_t MAX_BUCKET_PAIRS = 64;
+
+// 签名估计的相似度低于阈值这么多时不再精确计算;64个签名时
+// 估计值的标准差不超过0.0625,0.2约为3倍以上标准差
+static const float ESTIMATE_MARGIN = 0.2f;
+
+/*******************************************
+ * @brief 64位整数的混合函数(splitmix64的输出部分)
+ * @param[in] x 输入
+ * @return 混合后的值
+ * ****************************************/
+static uint64_t mix64(uint64_t x) noexcept
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+Deduplicator::Deduplicator(int shingle, int bands, int rows, float threshold, uint64_t seed) noexcept :
+    m_shingle(shingle > 0 ? shingle : 1),
+    m_bands(bands > 0 ? bands : 1),
+    m_rows(rows > 0 ? rows : 1),
+    m_threshold(threshold),
+    m_threads(0),
+    m_candidates(0),
+    m_skipped(0)
+{
+    // 每个MinHash函数为h(x) = (a*x + b) >> 32,a为奇数
+    size_t k = m_bands * m_rows;
+    m_mul.resize(k);
+    m_add.resize(k);
+    for (size_t i = 0; i < k; i++)
+    {
+        seed += 0x9E3779B97F4A7C15ull;
+        m_mul[i] = mix64(seed) | 1;
+        seed += 0x9E3779B97F4A7C15ull;
+        m_add[i] = mix64(seed);
+    }
+}
+
+/*******************************************
+ * @brief 设置Jaccard相似度阈值
+ * @param[in] threshold 阈值,0~1
+ * ****************************************/
+void Deduplicator::setThreshold(float threshold) noexcept
+{
+    m_threshold = threshold;
+}
+
+/*******************************************
+ * @brief 设置CPU线程数量
+ * @param[in] threads 线程数量,0表示使用Dispatcher的设置
+ * ****************************************/
+void Deduplicator::setThreads(size_t threads) noexcept
+{
+    m_threads = threads;
+}
+
+/*******************************************
+ * @brief 查找近似重复的文本;相似度为s的一对文本成为
+ *        候选的概率为1-(1-s^rows)^bands,默认参数下
+ *        s=0.8时约为0.9998;超过MAX_BUCKET_SIZE个文本的
+ *        桶中每个文本只与之后的MAX_BUCKET_PAIRS个文本比较,
+ *        因此跳过的文本对可能漏掉,数量由skipped()获取
+ * @param[in] texts 文本
+ * @return 相似度不低于阈值的文本对,按序号排序
+ * ****************************************/
+std::vector<Deduplicator::Pair> Deduplicator::find(const std::vector<std::wstring>& texts) noexcept
+{
+    TRACE_SCOPE("Deduplicator::find");
+    std::vector<Pair> result;
+    size_t n = texts.size();
+    size_t k = m_bands * m_rows;
+    size_t threads = m_threads > 0 ? m_threads : Dispatcher::instance().threads();
+    m_candidates = 0;
+    m_skipped = 0;
+    if (n < 2 || n > UINT32_MAX)
+        return result;
+
+    // 每个文本按最多的n-gram数量预留空间
+    m_offsets.resize(n + 1);
+    m_offsets[0] = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t len = texts[i].size();
+        m_offsets[i + 1] = m_offsets[i] + (len >= static_cast<size_t>(m_shingle) ? len - m_shingle + 1 : (len > 0 ? 1 : 0));
+    }
+    m_shingles.resize(m_offsets[n]);
+    m_counts.resize(n);
+    m_signatures.resize(n * k);
+
+    {
+        TRACE_SCOPE("Deduplicator::sign");
+        Dispatcher::parallel(n, threads, [&](size_t, size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+            {
+                m_counts[i] = m_shingleText(texts[i], &m_shingles[m_offsets[i]]);
+                m_sign(&m_shingles[m_offsets[i]], m_counts[i], &m_signatures[i * k]);
+            }
+        });
+    }
+
+    // 先对每一段排序,记录每个文本在各段中的位置,验证时
+    // 据此判断一对文本是否已经由之前的段产生
+    m_orders.resize(m_bands * n);
+    m_positions.resize(m_bands * n);
+    m_bucketSizes.resize(m_bands * n);
+    m_bandSizes.assign(m_bands, 0);
+    {
+        TRACE_SCOPE("Deduplicator::bucket");
+        Dispatcher::parallel(m_bands, threads, [&](size_t, size_t first, size_t last) {
+            std::vector<std::pair<uint64_t, uint32_t>> keys;
+            for (size_t band = first; band < last; band++)
+            {
+                m_sortBand(static_cast<int>(band), n, keys);
+            }
+        });
+    }
+
+    std::vector<std::vector<Pair>> bandPairs(m_bands);
+    std::vector<size_t> bandCandidates(m_bands, 0);
+    std::vector<size_t> bandSkipped(m_bands, 0);
+    {
+        TRACE_SCOPE("Deduplicator::verify");
+        Dispatcher::parallel(m_bands, threads, [&](size_t, size_t first, size_t last) {
+            for (size_t band = first; band < last; band++)
+            {
+                bandCandidates[band] = m_verifyBand(static_cast<int>(band), n, bandPairs[band], bandSkipped[band]);
+            }
+        });
+    }
+
+    {
+        TRACE_SCOPE("Deduplicator::merge");
+        size_t total = 0;
+        for (int band = 0; band < m_bands; band++)
+        {
+            total += bandPairs[band].size();
+            m_candidates += bandCandidates[band];
+            m_skipped += bandSkipped[band];
+        }
+        result.reserve(total);
+        for (auto& item : bandPairs)
+        {
+            result.insert(result.end(), item.begin(), item.end());
+            std::vector<Pair>().swap(item);
+        }
+        std::sort(result.begin(), result.end(), [](const Pair& x, const Pair& y) {
+            return x.first < y.first || (x.first == y.first && x.second < y.second);
+        });
+    }
+    TRACE_COUNT("dedup.candidates", m_candidates);
+    TRACE_COUNT("dedup.skipped", m_skipped);
+    TRACE_COUNT("dedup.pairs", result.size());
+    return result;
+}
+
+/*******************************************
+ * @brief 查找近似重复的样本,使用样本解码后的文本
+ * @param[in] dataset 样本集
+ * @return 相似度不低于阈值的所有样本对,按序号排序
+ * ****************************************/
+std::vector<Deduplicator::Pair> Deduplicator::find(const std::vector<Text>& dataset) noexcept
+{
+    std::vector<std::wstring> texts;
+    texts.reserve(dataset.size());
+    for (auto& item : dataset)
+    {
+        texts.push_back(item.text());
+    }
+    return find(texts);
+}
+
+/*******************************************
+ * @brief 获取上次查找时精确验证的候选对数量
+ * @return 候选对数量
+ * ****************************************/
+size_t Deduplicator::candidates() const noexcept
+{
+    return m_candidates;
+}
+
+/*******************************************
+ * @brief 获取上次查找时因桶过大而没有比较的文本对
+ *        数量,同一对在多个段中跳过时重复计数
+ * @return 跳过的文本对数量
+ * ****************************************/
+size_t Deduplicator::skipped() const noexcept
+{
+    return m_skipped;
+}
+
+/*******************************************
+ * @brief 计算两个有序集合的Jaccard相似度
+ * @param[in] a 集合
+ * @param[in] na 集合a的元素数量
+ * @param[in] b 集合
+ * @param[in] nb 集合b的元素数量
+ * @return 相似度,两个集合都为空时为0
+ * ****************************************/
+float Deduplicator::jaccard(const uint64_t* a, size_t na, const uint64_t* b, size_t nb) noexcept
+{
+    size_t i = 0;
+    size_t j = 0;
+    size_t common = 0;
+    while (i < na && j < nb)
+    {
+        if (a[i] < b[j])
+        {
+            i++;
+        }
+        else if (a[i] > b[j])
+        {
+            j++;
+        }
+        else
+        {
+            common++;
+            i++;
+            j++;
+        }
+    }
+
+    size_t total = na + nb - common;
+    return total > 0 ? static_cast<float>(common) / total : 0.0f;
+}
+
+/*******************************************
+ * @brief 计算一个文本的n-gram哈希,排序并去重;
+ *        文本短于n时整个文本作为一个n-gram
+ * @param[in] text 文本
+ * @param[out] out 输出位置,至少有文本长度个元素
+ * @return n-gram数量
+ * ****************************************/
+size_t Deduplicator::m_shingleText(const std::wstring& text, uint64_t* out) const noexcept
+{
+    size_t len = text.size();
+    size_t width = static_cast<size_t>(m_shingle);
+    if (len == 0)
+        return 0;
+    if (len < width)
+        width = len;
+
+    size_t n = len - width + 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t h = width;
+        for (size_t j = 0; j < width; j++)
+        {
+            h = (h ^ static_cast<uint32_t>(text[i + j])) * 0x100000001B3ull;
+        }
+        out[i] = mix64(h);
+    }
+
+    std::sort(out, out + n);
+    return std::unique(out, out + n) - out;
+}
+
+/*******************************************
+ * @brief 计算一个文本的MinHash签名,没有n-gram的
+ *        文本签名全部为最大值
+ * @param[in] shingles n-gram哈希
+ * @param[in] n n-gram数量
+ * @param[out] signature 签名,m_bands*m_rows个元素
+ * ****************************************/
+void Deduplicator::m_sign(const uint64_t* shingles, size_t n, uint32_t* signature) const noexcept
+{
+    size_t k = m_mul.size();
+    std::fill(signature, signature + k, UINT32_MAX);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t x = shingles[i];
+        for (size_t h = 0; h < k; h++)
+        {
+            uint32_t value = static_cast<uint32_t>((m_mul[h] * x + m_add[h]) >> 32);
+            signature[h] = std::min(signature[h], value);
+        }
+    }
+}
+
+/*******************************************
+ * @brief 对一段LSH分桶:按这一段签名的哈希排序,
+ *        签名相同的文本按序号升序相邻,并记录每个
+ *        文本所在桶的大小
+ * @param[in] band 段序号
+ * @param[in] n 文本数量
+ * @param[out] keys 临时空间
+ * ****************************************/
+void Deduplicator::m_sortBand(int band, size_t n, std::vector<std::pair<uint64_t, uint32_t>>& keys) noexcept
+{
+    size_t k = m_mul.size();
+    keys.clear();
+    for (size_t i = 0; i < n; i++)
+    {
+        if (m_counts[i] == 0)
+            continue;
+
+        const uint32_t* rows = &m_signatures[i * k + band * m_rows];
+        uint64_t key = mix64(band + 1);
+        for (int r = 0; r < m_rows; r++)
+        {
+            key = mix64(key ^ rows[r]);
+        }
+        keys.emplace_back(key, static_cast<uint32_t>(i));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    uint32_t* order = &m_orders[band * n];
+    uint32_t* positions = &m_positions[band * n];
+    for (size_t r = 0; r < keys.size(); r++)
+    {
+        order[r] = keys[r].second;
+        positions[keys[r].second] = static_cast<uint32_t>(r);
+    }
+    m_bandSizes[band] = keys.size();
+
+    // 与m_verifyBand相同,签名相同的相邻文本为一个桶
+    uint32_t* sizes = &m_bucketSizes[band * n];
+    for (size_t begin = 0; begin < keys.size();)
+    {
+        const uint32_t* first = &m_signatures[order[begin] * k + band * m_rows];
+        size_t end = begin + 1;
+        while (end < keys.size() && std::equal(first, first + m_rows, &m_signatures[order[end] * k + band * m_rows]))
+        {
+            end++;
+        }
+        for (size_t r = begin; r < end; r++)
+        {
+            sizes[order[r]] = static_cast<uint32_t>(end - begin);
+        }
+        begin = end;
+    }
+}
+
+/*******************************************
+ * @brief 验证一段中同一个桶的候选对;不超过
+ *        MAX_BUCKET_SIZE个文本的桶中每一对都是候选对,
+ *        更大的桶中每个文本只与之后的MAX_BUCKET_PAIRS个
+ *        文本组成候选对;之前的段已经产生的候选对跳过,
+ *        因此每一对最多验证一次
+ * @param[in] band 段序号
+ * @param[in] n 文本数量
+ * @param[out] pairs 相似度不低于阈值的文本对
+ * @param[out] skipped 因桶过大没有组成候选的文本对数量
+ * @return 验证的候选对数量
+ * ****************************************/
+size_t Deduplicator::m_verifyBand(int band, size_t n, std::vector<Pair>& pairs, size_t& skipped) const noexcept
+{
+    size_t k = m_mul.size();
+    size_t rows = m_rows;
+    const uint32_t* order = &m_orders[band * n];
+    size_t size = m_bandSizes[band];
+    size_t candidates = 0;
+    skipped = 0;
+
+    // 签名相同的两个文本在同一个桶中
+    auto same = [&](size_t a, size_t b, size_t c) -> bool {
+        const uint32_t* sa = &m_signatures[a * k + c * rows];
+        const uint32_t* sb = &m_signatures[b * k + c * rows];
+        return std::equal(sa, sa + rows, sb);
+    };
+
+    for (size_t begin = 0; begin < size;)
+    {
+        size_t end = begin + 1;
+        while (end < size && same(order[begin], order[end], band))
+        {
+            end++;
+        }
+
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t a = order[i];
+            size_t last = end - begin <= MAX_BUCKET_SIZE ? end : std::min(end, i + 1 + MAX_BUCKET_PAIRS);
+            skipped += end - last;
+            for (size_t j = i + 1; j < last; j++)
+            {
+                size_t b = order[j];
+                // |A∩B|/|A∪B| <= min(|A|,|B|)/max(|A|,|B|)
+                size_t na = m_counts[a];
+                size_t nb = m_counts[b];
+                if (std::min(na, nb) < m_threshold * std::max(na, nb))
+                    continue;
+
+                // 相同签名的比例是相似度的无偏估计
+                const uint32_t* sa = &m_signatures[a * k];
+                const uint32_t* sb = &m_signatures[b * k];
+                size_t equal = 0;
+                for (size_t h = 0; h < k; h++)
+                {
+                    equal += sa[h] == sb[h];
+                }
+                if (equal < (m_threshold - ESTIMATE_MARGIN) * k)
+                    continue;
+
+                // 之前的段已经产生的候选对由之前的段验证
+                bool earlier = false;
+                for (int c = 0; c < band && !earlier; c++)
+                {
+                    const uint32_t* positions = &m_positions[c * n];
+                    earlier = same(a, b, c) && (m_bucketSizes[c * n + a] <= MAX_BUCKET_SIZE || positions[b] - positions[a] <= MAX_BUCKET_PAIRS);
+                }
+                if (earlier)
+                    continue;
+
+                candidates++;
+                float similarity = jaccard(&m_shingles[m_offsets[a]], na, &m_shingles[m_offsets[b]], nb);
+                if (similarity >= m_threshold)
+                    pairs.push_back(Pair{a, b, similarity});
+            }
+        }
+        begin = end;
+    }
+    return candidates;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,151 @@
+#ifndef AUTO_BUG_DEDUPLICATOR_H
+#define AUTO_BUG_DEDUPLICATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Text.h"
+
+namespace AutoBug
+{
+
+/* 查找近似重复的文本:对字符n-gram取MinHash签名,分段
+ * 局部敏感哈希得到候选对,再精确计算Jaccard相似度;
+ * 总耗时与文本数量近似成线性 */
+class Deduplicator
+{
+public:
+    /* 一对近似重复的文本 */
+    struct Pair
+    {
+        size_t first;       // 较小的序号
+        size_t second;      // 较大的序号
+        float similarity;   // n-gram集合的Jaccard相似度
+    };
+
+    ~Deduplicator() noexcept = default;
+
+    /*******************************************
+     * @brief 创建查找器
+     * @param[in] shingle n-gram的字符数,中文标题默认为2
+     * @param[in] bands LSH的段数
+     * @param[in] rows 每段的签名数量
+     * @param[in] threshold Jaccard相似度阈值
+     * @param[in] seed 哈希函数的随机数种子
+     * ****************************************/
+    Deduplicator(int shingle = 2, int bands = 16, int rows = 4, float threshold = 0.8f, uint64_t seed = 1) noexcept;
+
+    /*******************************************
+     * @brief 设置Jaccard相似度阈值
+     * @param[in] threshold 阈值,0~1
+     * ****************************************/
+    void setThreshold(float threshold) noexcept;
+
+    /*******************************************
+     * @brief 设置CPU线程数量
+     * @param[in] threads 线程数量,0表示使用Dispatcher的设置
+     * ****************************************/
+    void setThreads(size_t threads) noexcept;
+
+    /*******************************************
+     * @brief 查找近似重复的文本;大量文本落在同一个桶时
+     *        只比较每个文本之后的一部分,跳过的文本对
+     *        数量由skipped()获取
+     * @param[in] texts 文本
+     * @return 相似度不低于阈值的文本对,按序号排序
+     * ****************************************/
+    std::vector<Pair> find(const std::vector<std::wstring>& texts) noexcept;
+
+    /*******************************************
+     * @brief 查找近似重复的样本,使用样本解码后的文本
+     * @param[in] dataset 样本集
+     * @return 相似度不低于阈值的样本对,按序号排序
+     * ****************************************/
+    std::vector<Pair> find(const std::vector<Text>& dataset) noexcept;
+
+    /*******************************************
+     * @brief 获取上次查找时精确验证的候选对数量
+     * @return 候选对数量
+     * ****************************************/
+    size_t candidates() const noexcept;
+
+    /*******************************************
+     * @brief 获取上次查找时因桶过大而没有比较的文本对
+     *        数量,同一对在多个段中跳过时重复计数
+     * @return 跳过的文本对数量
+     * ****************************************/
+    size_t skipped() const noexcept;
+
+    /*******************************************
+     * @brief 计算两个有序集合的Jaccard相似度
+     * @param[in] a 集合
+     * @param[in] na 集合a的元素数量
+     * @param[in] b 集合
+     * @param[in] nb 集合b的元素数量
+     * @return 相似度
+     * ****************************************/
+    static float jaccard(const uint64_t* a, size_t na, const uint64_t* b, size_t nb) noexcept;
+
+private:
+    int m_shingle;
+    int m_bands;
+    int m_rows;
+    float m_threshold;
+    size_t m_threads;
+    size_t m_candidates;
+    size_t m_skipped;
+    std::vector<uint64_t> m_mul;        // 每个MinHash函数的乘数,奇数
+    std::vector<uint64_t> m_add;        // 每个MinHash函数的加数
+
+    // 上次查找的中间结果
+    std::vector<size_t> m_offsets;      // 每个文本n-gram的起始位置
+    std::vector<size_t> m_counts;       // 每个文本去重后的n-gram数量
+    std::vector<uint64_t> m_shingles;   // 所有文本n-gram的哈希,每个文本内有序
+    std::vector<uint32_t> m_signatures; // 文本数量*签名数量
+    std::vector<uint32_t> m_orders;     // 每一段排序后的文本序号,段数*文本数量
+    std::vector<uint32_t> m_positions;  // 每一段中每个文本排序后的位置
+    std::vector<uint32_t> m_bucketSizes;// 每一段中每个文本所在桶的大小
+    std::vector<size_t> m_bandSizes;    // 每一段参与分桶的文本数量
+
+    /*******************************************
+     * @brief 计算一个文本的n-gram哈希,排序并去重
+     * @param[in] text 文本
+     * @param[out] out 输出位置,至少有文本长度个元素
+     * @return n-gram数量
+     * ****************************************/
+    size_t m_shingleText(const std::wstring& text, uint64_t* out) const noexcept;
+
+    /*******************************************
+     * @brief 计算一个文本的MinHash签名
+     * @param[in] shingles n-gram哈希
+     * @param[in] n n-gram数量
+     * @param[out] signature 签名,m_bands*m_rows个元素
+     * ****************************************/
+    void m_sign(const uint64_t* shingles, size_t n, uint32_t* signature) const noexcept;
+
+    /*******************************************
+     * @brief 对一段LSH分桶,签名相同的文本按序号升序
+     *        相邻,记录每个文本的位置和所在桶的大小
+     * @param[in] band 段序号
+     * @param[in] n 文本数量
+     * @param[out] keys 临时空间
+     * ****************************************/
+    void m_sortBand(int band, size_t n, std::vector<std::pair<uint64_t, uint32_t>>& keys) noexcept;
+
+    /*******************************************
+     * @brief 验证一段中同一个桶的候选对,之前的段已经
+     *        产生的候选对跳过
+     * @param[in] band 段序号
+     * @param[in] n 文本数量
+     * @param[out] pairs 相似度不低于阈值的文本对
+     * @param[out] skipped 因桶过大没有组成候选的文本对数量
+     * @return 验证的候选对数量
+     * ****************************************/
+    size_t m_verifyBand(int band, size_t n, std::vector<Pair>& pairs, size_t& skipped) const noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_DEDUPLICATOR_H
\ No newline at end of file
@@ -23,7 +23,8 @@ DimMap& DimMap::instance() noexcept
     return dimMap;
 }
 
-DimMap::DimMap() noexcept
+DimMap::DimMap() noexcept :
+    m_first(0)
 {
     /* 构建汉字和超空间维度的映射关系 */
     int dim = 0;
@@ -42,6 +43,17 @@ DimMap::DimMap() noexcept
         m_wordMap[dim] = ch;
         dim++;
     }
+
+    /* 常用汉字集中在一段连续的编码中,用数组查找代替红黑树 */
+    if (!m_dimMap.empty())
+    {
+        m_first = m_dimMap.begin()->first;
+        m_table.assign(m_dimMap.rbegin()->first - m_first + 1, -1);
+        for (auto& item : m_dimMap)
+        {
+            m_table[item.first - m_first] = item.second;
+        }
+    }
 }
 
 /*******************************************
@@ -51,10 +63,10 @@ DimMap::DimMap() noexcept
  * ****************************************/
 int DimMap::dim(wchar_t ch) const noexcept
 {
-    auto iter = m_dimMap.find(ch);
-    if (iter == m_dimMap.end())
+    size_t offset = static_cast<size_t>(ch) - static_cast<size_t>(m_first);
+    if (ch < m_first || offset >= m_table.size())
         return -1;
-    return iter->second;
+    return m_table[offset];
 }
 
 /*******************************************
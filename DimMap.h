@@ -2,6 +2,7 @@
 #define AUTO_BUG_DIM_MAP_H
 
 #include <map>
+#include <vector>
 
 namespace AutoBug
 {
@@ -40,6 +41,8 @@ public:
 private:
     std::map<wchar_t, int> m_dimMap;
     std::map<int, wchar_t> m_wordMap; 
+    wchar_t m_first;            // 收录的最小字符
+    std::vector<int> m_table;   // 从m_first开始的连续查找表,未收录的为-1
 };
 
 }; // namespace AutoBug
@@ -0,0 +1,367 @@
+#include "Dispatcher.h"
+#include "Accelerator.h"
+#include "Kernel.h"
+#include "ProgramCache.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace AutoBug
+{
+
+/*******************************************
+ * @brief 获取一个全局公共实例
+ * @return 对象实例
+ * ****************************************/
+Dispatcher& Dispatcher::instance() noexcept
+{
+    static Dispatcher obj;
+    return obj;
+}
+
+Dispatcher::Dispatcher() noexcept :
+    m_calibrated(false),
+    m_threads(std::thread::hardware_concurrency()),
+    m_cpuOp(1e-9),
+    m_threadOverhead(1e-4),
+    m_gpuOp(1e-11),
+    m_gpuLaunch(1e-4),
+    m_gpuTransfer(1e-10),
+    m_gpuBuild(0.5)
+{
+    // 环境变量AUTO_BUG_THREADS可以指定CPU后端的线程数量
+    const char* env = getenv("AUTO_BUG_THREADS");
+    if (env != nullptr && atoi(env) > 0)
+        m_threads = atoi(env);
+
+    if (m_threads == 0)
+        m_threads = 1;
+}
+
+/*******************************************
+ * @brief 为一次Kmeans学习选择计算后端,第一次调用时
+ *        进行校准,环境变量AUTO_BUG_BACKEND可以设置为
+ *        simd、threads或opencl强制使用某个后端
+ * @param[in] n 样本数量
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] rounds 学习轮次
+ * @param[in] sampleBytes 每个样本上传到设备的字节数
+ * @param[in] gpu OpenCL设备是否可用
+ * @return 选择的结果
+ * ****************************************/
+Dispatcher::Decision Dispatcher::choose(size_t n, int dims, size_t k, int rounds, size_t sampleBytes, bool gpu) noexcept
+{
+    Decision decision;
+    decision.backend = CPU_SIMD;
+    for (int i = 0; i < BACKENDS; i++)
+    {
+        decision.cost[i] = -1;
+    }
+
+    const char* env = getenv("AUTO_BUG_BACKEND");
+    if (env != nullptr)
+    {
+        if (strcmp(env, "threads") == 0 && m_threads > 1)
+            decision.backend = CPU_THREADED;
+        else if (strcmp(env, "opencl") == 0 && gpu)
+            decision.backend = OPENCL;
+        return decision;
+    }
+
+    if (!m_calibrated)
+        calibrate();
+
+    // 每轮:所有样本与所有中心点求距离,再把样本累加到所属分组
+    double ops = static_cast<double>(n) * dims * (k + 1);
+    decision.cost[CPU_SIMD] = rounds * ops * m_cpuOp;
+
+    // 每轮有划分和累加两段并行
+    if (m_threads > 1)
+        decision.cost[CPU_THREADED] = rounds * (ops * m_cpuOp / m_threads + 2 * m_threadOverhead);
+
+    // 上传样本和中心点,每轮调用4个核函数,最后读回一次;这个形状的
+    // 特化程序既没有构建过也不在程序缓存中时还要从源码构建
+    if (gpu)
+    {
+        double bytes = static_cast<double>(n) * sampleBytes + static_cast<double>(k) * dims * sizeof(float);
+        decision.cost[OPENCL] = bytes * m_gpuTransfer + rounds * (ops * m_gpuOp + 4 * m_gpuLaunch) + m_gpuLaunch;
+
+        auto& accelerator = Accelerator::instance();
+        if (accelerator.available() && !accelerator.built(accelerator.specialize(dims, static_cast<int>(k))))
+            decision.cost[OPENCL] += m_gpuBuild;
+    }
+
+    for (int i = 0; i < BACKENDS; i++)
+    {
+        if (decision.cost[i] >= 0 && decision.cost[i] < decision.cost[decision.backend])
+            decision.backend = static_cast<Backend>(i);
+    }
+    return decision;
+}
+
+/*******************************************
+ * @brief 运行校准微基准测试,结果写入缓存目录;缓存中
+ *        已有同一设备的结果时直接加载
+ * ****************************************/
+void Dispatcher::calibrate() noexcept
+{
+    TRACE_SCOPE("Dispatcher::calibrate");
+    m_calibrated = true;
+
+    std::string path = m_cachePath();
+    if (!path.empty())
+    {
+        FILE* fp = fopen(path.c_str(), "r");
+        if (fp != nullptr)
+        {
+            int n = fscanf(fp, "%lf %lf %lf %lf %lf %lf", &m_cpuOp, &m_threadOverhead, &m_gpuOp, &m_gpuLaunch, &m_gpuTransfer, &m_gpuBuild);
+            fclose(fp);
+            if (n == 6)
+                return;
+        }
+    }
+
+    m_calibrateCpu();
+    if (Accelerator::instance().available())
+        m_calibrateGpu();
+
+    if (!path.empty())
+    {
+        FILE* fp = fopen(path.c_str(), "w");
+        if (fp != nullptr)
+        {
+            fprintf(fp, "%g %g %g %g %g %g\n", m_cpuOp, m_threadOverhead, m_gpuOp, m_gpuLaunch, m_gpuTransfer, m_gpuBuild);
+            fclose(fp);
+        }
+    }
+}
+
+/*******************************************
+ * @brief 获取CPU后端使用的线程数量,默认为硬件线程数,
+ *        可以通过环境变量AUTO_BUG_THREADS设置
+ * @return 线程数量
+ * ****************************************/
+size_t Dispatcher::threads() const noexcept
+{
+    return m_threads;
+}
+
+/*******************************************
+ * @brief 把[0, n)分成连续的几段,在多个线程中执行,
+ *        当前线程执行第0段
+ * @param[in] n 总数
+ * @param[in] threads 线程数量,超过n时按n计算,小于2时
+ *                    在当前线程执行整个范围
+ * @param[in] fn 对一段执行的函数,参数为段序号、起点和终点
+ * ****************************************/
+void Dispatcher::parallel(size_t n, size_t threads, const std::function<void(size_t, size_t, size_t)>& fn) noexcept
+{
+    if (threads > n)
+        threads = n;
+    if (threads < 2)
+    {
+        if (n > 0)
+            fn(0, 0, n);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t step = (n + threads - 1) / threads;
+    size_t chunk = 1;
+    for (size_t first = step; first < n; first += step, chunk++)
+    {
+        workers.emplace_back(fn, chunk, first, std::min(first + step, n));
+    }
+    fn(0, 0, step);
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/*******************************************
+ * @brief 获取后端的名称
+ * @param[in] backend 后端
+ * @return 名称
+ * ****************************************/
+const char* Dispatcher::name(Backend backend) noexcept
+{
+    switch (backend)
+    {
+    case CPU_SIMD:
+        return "simd";
+    case CPU_THREADED:
+        return "threads";
+    case OPENCL:
+        return "opencl";
+    default:
+        return "unknown";
+    }
+}
+
+/*******************************************
+ * @brief 将选择的结果格式化为便于记录日志的字符串
+ * @param[in] decision 选择的结果
+ * @return 字符串
+ * ****************************************/
+std::string Dispatcher::describe(const Decision& decision) noexcept
+{
+    std::string str = name(decision.backend);
+    str += " (";
+    for (int i = 0; i < BACKENDS; i++)
+    {
+        char buffer[64];
+        if (decision.cost[i] < 0)
+            snprintf(buffer, sizeof(buffer), "%s%s -", i > 0 ? ", " : "", name(static_cast<Backend>(i)));
+        else
+            snprintf(buffer, sizeof(buffer), "%s%s %.3fms", i > 0 ? ", " : "", name(static_cast<Backend>(i)), decision.cost[i] * 1e3);
+        str += buffer;
+    }
+    str += ")";
+    return str;
+}
+
+/*******************************************
+ * @brief 获取校准结果的缓存文件路径,与CPU线程数和
+ *        设备名称相关
+ * @return 路径,不使用缓存时为空
+ * ****************************************/
+std::string Dispatcher::m_cachePath() const noexcept
+{
+    ProgramCache cache;
+    if (cache.directory().empty())
+        return "";
+
+    auto& gpu = Accelerator::instance();
+    std::string device = gpu.available() ? gpu.name() : "none";
+    uint64_t h = ProgramCache::hash(device.data(), device.size());
+    h = ProgramCache::hash(&m_threads, sizeof(m_threads), h);
+
+    char name[40];
+    snprintf(name, sizeof(name), "/dispatch-%016llx.txt", static_cast<unsigned long long>(h));
+    return cache.directory() + name;
+}
+
+/*******************************************
+ * @brief 测量CPU的计算速度和线程开销
+ * ****************************************/
+void Dispatcher::m_calibrateCpu() noexcept
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // 与Kmeans的划分步骤相同的访存模式:每个样本与所有中心点求距离
+    const size_t n = 64;
+    const size_t k = 16;
+    const size_t dims = 256;
+    std::vector<float> samples(n * dims);
+    std::vector<float> centers(k * dims);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        samples[i] = static_cast<float>(i % 7);
+    }
+    for (size_t i = 0; i < centers.size(); i++)
+    {
+        centers[i] = static_cast<float>(i % 5);
+    }
+
+    volatile float sink = 0.0f;
+    size_t reps = 0;
+    auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    while (elapsed < std::chrono::milliseconds(5))
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            float nearest = -1.0f;
+            for (size_t c = 0; c < k; c++)
+            {
+                float sum = 0.0f;
+                for (size_t d = 0; d < dims; d++)
+                {
+                    float diff = samples[i * dims + d] - centers[c * dims + d];
+                    sum += diff * diff;
+                }
+                nearest = (nearest < 0 || sum < nearest) ? sum : nearest;
+            }
+            sink = sink + nearest;
+        }
+        reps += 1;
+        elapsed = Clock::now() - start;
+    }
+    m_cpuOp = std::chrono::duration<double>(elapsed).count() / (reps * n * k * dims);
+
+    if (m_threads < 2)
+        return;
+
+    const int rounds = 20;
+    start = Clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        parallel(m_threads, m_threads, [](size_t, size_t, size_t) {});
+    }
+    m_threadOverhead = std::chrono::duration<double>(Clock::now() - start).count() / rounds;
+}
+
+/*******************************************
+ * @brief 测量OpenCL设备的传输、调用、计算速度以及
+ *        构建特化程序的耗时
+ * ****************************************/
+void Dispatcher::m_calibrateGpu() noexcept
+{
+    typedef std::chrono::steady_clock Clock;
+    auto& gpu = Accelerator::instance();
+
+    // 使用与Kmeans相同名字的缓存,校准后可以直接复用
+    int n = 4096;
+    int k = 16;
+    int dims = 256;
+    std::vector<float> samples(n * dims, 1.0f);
+    std::vector<int> assign(n);
+    auto items = gpu.createBuffer("items", samples.size() * sizeof(float));
+    auto points = gpu.createBuffer("points", k * dims * sizeof(float));
+    auto assignment = gpu.createBuffer("assignment", n * sizeof(int));
+    auto distances = gpu.createBuffer("distances", n * sizeof(float));
+    FindNearestKernel findNearest{gpu, "findNearest"};
+    if (items == nullptr || points == nullptr || assignment == nullptr || distances == nullptr || !findNearest.valid())
+        return;
+
+    // 第一次写入包含分配物理内存的开销,计时第二次
+    gpu.writeBuffer("items", 0, samples.data(), samples.size() * sizeof(float), true);
+    auto start = Clock::now();
+    gpu.writeBuffer("items", 0, samples.data(), samples.size() * sizeof(float), true);
+    m_gpuTransfer = std::chrono::duration<double>(Clock::now() - start).count() / (samples.size() * sizeof(float));
+    gpu.writeBuffer("points", 0, samples.data(), k * dims * sizeof(float), true);
+
+    // 极小的调用测量调用和同步的固定开销
+    auto run = [&](int n, int k, int dims) -> double {
+        auto start = Clock::now();
+        findNearest(gpu.localSize(n), gpu.globalSize(n), items, points, assignment, distances, dims, k, n);
+        gpu.readBuffer("assignment", 0, assign.data(), sizeof(int), true);
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    run(1, 1, 1);
+    const int rounds = 10;
+    double launch = 0.0;
+    for (int r = 0; r < rounds; r++)
+    {
+        launch += run(1, 1, 1);
+    }
+    m_gpuLaunch = launch / rounds;
+
+    double compute = run(n, k, dims) - m_gpuLaunch;
+    m_gpuOp = (compute > 0 ? compute : 0.0) / (static_cast<double>(n) * k * dims);
+
+    // 每个新的(dims, k)都要构建一次特化程序
+    double build = gpu.buildSeconds(gpu.specialize(dims, k));
+    if (build >= 0)
+        m_gpuBuild = build;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
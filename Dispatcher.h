@@ -0,0 +1,123 @@
+#ifndef AUTO_BUG_DISPATCHER_H
+#define AUTO_BUG_DISPATCHER_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace AutoBug
+{
+
+class Dispatcher
+{
+public:
+    /* 计算后端 */
+    enum Backend
+    {
+        CPU_SIMD,       // 单线程,依靠编译器向量化和QuantizedSet中的SIMD
+        CPU_THREADED,   // 多线程,样本分段并行
+        OPENCL,         // OpenCL设备
+        BACKENDS,       // 后端数量
+    };
+
+    /* 一次选择的结果,cost为各个后端的预计耗时(秒),不可用的后端为-1 */
+    struct Decision
+    {
+        Backend backend;
+        double cost[BACKENDS];
+    };
+
+    /*******************************************
+     * @brief 获取一个全局公共实例
+     * @return 对象实例
+     * ****************************************/
+    static Dispatcher& instance() noexcept;
+
+    ~Dispatcher() noexcept = default;
+    Dispatcher() noexcept;
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher(Dispatcher&&) = delete;
+
+    /*******************************************
+     * @brief 为一次Kmeans学习选择计算后端,第一次调用时
+     *        进行校准,环境变量AUTO_BUG_BACKEND可以设置为
+     *        simd、threads或opencl强制使用某个后端
+     * @param[in] n 样本数量
+     * @param[in] dims 维度
+     * @param[in] k 分组数量
+     * @param[in] rounds 学习轮次
+     * @param[in] sampleBytes 每个样本上传到设备的字节数
+     * @param[in] gpu OpenCL设备是否可用
+     * @return 选择的结果
+     * ****************************************/
+    Decision choose(size_t n, int dims, size_t k, int rounds, size_t sampleBytes, bool gpu) noexcept;
+
+    /*******************************************
+     * @brief 运行校准微基准测试,结果写入缓存目录;缓存中
+     *        已有同一设备的结果时直接加载
+     * ****************************************/
+    void calibrate() noexcept;
+
+    /*******************************************
+     * @brief 获取CPU后端使用的线程数量,默认为硬件线程数,
+     *        可以通过环境变量AUTO_BUG_THREADS设置
+     * @return 线程数量
+     * ****************************************/
+    size_t threads() const noexcept;
+
+    /*******************************************
+     * @brief 把[0, n)分成连续的几段,在多个线程中执行,
+     *        当前线程执行第0段
+     * @param[in] n 总数
+     * @param[in] threads 线程数量,超过n时按n计算,小于2时
+     *                    在当前线程执行整个范围
+     * @param[in] fn 对一段执行的函数,参数为段序号、起点和终点
+     * ****************************************/
+    static void parallel(size_t n, size_t threads, const std::function<void(size_t, size_t, size_t)>& fn) noexcept;
+
+    /*******************************************
+     * @brief 获取后端的名称
+     * @param[in] backend 后端
+     * @return 名称
+     * ****************************************/
+    static const char* name(Backend backend) noexcept;
+
+    /*******************************************
+     * @brief 将选择的结果格式化为便于记录日志的字符串
+     * @param[in] decision 选择的结果
+     * @return 字符串
+     * ****************************************/
+    static std::string describe(const Decision& decision) noexcept;
+
+private:
+    bool m_calibrated;
+    size_t m_threads;
+    double m_cpuOp;             // CPU单线程每次乘加的耗时
+    double m_threadOverhead;    // 一次创建并等待所有线程的耗时
+    double m_gpuOp;             // 设备上每次乘加的耗时
+    double m_gpuLaunch;         // 一次核函数调用加同步的耗时
+    double m_gpuTransfer;       // 每字节上传的耗时
+    double m_gpuBuild;          // 从源码构建一个特化程序的耗时
+
+    /*******************************************
+     * @brief 获取校准结果的缓存文件路径,与CPU线程数和
+     *        设备名称相关
+     * @return 路径,不使用缓存时为空
+     * ****************************************/
+    std::string m_cachePath() const noexcept;
+
+    /*******************************************
+     * @brief 测量CPU的计算速度和线程开销
+     * ****************************************/
+    void m_calibrateCpu() noexcept;
+
+    /*******************************************
+     * @brief 测量OpenCL设备的传输、调用、计算速度以及
+     *        构建特化程序的耗时
+     * ****************************************/
+    void m_calibrateGpu() noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_DISPATCHER_H
\ No newline at end of file
@@ -0,0 +1,505 @@
+#include "FeatureCache.h"
+#include "Model.h"
+#include "ProgramCache.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace AutoBug
+{
+
+/* 缓存文件的头部,之后是rows条记录,每条记录依次为:
+ * uint32_t nnz, uint32_t chars, int32_t indices[nnz],
+ * float values[nnz], wchar_t text[chars]
+ * 追加时先写记录再更新头部,bytes之后多出的部分被忽略 */
+struct FeatureCache::Header
+{
+    char magic[8];
+    uint32_t version;
+    int32_t dims;
+    uint64_t dimMapHash;
+    uint64_t sourceSize;    // 缓存覆盖的源文件字节数
+    int64_t sourceMtime;
+    uint64_t sourceInode;
+    uint64_t sourceHash;
+    uint64_t rows;
+    uint64_t bytes;         // 所有记录的字节数
+};
+
+static_assert(sizeof(wchar_t) == sizeof(int32_t), "the cache stores 32-bit characters");
+
+static const char FEATURE_CACHE_MAGIC[8] = {'A', 'U', 'T', 'O', 'B', 'U', 'G', 'F'};
+static const uint32_t FEATURE_CACHE_VERSION = 3;
+
+// 计算源文件哈希时每次读取的字节数
+static const size_t HASH_CHUNK_BYTES = 1 << 20;
+
+/*******************************************
+ * @brief 把一个样本编码成一条记录,追加到缓冲区;
+ *        坐标由文本中的字符决定,只需要检查出现过的维度
+ * @param[in] sample 样本
+ * @param[in] dimMap 超空间维度映射
+ * @param[out] out 缓冲区
+ * ****************************************/
+static void encodeRecord(const Text& sample, const DimMap& dimMap, std::vector<char>& out) noexcept
+{
+    std::wstring text = sample.text();
+    std::vector<int32_t> indices;
+    for (wchar_t ch : text)
+    {
+        int dim = dimMap.dim(ch);
+        if (dim >= 0 && dim < sample.dims())
+            indices.push_back(dim);
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+    uint32_t counts[2] = {static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(text.size())};
+    size_t pos = out.size();
+    out.resize(pos + sizeof(counts) + indices.size() * (sizeof(int32_t) + sizeof(float)) + text.size() * sizeof(wchar_t));
+    char* dest = out.data() + pos;
+    memcpy(dest, counts, sizeof(counts));
+    dest += sizeof(counts);
+    memcpy(dest, indices.data(), indices.size() * sizeof(int32_t));
+    dest += indices.size() * sizeof(int32_t);
+    for (int32_t dim : indices)
+    {
+        float value = sample[dim];
+        memcpy(dest, &value, sizeof(value));
+        dest += sizeof(value);
+    }
+    memcpy(dest, text.data(), text.size() * sizeof(wchar_t));
+}
+
+/*******************************************
+ * @brief 在指定位置写入全部数据
+ * @param[in] fd 文件描述符
+ * @param[in] data 数据
+ * @param[in] bytes 字节数
+ * @param[in] pos 位置
+ * @return 是否成功
+ * ****************************************/
+static bool writeAll(int fd, const void* data, size_t bytes, off_t pos) noexcept
+{
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0)
+    {
+        ssize_t n = pwrite(fd, p, bytes, pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        bytes -= n;
+        pos += n;
+    }
+    return true;
+}
+
+/*******************************************
+ * @brief 创建缓存,目录与ProgramCache相同
+ * ****************************************/
+FeatureCache::FeatureCache() noexcept :
+    m_dir(ProgramCache().directory()),
+    m_offset(0),
+    m_hash(ProgramCache::FNV_OFFSET)
+{
+
+}
+
+/*******************************************
+ * @brief 设置缓存目录
+ * @param[in] dir 缓存目录,为空时不使用缓存
+ * ****************************************/
+void FeatureCache::setDirectory(const std::string& dir) noexcept
+{
+    m_dir = dir;
+}
+
+/*******************************************
+ * @brief 获取缓存目录
+ * @return 缓存目录,为空表示不使用缓存
+ * ****************************************/
+const std::string& FeatureCache::directory() const noexcept
+{
+    return m_dir;
+}
+
+/*******************************************
+ * @brief 计算源文件对应的缓存文件路径,由绝对路径
+ *        的哈希命名
+ * @param[in] file 源文件
+ * @return 缓存文件的路径,无法确定时为空
+ * ****************************************/
+std::string FeatureCache::path(const char* file) const noexcept
+{
+    char real[PATH_MAX];
+    if (m_dir.empty() || realpath(file, real) == nullptr)
+        return "";
+
+    char name[32];
+    uint64_t h = ProgramCache::hash(real, strlen(real));
+    snprintf(name, sizeof(name), "/%016llx.features", static_cast<unsigned long long>(h));
+    return m_dir + name;
+}
+
+/*******************************************
+ * @brief 检查缓存是否覆盖源文件或者它的前缀,
+ *        不恢复样本
+ * @param[in] file 源文件
+ * @param[in] dimMap 超空间维度映射
+ * @return 缓存是否有效
+ * ****************************************/
+bool FeatureCache::open(const char* file, const DimMap& dimMap) noexcept
+{
+    m_offset = 0;
+    m_hash = ProgramCache::FNV_OFFSET;
+    std::string cache = path(file);
+    if (cache.empty())
+        return false;
+
+    int fd = ::open(cache.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    Header header;
+    struct stat info;
+    bool success = pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                   fstat(fd, &info) == 0 &&
+                   header.bytes <= static_cast<uint64_t>(info.st_size) - sizeof(header) &&
+                   m_check(header, file, dimMap);
+    close(fd);
+    if (success)
+    {
+        m_offset = header.sourceSize;
+        m_hash = header.sourceHash;
+    }
+    return success;
+}
+
+/*******************************************
+ * @brief 从缓存加载数据集,源文件在缓存之后追加的
+ *        部分需要调用者继续解析
+ * @param[in] file 源文件
+ * @param[in] dimMap 超空间维度映射
+ * @param[out] dataset 样本集
+ * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+ * @return 缓存是否有效
+ * ****************************************/
+bool FeatureCache::load(const char* file, const DimMap& dimMap, std::vector<Text>& dataset, Arena* arena) noexcept
+{
+    TRACE_SCOPE("FeatureCache::load");
+    m_offset = 0;
+    m_hash = ProgramCache::FNV_OFFSET;
+    std::string cache = path(file);
+    if (cache.empty())
+        return false;
+
+    int fd = ::open(cache.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    size_t size = 0;
+    const Header* header = nullptr;
+    const char* pos = nullptr;
+    const char* end = nullptr;
+    bool success = false;
+
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header)))
+        goto EXIT;
+
+    size = static_cast<size_t>(info.st_size);
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        goto EXIT;
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    header = static_cast<const Header*>(data);
+    if (header->bytes > size - sizeof(Header) || !m_check(*header, file, dimMap))
+        goto EXIT;
+
+    // 逐条检查记录的长度,损坏的缓存不会越界
+    pos = static_cast<const char*>(data) + sizeof(Header);
+    end = pos + header->bytes;
+    dataset.clear();
+    dataset.reserve(header->rows < size ? header->rows : 0);
+    for (uint64_t row = 0; row < header->rows; row++)
+    {
+        uint32_t counts[2];
+        if (static_cast<size_t>(end - pos) < sizeof(counts))
+            break;
+        memcpy(counts, pos, sizeof(counts));
+
+        size_t bytes = sizeof(counts) + static_cast<size_t>(counts[0]) * (sizeof(int32_t) + sizeof(float)) + static_cast<size_t>(counts[1]) * sizeof(wchar_t);
+        if (bytes > static_cast<size_t>(end - pos))
+            break;
+
+        const int32_t* indices = reinterpret_cast<const int32_t*>(pos + sizeof(counts));
+        const float* values = reinterpret_cast<const float*>(indices + counts[0]);
+        const wchar_t* text = reinterpret_cast<const wchar_t*>(values + counts[0]);
+        Text sample{0, arena};
+        sample.setFeatures(text, counts[1], header->dims, indices, values, counts[0]);
+        dataset.push_back(std::move(sample));
+        pos += bytes;
+    }
+
+    success = dataset.size() == header->rows;
+    if (success)
+    {
+        m_offset = header->sourceSize;
+        m_hash = header->sourceHash;
+    }
+    else
+        dataset.clear();
+
+EXIT:
+    if (data != MAP_FAILED)
+        munmap(data, size);
+    close(fd);
+    return success;
+}
+
+/*******************************************
+ * @brief 获取缓存覆盖的源文件字节数
+ * @return 上次open、load或append之后的字节数
+ * ****************************************/
+uint64_t FeatureCache::offset() const noexcept
+{
+    return m_offset;
+}
+
+/*******************************************
+ * @brief 获取缓存覆盖的源文件字节的哈希,可以交给
+ *        Follower继续计算
+ * @return 上次open、load或append之后的哈希,缓存无效
+ *         时为空内容的哈希
+ * ****************************************/
+uint64_t FeatureCache::hash() const noexcept
+{
+    return m_hash;
+}
+
+/*******************************************
+ * @brief 把源文件[begin, end)中解析出的样本追加
+ *        到缓存,begin为0时重新创建缓存,否则必须
+ *        等于缓存当前覆盖的字节数;追加时只读取新的
+ *        字节,在头部的哈希上继续计算,前缀在此之前
+ *        被改写时下次检查会发现哈希不一致
+ * @param[in] file 源文件
+ * @param[in] dimMap 超空间维度映射
+ * @param[in] dataset 样本
+ * @param[in] begin 样本在源文件中的起始位置
+ * @param[in] end 样本在源文件中的结束位置
+ * @return 是否成功
+ * ****************************************/
+bool FeatureCache::append(const char* file, const DimMap& dimMap, const std::vector<Text>& dataset, uint64_t begin, uint64_t end) noexcept
+{
+    TRACE_SCOPE("FeatureCache::append");
+    Source source;
+    std::string cache = path(file);
+    if (cache.empty() || begin > end)
+        return false;
+
+    std::vector<char> records;
+    for (auto& sample : dataset)
+    {
+        encodeRecord(sample, dimMap, records);
+    }
+
+    Header header;
+    struct stat info;
+    int fd = -1;
+    bool success = false;
+
+    // 重新创建时先写临时文件再改名,多个进程同时写入时不会读到不完整的文件
+    if (begin == 0)
+    {
+        if (!m_identify(file, 0, end, ProgramCache::FNV_OFFSET, source))
+            return false;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FEATURE_CACHE_MAGIC, sizeof(header.magic));
+        header.version = FEATURE_CACHE_VERSION;
+        header.dims = dimMap.dims();
+        header.dimMapHash = Model::hash(dimMap);
+        header.sourceSize = source.size;
+        header.sourceMtime = source.mtime;
+        header.sourceInode = source.inode;
+        header.sourceHash = source.hash;
+        header.rows = dataset.size();
+        header.bytes = records.size();
+        if (!ProgramCache::makeDirs(m_dir))
+            return false;
+
+        std::string temp = cache + "." + std::to_string(getpid()) + ".tmp";
+        FILE* fp = fopen(temp.c_str(), "wb");
+        if (fp == nullptr)
+            return false;
+
+        success = fwrite(&header, sizeof(header), 1, fp) == 1;
+        success = success && fwrite(records.data(), 1, records.size(), fp) == records.size();
+        success = (fclose(fp) == 0) && success;
+        if (!success || rename(temp.c_str(), cache.c_str()) != 0)
+        {
+            remove(temp.c_str());
+            return false;
+        }
+
+        m_offset = end;
+        m_hash = source.hash;
+        return true;
+    }
+
+    // 追加时加锁,先写入记录再更新头部,中途失败时头部仍然描述旧的记录
+    fd = ::open(cache.c_str(), O_RDWR);
+    if (fd < 0)
+        return false;
+
+    if (flock(fd, LOCK_EX) != 0 || pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) || fstat(fd, &info) != 0)
+        goto EXIT;
+
+    if (memcmp(header.magic, FEATURE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != FEATURE_CACHE_VERSION || header.dims != dimMap.dims() ||
+        header.dimMapHash != Model::hash(dimMap) || header.sourceSize != begin ||
+        header.bytes > static_cast<uint64_t>(info.st_size) - sizeof(header))
+        goto EXIT;
+
+    if (!m_identify(file, begin, end, header.sourceHash, source) || source.inode != header.sourceInode)
+        goto EXIT;
+
+    if (ftruncate(fd, sizeof(header) + header.bytes) != 0 ||
+        !writeAll(fd, records.data(), records.size(), sizeof(header) + header.bytes) ||
+        fdatasync(fd) != 0)
+        goto EXIT;
+
+    header.sourceSize = source.size;
+    header.sourceMtime = source.mtime;
+    header.sourceInode = source.inode;
+    header.sourceHash = source.hash;
+    header.rows += dataset.size();
+    header.bytes += records.size();
+    if (!writeAll(fd, &header, sizeof(header), 0))
+        goto EXIT;
+
+    m_offset = end;
+    m_hash = source.hash;
+    success = true;
+
+EXIT:
+    close(fd);
+    return success;
+}
+
+/*******************************************
+ * @brief 检查缓存的头部与源文件和维度映射表一致;
+ *        源文件的大小和修改时间与写入缓存时相同时不读
+ *        取内容,否则重新计算缓存覆盖的全部字节的哈希,
+ *        变长时只接受在换行之后追加
+ * @param[in] header 头部
+ * @param[in] file 源文件
+ * @param[in] dimMap 超空间维度映射
+ * @return 是否一致
+ * ****************************************/
+bool FeatureCache::m_check(const Header& header, const char* file, const DimMap& dimMap) noexcept
+{
+    if (memcmp(header.magic, FEATURE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != FEATURE_CACHE_VERSION ||
+        header.dims != dimMap.dims() || header.dimMapHash != Model::hash(dimMap))
+        return false;
+
+    // 先只获取大小、修改时间和inode,源文件写入缓存之后没有变化时信任头部的哈希
+    Source source;
+    if (!m_identify(file, header.sourceSize, header.sourceSize, header.sourceHash, source) ||
+        source.inode != header.sourceInode)
+        return false;
+
+    if (source.fileSize == header.sourceSize && source.mtime == header.sourceMtime)
+        return true;
+
+    TRACE_COUNT("featurecache.rehash", 1);
+    if (!m_identify(file, 0, header.sourceSize, ProgramCache::FNV_OFFSET, source) ||
+        source.hash != header.sourceHash)
+        return false;
+    return source.fileSize == header.sourceSize || header.sourceSize == 0 || source.lineEnd;
+}
+
+/*******************************************
+ * @brief 在已有的哈希上继续计算文件[begin, end)的
+ *        内容,分段计算的结果与一次计算相同
+ * @param[in] fd 文件描述符
+ * @param[in] begin 起始位置
+ * @param[in] end 结束位置
+ * @param[in,out] hash 哈希,从头计算时为ProgramCache::FNV_OFFSET
+ * @return 是否成功,文件不足end字节时失败
+ * ****************************************/
+bool FeatureCache::hashFile(int fd, uint64_t begin, uint64_t end, uint64_t& hash) noexcept
+{
+    if (begin >= end)
+        return begin == end;
+
+    std::vector<char> buffer(end - begin < HASH_CHUNK_BYTES ? end - begin : HASH_CHUNK_BYTES);
+    while (begin < end)
+    {
+        size_t bytes = end - begin < buffer.size() ? end - begin : buffer.size();
+        ssize_t n = pread(fd, buffer.data(), bytes, static_cast<off_t>(begin));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        hash = ProgramCache::hash(buffer.data(), n, hash);
+        begin += n;
+    }
+    return true;
+}
+
+/*******************************************
+ * @brief 获取源文件前length字节的标识,哈希从begin
+ *        开始接着seed计算,begin为0时读取全部length字节
+ * @param[in] file 源文件
+ * @param[in] begin 从这个位置开始计算哈希
+ * @param[in] length 字节数
+ * @param[in] seed 前begin字节的哈希
+ * @param[out] source 标识
+ * @return 是否成功,源文件不足length字节时失败
+ * ****************************************/
+bool FeatureCache::m_identify(const char* file, uint64_t begin, uint64_t length, uint64_t seed, Source& source) noexcept
+{
+    int fd = ::open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    char last = 0;
+    bool success = false;
+
+    if (fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < length || begin > length)
+        goto EXIT;
+
+    source.size = length;
+    source.fileSize = static_cast<uint64_t>(info.st_size);
+    source.mtime = source.fileSize == length ? static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec : 0;
+    source.inode = static_cast<uint64_t>(info.st_ino);
+    source.hash = seed;
+    if (!hashFile(fd, begin, length, source.hash))
+        goto EXIT;
+
+    source.lineEnd = length > 0 && pread(fd, &last, 1, static_cast<off_t>(length - 1)) == 1 && last == '\n';
+    success = true;
+
+EXIT:
+    close(fd);
+    return success;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
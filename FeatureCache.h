@@ -0,0 +1,155 @@
+#ifndef AUTO_BUG_FEATURE_CACHE_H
+#define AUTO_BUG_FEATURE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DimMap.h"
+#include "Text.h"
+#include "Arena.h"
+
+namespace AutoBug
+{
+
+/* 数据集的特征缓存,保存解码后的文本和稀疏坐标,再次
+ * 加载未修改的文件时映射到内存直接恢复样本
+ *
+ * 缓存文件由源文件的绝对路径命名,头部记录维度映射表
+ * 的哈希,以及缓存覆盖的源文件字节数、修改时间、inode
+ * 和这些字节的哈希;源文件只在末尾追加时缓存仍然覆盖
+ * 它的前缀,新追加的样本可以直接追加到缓存末尾,哈希
+ * 在原有的值上继续计算新追加的字节。源文件的大小和
+ * 修改时间与写入缓存时相同时直接信任缓存,否则重新
+ * 计算整个前缀的哈希,前缀中任何位置被改写都会失效 */
+class FeatureCache
+{
+public:
+    ~FeatureCache() noexcept = default;
+
+    /*******************************************
+     * @brief 创建缓存,目录与ProgramCache相同
+     * ****************************************/
+    FeatureCache() noexcept;
+    FeatureCache(const FeatureCache&) = delete;
+    FeatureCache(FeatureCache&&) = delete;
+
+    /*******************************************
+     * @brief 设置缓存目录
+     * @param[in] dir 缓存目录,为空时不使用缓存
+     * ****************************************/
+    void setDirectory(const std::string& dir) noexcept;
+
+    /*******************************************
+     * @brief 获取缓存目录
+     * @return 缓存目录,为空表示不使用缓存
+     * ****************************************/
+    const std::string& directory() const noexcept;
+
+    /*******************************************
+     * @brief 计算源文件对应的缓存文件路径
+     * @param[in] file 源文件
+     * @return 缓存文件的路径,无法确定时为空
+     * ****************************************/
+    std::string path(const char* file) const noexcept;
+
+    /*******************************************
+     * @brief 检查缓存是否覆盖源文件或者它的前缀,
+     *        不恢复样本
+     * @param[in] file 源文件
+     * @param[in] dimMap 超空间维度映射
+     * @return 缓存是否有效
+     * ****************************************/
+    bool open(const char* file, const DimMap& dimMap) noexcept;
+
+    /*******************************************
+     * @brief 从缓存加载数据集,源文件在缓存之后追加的
+     *        部分需要调用者继续解析
+     * @param[in] file 源文件
+     * @param[in] dimMap 超空间维度映射
+     * @param[out] dataset 样本集
+     * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+     * @return 缓存是否有效
+     * ****************************************/
+    bool load(const char* file, const DimMap& dimMap, std::vector<Text>& dataset, Arena* arena=nullptr) noexcept;
+
+    /*******************************************
+     * @brief 获取缓存覆盖的源文件字节数
+     * @return 上次open、load或append之后的字节数
+     * ****************************************/
+    uint64_t offset() const noexcept;
+
+    /*******************************************
+     * @brief 获取缓存覆盖的源文件字节的哈希,可以交给
+     *        Follower继续计算
+     * @return 上次open、load或append之后的哈希,缓存无效
+     *         时为空内容的哈希
+     * ****************************************/
+    uint64_t hash() const noexcept;
+
+    /*******************************************
+     * @brief 把源文件[begin, end)中解析出的样本追加
+     *        到缓存,begin为0时重新创建缓存,否则必须
+     *        等于缓存当前覆盖的字节数,只读取新追加的字节
+     * @param[in] file 源文件
+     * @param[in] dimMap 超空间维度映射
+     * @param[in] dataset 样本
+     * @param[in] begin 样本在源文件中的起始位置
+     * @param[in] end 样本在源文件中的结束位置
+     * @return 是否成功
+     * ****************************************/
+    bool append(const char* file, const DimMap& dimMap, const std::vector<Text>& dataset, uint64_t begin, uint64_t end) noexcept;
+
+    /*******************************************
+     * @brief 在已有的哈希上继续计算文件[begin, end)的
+     *        内容,分段计算的结果与一次计算相同
+     * @param[in] fd 文件描述符
+     * @param[in] begin 起始位置
+     * @param[in] end 结束位置
+     * @param[in,out] hash 哈希,从头计算时为ProgramCache::FNV_OFFSET
+     * @return 是否成功,文件不足end字节时失败
+     * ****************************************/
+    static bool hashFile(int fd, uint64_t begin, uint64_t end, uint64_t& hash) noexcept;
+
+private:
+    struct Header;
+
+    /* 源文件的标识 */
+    struct Source
+    {
+        uint64_t size;      // 参与计算的字节数
+        int64_t mtime;      // 纳秒,源文件比size长时为0
+        uint64_t inode;
+        uint64_t hash;      // 前size字节的哈希
+        uint64_t fileSize;  // 源文件当前的大小
+        bool lineEnd;       // 第size个字节是否是换行
+    };
+
+    std::string m_dir;
+    uint64_t m_offset;
+    uint64_t m_hash;
+
+    /*******************************************
+     * @brief 检查缓存的头部与源文件和维度映射表一致
+     * @param[in] header 头部
+     * @param[in] file 源文件
+     * @param[in] dimMap 超空间维度映射
+     * @return 是否一致
+     * ****************************************/
+    static bool m_check(const Header& header, const char* file, const DimMap& dimMap) noexcept;
+
+    /*******************************************
+     * @brief 获取源文件前length字节的标识
+     * @param[in] file 源文件
+     * @param[in] begin 从这个位置开始计算哈希
+     * @param[in] length 字节数
+     * @param[in] seed 前begin字节的哈希
+     * @param[out] source 标识
+     * @return 是否成功,源文件不足length字节时失败
+     * ****************************************/
+    static bool m_identify(const char* file, uint64_t begin, uint64_t length, uint64_t seed, Source& source) noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_FEATURE_CACHE_H
\ No newline at end of file
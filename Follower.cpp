@@ -0,0 +1,271 @@
+#include "Follower.h"
+#include "DataLoader.h"
+#include "FeatureCache.h"
+#include "ProgramCache.h"
+#include "Trace.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace AutoBug
+{
+
+// 每次读取都比较的已读内容的长度,发现末尾附近的改写
+static const size_t TAIL_BYTES = 1 << 16;
+
+// 每次读取的字节数,一行更长时加倍
+static const size_t CHUNK_BYTES = 1 << 20;
+
+Follower::~Follower() noexcept
+{
+    if (m_inotify >= 0)
+        close(m_inotify);
+}
+
+/*******************************************
+ * @brief 创建跟踪器
+ * @param[in] file 文件名
+ * @param[in] offset 已经处理过的字节数,必须是一行的开头
+ * ****************************************/
+Follower::Follower(const char* file, uint64_t offset) noexcept :
+    m_file(file),
+    m_offset(offset),
+    m_inode(0),
+    m_hash(ProgramCache::FNV_OFFSET),
+    m_hashed(offset == 0),
+    m_verify(false),
+    m_size(0),
+    m_mtime(0),
+    m_inotify(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+    m_watch(-1),
+    m_buffer(CHUNK_BYTES)
+{
+    m_watchFile();
+}
+
+/*******************************************
+ * @brief 从指定的位置重新开始,下次读取时计算之前
+ *        内容的哈希
+ * @param[in] offset 位置,必须是一行的开头
+ * ****************************************/
+void Follower::seek(uint64_t offset) noexcept
+{
+    seek(offset, ProgramCache::FNV_OFFSET);
+    m_hashed = offset == 0;
+}
+
+/*******************************************
+ * @brief 从指定的位置重新开始,使用已知的哈希
+ * @param[in] offset 位置,必须是一行的开头
+ * @param[in] hash 之前内容的哈希,例如FeatureCache::hash()
+ * ****************************************/
+void Follower::seek(uint64_t offset, uint64_t hash) noexcept
+{
+    m_offset = offset;
+    m_inode = 0;
+    m_hash = hash;
+    m_hashed = true;
+    m_verify = false;
+    m_tail.clear();
+}
+
+/*******************************************
+ * @brief 获取已经处理过的字节数
+ * @return 字节数
+ * ****************************************/
+uint64_t Follower::offset() const noexcept
+{
+    return m_offset;
+}
+
+/*******************************************
+ * @brief 读取新追加的完整行,解析成样本追加到样本
+ *        集;没有换行结尾的最后一行留到下次读取,
+ *        非法的UTF-8行被跳过
+ * @param[in] dimMap 超空间维度映射
+ * @param[out] data 样本集
+ * @param[in] maxRows 最多读取的样本数量
+ * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+ * @return 新样本的数量,文件被截断、替换或改写时回到开头
+ *         并返回-1
+ * ****************************************/
+int Follower::read(const DimMap& dimMap, std::vector<Text>& data, size_t maxRows, Arena* arena) noexcept
+{
+    TRACE_SCOPE("Follower::read");
+    if (m_watch < 0)
+        m_watchFile();
+
+    // 轮转期间文件可能暂时不存在,下次再读
+    int fd = open(m_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    struct stat info;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = ProgramCache::FNV_OFFSET;
+    std::string tail;
+    size_t used = 0;
+    size_t invalid = 0;
+    int rows = 0;
+    bool reset = false;
+
+    if (fstat(fd, &info) != 0)
+        goto EXIT;
+
+    size = static_cast<uint64_t>(info.st_size);
+    mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    reset = (m_inode != 0 && static_cast<uint64_t>(info.st_ino) != m_inode) || size < m_offset;
+
+    // 每次都比较已读内容的最后一段,第一次读取时信任调用者给出的位置
+    if (!reset && m_tail.size() == (m_offset < TAIL_BYTES ? m_offset : TAIL_BYTES))
+    {
+        tail.resize(m_tail.size());
+        reset = pread(fd, &tail[0], tail.size(), m_offset - tail.size()) != static_cast<ssize_t>(tail.size()) || tail != m_tail;
+    }
+    else if (!reset)
+    {
+        m_tail.resize(m_offset < TAIL_BYTES ? m_offset : TAIL_BYTES);
+        if (pread(fd, &m_tail[0], m_tail.size(), m_offset - m_tail.size()) != static_cast<ssize_t>(m_tail.size()))
+            goto EXIT;
+    }
+
+    // 大小不变而修改时间变化,或者wait之后第一次有新内容时检查全部已读内容,
+    // 连续读取一批批新内容时不再重复计算
+    if (!reset && (!m_hashed || (m_inode != 0 && size == m_size && mtime != m_mtime) || (m_verify && size > m_offset)))
+    {
+        if (!FeatureCache::hashFile(fd, 0, m_offset, hash))
+            goto EXIT;
+        reset = m_hashed && hash != m_hash;
+        m_hash = hash;
+        m_hashed = true;
+        m_verify = false;
+    }
+
+    if (reset)
+    {
+        if (m_inode != 0 && static_cast<uint64_t>(info.st_ino) != m_inode)
+            m_watchFile();
+        seek(0);
+        rows = -1;
+        goto EXIT;
+    }
+    m_inode = static_cast<uint64_t>(info.st_ino);
+    m_size = size;
+    m_mtime = mtime;
+
+    while (static_cast<size_t>(rows) < maxRows)
+    {
+        ssize_t n = pread(fd, m_buffer.data() + used, m_buffer.size() - used, m_offset + used);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        used += n;
+
+        // 逐行解析,只有完整的行才算处理过
+        size_t consumed = 0;
+        while (static_cast<size_t>(rows) < maxRows)
+        {
+            const char* begin = m_buffer.data() + consumed;
+            const char* newline = static_cast<const char*>(memchr(begin, '\n', used - consumed));
+            if (newline == nullptr)
+                break;
+
+            std::string line = DataLoader::trimSpace(std::string(begin, newline - begin));
+            consumed = newline - m_buffer.data() + 1;
+            if (line.empty())
+                continue;
+
+            Text text{0, arena};
+            if (!text.setText(line, dimMap))
+            {
+                invalid++;
+                continue;
+            }
+            data.push_back(std::move(text));
+            rows++;
+        }
+
+        m_hash = ProgramCache::hash(m_buffer.data(), consumed, m_hash);
+        if (consumed >= TAIL_BYTES)
+        {
+            m_tail.assign(m_buffer.data() + consumed - TAIL_BYTES, TAIL_BYTES);
+        }
+        else
+        {
+            m_tail.append(m_buffer.data(), consumed);
+            if (m_tail.size() > TAIL_BYTES)
+                m_tail.erase(0, m_tail.size() - TAIL_BYTES);
+        }
+        m_offset += consumed;
+        used -= consumed;
+        if (used > 0)
+            memmove(m_buffer.data(), m_buffer.data() + consumed, used);
+        if (used == m_buffer.size())
+            m_buffer.resize(m_buffer.size() * 2);
+    }
+
+EXIT:
+    close(fd);
+    if (invalid > 0)
+        fprintf(stderr, "skipped %zu lines of invalid UTF-8 in %s\n", invalid, m_file.c_str());
+    return rows;
+}
+
+/*******************************************
+ * @brief 等待文件变化,收到信号时提前返回;之后第一次
+ *        有新内容时检查全部已读内容
+ * @param[in] timeout 最多等待的毫秒数
+ * ****************************************/
+void Follower::wait(int timeout) noexcept
+{
+    m_verify = true;
+    if (m_inotify < 0 || m_watch < 0)
+    {
+        poll(nullptr, 0, timeout);
+        return;
+    }
+
+    struct pollfd fds;
+    fds.fd = m_inotify;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (poll(&fds, 1, timeout) <= 0)
+        return;
+
+    // 只关心有没有变化,丢弃所有事件;文件被移走或删除后监视失效
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = ::read(m_inotify, events, sizeof(events))) > 0)
+    {
+        for (char* p = events; p < events + n;)
+        {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            if (event->mask & IN_IGNORED)
+                m_watch = -1;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/*******************************************
+ * @brief 监视当前路径上的文件,文件被替换后需要
+ *        重新监视
+ * ****************************************/
+void Follower::m_watchFile() noexcept
+{
+    if (m_inotify < 0)
+        return;
+
+    if (m_watch >= 0)
+        inotify_rm_watch(m_inotify, m_watch);
+    m_watch = inotify_add_watch(m_inotify, m_file.c_str(), IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef AUTO_BUG_FOLLOWER_H
+#define AUTO_BUG_FOLLOWER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DimMap.h"
+#include "Text.h"
+#include "Arena.h"
+
+namespace AutoBug
+{
+
+/* 跟踪只在末尾追加的文件,每次只读取新追加的完整行;
+ * 通过inotify等待文件变化,不可用时按间隔轮询
+ *
+ * 记住已经读取的位置、已读内容的哈希和最后一段内容。
+ * 每次读取只检查inode、大小和这段内容,大小不变而修改
+ * 时间变化,或者每次wait之后第一次有新内容时,重新计算
+ * 已读部分的哈希;文件被截断、替换或者已读部分被改写
+ * 时从头开始 */
+class Follower
+{
+public:
+    ~Follower() noexcept;
+
+    /*******************************************
+     * @brief 创建跟踪器
+     * @param[in] file 文件名
+     * @param[in] offset 已经处理过的字节数,必须是一行的开头
+     * ****************************************/
+    Follower(const char* file, uint64_t offset = 0) noexcept;
+
+    Follower(const Follower&) = delete;
+    Follower& operator = (const Follower&) = delete;
+
+    /*******************************************
+     * @brief 从指定的位置重新开始,下次读取时计算之前
+     *        内容的哈希
+     * @param[in] offset 位置,必须是一行的开头
+     * ****************************************/
+    void seek(uint64_t offset) noexcept;
+
+    /*******************************************
+     * @brief 从指定的位置重新开始,使用已知的哈希
+     * @param[in] offset 位置,必须是一行的开头
+     * @param[in] hash 之前内容的哈希,例如FeatureCache::hash()
+     * ****************************************/
+    void seek(uint64_t offset, uint64_t hash) noexcept;
+
+    /*******************************************
+     * @brief 获取已经处理过的字节数
+     * @return 字节数
+     * ****************************************/
+    uint64_t offset() const noexcept;
+
+    /*******************************************
+     * @brief 读取新追加的完整行,解析成样本追加到样本
+     *        集;没有换行结尾的最后一行留到下次读取,
+     *        非法的UTF-8行被跳过
+     * @param[in] dimMap 超空间维度映射
+     * @param[out] data 样本集
+     * @param[in] maxRows 最多读取的样本数量
+     * @param[in] arena 存放样本坐标的内存池,nullptr表示使用堆内存
+     * @return 新样本的数量,文件被截断、替换或改写时回到开头
+     *         并返回-1
+     * ****************************************/
+    int read(const DimMap& dimMap, std::vector<Text>& data, size_t maxRows, Arena* arena=nullptr) noexcept;
+
+    /*******************************************
+     * @brief 等待文件变化,收到信号时提前返回;之后第一次
+     *        有新内容时检查全部已读内容
+     * @param[in] timeout 最多等待的毫秒数
+     * ****************************************/
+    void wait(int timeout) noexcept;
+
+private:
+    std::string m_file;
+    uint64_t m_offset;
+    uint64_t m_inode;           // 正在跟踪的文件,0表示未知
+    uint64_t m_hash;            // [0, m_offset)内容的哈希
+    bool m_hashed;              // m_hash是否已知
+    bool m_verify;              // 下次有新内容时重新计算已读部分的哈希
+    uint64_t m_size;            // 上次读取时文件的大小
+    int64_t m_mtime;            // 上次读取时文件的修改时间,纳秒
+    std::string m_tail;         // m_offset之前的一段内容,每次读取都比较
+    int m_inotify;
+    int m_watch;
+    std::vector<char> m_buffer;
+
+    /*******************************************
+     * @brief 监视当前路径上的文件,文件被替换后需要
+     *        重新监视
+     * ****************************************/
+    void m_watchFile() noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_FOLLOWER_H
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "Future.h"
+#include <cstdio>
+
+namespace AutoBug
+{
+
+/* 所有副本共享的状态 */
+struct Future::State
+{
+    cl_event event;
+    std::function<void()> finish;
+    bool done;
+    bool success;
+
+    ~State() noexcept
+    {
+        // 有完成函数时必须等待,否则只释放事件,不阻塞
+        if (finish)
+        {
+            complete();
+        }
+        else if (event != nullptr)
+        {
+            clReleaseEvent(event);
+        }
+    }
+
+    /*******************************************
+     * @brief 等待事件完成,释放事件并执行完成函数,
+     *        只执行一次
+     * @return 操作是否成功
+     * ****************************************/
+    bool complete() noexcept
+    {
+        if (done)
+            return success;
+
+        done = true;
+        if (event != nullptr)
+        {
+            cl_int status = CL_COMPLETE;
+            int state = clWaitForEvents(1, &event);
+            if (state == CL_SUCCESS)
+                state = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+            if (state != CL_SUCCESS || status < 0)
+            {
+                fprintf(stderr, "failed to wait for event\n");
+                success = false;
+            }
+            clReleaseEvent(event);
+            event = nullptr;
+        }
+
+        if (finish)
+            finish();
+        return success;
+    }
+};
+
+/*******************************************
+ * @brief 创建一个失败的结果
+ * @return 失败的结果
+ * ****************************************/
+Future Future::failed() noexcept
+{
+    Future future;
+    future.m_state->success = false;
+    return future;
+}
+
+/*******************************************
+ * @brief 等待一组结果全部完成
+ * @param[in] futures 结果列表
+ * @return 是否全部成功
+ * ****************************************/
+bool Future::waitAll(const std::vector<Future>& futures) noexcept
+{
+    bool success = true;
+    for (auto& future : futures)
+    {
+        success = future.wait() && success;
+    }
+    return success;
+}
+
+/*******************************************
+ * @brief 获取一组结果的事件,作为排队命令的依赖
+ * @param[in] futures 结果列表
+ * @return 事件列表,已完成或没有事件的结果不包含在内
+ * ****************************************/
+std::vector<cl_event> Future::events(const std::vector<Future>& futures) noexcept
+{
+    std::vector<cl_event> events;
+    for (auto& future : futures)
+    {
+        cl_event event = future.event();
+        if (event != nullptr)
+            events.push_back(event);
+    }
+    return events;
+}
+
+Future::Future() noexcept :
+    Future(nullptr)
+{
+
+}
+
+Future::Future(cl_event event, std::function<void()> finish) noexcept :
+    m_state(std::make_shared<State>())
+{
+    m_state->event = event;
+    m_state->finish = std::move(finish);
+    m_state->done = (event == nullptr && !m_state->finish);
+    m_state->success = true;
+}
+
+/*******************************************
+ * @brief 排队是否成功
+ * @return 是否成功
+ * ****************************************/
+bool Future::valid() const noexcept
+{
+    return m_state->success;
+}
+
+/*******************************************
+ * @brief 查询是否已经完成,不阻塞
+ * @return 是否已经完成
+ * ****************************************/
+bool Future::ready() const noexcept
+{
+    if (m_state->done || m_state->event == nullptr)
+        return true;
+
+    cl_int status = CL_COMPLETE;
+    int state = clGetEventInfo(m_state->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+    return state != CL_SUCCESS || status == CL_COMPLETE || status < 0;
+}
+
+/*******************************************
+ * @brief 等待完成
+ * @return 操作是否成功
+ * ****************************************/
+bool Future::wait() const noexcept
+{
+    return m_state->complete();
+}
+
+/*******************************************
+ * @brief 获取事件
+ * @return 事件,已完成或没有事件时为nullptr
+ * ****************************************/
+cl_event Future::event() const noexcept
+{
+    return m_state->event;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef AUTO_BUG_FUTURE_H
+#define AUTO_BUG_FUTURE_H
+
+#ifndef CL_HPP_TARGET_OPENCL_VERSION
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#endif // CL_HPP_TARGET_OPENCL_VERSION
+#include <CL/cl2.hpp>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace AutoBug
+{
+
+/* 一个异步操作的结果,由OpenCL事件表示,可以复制,
+ * 所有副本共享同一个事件 */
+class Future
+{
+public:
+    /*******************************************
+     * @brief 创建一个失败的结果
+     * @return 失败的结果
+     * ****************************************/
+    static Future failed() noexcept;
+
+    /*******************************************
+     * @brief 等待一组结果全部完成
+     * @param[in] futures 结果列表
+     * @return 是否全部成功
+     * ****************************************/
+    static bool waitAll(const std::vector<Future>& futures) noexcept;
+
+    /*******************************************
+     * @brief 获取一组结果的事件,作为排队命令的依赖
+     * @param[in] futures 结果列表
+     * @return 事件列表,已完成或没有事件的结果不包含在内
+     * ****************************************/
+    static std::vector<cl_event> events(const std::vector<Future>& futures) noexcept;
+
+    ~Future() noexcept = default;
+
+    /*******************************************
+     * @brief 创建一个已经完成的结果
+     * ****************************************/
+    Future() noexcept;
+
+    /*******************************************
+     * @brief 创建一个结果,接管事件的引用
+     * @param[in] event 事件,可以为nullptr表示已经完成
+     * @param[in] finish 完成后在等待的线程上执行一次,
+     *                   用于归还临时缓存等;有完成函数时
+     *                   最后一个副本析构前会先等待完成,
+     *                   否则析构不阻塞
+     * ****************************************/
+    explicit Future(cl_event event, std::function<void()> finish = nullptr) noexcept;
+
+    Future(const Future&) = default;
+    Future(Future&&) = default;
+    Future& operator = (const Future&) = default;
+    Future& operator = (Future&&) = default;
+
+    /*******************************************
+     * @brief 排队是否成功
+     * @return 是否成功
+     * ****************************************/
+    bool valid() const noexcept;
+
+    /*******************************************
+     * @brief 查询是否已经完成,不阻塞
+     * @return 是否已经完成
+     * ****************************************/
+    bool ready() const noexcept;
+
+    /*******************************************
+     * @brief 等待完成
+     * @return 操作是否成功
+     * ****************************************/
+    bool wait() const noexcept;
+
+    /*******************************************
+     * @brief 获取事件
+     * @return 事件,已完成或没有事件时为nullptr
+     * ****************************************/
+    cl_event event() const noexcept;
+
+private:
+    struct State;
+    std::shared_ptr<State> m_state;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_FUTURE_H
\ No newline at end of file
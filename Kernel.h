@@ -0,0 +1,276 @@
+#ifndef AUTO_BUG_KERNEL_H
+#define AUTO_BUG_KERNEL_H
+
+#include "Accelerator.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace AutoBug
+{
+
+/* 核函数的__local参数,只指定字节数 */
+struct LocalMemory
+{
+    size_t bytes;
+};
+
+/* 参数类型确定的核函数,创建时解析一次,参数在调用时按类型
+ * 检查,与上次绑定的值相同时不再重复设置 */
+template <typename... Args>
+class Kernel
+{
+public:
+    ~Kernel() noexcept
+    {
+        m_release();
+    }
+
+    Kernel() noexcept :
+        m_gpu(nullptr),
+        m_kernel(nullptr),
+        m_bound()
+    {
+
+    }
+
+    /*******************************************
+     * @brief 创建核函数,检查参数数量与核函数的声明一致
+     * @param[in] gpu 加速器
+     * @param[in] name 核函数的名字
+     * @param[in] options 构建选项,为空时使用通用程序
+     * ****************************************/
+    Kernel(Accelerator& gpu, const std::string& name, const std::string& options = "") noexcept :
+        m_gpu(&gpu),
+        m_kernel(gpu.createKernel(name, options)),
+        m_bound()
+    {
+        if (m_kernel == nullptr)
+            return;
+
+        cl_uint argc = 0;
+        int state = clGetKernelInfo(m_kernel, CL_KERNEL_NUM_ARGS, sizeof(argc), &argc, nullptr);
+        if (state == CL_SUCCESS && argc != sizeof...(Args))
+        {
+            fprintf(stderr, "kernel %s takes %u args but is declared with %zu\n", name.c_str(), argc, sizeof...(Args));
+            clReleaseKernel(m_kernel);
+            m_kernel = nullptr;
+        }
+    }
+
+    Kernel(const Kernel&) = delete;
+    Kernel& operator = (const Kernel&) = delete;
+
+    Kernel(Kernel&& src) noexcept :
+        m_gpu(src.m_gpu),
+        m_kernel(src.m_kernel),
+        m_args(src.m_args)
+    {
+        memcpy(m_bound, src.m_bound, sizeof(m_bound));
+        src.m_kernel = nullptr;
+    }
+
+    Kernel& operator = (Kernel&& src) noexcept
+    {
+        if (this != &src)
+        {
+            m_release();
+            m_gpu = src.m_gpu;
+            m_kernel = src.m_kernel;
+            m_args = src.m_args;
+            memcpy(m_bound, src.m_bound, sizeof(m_bound));
+            src.m_kernel = nullptr;
+        }
+        return *this;
+    }
+
+    /*******************************************
+     * @brief 检查核函数是否可用
+     * @return 是否可用
+     * ****************************************/
+    bool valid() const noexcept
+    {
+        return m_kernel != nullptr;
+    }
+
+    /*******************************************
+     * @brief 获取OpenCL核函数对象
+     * @return 核函数对象
+     * ****************************************/
+    cl_kernel handle() const noexcept
+    {
+        return m_kernel;
+    }
+
+    /*******************************************
+     * @brief 绑定全部参数,只设置发生变化的参数
+     * @param[in] args 参数
+     * @return 是否成功
+     * ****************************************/
+    bool bind(const Args&... args) noexcept
+    {
+        return m_kernel != nullptr && m_bind<0>(args...);
+    }
+
+    /*******************************************
+     * @brief 绑定一个参数
+     * @param[in] arg 第I个参数
+     * @return 是否成功
+     * ****************************************/
+    template <size_t I>
+    bool bind(const typename std::tuple_element<I, std::tuple<Args...>>::type& arg) noexcept
+    {
+        return m_kernel != nullptr && m_bindArg<I>(arg);
+    }
+
+    /*******************************************
+     * @brief 设置每次调用的计算量和必须的访存量,
+     *        性能分析时用于计算GFLOP/s和GB/s
+     * @param[in] flops 浮点运算次数
+     * @param[in] bytes 读写的字节数
+     * ****************************************/
+    void setWork(double flops, double bytes) const noexcept
+    {
+        if (m_kernel != nullptr)
+            m_gpu->setWork(m_kernel, flops, bytes);
+    }
+
+    /*******************************************
+     * @brief 用已绑定的参数调用核函数
+     * @param[in] localSize 一组工作项的数量
+     * @param[in] globalSize 总工作项的数量
+     * @param[in] deps 依赖的结果
+     * @return 结果
+     * ****************************************/
+    Future launch(size_t localSize, size_t globalSize, const std::vector<Future>& deps = {}) const noexcept
+    {
+        return launch(1, &localSize, &globalSize, deps);
+    }
+
+    /*******************************************
+     * @brief 用已绑定的参数调用多维的核函数
+     * @param[in] workDim 维数
+     * @param[in] localSize 每一维一组工作项的数量
+     * @param[in] globalSize 每一维总工作项的数量
+     * @param[in] deps 依赖的结果
+     * @return 结果
+     * ****************************************/
+    Future launch(cl_uint workDim, const size_t* localSize, const size_t* globalSize, const std::vector<Future>& deps = {}) const noexcept
+    {
+        if (m_kernel == nullptr)
+            return Future::failed();
+
+        for (size_t i = 0; i < sizeof...(Args); i++)
+        {
+            if (!m_bound[i])
+            {
+                fprintf(stderr, "kernel arg %zu is not bound\n", i);
+                return Future::failed();
+            }
+        }
+
+        return m_gpu->invokeAsync(m_kernel, workDim, localSize, globalSize, deps);
+    }
+
+    /*******************************************
+     * @brief 绑定全部参数并调用核函数
+     * @param[in] localSize 一组工作项的数量
+     * @param[in] globalSize 总工作项的数量
+     * @param[in] args 参数
+     * @return 结果
+     * ****************************************/
+    Future operator () (size_t localSize, size_t globalSize, const Args&... args) noexcept
+    {
+        if (!bind(args...))
+            return Future::failed();
+        return launch(localSize, globalSize);
+    }
+
+private:
+    const Accelerator* m_gpu;
+    cl_kernel m_kernel;
+    std::tuple<Args...> m_args;         // 最近一次绑定的参数
+    bool m_bound[sizeof...(Args) + 1];  // 各参数是否已绑定
+
+    void m_release() noexcept
+    {
+        if (m_kernel == nullptr)
+            return;
+
+        // 句柄可能被新的核函数复用,先删除性能分析中的工作量
+        m_gpu->setWork(m_kernel, 0, 0);
+        clReleaseKernel(m_kernel);
+        m_kernel = nullptr;
+    }
+
+    template <size_t I>
+    bool m_bind() noexcept
+    {
+        return true;
+    }
+
+    template <size_t I, typename T, typename... Rest>
+    bool m_bind(const T& arg, const Rest&... rest) noexcept
+    {
+        return m_bindArg<I>(arg) && m_bind<I + 1>(rest...);
+    }
+
+    template <size_t I, typename T>
+    bool m_bindArg(const T& arg) noexcept
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "kernel args must be trivially copyable");
+
+        T& cached = std::get<I>(m_args);
+        if (m_bound[I] && m_same(cached, arg))
+            return true;
+
+        m_bound[I] = m_set(I, arg);
+        if (m_bound[I])
+            cached = arg;
+        return m_bound[I];
+    }
+
+    template <typename T>
+    static bool m_same(const T& x, const T& y) noexcept
+    {
+        return memcmp(&x, &y, sizeof(T)) == 0;
+    }
+
+    static bool m_same(const LocalMemory& x, const LocalMemory& y) noexcept
+    {
+        return x.bytes == y.bytes;
+    }
+
+    template <typename T>
+    bool m_set(size_t i, const T& arg) const noexcept
+    {
+        return m_gpu->setArg(m_kernel, i, &arg, sizeof(T));
+    }
+
+    bool m_set(size_t i, const LocalMemory& arg) const noexcept
+    {
+        return m_gpu->setArg(m_kernel, i, nullptr, arg.bytes);
+    }
+};
+
+/* kernel.cl中各核函数的参数类型 */
+typedef Kernel<cl_mem, cl_mem, cl_mem> ScalarKernel;                                        // add, sub, mul, div
+typedef Kernel<cl_mem, cl_mem, cl_mem, cl_mem, int, int, int> FindNearestKernel;            // findNearest, findNearestTiled
+typedef Kernel<cl_mem, cl_mem, cl_mem, cl_mem, int, int, int, int> FindNearestStrideKernel; // findNearestU8, findNearestHalf
+typedef Kernel<cl_mem, cl_mem, cl_mem, cl_mem, int, int, int, int> SumPointsKernel;         // sumPoints
+typedef Kernel<cl_mem, cl_mem, cl_mem, cl_mem, int, int, int, int, int> SumPointsStrideKernel; // sumPointsU8, sumPointsHalf
+typedef Kernel<cl_mem, cl_mem, cl_mem, cl_mem, int, int, int> MergePointsKernel;            // mergePoints, foldPoints
+typedef Kernel<cl_mem, cl_mem, cl_mem, LocalMemory, LocalMemory, int, int> ReseedPointsKernel; // reseedPoints
+typedef Kernel<cl_mem, cl_mem, LocalMemory, int> ReduceStage1Kernel;                        // reduceStage1
+typedef Kernel<cl_mem, cl_mem, LocalMemory, int, int, int> ReduceStage2Kernel;              // reduceStage2
+typedef Kernel<cl_mem, cl_mem, cl_mem, LocalMemory, int> DistanceStage1Kernel;              // distanceStage1
+typedef Kernel<cl_mem, cl_mem, cl_mem, LocalMemory, int, int> DistanceBatchKernel;          // distanceBatch
+typedef Kernel<cl_mem, cl_mem, cl_mem, LocalMemory, LocalMemory, int, int, int> DistanceMatrixKernel; // distanceMatrix
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_KERNEL_H
\ No newline at end of file
@@ -1,21 +1,29 @@
 #include "Kmeans.h"
 #include "Accelerator.h"
+#include "Kernel.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
 
 namespace AutoBug
 {
 
 Kmeans::Kmeans() noexcept :
-    m_k(0)
+    m_k(0),
+    m_inertia(0.0f),
+    m_storage(QuantizedSet::NONE),
+    m_decision()
 {
 
 }
 
 Kmeans::Kmeans(const std::vector<Text>& dataset, size_t k) noexcept :
     m_k(k),
-    m_dataset(dataset)
+    m_inertia(0.0f),
+    m_storage(QuantizedSet::NONE),
+    m_decision()
 {
-    m_groupCenters.resize(m_k);
-    m_groups.resize(m_k);
+    setData(dataset);
 }
 
 /*******************************************
@@ -24,7 +32,23 @@ Kmeans::Kmeans(const std::vector<Text>& dataset, size_t k) noexcept :
  * ****************************************/
 void Kmeans::setData(const std::vector<Text>& dataset) noexcept
 {
-    m_dataset = dataset;
+    // 旧的样本和中心点都在内存池中,先清空再整体回收
+    m_dataset.clear();
+    m_groupCenters.clear();
+    m_groups.clear();
+    m_assignment.clear();
+    m_counts.clear();
+    m_inertia = 0.0f;
+    m_arena.reset();
+
+    m_dataset.reserve(dataset.size());
+    for (auto& item : dataset)
+    {
+        m_dataset.emplace_back(item, &m_arena);
+    }
+    m_groupCenters.resize(m_k);
+    m_groups.resize(m_k);
+    m_quantized.build(m_dataset, m_storage);
 }
 
 /*******************************************
@@ -38,22 +62,69 @@ void Kmeans::setGroupCount(size_t k) noexcept
     m_groups.resize(m_k);
 }
 
+/*******************************************
+ * @brief 设置样本的存储格式,量化后分配样本时使用
+ *        紧凑存储,中心点仍然使用float
+ * @param[in] format 存储格式
+ * ****************************************/
+void Kmeans::setStorage(QuantizedSet::Format format) noexcept
+{
+    m_storage = format;
+    m_quantized.build(m_dataset, m_storage);
+}
+
+/*******************************************
+ * @brief 设置使用的加速器,样本按计算单元数量分配到
+ *        各个设备,默认使用Accelerator::devices()
+ * @param[in] devices 加速器列表
+ * ****************************************/
+void Kmeans::setDevices(const std::vector<Accelerator*>& devices) noexcept
+{
+    m_devices = devices;
+}
+
 /*******************************************
      * @brief 进行学习
      * @param[in] n 学习轮次
      * ****************************************/
 void Kmeans::learn(int n) noexcept
 {
-    if (m_dataset.size() > 100 && Accelerator::instance().available())
+    TRACE_SCOPE("Kmeans::learn");
+    bool available = false;
+    for (auto gpu : m_devices.empty() ? Accelerator::devices() : m_devices)
+    {
+        available = available || gpu->available();
+    }
+
+    // 根据校准的开销模型选择后端
+    int dims = m_dataset.empty() ? 0 : m_dataset[0].dims();
+    size_t sampleBytes = m_quantized.rows() > 0 ? m_quantized.bytes() / m_quantized.rows() : sizeof(float) * dims;
+    auto& dispatcher = Dispatcher::instance();
+    m_decision = dispatcher.choose(m_dataset.size(), dims, m_k, n, sampleBytes, available);
+
+    if (m_decision.backend == Dispatcher::OPENCL)
     {
         m_gpuLearn(n);
     }
+    else if (m_decision.backend == Dispatcher::CPU_THREADED)
+    {
+        m_cpuLearn(n, dispatcher.threads());
+    }
     else
     {
-        m_cpuLearn(n);
+        m_cpuLearn(n, 1);
     }
 }
 
+/*******************************************
+ * @brief 获取最近一次学习选择的计算后端
+ * @return 选择的结果,可以通过Dispatcher::describe输出
+ * ****************************************/
+const Dispatcher::Decision& Kmeans::decision() noexcept
+{
+    return m_decision;
+}
+
 /*******************************************
  * @brief 打印学习后的各个分组
  * ****************************************/
@@ -93,16 +164,142 @@ Text Kmeans::groupCenter(size_t idx) noexcept
  * @param[in] idx 分组序号
  * @return 分组的数据
  * ****************************************/
-std::vector<Text> Kmeans::group(size_t idx) noexcept
+const std::vector<Text>& Kmeans::group(size_t idx) noexcept
 {
     return m_groups[idx];
 }
 
+/*******************************************
+ * @brief 获取指定分组的样本数量
+ * @param[in] idx 分组序号
+ * @return 样本数量,为0表示该分组为空
+ * ****************************************/
+size_t Kmeans::groupSize(size_t idx) noexcept
+{
+    return idx < m_counts.size() ? m_counts[idx] : 0;
+}
+
+/*******************************************
+ * @brief 获取样本所属的分组
+ * @param[in] idx 样本序号
+ * @return 分组序号
+ * ****************************************/
+size_t Kmeans::assignment(size_t idx) noexcept
+{
+    return m_assignment[idx];
+}
+
+/*******************************************
+ * @brief 获取空分组的数量
+ * @return 空分组的数量
+ * ****************************************/
+size_t Kmeans::emptyGroups() noexcept
+{
+    size_t n = 0;
+    for (auto count : m_counts)
+    {
+        if (count == 0)
+            n += 1;
+    }
+    return n;
+}
+
+/*******************************************
+ * @brief 获取最后一轮划分的误差,即所有样本到所属
+ *        分组中心距离的平方和
+ * @return 误差
+ * ****************************************/
+float Kmeans::inertia() noexcept
+{
+    return m_inertia;
+}
+
+/*******************************************
+ * @brief 按照样本的分组索引生成各个分组
+ * ****************************************/
+void Kmeans::m_buildGroups() noexcept
+{
+    for (size_t i = 0; i < m_groups.size(); i++)
+    {
+        m_groups[i].clear();
+    }
+
+    for (size_t i = 0; i < m_assignment.size(); i++)
+    {
+        m_groups[m_assignment[i]].emplace_back(m_dataset[i], &m_arena);
+    }
+}
+
+/*******************************************
+ * @brief 修复空分组:每个空分组依次取走当前距离最大
+ *        的样本,该样本原来的分组至少还剩一个样本;
+ *        同时更新分组索引、样本数量和误差
+ * @param[in,out] distances 各样本到所属中心距离的平方,取走的样本置0
+ * @return 取走的样本序号及其原来的分组
+ * ****************************************/
+std::vector<std::pair<size_t, size_t>> Kmeans::m_reseed(std::vector<float>& distances) noexcept
+{
+    std::vector<std::pair<size_t, size_t>> moved;
+    std::vector<size_t> empty;
+    for (size_t group = 0; group < m_k; group++)
+    {
+        if (m_counts[group] == 0)
+            empty.push_back(group);
+    }
+    if (empty.empty())
+        return moved;
+
+    // 距离从大到小,相同时序号小的优先,与reseedPoints核函数一致;
+    // 通常只需要排在前面的少量样本,不够时再排序其余部分
+    std::vector<size_t> order(distances.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    auto farther = [&distances](size_t x, size_t y) -> bool {
+        return distances[x] > distances[y] || (distances[x] == distances[y] && x < y);
+    };
+    size_t sorted = std::min(order.size(), std::max<size_t>(empty.size() * 4, 64));
+    std::partial_sort(order.begin(), order.begin() + sorted, order.end(), farther);
+
+    size_t next = 0;
+    for (auto group : empty)
+    {
+        // 只有1个样本的分组不能取走,它不会再变大,跳过即可
+        while (next < order.size())
+        {
+            if (next == sorted)
+            {
+                std::sort(order.begin() + sorted, order.end(), farther);
+                sorted = order.size();
+            }
+            if (m_counts[m_assignment[order[next]]] > 1)
+                break;
+            next++;
+        }
+        if (next == order.size())
+            break;
+
+        size_t sample = order[next++];
+        size_t from = m_assignment[sample];
+        m_counts[from] -= 1;
+        m_counts[group] = 1;
+        m_assignment[sample] = group;
+        m_inertia -= distances[sample];
+        distances[sample] = 0.0f;
+        moved.emplace_back(sample, from);
+    }
+
+    TRACE_COUNT("kmeans.reseeds", moved.size());
+    return moved;
+}
+
 /*******************************************
  * @brief 通过CPU进行学习
  * @param[in] round 学习轮次
+ * @param[in] threads 线程数量
  * ****************************************/
-void Kmeans::m_cpuLearn(int round) noexcept
+void Kmeans::m_cpuLearn(int round, size_t threads) noexcept
 {
     int dims = m_dataset[0].dims();
 
@@ -110,55 +307,144 @@ void Kmeans::m_cpuLearn(int round) noexcept
     size_t step = m_dataset.size() / m_k;
     for (size_t i = 0; i < m_k; i++)
     {
-        m_groupCenters[i] = m_dataset[i * step];
+        m_groupCenters[i] = Text{m_dataset[i * step], &m_arena};
     }
 
+    bool quantized = m_quantized.format() != QuantizedSet::NONE;
+    std::vector<float> centers;     // 量化时中心点按行连续存放
+    std::vector<float> norms;
+    std::vector<float> distances(m_dataset.size());
+    m_assignment.assign(m_dataset.size(), 0);
+    std::vector<size_t>& counts = m_counts;
     for (int n = 0; n < round; n++)
     {
-        // 清空上次的分组
-        for (size_t i = 0; i < m_groups.size(); i++)
+        TRACE_SCOPE("Kmeans::cpuRound");
+        TRACE_COUNT("kmeans.iterations", 1);
+        TRACE_COUNT("kmeans.distances", m_dataset.size() * m_k);
+        if (quantized)
         {
-            m_groups[i].clear();
+            centers.resize(m_k * dims);
+            norms.assign(m_k, 0.0f);
+            for (size_t group = 0; group < m_k; group++)
+            {
+                float* center = centers.data() + group * dims;
+                memcpy(center, m_groupCenters[group].pos(), sizeof(float) * dims);
+                for (int i = 0; i < dims; i++)
+                {
+                    norms[group] += center[i] * center[i];
+                }
+            }
         }
 
-        // 将所有样本划分到距离最近的中心点
-        for (size_t sample = 0; sample < m_dataset.size(); sample++)
-        {
-            auto& s = m_dataset[sample];
-            size_t groupId = 0;
-            for (size_t group = 1; group < m_k; group++)
+        // 将所有样本划分到距离最近的中心点,样本按线程分段
+        Dispatcher::parallel(m_dataset.size(), threads, [&](size_t, size_t first, size_t last) {
+            for (size_t sample = first; sample < last; sample++)
             {
-                auto& g0 = m_groupCenters[groupId];
-                auto& g1 = m_groupCenters[group];
-                if (s.distance(g1) < s.distance(g0))
+                if (quantized)
+                {
+                    m_assignment[sample] = m_quantized.nearest(sample, centers.data(), norms.data(), m_k, &distances[sample]);
+                    continue;
+                }
+
+                auto& s = m_dataset[sample];
+                size_t groupId = 0;
+                float nearest = s.distance(m_groupCenters[0]);
+                for (size_t group = 1; group < m_k; group++)
                 {
-                    groupId = group;
+                    float d = s.distance(m_groupCenters[group]);
+                    if (d < nearest)
+                    {
+                        groupId = group;
+                        nearest = d;
+                    }
                 }
+                m_assignment[sample] = groupId;
+                distances[sample] = nearest * nearest;
             }
-            m_groups[groupId].push_back(s);
+        });
+
+        // 按样本顺序统计,结果与线程数量无关
+        counts.assign(m_k, 0);
+        m_inertia = 0.0f;
+        for (size_t sample = 0; sample < m_dataset.size(); sample++)
+        {
+            counts[m_assignment[sample]] += 1;
+            m_inertia += distances[sample];
         }
 
-        // 更新中心点的坐标为该组所有点坐标的平均值
+        // 空分组从误差最大的样本重新开始,取走的样本单独成组
+        m_reseed(distances);
+
+        // 更新中心点的坐标为该组所有点坐标的平均值,累加用的临时向量每轮回收
+        Arena::Scope scope{Arena::scratch()};
+        std::vector<Text> sums;
+        sums.reserve(m_k);
         for (size_t group = 0; group < m_k; group++)
         {
-            Text newCenter{dims};
-            for (size_t i = 0; i < m_groups[group].size(); i++)
+            sums.emplace_back(dims, &Arena::scratch());
+        }
+
+        // 分组按线程划分,每个分组仍按样本顺序累加,结果与单线程一致
+        Dispatcher::parallel(threads, threads, [&](size_t thread, size_t, size_t) {
+            for (size_t sample = 0; sample < m_dataset.size(); sample++)
             {
-                newCenter = newCenter + m_groups[group][i];
+                size_t group = m_assignment[sample];
+                if (group % threads != thread)
+                    continue;
+
+                if (quantized)
+                    m_quantized.accumulate(sample, sums[group].pos());
+                else
+                    sums[group] += m_dataset[sample];
             }
-            newCenter.map([this, group](float n) -> float {return n/m_groups[group].size();});
-            m_groupCenters[group] = newCenter;
+        });
+
+        // 没有样本可以取走时空分组保留原来的中心
+        for (size_t group = 0; group < m_k; group++)
+        {
+            size_t count = counts[group];
+            if (count == 0)
+                continue;
+            sums[group].map([count](float n) -> float {return n/count;});
+            m_groupCenters[group] = sums[group];
         }
     }
+
+    m_buildGroups();
 }
 
+/* 一个设备负责的一段样本及其核函数配置 */
+struct Kmeans::Shard
+{
+    Accelerator* gpu;
+    int begin;                      // 第一个样本的序号
+    int count;                      // 样本数量
+    int parts;                      // 更新中心点时的样本分段数量
+    FindNearestKernel findNearest;              // 浮点样本
+    FindNearestStrideKernel findNearestStride;  // 量化样本
+    SumPointsKernel sumPoints;
+    SumPointsStrideKernel sumPointsStride;
+    MergePointsKernel mergePoints;
+    MergePointsKernel foldPoints;
+    ReseedPointsKernel reseedPoints;
+    cl_mem distances;
+    cl_mem inertia;
+    size_t findNearestLocalSize;
+    size_t findNearestGlobalSize;
+    size_t reseedLocalSize;         // 单个工作组,2的幂
+    size_t pointsLocalSize[2];
+    size_t sumPointsGlobalSize[2];
+    size_t mergePointsGlobalSize[2];
+};
+
 /*******************************************
- * @brief 通过GPU进行学习
+ * @brief 通过GPU进行学习,选中多个设备时样本按计算
+ *        单元数量分配到各个设备,每轮在主机上汇总
+ *        各设备的坐标和
  * @param[in] round 学习轮次
  * ****************************************/
 void Kmeans::m_gpuLearn(int round) noexcept
 {
-    auto& gpu = Accelerator::instance();
     int k = m_k;
     int dims = m_dataset[0].dims();
     int count = m_dataset.size();
@@ -167,57 +453,454 @@ void Kmeans::m_gpuLearn(int round) noexcept
     size_t step = count / k;
     for (size_t i = 0; i < m_k; i++)
     {
-        m_groupCenters[i] = m_dataset[i * step];
+        m_groupCenters[i] = Text{m_dataset[i * step], &m_arena};
+    }
+
+    // 按计算单元数量分配样本
+    std::vector<Accelerator*> devices;
+    size_t units = 0;
+    for (auto gpu : m_devices.empty() ? Accelerator::devices() : m_devices)
+    {
+        if (gpu->available())
+        {
+            devices.push_back(gpu);
+            units += gpu->computeUnits();
+        }
+    }
+
+    std::vector<Shard> shards;
+    int begin = 0;
+    for (size_t i = 0; i < devices.size() && begin < count; i++)
+    {
+        int size = (i + 1 == devices.size()) ? count - begin : count * devices[i]->computeUnits() / units;
+        if (size <= 0)
+            continue;
+
+        Shard shard;
+        shard.gpu = devices[i];
+        shard.begin = begin;
+        shard.count = size;
+        if (!m_gpuPrepare(shard))
+        {
+            m_gpuRelease(shard);
+            continue;
+        }
+
+        shards.push_back(std::move(shard));
+        begin += size;
+    }
+
+    // 有设备准备失败时退回CPU,已准备好的设备不再使用,样本缓存
+    // 可能直接使用了样本矩阵的内存,先释放
+    if (shards.empty() || begin < count)
+    {
+        for (auto& shard : shards)
+        {
+            m_gpuRelease(shard);
+        }
+        m_cpuLearn(round, Dispatcher::instance().threads());
+        return;
+    }
+
+    if (shards.size() == 1)
+    {
+        // 整个学习过程在设备上排队执行,中间不与主机同步
+        auto& gpu = *shards[0].gpu;
+        for (int n = 0; n < round; n++)
+        {
+            TRACE_COUNT("kmeans.iterations", 1);
+            m_gpuRound(shards[0], true);
+        }
+        gpu.reduce(shards[0].distances, count, shards[0].inertia, 0);
+
+        // 最后一次性读回中心点、分组索引、样本数量和误差,样本缓存可能
+        // 直接使用了样本矩阵的内存,读回后释放
+        std::vector<float> groupCenters(m_k * dims);
+        std::vector<int> assign(count);
+        std::vector<int> groupCounts(m_k);
+        float sum = 0.0f;
+        std::vector<Future> reads = {
+            gpu.readAsync("points", 0, groupCenters.data(), groupCenters.size() * sizeof(float)),
+            gpu.readAsync("assignment", 0, assign.data(), count * sizeof(int)),
+            gpu.readAsync("counts", 0, groupCounts.data(), m_k * sizeof(int)),
+            gpu.readAsync("inertia", 0, &sum, sizeof(float)),
+        };
+        gpu.flush();
+        Future::waitAll(reads);
+
+        for (size_t i = 0; i < m_k; i++)
+        {
+            memcpy(m_groupCenters[i].pos(), groupCenters.data() + i * dims, sizeof(float) * dims);
+        }
+        m_assignment.assign(assign.begin(), assign.end());
+        m_counts.assign(groupCounts.begin(), groupCounts.end());
+        m_inertia = sum;
+        gpu.releaseBuffer("items");
+        m_buildGroups();
+        return;
     }
 
-    int findNearestLocalSize = gpu.localSize(count);
-    int findNearestGlobalSize = gpu.globalSize(count);
+    // 多个设备:每轮各设备输出本段样本的坐标和与样本数量,在主机上汇总
+    std::vector<float> centers(m_k * dims);
+    std::vector<float> sums(shards.size() * m_k * dims);
+    std::vector<int> counts(shards.size() * m_k);
+    std::vector<float> total(m_k * dims);
+    std::vector<std::vector<Future>> reads(shards.size());
+    for (int n = 0; n < round; n++)
+    {
+        TRACE_COUNT("kmeans.iterations", 1);
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            auto& gpu = *shards[i].gpu;
+            if (n > 0)
+                gpu.writeBuffer("points", 0, centers.data(), centers.size() * sizeof(float), false);
+            m_gpuRound(shards[i], false);
+            reads[i] = {
+                gpu.readAsync("sums", 0, sums.data() + i * m_k * dims, m_k * dims * sizeof(float)),
+                gpu.readAsync("counts", 0, counts.data() + i * m_k, m_k * sizeof(int)),
+            };
+            gpu.flush();
+        }
+
+        // 按设备顺序汇总,先完成的设备的结果在其他设备计算时累加
+        total.assign(m_k * dims, 0.0f);
+        m_counts.assign(m_k, 0);
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            Future::waitAll(reads[i]);
+            for (size_t group = 0; group < m_k; group++)
+            {
+                m_counts[group] += counts[i * m_k + group];
+                for (int d = 0; d < dims; d++)
+                {
+                    total[group * dims + d] += sums[(i * m_k + group) * dims + d];
+                }
+            }
+        }
+
+        // 分组是否为空要看所有设备的汇总,只在出现空分组时同步读取
+        if (std::find(m_counts.begin(), m_counts.end(), 0) != m_counts.end())
+            m_gpuReseed(shards, total);
+
+        // 没有样本可以取走时空分组保留原来的中心
+        for (size_t group = 0; group < m_k; group++)
+        {
+            float* center = m_groupCenters[group].pos();
+            for (int d = 0; d < dims; d++)
+            {
+                if (m_counts[group] > 0)
+                    center[d] = total[group * dims + d] / m_counts[group];
+                centers[group * dims + d] = center[d];
+            }
+        }
+    }
+
+    // 读回各段的分组索引和误差
+    std::vector<int> assign(count);
+    std::vector<float> inertia(shards.size());
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        auto& gpu = *shards[i].gpu;
+        gpu.reduce(shards[i].distances, shards[i].count, shards[i].inertia, 0);
+        reads[i] = {
+            gpu.readAsync("assignment", 0, assign.data() + shards[i].begin, shards[i].count * sizeof(int)),
+            gpu.readAsync("inertia", 0, &inertia[i], sizeof(float)),
+        };
+        gpu.flush();
+    }
+
+    // 样本缓存可能直接使用了样本矩阵的内存,学习结束后释放
+    m_inertia = 0.0f;
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        Future::waitAll(reads[i]);
+        m_inertia += inertia[i];
+        shards[i].gpu->releaseBuffer("items");
+    }
+
+    m_assignment.assign(assign.begin(), assign.end());
+    m_buildGroups();
+}
+
+/*******************************************
+ * @brief 为一个设备创建缓存、上传本段样本和初始中心点
+ *        并设置核函数参数
+ * @param[in,out] shard 设备及其负责的样本
+ * @return 是否成功
+ * ****************************************/
+bool Kmeans::m_gpuPrepare(Shard& shard) noexcept
+{
+    TRACE_SCOPE("Kmeans::gpuPrepare");
+    auto& gpu = *shard.gpu;
+    int k = m_k;
+    int dims = m_dataset[0].dims();
+    int count = shard.count;
+
+    // 分块版本每个线程处理多个样本
+    bool tiled = gpu.tiled() && m_quantized.format() == QuantizedSet::NONE;
+    size_t findNearestItems = tiled ? (count + Accelerator::SAMPLES_PER_ITEM - 1) / Accelerator::SAMPLES_PER_ITEM : count;
+    shard.findNearestLocalSize = gpu.localSize(findNearestItems);
+    shard.findNearestGlobalSize = gpu.globalSize(findNearestItems);
+
+    // 修复空分组的核函数在组内树形归约,工作项数量取2的幂
+    shard.reseedLocalSize = 1;
+    while (shard.reseedLocalSize * 2 <= gpu.localSize(256))
+    {
+        shard.reseedLocalSize *= 2;
+    }
+
+    // 更新中心点分为两步:样本分为parts段并行求部分和,再按(维度,分组)合并
+    // 段数使工作项足够多,同时限制部分和缓冲区不超过64MB
+    size_t parts = 65536 / dims + 1;
+    size_t maxParts = (16 << 20) / (static_cast<size_t>(k) * dims) + 1;
+    parts = parts < maxParts ? parts : maxParts;
+    parts = parts < static_cast<size_t>(count) ? parts : count;
+    shard.parts = parts;
+    shard.pointsLocalSize[0] = gpu.localSize(dims);
+    shard.pointsLocalSize[1] = 1;
+    shard.sumPointsGlobalSize[0] = gpu.globalSize(dims);
+    shard.sumPointsGlobalSize[1] = parts;
+    shard.mergePointsGlobalSize[0] = gpu.globalSize(dims);
+    shard.mergePointsGlobalSize[1] = m_k;
+
+    // 量化存储时上传紧凑的样本矩阵,并使用对应类型的核函数;
+    // 维度和分组数量在本次学习中不变,使用特化的程序
+    bool quantized = m_quantized.format() != QuantizedSet::NONE;
+    int stride = m_quantized.stride();
+    std::string options = gpu.specialize(dims, k);
+    if (m_quantized.format() == QuantizedSet::U8)
+    {
+        shard.findNearestStride = FindNearestStrideKernel{gpu, "findNearestU8", options};
+        shard.sumPointsStride = SumPointsStrideKernel{gpu, "sumPointsU8", options};
+    }
+    else if (m_quantized.format() == QuantizedSet::F16)
+    {
+        shard.findNearestStride = FindNearestStrideKernel{gpu, "findNearestHalf", options};
+        shard.sumPointsStride = SumPointsStrideKernel{gpu, "sumPointsHalf", options};
+    }
+    else
+    {
+        shard.findNearest = FindNearestKernel{gpu, tiled ? "findNearestTiled" : "findNearest", options};
+        shard.sumPoints = SumPointsKernel{gpu, "sumPoints", options};
+    }
+    shard.mergePoints = MergePointsKernel{gpu, "mergePoints", options};
+    shard.foldPoints = MergePointsKernel{gpu, "foldPoints", options};
+    shard.reseedPoints = ReseedPointsKernel{gpu, "reseedPoints", options};
+    bool valid = quantized ? shard.findNearestStride.valid() && shard.sumPointsStride.valid()
+                           : shard.findNearest.valid() && shard.sumPoints.valid();
+    if (!valid || !shard.mergePoints.valid() || !shard.foldPoints.valid() || !shard.reseedPoints.valid())
+        return false;
 
-    int updatePointsLocalSize = gpu.localSize(k);
-    int updatePointsGlobalSize = gpu.globalSize(k);
+    // 量化的样本矩阵按页对齐,第一段在共享内存的设备上直接使用,不复制
+    size_t rowBytes = quantized ? m_quantized.bytes() / m_quantized.rows() : sizeof(float) * dims;
+    cl_mem items = nullptr;
+    if (quantized && shard.begin == 0)
+        items = gpu.shareBuffer("items", m_quantized.data(), rowBytes * count);
+    bool shared = items != nullptr;
+    if (!shared)
+        items = gpu.createBuffer("items", rowBytes * count);
 
-    auto items = gpu.createBuffer("items", sizeof(float) * dims * count);
     auto points = gpu.createBuffer("points", sizeof(float) * dims * m_k);
     auto assignment = gpu.createBuffer("assignment", sizeof(int) * count);
+    auto partial = gpu.createBuffer("partial", sizeof(float) * dims * m_k * parts);
+    auto partialCounts = gpu.createBuffer("partialCounts", sizeof(int) * m_k * parts);
+    auto sums = gpu.createBuffer("sums", sizeof(float) * dims * m_k);
+    auto counts = gpu.createBuffer("counts", sizeof(int) * m_k);
+    auto distances = gpu.createBuffer("distances", sizeof(float) * count);
+    auto inertia = gpu.createBuffer("inertia", sizeof(float));
+    if (items == nullptr || points == nullptr || assignment == nullptr || partial == nullptr ||
+        partialCounts == nullptr || sums == nullptr || counts == nullptr || distances == nullptr || inertia == nullptr)
+        return false;
 
-    for (int i = 0; i < count; i++)
+    // 其余情况一次上传整段样本,逐行的样本直接填充到映射的缓存或中转缓冲区
+    bool uploaded = shared;
+    if (!shared && quantized)
     {
-        gpu.writeBuffer("items", i * sizeof(float) * dims, m_dataset[i].pos(), sizeof(float) * dims, false);
+        const char* data = static_cast<const char*>(m_quantized.data()) + rowBytes * shard.begin;
+        uploaded = gpu.uploadBuffer("items", rowBytes * count, [data](size_t offset, void* dst, size_t bytes) {
+            memcpy(dst, data + offset, bytes);
+        });
+    }
+    else if (!shared)
+    {
+        uploaded = gpu.uploadBuffer("items", rowBytes * count, [&](size_t offset, void* dst, size_t bytes) {
+            char* out = static_cast<char*>(dst);
+            while (bytes > 0)
+            {
+                size_t row = offset / rowBytes;
+                size_t pos = offset % rowBytes;
+                size_t n = rowBytes - pos < bytes ? rowBytes - pos : bytes;
+                memcpy(out, reinterpret_cast<const char*>(m_dataset[shard.begin + row].pos()) + pos, n);
+                out += n;
+                offset += n;
+                bytes -= n;
+            }
+        });
     }
+    if (!uploaded)
+        return false;
 
     for (size_t i = 0; i < m_k; i++)
     {
         gpu.writeBuffer("points", i * sizeof(float) * dims, m_groupCenters[i].pos(), sizeof(float) * dims, false);
     }
-    
-    gpu.setArg(gpu.kernel("findNearest"), 0, &items, sizeof(cl_mem));
-    gpu.setArg(gpu.kernel("findNearest"), 1, &points, sizeof(cl_mem));
-    gpu.setArg(gpu.kernel("findNearest"), 2, &assignment, sizeof(cl_mem));
-    gpu.setArg(gpu.kernel("findNearest"), 3, &dims, sizeof(dims));
-    gpu.setArg(gpu.kernel("findNearest"), 4, &k, sizeof(k));
-    gpu.setArg(gpu.kernel("findNearest"), 5, &count, sizeof(count));
-
-    gpu.setArg(gpu.kernel("updatePoints"), 0, &items, sizeof(cl_mem));
-    gpu.setArg(gpu.kernel("updatePoints"), 1, &points, sizeof(cl_mem));
-    gpu.setArg(gpu.kernel("updatePoints"), 2, &assignment, sizeof(cl_mem));
-    gpu.setArg(gpu.kernel("updatePoints"), 3, &dims, sizeof(dims));
-    gpu.setArg(gpu.kernel("updatePoints"), 4, &k, sizeof(k));
-    gpu.setArg(gpu.kernel("updatePoints"), 5, &count, sizeof(count));
 
-    for (int n = 0; n < round; n++)
+    // 参数在本次学习中不变,只绑定一次
+    int partCount = parts;
+    bool success;
+    if (quantized)
+    {
+        success = shard.findNearestStride.bind(items, points, assignment, distances, dims, k, count, stride) &&
+                  shard.sumPointsStride.bind(items, assignment, partial, partialCounts, dims, k, count, partCount, stride);
+    }
+    else
     {
-        gpu.invoke(gpu.kernel("findNearest"), findNearestLocalSize, findNearestGlobalSize);
-        gpu.invoke(gpu.kernel("updatePoints"), updatePointsLocalSize, updatePointsGlobalSize);
+        success = shard.findNearest.bind(items, points, assignment, distances, dims, k, count) &&
+                  shard.sumPoints.bind(items, assignment, partial, partialCounts, dims, k, count, partCount);
     }
 
-    int* assign = new int[count];
-    gpu.readBuffer("assignment", 0, assign, count * sizeof(int), true);
-    for (int i = 0; i < count; i++)
+    // mergePoints就地更新中心点,foldPoints只输出坐标和,由主机汇总
+    success = success &&
+              shard.mergePoints.bind(points, counts, partial, partialCounts, dims, k, partCount) &&
+              shard.foldPoints.bind(sums, counts, partial, partialCounts, dims, k, partCount) &&
+              shard.reseedPoints.bind(assignment, distances, counts, LocalMemory{sizeof(float) * shard.reseedLocalSize},
+                                      LocalMemory{sizeof(int) * shard.reseedLocalSize}, k, count);
+
+    // 性能分析用的工作量:每个样本与每个中心点求距离为3次运算,
+    // 访存只计必须读写的样本、中心点和输出
+    double n = count;
+    double centerBytes = sizeof(float) * dims * m_k;
+    double partialBytes = (sizeof(float) * dims + sizeof(int)) * m_k * parts;
+    double findNearestFlops = 3.0 * n * m_k * dims;
+    double findNearestBytes = n * rowBytes + centerBytes + n * (sizeof(int) + sizeof(float));
+    double sumPointsBytes = n * rowBytes + n * sizeof(int) + partialBytes;
+    double mergeBytes = partialBytes + centerBytes + sizeof(int) * m_k;
+    if (quantized)
     {
-        int group = assign[i];
-        m_groups[group].push_back(m_dataset[i]);
+        shard.findNearestStride.setWork(findNearestFlops, findNearestBytes);
+        shard.sumPointsStride.setWork(n * dims, sumPointsBytes);
+    }
+    else
+    {
+        shard.findNearest.setWork(findNearestFlops, findNearestBytes);
+        shard.sumPoints.setWork(n * dims, sumPointsBytes);
+    }
+    shard.mergePoints.setWork(static_cast<double>(parts) * m_k * dims, mergeBytes);
+    shard.foldPoints.setWork(static_cast<double>(parts) * m_k * dims, mergeBytes);
+    shard.reseedPoints.setWork(0, n * (sizeof(int) + sizeof(float)) + sizeof(int) * m_k);
+
+    shard.distances = distances;
+    shard.inertia = inertia;
+    return success;
+}
+
+/*******************************************
+ * @brief 释放一个设备上为学习创建的所有缓存
+ * @param[in] shard 设备及其负责的样本
+ * ****************************************/
+void Kmeans::m_gpuRelease(Shard& shard) noexcept
+{
+    static const char* const buffers[] = {
+        "items", "points", "assignment", "partial", "partialCounts", "sums", "counts", "distances", "inertia",
+    };
+    for (auto name : buffers)
+    {
+        shard.gpu->releaseBuffer(name);
+    }
+}
+
+/*******************************************
+ * @brief 在一个设备上排队执行一轮学习,不进行同步
+ * @param[in] shard 设备及其负责的样本
+ * @param[in] merge 为true时在设备上修复空分组并用mergePoints
+ *                  就地更新中心点,否则用foldPoints输出坐标和
+ * ****************************************/
+void Kmeans::m_gpuRound(Shard& shard, bool merge) noexcept
+{
+    // 只记录排队的时间,设备上的执行时间由Accelerator的性能分析记录
+    TRACE_SCOPE("Kmeans::gpuRound");
+    TRACE_COUNT("kmeans.distances", static_cast<size_t>(shard.count) * m_k);
+    if (shard.findNearest.valid())
+        shard.findNearest.launch(shard.findNearestLocalSize, shard.findNearestGlobalSize);
+    else
+        shard.findNearestStride.launch(shard.findNearestLocalSize, shard.findNearestGlobalSize);
+
+    // 多个设备时一个设备上为空的分组在其他设备上可能有样本,由主机修复
+    if (merge)
+        shard.reseedPoints.launch(shard.reseedLocalSize, shard.reseedLocalSize);
+
+    if (shard.sumPoints.valid())
+        shard.sumPoints.launch(2, shard.pointsLocalSize, shard.sumPointsGlobalSize);
+    else
+        shard.sumPointsStride.launch(2, shard.pointsLocalSize, shard.sumPointsGlobalSize);
+
+    auto& update = merge ? shard.mergePoints : shard.foldPoints;
+    update.launch(2, shard.pointsLocalSize, shard.mergePointsGlobalSize);
+}
+
+/*******************************************
+ * @brief 多个设备学习时在主机上修复空分组,读回各段
+ *        的分组索引和距离,修改汇总的坐标和,并把
+ *        取走的样本写回设备
+ * @param[in] shards 各个设备及其负责的样本
+ * @param[in,out] total 各分组的坐标和
+ * ****************************************/
+void Kmeans::m_gpuReseed(std::vector<Shard>& shards, std::vector<float>& total) noexcept
+{
+    TRACE_SCOPE("Kmeans::gpuReseed");
+    int dims = m_dataset[0].dims();
+    std::vector<int> assign(m_dataset.size());
+    std::vector<float> distances(m_dataset.size());
+    std::vector<std::vector<Future>> reads(shards.size());
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        auto& gpu = *shards[i].gpu;
+        reads[i] = {
+            gpu.readAsync("assignment", 0, assign.data() + shards[i].begin, shards[i].count * sizeof(int)),
+            gpu.readAsync("distances", 0, distances.data() + shards[i].begin, shards[i].count * sizeof(float)),
+        };
+        gpu.flush();
+    }
+    for (auto& read : reads)
+    {
+        Future::waitAll(read);
+    }
+
+    // 取走的样本从原来分组的坐标和中减去,单独作为空分组的坐标和;
+    // 量化存储时使用设备上相同的解码值
+    m_assignment.assign(assign.begin(), assign.end());
+    std::vector<float> point(dims);
+    for (auto& move : m_reseed(distances))
+    {
+        size_t sample = move.first;
+        size_t from = move.second;
+        int group = m_assignment[sample];
+        if (m_quantized.format() != QuantizedSet::NONE)
+        {
+            point.assign(dims, 0.0f);
+            m_quantized.accumulate(sample, point.data());
+        }
+        else
+        {
+            memcpy(point.data(), m_dataset[sample].pos(), sizeof(float) * dims);
+        }
+
+        for (int d = 0; d < dims; d++)
+        {
+            total[from * dims + d] -= point[d];
+            total[group * dims + d] = point[d];
+        }
+
+        // 写回设备,最后一轮读回的分组索引和误差与主机一致
+        float zero = 0.0f;
+        for (auto& shard : shards)
+        {
+            if (sample < static_cast<size_t>(shard.begin) || sample >= static_cast<size_t>(shard.begin + shard.count))
+                continue;
+            shard.gpu->writeBuffer("assignment", (sample - shard.begin) * sizeof(int), &group, sizeof(int), true);
+            shard.gpu->writeBuffer("distances", (sample - shard.begin) * sizeof(float), &zero, sizeof(float), true);
+        }
     }
-    delete[] assign;
 }
 
 }; // namespace AutoBug
\ No newline at end of file
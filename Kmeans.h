@@ -1,18 +1,26 @@
 #ifndef AUTO_BUG_KMEANS_H
 #define AUTO_BUG_KMEANS_H
 
+#include <utility>
 #include <vector>
 #include "Text.h"
+#include "Arena.h"
+#include "QuantizedSet.h"
+#include "Dispatcher.h"
 
 namespace AutoBug
 {
 
+class Accelerator;
+
 class Kmeans
 {
 public:
     ~Kmeans() noexcept = default;
     Kmeans() noexcept;
     Kmeans(const std::vector<Text>& dataset, size_t k) noexcept;
+    Kmeans(const Kmeans&) = delete;
+    Kmeans(Kmeans&&) = delete;
 
     /*******************************************
      * @brief 设置数据集
@@ -26,6 +34,20 @@ public:
      * ****************************************/
     void setGroupCount(size_t k) noexcept;
 
+    /*******************************************
+     * @brief 设置样本的存储格式,量化后分配样本时使用
+     *        紧凑存储,中心点仍然使用float
+     * @param[in] format 存储格式
+     * ****************************************/
+    void setStorage(QuantizedSet::Format format) noexcept;
+
+    /*******************************************
+     * @brief 设置使用的加速器,样本按计算单元数量分配到
+     *        各个设备,默认使用Accelerator::devices()
+     * @param[in] devices 加速器列表
+     * ****************************************/
+    void setDevices(const std::vector<Accelerator*>& devices) noexcept;
+
     /*******************************************
      * @brief 进行学习
      * @param[in] n 学习轮次
@@ -55,25 +77,116 @@ public:
      * @param[in] idx 分组序号
      * @return 分组的数据
      * ****************************************/
-    std::vector<Text> group(size_t idx) noexcept;
+    const std::vector<Text>& group(size_t idx) noexcept;
+
+    /*******************************************
+     * @brief 获取指定分组的样本数量
+     * @param[in] idx 分组序号
+     * @return 样本数量,为0表示该分组为空
+     * ****************************************/
+    size_t groupSize(size_t idx) noexcept;
+
+    /*******************************************
+     * @brief 获取样本所属的分组
+     * @param[in] idx 样本序号
+     * @return 分组序号
+     * ****************************************/
+    size_t assignment(size_t idx) noexcept;
+
+    /*******************************************
+     * @brief 获取空分组的数量
+     * @return 空分组的数量
+     * ****************************************/
+    size_t emptyGroups() noexcept;
+
+    /*******************************************
+     * @brief 获取最后一轮划分的误差,即所有样本到所属
+     *        分组中心距离的平方和
+     * @return 误差
+     * ****************************************/
+    float inertia() noexcept;
+
+    /*******************************************
+     * @brief 获取最近一次学习选择的计算后端
+     * @return 选择的结果,可以通过Dispatcher::describe输出
+     * ****************************************/
+    const Dispatcher::Decision& decision() noexcept;
 
 private:
+    struct Shard;
+
+    Arena m_arena;          // 本次学习的数据集和中心点,随对象一次性释放
     size_t m_k;
     std::vector<Text> m_dataset;
     std::vector<Text> m_groupCenters;
     std::vector<std::vector<Text>> m_groups;
+    std::vector<size_t> m_assignment;
+    std::vector<size_t> m_counts;       // 各分组的样本数量
+    float m_inertia;
+    QuantizedSet::Format m_storage;
+    QuantizedSet m_quantized;
+    std::vector<Accelerator*> m_devices;
+    Dispatcher::Decision m_decision;
+
+    /*******************************************
+     * @brief 按照样本的分组索引生成各个分组
+     * ****************************************/
+    void m_buildGroups() noexcept;
+
+    /*******************************************
+     * @brief 修复空分组:每个空分组依次取走当前距离最大
+     *        的样本,该样本原来的分组至少还剩一个样本;
+     *        同时更新分组索引、样本数量和误差
+     * @param[in,out] distances 各样本到所属中心距离的平方,取走的样本置0
+     * @return 取走的样本序号及其原来的分组
+     * ****************************************/
+    std::vector<std::pair<size_t, size_t>> m_reseed(std::vector<float>& distances) noexcept;
 
     /*******************************************
      * @brief 通过CPU进行学习
      * @param[in] round 学习轮次
+     * @param[in] threads 线程数量
      * ****************************************/
-    void m_cpuLearn(int round) noexcept;
+    void m_cpuLearn(int round, size_t threads) noexcept;
 
     /*******************************************
-     * @brief 通过GPU进行学习
+     * @brief 通过GPU进行学习,选中多个设备时样本按计算
+     *        单元数量分配到各个设备,每轮在主机上汇总
+     *        各设备的坐标和
      * @param[in] round 学习轮次
      * ****************************************/
     void m_gpuLearn(int round) noexcept;
+
+    /*******************************************
+     * @brief 为一个设备创建缓存、上传本段样本和初始中心点
+     *        并设置核函数参数
+     * @param[in,out] shard 设备及其负责的样本
+     * @return 是否成功
+     * ****************************************/
+    bool m_gpuPrepare(Shard& shard) noexcept;
+
+    /*******************************************
+     * @brief 释放一个设备上为学习创建的所有缓存
+     * @param[in] shard 设备及其负责的样本
+     * ****************************************/
+    void m_gpuRelease(Shard& shard) noexcept;
+
+    /*******************************************
+     * @brief 在一个设备上排队执行一轮学习,不进行同步
+     * @param[in] shard 设备及其负责的样本
+     * @param[in] merge 为true时在设备上修复空分组并用mergePoints
+     *                  就地更新中心点,否则用foldPoints输出坐标和
+     * ****************************************/
+    void m_gpuRound(Shard& shard, bool merge) noexcept;
+
+    /*******************************************
+     * @brief 多个设备学习时在主机上修复空分组,读回各段
+     *        的分组索引和距离,修改汇总的坐标和,并把
+     *        取走的样本写回设备
+     * @param[in] shards 各个设备及其负责的样本
+     * @param[in,out] total 各分组的坐标和
+     * ****************************************/
+    void m_gpuReseed(std::vector<Shard>& shards, std::vector<float>& total) noexcept;
 };
 
 }; // namespace AutoBug
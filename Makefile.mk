@@ -5,11 +5,11 @@ CXXFLAGS := -W -Wall -Wextra -Werror -O3 -std=c++11
 PREFIX := /usr/local
 INSTALL_PATH := $(DESTDIR)$(PREFIX)
 
-SRCS := $(wildcard *.cpp) Accelerator.cpp
+SRCS := $(filter-out bench.cpp,$(wildcard *.cpp)) Accelerator.cpp
 HEADERS := $(wildcard *.h)
 OBJS := $(patsubst %.cpp,%.o,$(SRCS))
 
-.PHONY: prepare all clean install uninstall print profile
+.PHONY: prepare all clean install uninstall print profile bench
 
 all: $(TARGET) prepare
 
@@ -27,11 +27,16 @@ uninstall:
 $(TARGET): $(OBJS) 
 	$(CXX) -o $@ $^ $(LIBS)
 
+bench: $(TARGET)-bench
+
+$(TARGET)-bench: $(filter-out main.o,$(OBJS)) bench.o
+	$(CXX) -o $@ $^ $(LIBS)
+
 Accelerator.cpp: Accelerator.cxx kernel.cl prepare.sh
 	bash -c ./prepare.sh
 
 clean:
-	$(RM) $(OBJS) Accelerator.cpp
+	$(RM) $(OBJS) bench.o Accelerator.cpp
 
 print:
 	@echo "DESTDIR : $(DESTDIR)"
@@ -0,0 +1,803 @@
+#include "Model.h"
+#include "Dispatcher.h"
+#include "ProgramCache.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AUTO_BUG_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace AutoBug
+{
+
+/* 模型文件的头部,之后是分组数量*维度个float;版本2接着是
+ * 分组树的节点数量、节点和节点数量*维度个float;最后是
+ * 以上内容的哈希 */
+struct ModelHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t dims;
+    uint64_t dimMapHash;
+    uint64_t groupCount;
+};
+
+static const char MODEL_MAGIC[8] = {'A', 'U', 'T', 'O', 'B', 'U', 'G', 'M'};
+static const uint32_t MODEL_VERSION = 2;    // 版本1没有分组树,仍然可以加载
+
+// 每个线程至少分到的样本数量,太少时线程开销超过计算
+static const size_t MIN_ROWS_PER_THREAD = 256;
+
+/*******************************************
+ * @brief 计算稀疏向量与按维度存储的矩阵的乘积,
+ *        dots[g] = sum(values[j] * matrix[dims[j] * k + g])
+ * @param[in] dims 非零元素的维度
+ * @param[in] values 非零元素的值
+ * @param[in] nnz 非零元素的数量
+ * @param[in] matrix 维度*k的矩阵
+ * @param[in] k 矩阵的列数
+ * @param[out] dots 结果,k个元素
+ * ****************************************/
+static void sparseDots(const int* dims, const float* values, size_t nnz, const float* matrix, size_t k, float* dots) noexcept
+{
+    std::fill(dots, dots + k, 0.0f);
+    for (size_t j = 0; j < nnz; j++)
+    {
+        const float x = values[j];
+        const float* row = matrix + static_cast<size_t>(dims[j]) * k;
+        for (size_t g = 0; g < k; g++)
+        {
+            dots[g] += x * row[g];
+        }
+    }
+}
+
+#ifdef AUTO_BUG_X86_SIMD
+
+/*******************************************
+ * @brief sparseDots的AVX2版本,每次处理32列,
+ *        累加结果留在寄存器中直到所有非零元素处理完
+ * ****************************************/
+__attribute__((target("avx2,fma")))
+static void sparseDotsAvx2(const int* dims, const float* values, size_t nnz, const float* matrix, size_t k, float* dots) noexcept
+{
+    size_t g = 0;
+    for (; g + 32 <= k; g += 32)
+    {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        for (size_t j = 0; j < nnz; j++)
+        {
+            __m256 x = _mm256_set1_ps(values[j]);
+            const float* row = matrix + static_cast<size_t>(dims[j]) * k + g;
+            acc0 = _mm256_fmadd_ps(x, _mm256_loadu_ps(row), acc0);
+            acc1 = _mm256_fmadd_ps(x, _mm256_loadu_ps(row + 8), acc1);
+            acc2 = _mm256_fmadd_ps(x, _mm256_loadu_ps(row + 16), acc2);
+            acc3 = _mm256_fmadd_ps(x, _mm256_loadu_ps(row + 24), acc3);
+        }
+        _mm256_storeu_ps(dots + g, acc0);
+        _mm256_storeu_ps(dots + g + 8, acc1);
+        _mm256_storeu_ps(dots + g + 16, acc2);
+        _mm256_storeu_ps(dots + g + 24, acc3);
+    }
+
+    // 分组树的子节点通常不足32个,剩余的列按8列处理
+    for (; g + 8 <= k; g += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t j = 0; j < nnz; j++)
+        {
+            const float* row = matrix + static_cast<size_t>(dims[j]) * k + g;
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(values[j]), _mm256_loadu_ps(row), acc);
+        }
+        _mm256_storeu_ps(dots + g, acc);
+    }
+
+    for (; g < k; g++)
+    {
+        float sum = 0.0f;
+        for (size_t j = 0; j < nnz; j++)
+        {
+            sum += values[j] * matrix[static_cast<size_t>(dims[j]) * k + g];
+        }
+        dots[g] = sum;
+    }
+}
+
+#endif // AUTO_BUG_X86_SIMD
+
+/* 运行时根据CPU特性选择实现 */
+typedef void (*SparseDotsFn)(const int*, const float*, size_t, const float*, size_t, float*);
+
+static SparseDotsFn selectSparseDots() noexcept
+{
+#ifdef AUTO_BUG_X86_SIMD
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return sparseDotsAvx2;
+#endif
+    return sparseDots;
+}
+
+SparseBatch::SparseBatch() noexcept :
+    m_offsets(1, 0)
+{
+
+}
+
+/*******************************************
+ * @brief 清空所有样本,保留已分配的内存
+ * ****************************************/
+void SparseBatch::clear() noexcept
+{
+    m_offsets.resize(1);
+    m_dims.clear();
+    m_values.clear();
+}
+
+/*******************************************
+ * @brief 添加一个UTF-8编码的文本作为新的一行,
+ *        非法的字节和未收录的字符被忽略
+ * @param[in] text 文本
+ * @param[in] len 字节数
+ * @param[in] dimMap 维度映射表
+ * ****************************************/
+void SparseBatch::add(const char* text, size_t len, const DimMap& dimMap) noexcept
+{
+    const unsigned char* str = reinterpret_cast<const unsigned char*>(text);
+    size_t first = m_dims.size();
+    size_t i = 0;
+    while (i < len)
+    {
+        uint32_t ch = str[i];
+        size_t extra = 0;
+        if (ch < 0x80)
+            extra = 0;
+        else if ((ch & 0xE0) == 0xC0)
+            extra = 1, ch &= 0x1F;
+        else if ((ch & 0xF0) == 0xE0)
+            extra = 2, ch &= 0x0F;
+        else if ((ch & 0xF8) == 0xF0)
+            extra = 3, ch &= 0x07;
+        else
+        {
+            i++;
+            continue;
+        }
+
+        // 末尾不完整的字符
+        if (i + extra >= len)
+            break;
+
+        size_t j = 1;
+        for (; j <= extra; j++)
+        {
+            if ((str[i + j] & 0xC0) != 0x80)
+                break;
+            ch = (ch << 6) | (str[i + j] & 0x3F);
+        }
+        if (j <= extra)
+        {
+            i += j;
+            continue;
+        }
+        i += extra + 1;
+
+        int dim = dimMap.dim(static_cast<wchar_t>(ch));
+        if (dim < 0)
+            continue;
+
+        // 标题很短,线性查找已经出现过的维度
+        size_t k = first;
+        while (k < m_dims.size() && m_dims[k] != dim)
+        {
+            k++;
+        }
+        if (k < m_dims.size())
+        {
+            m_values[k] += 1.0f;
+        }
+        else
+        {
+            m_dims.push_back(dim);
+            m_values.push_back(1.0f);
+        }
+    }
+    m_offsets.push_back(m_dims.size());
+}
+
+/*******************************************
+ * @brief 获取样本数量
+ * @return 样本数量
+ * ****************************************/
+size_t SparseBatch::size() const noexcept
+{
+    return m_offsets.size() - 1;
+}
+
+/*******************************************
+ * @brief 获取一行的起始位置
+ * @param[in] row 行号
+ * @return 在dims和values中的下标
+ * ****************************************/
+size_t SparseBatch::begin(size_t row) const noexcept
+{
+    return m_offsets[row];
+}
+
+/*******************************************
+ * @brief 获取一行的结束位置
+ * @param[in] row 行号
+ * @return 在dims和values中的下标
+ * ****************************************/
+size_t SparseBatch::end(size_t row) const noexcept
+{
+    return m_offsets[row + 1];
+}
+
+/*******************************************
+ * @brief 获取所有非零元素的维度
+ * @return 维度数组
+ * ****************************************/
+const int* SparseBatch::dims() const noexcept
+{
+    return m_dims.data();
+}
+
+/*******************************************
+ * @brief 获取所有非零元素的值
+ * @return 值数组
+ * ****************************************/
+const float* SparseBatch::values() const noexcept
+{
+    return m_values.data();
+}
+
+Model::Model() noexcept :
+    m_dims(0),
+    m_groupCount(0),
+    m_dimMapHash(0)
+{
+
+}
+
+/*******************************************
+ * @brief 从学习完成的分类器获取分组中心
+ * @param[in] classifier 分类器
+ * @param[in] dimMap 学习时使用的维度映射表
+ * @return 是否成功
+ * ****************************************/
+bool Model::build(const Classifier& classifier, const DimMap& dimMap) noexcept
+{
+    m_dims = dimMap.dims();
+    m_groupCount = classifier.groupCount();
+    m_dimMapHash = hash(dimMap);
+    m_centers.assign(m_groupCount * m_dims, 0.0f);
+    for (size_t i = 0; i < m_groupCount; i++)
+    {
+        Text center = classifier.groupCenter(i);
+        if (center.dims() != m_dims)
+        {
+            fprintf(stderr, "group %zu has %d dims, expected %d\n", i, center.dims(), m_dims);
+            m_groupCount = 0;
+            m_centers.clear();
+            m_nodes.clear();
+            m_nodeCenters.clear();
+            m_prepare();
+            return false;
+        }
+        memcpy(&m_centers[i * m_dims], center.pos(), sizeof(float) * m_dims);
+    }
+
+    // 按层序重新编号,使每个节点的子节点连续
+    const auto& tree = classifier.tree();
+    std::vector<size_t> order;
+    m_nodes.clear();
+    if (!tree.empty())
+        order.push_back(0);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const auto& node = tree[order[i]];
+        uint32_t first = node.children.empty() ? 0 : static_cast<uint32_t>(order.size());
+        m_nodes.push_back(Node{node.group, first, static_cast<uint32_t>(node.children.size())});
+        order.insert(order.end(), node.children.begin(), node.children.end());
+    }
+
+    m_nodeCenters.assign(m_nodes.size() * m_dims, 0.0f);
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        Text center = tree[order[i]].center;
+        if (center.dims() == m_dims)
+            memcpy(&m_nodeCenters[i * m_dims], center.pos(), sizeof(float) * m_dims);
+    }
+
+    // 分组树无效时只能精确分类
+    if (!m_checkTree())
+    {
+        fprintf(stderr, "the group tree is invalid and will not be saved\n");
+        m_nodes.clear();
+        m_nodeCenters.clear();
+    }
+
+    m_prepare();
+    return m_groupCount > 0;
+}
+
+/*******************************************
+ * @brief 保存到文件,先写临时文件再改名
+ * @param[in] file 文件名
+ * @return 是否成功
+ * ****************************************/
+bool Model::save(const char* file) const noexcept
+{
+    ModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.dims = m_dims;
+    header.dimMapHash = m_dimMapHash;
+    header.groupCount = m_groupCount;
+    uint64_t nodeCount = m_nodes.size();
+    uint64_t checksum = ProgramCache::hash(m_centers.data(), m_centers.size() * sizeof(float));
+    checksum = ProgramCache::hash(&nodeCount, sizeof(nodeCount), checksum);
+    checksum = ProgramCache::hash(m_nodes.data(), m_nodes.size() * sizeof(Node), checksum);
+    checksum = ProgramCache::hash(m_nodeCenters.data(), m_nodeCenters.size() * sizeof(float), checksum);
+
+    std::string temp = std::string(file) + "." + std::to_string(getpid()) + ".tmp";
+    FILE* fp = fopen(temp.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "cannot open %s\n", temp.c_str());
+        return false;
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, fp) == 1;
+    success = success && fwrite(m_centers.data(), sizeof(float), m_centers.size(), fp) == m_centers.size();
+    success = success && fwrite(&nodeCount, sizeof(nodeCount), 1, fp) == 1;
+    success = success && fwrite(m_nodes.data(), sizeof(Node), m_nodes.size(), fp) == m_nodes.size();
+    success = success && fwrite(m_nodeCenters.data(), sizeof(float), m_nodeCenters.size(), fp) == m_nodeCenters.size();
+    success = success && fwrite(&checksum, sizeof(checksum), 1, fp) == 1;
+    success = (fclose(fp) == 0) && success;
+    if (!success || rename(temp.c_str(), file) != 0)
+    {
+        fprintf(stderr, "failed to write %s\n", file);
+        remove(temp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*******************************************
+ * @brief 从文件加载,检查维度映射表与学习时一致
+ * @param[in] file 文件名
+ * @param[in] dimMap 维度映射表
+ * @return 是否成功
+ * ****************************************/
+bool Model::load(const char* file, const DimMap& dimMap) noexcept
+{
+    FILE* fp = fopen(file, "rb");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "cannot open %s\n", file);
+        return false;
+    }
+
+    ModelHeader header;
+    std::vector<float> centers;
+    std::vector<Node> nodes;
+    std::vector<float> nodeCenters;
+    uint64_t nodeCount = 0;
+    uint64_t checksum = 0;
+    uint64_t stored = 0;
+    uint64_t expected = 0;
+    uint64_t size = 0;
+    bool success = false;
+    long len = 0;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a model file\n", file);
+        goto EXIT;
+    }
+
+    if (header.version != 1 && header.version != MODEL_VERSION)
+    {
+        fprintf(stderr, "%s has version %u, expected %u\n", file, header.version, MODEL_VERSION);
+        goto EXIT;
+    }
+
+    if (header.dims != dimMap.dims() || header.dimMapHash != hash(dimMap))
+    {
+        fprintf(stderr, "%s was trained with a different dim map\n", file);
+        goto EXIT;
+    }
+
+    // 分配内存前先检查文件大小,避免损坏的头部导致过大的分配
+    if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, sizeof(header), SEEK_SET) != 0)
+    {
+        fprintf(stderr, "%s is truncated or corrupted\n", file);
+        goto EXIT;
+    }
+    size = static_cast<uint64_t>(len);
+    expected = sizeof(header) + header.groupCount * header.dims * sizeof(float) + sizeof(checksum);
+    if (header.version > 1)
+        expected += sizeof(nodeCount);
+    if (header.groupCount > size || (header.version == 1 && size != expected) || size < expected)
+    {
+        fprintf(stderr, "%s is truncated or corrupted\n", file);
+        goto EXIT;
+    }
+
+    centers.resize(header.groupCount * header.dims);
+    if (fread(centers.data(), sizeof(float), centers.size(), fp) != centers.size())
+    {
+        fprintf(stderr, "%s is truncated or corrupted\n", file);
+        goto EXIT;
+    }
+    checksum = ProgramCache::hash(centers.data(), centers.size() * sizeof(float));
+
+    if (header.version > 1)
+    {
+        if (fread(&nodeCount, sizeof(nodeCount), 1, fp) != 1 || nodeCount > size ||
+            size != expected + nodeCount * (sizeof(Node) + header.dims * sizeof(float)))
+        {
+            fprintf(stderr, "%s is truncated or corrupted\n", file);
+            goto EXIT;
+        }
+
+        nodes.resize(nodeCount);
+        nodeCenters.resize(nodeCount * header.dims);
+        if (fread(nodes.data(), sizeof(Node), nodes.size(), fp) != nodes.size() ||
+            fread(nodeCenters.data(), sizeof(float), nodeCenters.size(), fp) != nodeCenters.size())
+        {
+            fprintf(stderr, "%s is truncated or corrupted\n", file);
+            goto EXIT;
+        }
+        checksum = ProgramCache::hash(&nodeCount, sizeof(nodeCount), checksum);
+        checksum = ProgramCache::hash(nodes.data(), nodes.size() * sizeof(Node), checksum);
+        checksum = ProgramCache::hash(nodeCenters.data(), nodeCenters.size() * sizeof(float), checksum);
+    }
+
+    if (fread(&stored, sizeof(stored), 1, fp) != 1 || stored != checksum)
+    {
+        fprintf(stderr, "%s is truncated or corrupted\n", file);
+        goto EXIT;
+    }
+
+    m_dims = header.dims;
+    m_groupCount = header.groupCount;
+    m_dimMapHash = header.dimMapHash;
+    m_centers.swap(centers);
+    m_nodes.swap(nodes);
+    m_nodeCenters.swap(nodeCenters);
+    if (!m_checkTree())
+    {
+        fprintf(stderr, "%s has an invalid group tree, using exact classification\n", file);
+        m_nodes.clear();
+        m_nodeCenters.clear();
+    }
+    m_prepare();
+    success = true;
+
+EXIT:
+    fclose(fp);
+    return success;
+}
+
+/*******************************************
+ * @brief 获取分组数量
+ * @return 分组数量
+ * ****************************************/
+size_t Model::groupCount() const noexcept
+{
+    return m_groupCount;
+}
+
+/*******************************************
+ * @brief 获取维度
+ * @return 维度
+ * ****************************************/
+int Model::dims() const noexcept
+{
+    return m_dims;
+}
+
+/*******************************************
+ * @brief 对一批样本分类,找到每个样本最近的分组,
+ *        样本足够多时分段并行
+ * @param[in] batch 样本
+ * @param[out] groups 每个样本所属的分组,没有分组时为-1
+ * @param[out] distances 每个样本到分组中心的距离
+ * @param[in] threads 线程数量,0表示使用Dispatcher的设置
+ * ****************************************/
+void Model::classify(const SparseBatch& batch, int* groups, float* distances, size_t threads) const noexcept
+{
+    TRACE_SCOPE("Model::classify");
+    size_t n = batch.size();
+    if (threads == 0)
+        threads = Dispatcher::instance().threads();
+    if (threads > n / MIN_ROWS_PER_THREAD)
+        threads = n / MIN_ROWS_PER_THREAD;
+
+    Dispatcher::parallel(n, threads, [&](size_t, size_t first, size_t last) {
+        m_classify(batch, first, last, groups, distances);
+    });
+}
+
+/*******************************************
+ * @brief 沿分组树自顶向下分类,每层只与子节点比较,
+ *        结果不一定是最近的分组;模型没有分组树时
+ *        与classify相同
+ * @param[in] batch 样本
+ * @param[out] groups 每个样本所属的分组
+ * @param[out] distances 每个样本到分组中心的距离
+ * @param[in] threads 线程数量,0表示使用Dispatcher的设置
+ * @return 计算距离的总次数
+ * ****************************************/
+uint64_t Model::route(const SparseBatch& batch, int* groups, float* distances, size_t threads) const noexcept
+{
+    TRACE_SCOPE("Model::route");
+    size_t n = batch.size();
+    if (m_nodes.empty())
+    {
+        classify(batch, groups, distances, threads);
+        return static_cast<uint64_t>(n) * m_groupCount;
+    }
+
+    if (threads == 0)
+        threads = Dispatcher::instance().threads();
+    if (threads > n / MIN_ROWS_PER_THREAD)
+        threads = n / MIN_ROWS_PER_THREAD;
+
+    // 每段的计数分开保存,最后汇总
+    std::vector<uint64_t> evaluations(threads > 1 ? threads : 1, 0);
+    Dispatcher::parallel(n, threads, [&](size_t chunk, size_t first, size_t last) {
+        evaluations[chunk] = m_route(batch, first, last, groups, distances);
+    });
+
+    uint64_t total = 0;
+    for (uint64_t count : evaluations)
+    {
+        total += count;
+    }
+    return total;
+}
+
+/*******************************************
+ * @brief 获取分组树的节点数量
+ * @return 节点数量,为0表示没有分组树
+ * ****************************************/
+size_t Model::nodeCount() const noexcept
+{
+    return m_nodes.size();
+}
+
+/*******************************************
+ * @brief 获取分组树的深度,子节点总在父节点之后,
+ *        一次顺序遍历即可
+ * @return 根节点到最深的叶子节点的层数
+ * ****************************************/
+size_t Model::depth() const noexcept
+{
+    std::vector<size_t> levels(m_nodes.size(), 0);
+    size_t deepest = 0;
+    for (size_t i = 0; i < m_nodes.size(); i++)
+    {
+        for (uint32_t c = 0; c < m_nodes[i].count; c++)
+        {
+            levels[m_nodes[i].first + c] = levels[i] + 1;
+        }
+        if (levels[i] > deepest)
+            deepest = levels[i];
+    }
+    return deepest;
+}
+
+/*******************************************
+ * @brief 计算维度映射表的哈希,用于检查模型与
+ *        当前的映射表是否一致
+ * @param[in] dimMap 维度映射表
+ * @return 哈希值
+ * ****************************************/
+uint64_t Model::hash(const DimMap& dimMap) noexcept
+{
+    uint64_t h = ProgramCache::hash(nullptr, 0);
+    for (int i = 0; i < dimMap.dims(); i++)
+    {
+        uint32_t ch = static_cast<uint32_t>(dimMap.word(i));
+        h = ProgramCache::hash(&ch, sizeof(ch), h);
+    }
+    return h;
+}
+
+/*******************************************
+ * @brief 由m_centers计算转置的中心点和模,分类时
+ *        ||x-c||^2 = ||x||^2 + ||c||^2 - 2x·c,而x
+ *        是稀疏的,只需要按x的非零维度累加转置后的
+ *        连续一行
+ * ****************************************/
+void Model::m_prepare() noexcept
+{
+    m_transposed.assign(m_centers.size(), 0.0f);
+    m_norms.assign(m_groupCount, 0.0f);
+    m_nodeNorms.assign(m_nodes.size(), 0.0f);
+    m_nodeTransposed.assign(m_nodeCenters.size(), 0.0f);
+    for (size_t i = 0; i < m_nodes.size(); i++)
+    {
+        const float* center = &m_nodeCenters[i * m_dims];
+        for (int d = 0; d < m_dims; d++)
+        {
+            m_nodeNorms[i] += center[d] * center[d];
+        }
+
+        // 兄弟节点连续,同一个父节点的子节点组成一块维度*子节点数量的矩阵
+        const size_t count = m_nodes[i].count;
+        float* block = &m_nodeTransposed[static_cast<size_t>(m_nodes[i].first) * m_dims];
+        for (size_t c = 0; c < count; c++)
+        {
+            const float* child = &m_nodeCenters[(m_nodes[i].first + c) * m_dims];
+            for (int d = 0; d < m_dims; d++)
+            {
+                block[d * count + c] = child[d];
+            }
+        }
+    }
+    for (size_t g = 0; g < m_groupCount; g++)
+    {
+        const float* center = &m_centers[g * m_dims];
+        for (int d = 0; d < m_dims; d++)
+        {
+            m_transposed[d * m_groupCount + g] = center[d];
+            m_norms[g] += center[d] * center[d];
+        }
+    }
+}
+
+/*******************************************
+ * @brief 对一段连续的样本分类
+ * @param[in] batch 样本
+ * @param[in] first 第一个样本
+ * @param[in] last 最后一个样本之后
+ * @param[out] groups 每个样本所属的分组
+ * @param[out] distances 每个样本到分组中心的距离
+ * ****************************************/
+void Model::m_classify(const SparseBatch& batch, size_t first, size_t last, int* groups, float* distances) const noexcept
+{
+    static const SparseDotsFn products = selectSparseDots();
+    const size_t k = m_groupCount;
+    const int* dims = batch.dims();
+    const float* values = batch.values();
+    std::vector<float> dots(k);
+    for (size_t i = first; i < last; i++)
+    {
+        if (k == 0)
+        {
+            groups[i] = -1;
+            distances[i] = 0.0f;
+            continue;
+        }
+
+        size_t begin = batch.begin(i);
+        size_t end = batch.end(i);
+        products(dims + begin, values + begin, end - begin, m_transposed.data(), k, dots.data());
+        float norm = 0.0f;
+        for (size_t j = begin; j < end; j++)
+        {
+            norm += values[j] * values[j];
+        }
+
+        size_t best = 0;
+        float nearest = m_norms[0] - 2 * dots[0];
+        for (size_t g = 1; g < k; g++)
+        {
+            float dist = m_norms[g] - 2 * dots[g];
+            if (dist < nearest)
+            {
+                nearest = dist;
+                best = g;
+            }
+        }
+
+        nearest += norm;
+        groups[i] = static_cast<int>(best);
+        distances[i] = nearest > 0.0f ? sqrtf(nearest) : 0.0f;
+    }
+}
+
+/*******************************************
+ * @brief 沿分组树对一段连续的样本分类,每层与精确
+ *        分类一样按样本的非零维度累加子节点矩阵的行
+ * @param[in] batch 样本
+ * @param[in] first 第一个样本
+ * @param[in] last 最后一个样本之后
+ * @param[out] groups 每个样本所属的分组
+ * @param[out] distances 每个样本到分组中心的距离
+ * @return 计算距离的次数
+ * ****************************************/
+uint64_t Model::m_route(const SparseBatch& batch, size_t first, size_t last, int* groups, float* distances) const noexcept
+{
+    static const SparseDotsFn products = selectSparseDots();
+    const int* dims = batch.dims();
+    const float* values = batch.values();
+    std::vector<float> dots;
+    uint64_t evaluations = 0;
+    for (size_t i = first; i < last; i++)
+    {
+        size_t begin = batch.begin(i);
+        size_t end = batch.end(i);
+        float norm = 0.0f;
+        for (size_t j = begin; j < end; j++)
+        {
+            norm += values[j] * values[j];
+        }
+
+        size_t node = 0;
+        float nearest = 0.0f;
+        while (m_nodes[node].count > 0)
+        {
+            const size_t child = m_nodes[node].first;
+            const size_t count = m_nodes[node].count;
+            if (dots.size() < count)
+                dots.resize(count);
+            products(dims + begin, values + begin, end - begin, &m_nodeTransposed[child * m_dims], count, dots.data());
+
+            size_t best = 0;
+            nearest = m_nodeNorms[child] - 2 * dots[0];
+            for (size_t c = 1; c < count; c++)
+            {
+                float dist = m_nodeNorms[child + c] - 2 * dots[c];
+                if (dist < nearest)
+                {
+                    nearest = dist;
+                    best = c;
+                }
+            }
+            evaluations += count;
+            node = child + best;
+        }
+
+        nearest += norm;
+        groups[i] = m_nodes[node].group;
+        distances[i] = nearest > 0.0f ? sqrtf(nearest) : 0.0f;
+    }
+    return evaluations;
+}
+
+/*******************************************
+ * @brief 检查分组树的结构,每个内部节点的子节点都
+ *        在它之后,保证自顶向下一定能到达叶子节点
+ * @return 是否有效
+ * ****************************************/
+bool Model::m_checkTree() const noexcept
+{
+    if (m_nodes.empty())
+        return true;
+    if (m_nodes[0].count == 0 || m_nodeCenters.size() != m_nodes.size() * m_dims)
+        return false;
+
+    for (size_t i = 0; i < m_nodes.size(); i++)
+    {
+        const Node& node = m_nodes[i];
+        if (node.count == 0)
+        {
+            if (node.group < 0 || static_cast<size_t>(node.group) >= m_groupCount)
+                return false;
+        }
+        else if (node.group != -1 || node.first <= i || node.first > m_nodes.size() || node.count > m_nodes.size() - node.first)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
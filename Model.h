@@ -0,0 +1,213 @@
+#ifndef AUTO_BUG_MODEL_H
+#define AUTO_BUG_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "DimMap.h"
+#include "Classifier.h"
+
+namespace AutoBug
+{
+
+/* 一批稀疏样本,按行压缩存储,每行只保存出现过的维度;
+ * 标题只有几十个字,比稠密的Text小两个数量级 */
+class SparseBatch
+{
+public:
+    ~SparseBatch() noexcept = default;
+    SparseBatch() noexcept;
+
+    /*******************************************
+     * @brief 清空所有样本,保留已分配的内存
+     * ****************************************/
+    void clear() noexcept;
+
+    /*******************************************
+     * @brief 添加一个UTF-8编码的文本作为新的一行
+     * @param[in] text 文本
+     * @param[in] len 字节数
+     * @param[in] dimMap 维度映射表
+     * ****************************************/
+    void add(const char* text, size_t len, const DimMap& dimMap) noexcept;
+
+    /*******************************************
+     * @brief 获取样本数量
+     * @return 样本数量
+     * ****************************************/
+    size_t size() const noexcept;
+
+    /*******************************************
+     * @brief 获取一行的起始位置
+     * @param[in] row 行号
+     * @return 在dims和values中的下标
+     * ****************************************/
+    size_t begin(size_t row) const noexcept;
+
+    /*******************************************
+     * @brief 获取一行的结束位置
+     * @param[in] row 行号
+     * @return 在dims和values中的下标
+     * ****************************************/
+    size_t end(size_t row) const noexcept;
+
+    /*******************************************
+     * @brief 获取所有非零元素的维度
+     * @return 维度数组
+     * ****************************************/
+    const int* dims() const noexcept;
+
+    /*******************************************
+     * @brief 获取所有非零元素的值
+     * @return 值数组
+     * ****************************************/
+    const float* values() const noexcept;
+
+private:
+    std::vector<size_t> m_offsets;  // 每行的起始位置,比行数多一个
+    std::vector<int> m_dims;
+    std::vector<float> m_values;
+};
+
+/* 学习结果的分组中心,可以保存到文件,加载后对新的
+ * 样本进行批量分类 */
+class Model
+{
+public:
+    ~Model() noexcept = default;
+    Model() noexcept;
+
+    /*******************************************
+     * @brief 从学习完成的分类器获取分组中心
+     * @param[in] classifier 分类器
+     * @param[in] dimMap 学习时使用的维度映射表
+     * @return 是否成功
+     * ****************************************/
+    bool build(const Classifier& classifier, const DimMap& dimMap) noexcept;
+
+    /*******************************************
+     * @brief 保存到文件
+     * @param[in] file 文件名
+     * @return 是否成功
+     * ****************************************/
+    bool save(const char* file) const noexcept;
+
+    /*******************************************
+     * @brief 从文件加载,检查维度映射表与学习时一致
+     * @param[in] file 文件名
+     * @param[in] dimMap 维度映射表
+     * @return 是否成功
+     * ****************************************/
+    bool load(const char* file, const DimMap& dimMap) noexcept;
+
+    /*******************************************
+     * @brief 获取分组数量
+     * @return 分组数量
+     * ****************************************/
+    size_t groupCount() const noexcept;
+
+    /*******************************************
+     * @brief 获取维度
+     * @return 维度
+     * ****************************************/
+    int dims() const noexcept;
+
+    /*******************************************
+     * @brief 对一批样本分类,找到每个样本最近的分组
+     * @param[in] batch 样本
+     * @param[out] groups 每个样本所属的分组
+     * @param[out] distances 每个样本到分组中心的距离
+     * @param[in] threads 线程数量,0表示使用Dispatcher的设置
+     * ****************************************/
+    void classify(const SparseBatch& batch, int* groups, float* distances, size_t threads = 0) const noexcept;
+
+    /*******************************************
+     * @brief 沿分组树自顶向下分类,每层只与子节点比较,
+     *        结果不一定是最近的分组;模型没有分组树时
+     *        与classify相同
+     * @param[in] batch 样本
+     * @param[out] groups 每个样本所属的分组
+     * @param[out] distances 每个样本到分组中心的距离
+     * @param[in] threads 线程数量,0表示使用Dispatcher的设置
+     * @return 计算距离的总次数
+     * ****************************************/
+    uint64_t route(const SparseBatch& batch, int* groups, float* distances, size_t threads = 0) const noexcept;
+
+    /*******************************************
+     * @brief 获取分组树的节点数量
+     * @return 节点数量,为0表示没有分组树
+     * ****************************************/
+    size_t nodeCount() const noexcept;
+
+    /*******************************************
+     * @brief 获取分组树的深度
+     * @return 根节点到最深的叶子节点的层数
+     * ****************************************/
+    size_t depth() const noexcept;
+
+    /*******************************************
+     * @brief 计算维度映射表的哈希,用于检查模型与
+     *        当前的映射表是否一致
+     * @param[in] dimMap 维度映射表
+     * @return 哈希值
+     * ****************************************/
+    static uint64_t hash(const DimMap& dimMap) noexcept;
+
+private:
+    /* 分组树的节点,按层序存储,每个节点的子节点连续 */
+    struct Node
+    {
+        int32_t group;      // 叶子节点的分组序号,内部节点为-1
+        uint32_t first;     // 第一个子节点
+        uint32_t count;     // 子节点数量,叶子节点为0
+    };
+
+    int m_dims;
+    size_t m_groupCount;
+    uint64_t m_dimMapHash;
+    std::vector<float> m_centers;       // 分组数量*维度,按分组存储,用于保存
+    std::vector<float> m_transposed;    // 维度*分组数量,按维度存储,用于分类
+    std::vector<float> m_norms;         // 每个中心点模的平方
+    std::vector<Node> m_nodes;          // 分组树,第0个是根节点
+    std::vector<float> m_nodeCenters;   // 节点数量*维度,按节点存储,用于保存
+    std::vector<float> m_nodeTransposed;// 每个节点的子节点中心按维度存储,用于分类
+    std::vector<float> m_nodeNorms;     // 每个节点中心模的平方
+
+    /*******************************************
+     * @brief 由m_centers计算转置的中心点和模
+     * ****************************************/
+    void m_prepare() noexcept;
+
+    /*******************************************
+     * @brief 对一段连续的样本分类
+     * @param[in] batch 样本
+     * @param[in] first 第一个样本
+     * @param[in] last 最后一个样本之后
+     * @param[out] groups 每个样本所属的分组
+     * @param[out] distances 每个样本到分组中心的距离
+     * ****************************************/
+    void m_classify(const SparseBatch& batch, size_t first, size_t last, int* groups, float* distances) const noexcept;
+
+    /*******************************************
+     * @brief 沿分组树对一段连续的样本分类
+     * @param[in] batch 样本
+     * @param[in] first 第一个样本
+     * @param[in] last 最后一个样本之后
+     * @param[out] groups 每个样本所属的分组
+     * @param[out] distances 每个样本到分组中心的距离
+     * @return 计算距离的次数
+     * ****************************************/
+    uint64_t m_route(const SparseBatch& batch, size_t first, size_t last, int* groups, float* distances) const noexcept;
+
+    /*******************************************
+     * @brief 检查分组树的结构,每个内部节点的子节点都
+     *        在它之后,保证自顶向下一定能到达叶子节点
+     * @return 是否有效
+     * ****************************************/
+    bool m_checkTree() const noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_MODEL_H
\ No newline at end of file
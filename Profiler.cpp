@@ -0,0 +1,324 @@
+#include "Profiler.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace AutoBug
+{
+
+Profiler::~Profiler() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& pending : m_pending)
+    {
+        clReleaseEvent(pending.event);
+    }
+}
+
+Profiler::Profiler() noexcept :
+    m_enable(false),
+    m_first(0),
+    m_last(0)
+{
+
+}
+
+/*******************************************
+ * @brief 环境变量AUTO_BUG_PROFILE是否要求进行性能分析
+ * @return 是否要求
+ * ****************************************/
+bool Profiler::requested() noexcept
+{
+    const char* env = getenv("AUTO_BUG_PROFILE");
+    return env != nullptr && env[0] != 0 && strcmp(env, "0") != 0;
+}
+
+/*******************************************
+ * @brief 打开或关闭记录
+ * @param[in] enable 是否记录
+ * ****************************************/
+void Profiler::setEnable(bool enable) noexcept
+{
+    m_enable = enable;
+}
+
+/*******************************************
+ * @brief 是否正在记录
+ * @return 是否正在记录
+ * ****************************************/
+bool Profiler::enabled() const noexcept
+{
+    return m_enable;
+}
+
+/*******************************************
+ * @brief 设置报告中显示的设备名称
+ * @param[in] device 设备名称
+ * ****************************************/
+void Profiler::setDevice(const std::string& device) noexcept
+{
+    m_device = device;
+}
+
+/*******************************************
+ * @brief 设置核函数每次调用的计算量和必须的访存量,
+ *        用于计算GFLOP/s和GB/s;都为0时删除
+ * @param[in] kernel 核函数
+ * @param[in] flops 浮点运算次数
+ * @param[in] bytes 读写的字节数
+ * ****************************************/
+void Profiler::setWork(cl_kernel kernel, double flops, double bytes) noexcept
+{
+    if (!m_enable || kernel == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (flops == 0 && bytes == 0)
+        m_work.erase(kernel);
+    else
+        m_work[kernel] = Work{flops, bytes};
+}
+
+/*******************************************
+ * @brief 记录一次核函数调用
+ * @param[in] event 调用的事件,nullptr时忽略
+ * @param[in] kernel 核函数
+ * ****************************************/
+void Profiler::record(cl_event event, cl_kernel kernel) noexcept
+{
+    if (!m_enable || event == nullptr)
+        return;
+
+    // 同一个核函数可能来自不同的特化程序,按函数名汇总
+    char name[128] = "unknown";
+    clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, nullptr);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_work.find(kernel);
+    Work work = iter != m_work.end() ? iter->second : Work{0, 0};
+    clRetainEvent(event);
+    m_push(Pending{event, name, true, work.flops, work.bytes});
+}
+
+/*******************************************
+ * @brief 记录一次数据传输
+ * @param[in] event 传输的事件,nullptr时忽略
+ * @param[in] name 传输类型,必须是字符串常量
+ * @param[in] bytes 字节数
+ * ****************************************/
+void Profiler::record(cl_event event, const char* name, size_t bytes) noexcept
+{
+    if (!m_enable || event == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    clRetainEvent(event);
+    m_push(Pending{event, name, false, 0, static_cast<double>(bytes)});
+}
+
+/*******************************************
+ * @brief 读取已完成命令的时间并释放事件
+ * @param[in] wait 是否等待所有命令完成
+ * ****************************************/
+void Profiler::collect(bool wait) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_collect(wait);
+}
+
+/*******************************************
+ * @brief 等待所有命令完成并输出报告
+ * @param[in] fp 输出文件
+ * ****************************************/
+void Profiler::print(FILE* fp) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_collect(true);
+    if (m_entries.empty())
+        return;
+
+    // 按执行时间从大到小,优先优化排在前面的核函数
+    std::sort(m_entries.begin(), m_entries.end(), [](const Entry& x, const Entry& y) {
+        return x.executed > y.executed;
+    });
+
+    fprintf(fp, "profile of %s\n", m_device.c_str());
+    fprintf(fp, "%-20s %-8s %8s %12s %10s %10s %10s %10s %10s %10s\n",
+            "name", "kind", "calls", "total ms", "mean us", "max us", "queue us", "submit us", "GB/s", "GFLOP/s");
+
+    double kernels = 0.0;
+    double transfers = 0.0;
+    for (auto& entry : m_entries)
+    {
+        (entry.kernel ? kernels : transfers) += entry.executed;
+
+        char bandwidth[16] = "-";
+        char throughput[16] = "-";
+        if (entry.bytes > 0 && entry.executed > 0)
+            snprintf(bandwidth, sizeof(bandwidth), "%.2f", entry.bytes / entry.executed);
+        if (entry.flops > 0 && entry.executed > 0)
+            snprintf(throughput, sizeof(throughput), "%.2f", entry.flops / entry.executed);
+
+        fprintf(fp, "%-20s %-8s %8zu %12.3f %10.1f %10.1f %10.1f %10.1f %10s %10s\n",
+                entry.name.c_str(), entry.kernel ? "kernel" : "transfer", entry.calls,
+                entry.executed / 1e6, entry.executed / 1e3 / entry.calls, entry.maxExecuted / 1e3,
+                entry.queued / 1e3 / entry.calls, entry.submitted / 1e3 / entry.calls, bandwidth, throughput);
+    }
+
+    // 设备空闲的时间是主机开销和同步等待
+    double span = m_last > m_first ? static_cast<double>(m_last - m_first) : 0.0;
+    double idle = span - kernels - transfers;
+    fprintf(fp, "span %.3f ms: kernels %.3f ms, transfers %.3f ms, device idle %.3f ms\n",
+            span / 1e6, kernels / 1e6, transfers / 1e6, (idle > 0 ? idle : 0.0) / 1e6);
+}
+
+/*******************************************
+ * @brief 等待所有命令完成,每项追加一行JSON到文件
+ * @param[in] file 文件名
+ * @return 是否成功
+ * ****************************************/
+bool Profiler::exportJson(const char* file) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_collect(true);
+
+    FILE* fp = fopen(file, "a");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return false;
+    }
+
+    for (auto& entry : m_entries)
+    {
+        fprintf(fp, "{\"device\":\"%s\",\"name\":\"%s\",\"kind\":\"%s\",\"calls\":%zu,"
+                    "\"total_s\":%.9g,\"max_s\":%.9g,\"queue_s\":%.9g,\"submit_s\":%.9g,"
+                    "\"bytes\":%.17g,\"flops\":%.17g,\"gbps\":%.6g,\"gflops\":%.6g}\n",
+                m_device.c_str(), entry.name.c_str(), entry.kernel ? "kernel" : "transfer", entry.calls,
+                entry.executed / 1e9, entry.maxExecuted / 1e9, entry.queued / 1e9, entry.submitted / 1e9,
+                entry.bytes, entry.flops,
+                entry.executed > 0 ? entry.bytes / entry.executed : 0.0,
+                entry.executed > 0 ? entry.flops / entry.executed : 0.0);
+    }
+
+    bool success = !ferror(fp);
+    if (fclose(fp) != 0)
+        success = false;
+    return success;
+}
+
+/*******************************************
+ * @brief 按环境变量AUTO_BUG_PROFILE输出报告:为1时
+ *        输出到标准错误,否则同时追加JSON到该文件
+ * ****************************************/
+void Profiler::report() noexcept
+{
+    if (!m_enable)
+        return;
+
+    print(stderr);
+    const char* env = getenv("AUTO_BUG_PROFILE");
+    if (env != nullptr && strcmp(env, "1") != 0)
+        exportJson(env);
+}
+
+/*******************************************
+ * @brief 清空汇总结果
+ * ****************************************/
+void Profiler::reset() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_collect(true);
+    m_entries.clear();
+    m_first = 0;
+    m_last = 0;
+}
+
+/*******************************************
+ * @brief 将一条命令加入待读取列表,过多时先读取
+ *        已完成的命令
+ * @param[in] pending 命令
+ * ****************************************/
+void Profiler::m_push(Pending&& pending) noexcept
+{
+    m_pending.push_back(std::move(pending));
+    if (m_pending.size() >= 1024)
+        m_collect(false);
+}
+
+/*******************************************
+ * @brief 读取已完成命令的时间,调用者持有锁
+ * @param[in] wait 是否等待所有命令完成
+ * ****************************************/
+void Profiler::m_collect(bool wait) noexcept
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < m_pending.size(); i++)
+    {
+        auto& pending = m_pending[i];
+        cl_int status = CL_COMPLETE;
+        if (wait)
+            clWaitForEvents(1, &pending.event);
+        else
+            clGetEventInfo(pending.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+
+        // 未完成的命令保留到下次读取
+        if (status > CL_COMPLETE)
+        {
+            if (kept != i)
+                m_pending[kept] = std::move(pending);
+            kept++;
+            continue;
+        }
+
+        if (status == CL_COMPLETE)
+            m_account(pending);
+        clReleaseEvent(pending.event);
+    }
+    m_pending.resize(kept);
+}
+
+/*******************************************
+ * @brief 读取一条已完成命令的时间计入汇总
+ * @param[in] pending 命令
+ * ****************************************/
+void Profiler::m_account(const Pending& pending) noexcept
+{
+    cl_ulong queued = 0;
+    cl_ulong submitted = 0;
+    cl_ulong started = 0;
+    cl_ulong ended = 0;
+    if (clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, nullptr) != CL_SUCCESS ||
+        clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_SUBMIT, sizeof(submitted), &submitted, nullptr) != CL_SUCCESS ||
+        clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_START, sizeof(started), &started, nullptr) != CL_SUCCESS ||
+        clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_END, sizeof(ended), &ended, nullptr) != CL_SUCCESS)
+    {
+        return;
+    }
+
+    auto iter = std::find_if(m_entries.begin(), m_entries.end(), [&](const Entry& entry) {
+        return entry.kernel == pending.kernel && entry.name == pending.name;
+    });
+    if (iter == m_entries.end())
+    {
+        m_entries.push_back(Entry{pending.name, pending.kernel, 0, 0, 0, 0, 0, 0, 0});
+        iter = m_entries.end() - 1;
+    }
+
+    double executed = ended > started ? static_cast<double>(ended - started) : 0.0;
+    iter->calls += 1;
+    iter->queued += submitted > queued ? static_cast<double>(submitted - queued) : 0.0;
+    iter->submitted += started > submitted ? static_cast<double>(started - submitted) : 0.0;
+    iter->executed += executed;
+    iter->maxExecuted = std::max(iter->maxExecuted, executed);
+    iter->flops += pending.flops;
+    iter->bytes += pending.bytes;
+
+    if (m_first == 0 || queued < m_first)
+        m_first = queued;
+    if (ended > m_last)
+        m_last = ended;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
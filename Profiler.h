@@ -0,0 +1,170 @@
+#ifndef AUTO_BUG_PROFILER_H
+#define AUTO_BUG_PROFILER_H
+
+#ifndef CL_HPP_TARGET_OPENCL_VERSION
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#endif // CL_HPP_TARGET_OPENCL_VERSION
+#include <CL/cl2.hpp>
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace AutoBug
+{
+
+/* 一个命令队列的性能分析,记录每条命令的排队、提交、开始和
+ * 结束时间,按核函数名和传输类型汇总;命令队列必须以
+ * CL_QUEUE_PROFILING_ENABLE创建 */
+class Profiler
+{
+public:
+    ~Profiler() noexcept;
+    Profiler() noexcept;
+    Profiler(const Profiler&) = delete;
+    Profiler(Profiler&&) = delete;
+
+    /*******************************************
+     * @brief 环境变量AUTO_BUG_PROFILE是否要求进行性能分析
+     * @return 是否要求
+     * ****************************************/
+    static bool requested() noexcept;
+
+    /*******************************************
+     * @brief 打开或关闭记录
+     * @param[in] enable 是否记录
+     * ****************************************/
+    void setEnable(bool enable) noexcept;
+
+    /*******************************************
+     * @brief 是否正在记录
+     * @return 是否正在记录
+     * ****************************************/
+    bool enabled() const noexcept;
+
+    /*******************************************
+     * @brief 设置报告中显示的设备名称
+     * @param[in] device 设备名称
+     * ****************************************/
+    void setDevice(const std::string& device) noexcept;
+
+    /*******************************************
+     * @brief 设置核函数每次调用的计算量和必须的访存量,
+     *        用于计算GFLOP/s和GB/s;都为0时删除
+     * @param[in] kernel 核函数
+     * @param[in] flops 浮点运算次数
+     * @param[in] bytes 读写的字节数
+     * ****************************************/
+    void setWork(cl_kernel kernel, double flops, double bytes) noexcept;
+
+    /*******************************************
+     * @brief 记录一次核函数调用
+     * @param[in] event 调用的事件,nullptr时忽略
+     * @param[in] kernel 核函数
+     * ****************************************/
+    void record(cl_event event, cl_kernel kernel) noexcept;
+
+    /*******************************************
+     * @brief 记录一次数据传输
+     * @param[in] event 传输的事件,nullptr时忽略
+     * @param[in] name 传输类型,必须是字符串常量
+     * @param[in] bytes 字节数
+     * ****************************************/
+    void record(cl_event event, const char* name, size_t bytes) noexcept;
+
+    /*******************************************
+     * @brief 读取已完成命令的时间并释放事件
+     * @param[in] wait 是否等待所有命令完成
+     * ****************************************/
+    void collect(bool wait) noexcept;
+
+    /*******************************************
+     * @brief 等待所有命令完成并输出报告
+     * @param[in] fp 输出文件
+     * ****************************************/
+    void print(FILE* fp) noexcept;
+
+    /*******************************************
+     * @brief 等待所有命令完成,每项追加一行JSON到文件
+     * @param[in] file 文件名
+     * @return 是否成功
+     * ****************************************/
+    bool exportJson(const char* file) noexcept;
+
+    /*******************************************
+     * @brief 按环境变量AUTO_BUG_PROFILE输出报告:为1时
+     *        输出到标准错误,否则同时追加JSON到该文件
+     * ****************************************/
+    void report() noexcept;
+
+    /*******************************************
+     * @brief 清空汇总结果
+     * ****************************************/
+    void reset() noexcept;
+
+private:
+    /* 一条未读取时间的命令 */
+    struct Pending
+    {
+        cl_event event;
+        std::string name;
+        bool kernel;
+        double flops;
+        double bytes;
+    };
+
+    /* 一个核函数或传输类型的汇总,时间单位为纳秒 */
+    struct Entry
+    {
+        std::string name;
+        bool kernel;
+        size_t calls;
+        double queued;      // 排队到提交
+        double submitted;   // 提交到开始执行
+        double executed;    // 开始到结束
+        double maxExecuted;
+        double flops;
+        double bytes;
+    };
+
+    /* 核函数每次调用的工作量 */
+    struct Work
+    {
+        double flops;
+        double bytes;
+    };
+
+    bool m_enable;
+    std::string m_device;
+    std::mutex m_mutex;
+    std::vector<Pending> m_pending;
+    std::vector<Entry> m_entries;
+    std::map<cl_kernel, Work> m_work;
+    cl_ulong m_first;       // 最早的排队时间
+    cl_ulong m_last;        // 最晚的结束时间
+
+    /*******************************************
+     * @brief 将一条命令加入待读取列表,过多时先读取
+     *        已完成的命令
+     * @param[in] pending 命令
+     * ****************************************/
+    void m_push(Pending&& pending) noexcept;
+
+    /*******************************************
+     * @brief 读取已完成命令的时间,调用者持有锁
+     * @param[in] wait 是否等待所有命令完成
+     * ****************************************/
+    void m_collect(bool wait) noexcept;
+
+    /*******************************************
+     * @brief 读取一条已完成命令的时间计入汇总
+     * @param[in] pending 命令
+     * ****************************************/
+    void m_account(const Pending& pending) noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_PROFILER_H
\ No newline at end of file
@@ -0,0 +1,311 @@
+#include "ProgramCache.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace AutoBug
+{
+
+ProgramCache::ProgramCache() noexcept
+{
+    const char* dir = getenv("AUTO_BUG_CACHE_DIR");
+    if (dir != nullptr)
+    {
+        m_dir = dir;
+        return;
+    }
+
+    dir = getenv("XDG_CACHE_HOME");
+    if (dir != nullptr && dir[0] != 0)
+    {
+        m_dir = std::string(dir) + "/autobug";
+        return;
+    }
+
+    dir = getenv("HOME");
+    if (dir != nullptr && dir[0] != 0)
+    {
+        m_dir = std::string(dir) + "/.cache/autobug";
+    }
+}
+
+/*******************************************
+ * @brief 设置缓存目录,默认依次使用环境变量
+ *        AUTO_BUG_CACHE_DIR、$XDG_CACHE_HOME/autobug、
+ *        $HOME/.cache/autobug
+ * @param[in] dir 缓存目录,为空时不使用缓存
+ * ****************************************/
+void ProgramCache::setDirectory(const std::string& dir) noexcept
+{
+    m_dir = dir;
+}
+
+/*******************************************
+ * @brief 获取缓存目录
+ * @return 缓存目录,为空表示不使用缓存
+ * ****************************************/
+const std::string& ProgramCache::directory() const noexcept
+{
+    return m_dir;
+}
+
+/*******************************************
+ * @brief 构建OpenCL程序,优先加载缓存的二进制,缓存
+ *        不存在或失效时从源码构建并写入缓存
+ * @param[in] ctx OpenCL上下文
+ * @param[in] pid 平台
+ * @param[in] did 设备
+ * @param[in] source 源码
+ * @param[in] options 构建选项,可以为nullptr
+ * @return 构建好的程序,失败返回nullptr
+ * ****************************************/
+cl_program ProgramCache::build(cl_context ctx, cl_platform_id pid, cl_device_id did, const char* source, const char* options) const noexcept
+{
+    std::string path;
+    if (!m_dir.empty())
+    {
+        path = m_path(pid, did, source, options);
+        cl_program program = m_load(ctx, did, path, options);
+        if (program != nullptr)
+            return program;
+    }
+
+    // 从源码构建
+    int state;
+    size_t len = strlen(source);
+    cl_program program = clCreateProgramWithSource(ctx, 1, &source, &len, &state);
+    if (state != CL_SUCCESS)
+    {
+        fprintf(stderr, "failed to create program\n");
+        return nullptr;
+    }
+
+    state = clBuildProgram(program, 1, &did, options, nullptr, nullptr);
+    if (state != CL_SUCCESS)
+    {
+        size_t len = 0;
+        clGetProgramBuildInfo(program, did, CL_PROGRAM_BUILD_LOG, 0, nullptr, &len);
+        char* msg = new char[len];
+        clGetProgramBuildInfo(program, did, CL_PROGRAM_BUILD_LOG, len, msg, &len);
+        fprintf(stderr, "failed to build program: %*s\n", static_cast<unsigned int>(len), msg);
+        delete[] msg;
+        clReleaseProgram(program);
+        return nullptr;
+    }
+
+    // 写入缓存失败不影响使用
+    if (!path.empty())
+        m_save(program, path);
+
+    return program;
+}
+
+/*******************************************
+ * @brief 检查缓存中是否已有程序的二进制,不检查
+ *        二进制能否加载
+ * @param[in] pid 平台
+ * @param[in] did 设备
+ * @param[in] source 源码
+ * @param[in] options 构建选项,可以为nullptr
+ * @return 是否存在
+ * ****************************************/
+bool ProgramCache::contains(cl_platform_id pid, cl_device_id did, const char* source, const char* options) const noexcept
+{
+    if (m_dir.empty())
+        return false;
+
+    return access(m_path(pid, did, source, options).c_str(), R_OK) == 0;
+}
+
+/*******************************************
+ * @brief 计算FNV-1a哈希
+ * @param[in] data 数据
+ * @param[in] bytes 字节数
+ * @param[in] seed 初始值,用于连续计算多段数据
+ * @return 哈希值
+ * ****************************************/
+uint64_t ProgramCache::hash(const void* data, size_t bytes, uint64_t seed) noexcept
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*******************************************
+ * @brief 计算缓存文件的路径,由平台、设备、驱动版本、
+ *        源码和构建选项共同决定
+ * @param[in] pid 平台
+ * @param[in] did 设备
+ * @param[in] source 源码
+ * @param[in] options 构建选项
+ * @return 缓存文件的路径
+ * ****************************************/
+std::string ProgramCache::m_path(cl_platform_id pid, cl_device_id did, const char* source, const char* options) const noexcept
+{
+    std::vector<char> info;
+    uint64_t h = FNV_OFFSET;
+
+    // 各段之间加入长度,避免拼接后相同
+    auto mix = [&h](const void* data, size_t bytes) {
+        h = hash(&bytes, sizeof(bytes), h);
+        h = hash(data, bytes, h);
+    };
+
+    const cl_platform_info platformParams[] = {CL_PLATFORM_NAME, CL_PLATFORM_VERSION};
+    for (auto param : platformParams)
+    {
+        size_t n = 0;
+        if (clGetPlatformInfo(pid, param, 0, nullptr, &n) != CL_SUCCESS)
+            n = 0;
+        info.resize(n);
+        if (n > 0)
+            clGetPlatformInfo(pid, param, n, info.data(), nullptr);
+        mix(info.data(), n);
+    }
+
+    const cl_device_info deviceParams[] = {CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+    for (auto param : deviceParams)
+    {
+        size_t n = 0;
+        if (clGetDeviceInfo(did, param, 0, nullptr, &n) != CL_SUCCESS)
+            n = 0;
+        info.resize(n);
+        if (n > 0)
+            clGetDeviceInfo(did, param, n, info.data(), nullptr);
+        mix(info.data(), n);
+    }
+
+    mix(source, strlen(source));
+    if (options != nullptr)
+        mix(options, strlen(options));
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", static_cast<unsigned long long>(h));
+    return m_dir + name;
+}
+
+/*******************************************
+ * @brief 从缓存文件加载程序
+ * @param[in] ctx OpenCL上下文
+ * @param[in] did 设备
+ * @param[in] path 缓存文件的路径
+ * @param[in] options 构建选项
+ * @return 程序,缓存不存在或失效时返回nullptr
+ * ****************************************/
+cl_program ProgramCache::m_load(cl_context ctx, cl_device_id did, const std::string& path, const char* options) const noexcept
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr)
+        return nullptr;
+
+    std::vector<unsigned char> binary;
+    cl_program program = nullptr;
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    int status = CL_SUCCESS;
+    int state;
+
+    if (fseek(fp, 0, SEEK_END) != 0)
+        goto EXIT;
+
+    long len;
+    len = ftell(fp);
+    if (len <= 0 || fseek(fp, 0, SEEK_SET) != 0)
+        goto EXIT;
+
+    binary.resize(len);
+    if (fread(binary.data(), 1, binary.size(), fp) != binary.size())
+        goto EXIT;
+
+    // 驱动升级等原因导致二进制失效时,创建或构建会失败,回退到从源码构建
+    data = binary.data();
+    size = binary.size();
+    program = clCreateProgramWithBinary(ctx, 1, &did, &size, &data, &status, &state);
+    if (state != CL_SUCCESS || status != CL_SUCCESS)
+    {
+        if (program != nullptr)
+            clReleaseProgram(program);
+        program = nullptr;
+        goto EXIT;
+    }
+
+    state = clBuildProgram(program, 1, &did, options, nullptr, nullptr);
+    if (state != CL_SUCCESS)
+    {
+        clReleaseProgram(program);
+        program = nullptr;
+    }
+
+EXIT:
+    fclose(fp);
+    return program;
+}
+
+/*******************************************
+ * @brief 将程序的二进制写入缓存文件
+ * @param[in] program 构建好的程序
+ * @param[in] path 缓存文件的路径
+ * @return 是否成功
+ * ****************************************/
+bool ProgramCache::m_save(cl_program program, const std::string& path) const noexcept
+{
+    size_t size = 0;
+    int state = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr);
+    if (state != CL_SUCCESS || size == 0)
+        return false;
+
+    std::vector<unsigned char> binary(size);
+    unsigned char* data = binary.data();
+    state = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, nullptr);
+    if (state != CL_SUCCESS)
+        return false;
+
+    if (!makeDirs(m_dir))
+        return false;
+
+    // 先写临时文件再改名,多个进程同时写入时不会读到不完整的文件
+    std::string temp = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE* fp = fopen(temp.c_str(), "wb");
+    if (fp == nullptr)
+        return false;
+
+    bool success = fwrite(binary.data(), 1, binary.size(), fp) == binary.size();
+    success = (fclose(fp) == 0) && success;
+    if (!success || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        remove(temp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*******************************************
+ * @brief 逐级创建目录
+ * @param[in] dir 目录
+ * @return 是否成功
+ * ****************************************/
+bool ProgramCache::makeDirs(const std::string& dir) noexcept
+{
+    for (size_t i = 1; i <= dir.size(); i++)
+    {
+        if (i < dir.size() && dir[i] != '/')
+            continue;
+
+        std::string sub = dir.substr(0, i);
+        if (mkdir(sub.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef AUTO_BUG_PROGRAM_CACHE_H
+#define AUTO_BUG_PROGRAM_CACHE_H
+
+#ifndef CL_HPP_TARGET_OPENCL_VERSION
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#endif // CL_HPP_TARGET_OPENCL_VERSION
+#include <CL/cl2.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace AutoBug
+{
+
+class ProgramCache
+{
+public:
+    /* FNV-1a哈希的初始值 */
+    static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+
+    ~ProgramCache() noexcept = default;
+    ProgramCache() noexcept;
+    ProgramCache(const ProgramCache&) = delete;
+    ProgramCache(ProgramCache&&) = delete;
+
+    /*******************************************
+     * @brief 设置缓存目录,默认依次使用环境变量
+     *        AUTO_BUG_CACHE_DIR、$XDG_CACHE_HOME/autobug、
+     *        $HOME/.cache/autobug
+     * @param[in] dir 缓存目录,为空时不使用缓存
+     * ****************************************/
+    void setDirectory(const std::string& dir) noexcept;
+
+    /*******************************************
+     * @brief 获取缓存目录
+     * @return 缓存目录,为空表示不使用缓存
+     * ****************************************/
+    const std::string& directory() const noexcept;
+
+    /*******************************************
+     * @brief 构建OpenCL程序,优先加载缓存的二进制,缓存
+     *        不存在或失效时从源码构建并写入缓存
+     * @param[in] ctx OpenCL上下文
+     * @param[in] pid 平台
+     * @param[in] did 设备
+     * @param[in] source 源码
+     * @param[in] options 构建选项,可以为nullptr
+     * @return 构建好的程序,失败返回nullptr
+     * ****************************************/
+    cl_program build(cl_context ctx, cl_platform_id pid, cl_device_id did, const char* source, const char* options) const noexcept;
+
+    /*******************************************
+     * @brief 检查缓存中是否已有程序的二进制,不检查
+     *        二进制能否加载
+     * @param[in] pid 平台
+     * @param[in] did 设备
+     * @param[in] source 源码
+     * @param[in] options 构建选项,可以为nullptr
+     * @return 是否存在
+     * ****************************************/
+    bool contains(cl_platform_id pid, cl_device_id did, const char* source, const char* options) const noexcept;
+
+    /*******************************************
+     * @brief 计算FNV-1a哈希
+     * @param[in] data 数据
+     * @param[in] bytes 字节数
+     * @param[in] seed 初始值,用于连续计算多段数据
+     * @return 哈希值
+     * ****************************************/
+    static uint64_t hash(const void* data, size_t bytes, uint64_t seed = FNV_OFFSET) noexcept;
+
+    /*******************************************
+     * @brief 逐级创建目录
+     * @param[in] dir 目录
+     * @return 是否成功
+     * ****************************************/
+    static bool makeDirs(const std::string& dir) noexcept;
+
+private:
+    std::string m_dir;
+
+    /*******************************************
+     * @brief 计算缓存文件的路径,由平台、设备、驱动版本、
+     *        源码和构建选项共同决定
+     * @param[in] pid 平台
+     * @param[in] did 设备
+     * @param[in] source 源码
+     * @param[in] options 构建选项
+     * @return 缓存文件的路径
+     * ****************************************/
+    std::string m_path(cl_platform_id pid, cl_device_id did, const char* source, const char* options) const noexcept;
+
+    /*******************************************
+     * @brief 从缓存文件加载程序
+     * @param[in] ctx OpenCL上下文
+     * @param[in] did 设备
+     * @param[in] path 缓存文件的路径
+     * @param[in] options 构建选项
+     * @return 程序,缓存不存在或失效时返回nullptr
+     * ****************************************/
+    cl_program m_load(cl_context ctx, cl_device_id did, const std::string& path, const char* options) const noexcept;
+
+    /*******************************************
+     * @brief 将程序的二进制写入缓存文件
+     * @param[in] program 构建好的程序
+     * @param[in] path 缓存文件的路径
+     * @return 是否成功
+     * ****************************************/
+    bool m_save(cl_program program, const std::string& path) const noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_PROGRAM_CACHE_H
\ No newline at end of file
@@ -0,0 +1,450 @@
+#include "QuantizedSet.h"
+#include <cstdio>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AUTO_BUG_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace AutoBug
+{
+
+/*******************************************
+ * @brief 计算8位整数坐标与float坐标的点积
+ * @param[in] x 8位整数坐标
+ * @param[in] v float坐标
+ * @param[in] dims 维度
+ * @return 点积
+ * ****************************************/
+static float dotU8(const uint8_t* x, const float* v, int dims) noexcept
+{
+    float sum = 0.0f;
+    for (int i = 0; i < dims; i++)
+    {
+        sum += x[i] * v[i];
+    }
+    return sum;
+}
+
+/*******************************************
+ * @brief 计算半精度坐标与float坐标的点积
+ * @param[in] x 半精度坐标
+ * @param[in] v float坐标
+ * @param[in] dims 维度
+ * @return 点积
+ * ****************************************/
+static float dotF16(const uint16_t* x, const float* v, int dims) noexcept
+{
+    float sum = 0.0f;
+    for (int i = 0; i < dims; i++)
+    {
+        sum += QuantizedSet::fromHalf(x[i]) * v[i];
+    }
+    return sum;
+}
+
+#ifdef AUTO_BUG_X86_SIMD
+
+/*******************************************
+ * @brief 对8个float求和
+ * @param[in] v 向量
+ * @return 元素之和
+ * ****************************************/
+__attribute__((target("avx2,fma")))
+static float hsumAvx2(__m256 v) noexcept
+{
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+    return _mm_cvtss_f32(x);
+}
+
+/*******************************************
+ * @brief dotU8的AVX2版本,每次处理16个维度
+ * ****************************************/
+__attribute__((target("avx2,fma")))
+static float dotU8Avx2(const uint8_t* x, const float* v, int dims) noexcept
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= dims; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+        acc0 = _mm256_fmadd_ps(lo, _mm256_loadu_ps(v + i), acc0);
+        acc1 = _mm256_fmadd_ps(hi, _mm256_loadu_ps(v + i + 8), acc1);
+    }
+
+    float sum = hsumAvx2(_mm256_add_ps(acc0, acc1));
+    for (; i < dims; i++)
+    {
+        sum += x[i] * v[i];
+    }
+    return sum;
+}
+
+/*******************************************
+ * @brief dotF16的AVX2+F16C版本,每次处理16个维度
+ * ****************************************/
+__attribute__((target("avx2,fma,f16c")))
+static float dotF16Avx2(const uint16_t* x, const float* v, int dims) noexcept
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= dims; i += 16)
+    {
+        __m256 lo = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+        __m256 hi = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i + 8)));
+        acc0 = _mm256_fmadd_ps(lo, _mm256_loadu_ps(v + i), acc0);
+        acc1 = _mm256_fmadd_ps(hi, _mm256_loadu_ps(v + i + 8), acc1);
+    }
+
+    float sum = hsumAvx2(_mm256_add_ps(acc0, acc1));
+    for (; i < dims; i++)
+    {
+        sum += QuantizedSet::fromHalf(x[i]) * v[i];
+    }
+    return sum;
+}
+
+#endif // AUTO_BUG_X86_SIMD
+
+/* 运行时根据CPU特性选择点积实现 */
+typedef float (*DotU8Fn)(const uint8_t*, const float*, int);
+typedef float (*DotF16Fn)(const uint16_t*, const float*, int);
+
+static DotU8Fn selectDotU8() noexcept
+{
+#ifdef AUTO_BUG_X86_SIMD
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return dotU8Avx2;
+#endif
+    return dotU8;
+}
+
+static DotF16Fn selectDotF16() noexcept
+{
+#ifdef AUTO_BUG_X86_SIMD
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+        return dotF16Avx2;
+#endif
+    return dotF16;
+}
+
+QuantizedSet::QuantizedSet() noexcept :
+    m_format(NONE),
+    m_rows(0),
+    m_dims(0),
+    m_stride(0),
+    m_data(nullptr)
+{
+
+}
+
+/*******************************************
+ * @brief 将数据集转换为紧凑存储,会清空以前的数据;
+ *        内存不足时格式变为NONE,调用者改用float样本
+ * @param[in] dataset 数据集
+ * @param[in] format 存储格式
+ * ****************************************/
+void QuantizedSet::build(const std::vector<Text>& dataset, Format format) noexcept
+{
+    m_arena.reset();
+    m_norms.clear();
+    m_format = format;
+    m_rows = dataset.size();
+    m_dims = m_rows > 0 ? dataset[0].dims() : 0;
+    m_stride = (m_dims + ALIGN - 1) / ALIGN * ALIGN;
+    m_data = nullptr;
+
+    if (m_format == NONE || m_rows == 0)
+        return;
+
+    // 按页对齐并补齐到缓存行,集成显卡可以直接使用这段内存而不复制
+    size_t size = (bytes() + 63) / 64 * 64;
+    m_data = m_arena.alloc(size, PAGE_ALIGN);
+    if (m_data == nullptr)
+    {
+        fprintf(stderr, "failed to allocate %zu bytes for quantized samples, using float\n", size);
+        m_format = NONE;
+        m_rows = 0;
+        return;
+    }
+    memset(m_data, 0, size);
+    m_norms.resize(m_rows);
+
+    for (size_t row = 0; row < m_rows; row++)
+    {
+        const Text& text = dataset[row];
+        float norm = 0.0f;
+        if (m_format == U8)
+        {
+            // 计数为整数,平方和可以精确计算
+            uint8_t* dst = static_cast<uint8_t*>(m_data) + row * m_stride;
+            uint32_t sum = 0;
+            for (int i = 0; i < m_dims; i++)
+            {
+                float n = text[i];
+                dst[i] = n <= 0.0f ? 0 : (n >= 255.0f ? 255 : static_cast<uint8_t>(n + 0.5f));
+                sum += static_cast<uint32_t>(dst[i]) * dst[i];
+            }
+            norm = static_cast<float>(sum);
+        }
+        else
+        {
+            uint16_t* dst = static_cast<uint16_t*>(m_data) + row * m_stride;
+            for (int i = 0; i < m_dims; i++)
+            {
+                dst[i] = toHalf(text[i]);
+                float n = fromHalf(dst[i]);
+                norm += n * n;
+            }
+        }
+        m_norms[row] = norm;
+    }
+}
+
+/*******************************************
+ * @brief 获取存储格式
+ * @return 存储格式
+ * ****************************************/
+QuantizedSet::Format QuantizedSet::format() const noexcept
+{
+    return m_format;
+}
+
+/*******************************************
+ * @brief 获取样本数量
+ * @return 样本数量
+ * ****************************************/
+size_t QuantizedSet::rows() const noexcept
+{
+    return m_rows;
+}
+
+/*******************************************
+ * @brief 获取超空间总维数
+ * @return 超空间的总维数
+ * ****************************************/
+int QuantizedSet::dims() const noexcept
+{
+    return m_dims;
+}
+
+/*******************************************
+ * @brief 获取每行的元素个数(含对齐填充)
+ * @return 每行的元素个数
+ * ****************************************/
+size_t QuantizedSet::stride() const noexcept
+{
+    return m_stride;
+}
+
+/*******************************************
+ * @brief 获取紧凑存储的数据
+ * @return 数据
+ * ****************************************/
+const void* QuantizedSet::data() const noexcept
+{
+    return m_data;
+}
+
+/*******************************************
+ * @brief 获取紧凑存储的总字节数
+ * @return 总字节数
+ * ****************************************/
+size_t QuantizedSet::bytes() const noexcept
+{
+    switch (m_format)
+    {
+    case U8:
+        return m_rows * m_stride * sizeof(uint8_t);
+    case F16:
+        return m_rows * m_stride * sizeof(uint16_t);
+    default:
+        return 0;
+    }
+}
+
+/*******************************************
+ * @brief 计算一个样本与一个float坐标之间欧氏距离的平方
+ * @param[in] row 样本序号
+ * @param[in] center 坐标,长度为dims
+ * @return 欧氏距离的平方
+ * ****************************************/
+float QuantizedSet::squaredDistance(size_t row, const float* center) const noexcept
+{
+    float norm = 0.0f;
+    for (int i = 0; i < m_dims; i++)
+    {
+        norm += center[i] * center[i];
+    }
+
+    float d = m_norms[row] - 2.0f * m_dot(row, center) + norm;
+    return d < 0.0f ? 0.0f : d;
+}
+
+/*******************************************
+ * @brief 查找距离样本最近的中心点
+ * @param[in] row 样本序号
+ * @param[in] centers k个中心点,按行连续存放,每行dims个元素
+ * @param[in] norms 各个中心点坐标的平方和
+ * @param[in] k 中心点数量
+ * @param[out] distance 最近距离的平方,可以为nullptr
+ * @return 最近的中心点序号
+ * ****************************************/
+size_t QuantizedSet::nearest(size_t row, const float* centers, const float* norms, size_t k, float* distance) const noexcept
+{
+    // |x-c|^2 = |x|^2 - 2x·c + |c|^2,每个中心点只需要一次点积
+    size_t p = 0;
+    float nearest = m_norms[row] - 2.0f * m_dot(row, centers) + norms[0];
+    for (size_t i = 1; i < k; i++)
+    {
+        float d = m_norms[row] - 2.0f * m_dot(row, centers + i * m_dims) + norms[i];
+        if (d < nearest)
+        {
+            p = i;
+            nearest = d;
+        }
+    }
+
+    if (distance != nullptr)
+        *distance = nearest < 0.0f ? 0.0f : nearest;
+    return p;
+}
+
+/*******************************************
+ * @brief 将一个样本的坐标累加到向量上
+ * @param[in] row 样本序号
+ * @param[out] sum 累加的目标向量,长度为dims
+ * ****************************************/
+void QuantizedSet::accumulate(size_t row, float* sum) const noexcept
+{
+    if (m_format == U8)
+    {
+        const uint8_t* x = static_cast<const uint8_t*>(m_data) + row * m_stride;
+        for (int i = 0; i < m_dims; i++)
+        {
+            sum[i] += x[i];
+        }
+    }
+    else if (m_format == F16)
+    {
+        const uint16_t* x = static_cast<const uint16_t*>(m_data) + row * m_stride;
+        for (int i = 0; i < m_dims; i++)
+        {
+            sum[i] += fromHalf(x[i]);
+        }
+    }
+}
+
+/*******************************************
+ * @brief float转换为半精度浮点,就近舍入
+ * @param[in] value float值
+ * @return 半精度浮点的位模式
+ * ****************************************/
+uint16_t QuantizedSet::toHalf(float value) noexcept
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // NaN和无穷大
+    if (((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+
+    // 溢出为无穷大
+    if (exponent >= 0x1f)
+        return sign | 0x7c00;
+
+    // 非规格化数或者下溢为0
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t middle = 1u << (shift - 1);
+        if (rest > middle || (rest == middle && (half & 1)))
+            half++;
+        return sign | static_cast<uint16_t>(half);
+    }
+
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;     // 进位可能溢出到指数,结果仍然正确
+    return sign | static_cast<uint16_t>(half);
+}
+
+/*******************************************
+ * @brief 半精度浮点转换为float
+ * @param[in] value 半精度浮点的位模式
+ * @return float值
+ * ****************************************/
+float QuantizedSet::fromHalf(uint16_t value) noexcept
+{
+    uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // 非规格化数,规格化后转换
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exponent == 0x1f)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+/*******************************************
+ * @brief 计算样本与坐标的点积
+ * @param[in] row 样本序号
+ * @param[in] v 坐标,长度为dims
+ * @return 点积
+ * ****************************************/
+float QuantizedSet::m_dot(size_t row, const float* v) const noexcept
+{
+    static const DotU8Fn u8 = selectDotU8();
+    static const DotF16Fn f16 = selectDotF16();
+
+    if (m_format == U8)
+        return u8(static_cast<const uint8_t*>(m_data) + row * m_stride, v, m_dims);
+    else
+        return f16(static_cast<const uint16_t*>(m_data) + row * m_stride, v, m_dims);
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef AUTO_BUG_QUANTIZED_SET_H
+#define AUTO_BUG_QUANTIZED_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Text.h"
+#include "Arena.h"
+
+namespace AutoBug
+{
+
+class QuantizedSet
+{
+public:
+    /* 存储格式 */
+    enum Format
+    {
+        NONE,   // 不量化,使用Text中的float坐标
+        U8,     // 8位无符号整数,适用于字符计数,超过255的截断为255
+        F16,    // 16位半精度浮点,适用于归一化后的坐标
+    };
+
+    /* 每行对齐的元素个数,便于SIMD整块读取 */
+    static const size_t ALIGN = 32;
+
+    /* 样本矩阵的起始地址对齐字节数,与Accelerator::HOST_ALIGN一致 */
+    static const size_t PAGE_ALIGN = 4096;
+
+    ~QuantizedSet() noexcept = default;
+    QuantizedSet() noexcept;
+    QuantizedSet(const QuantizedSet&) = delete;
+    QuantizedSet(QuantizedSet&&) = delete;
+
+    /*******************************************
+     * @brief 将数据集转换为紧凑存储,会清空以前的数据;
+     *        内存不足时格式变为NONE,调用者改用float样本
+     * @param[in] dataset 数据集
+     * @param[in] format 存储格式
+     * ****************************************/
+    void build(const std::vector<Text>& dataset, Format format) noexcept;
+
+    /*******************************************
+     * @brief 获取存储格式
+     * @return 存储格式
+     * ****************************************/
+    Format format() const noexcept;
+
+    /*******************************************
+     * @brief 获取样本数量
+     * @return 样本数量
+     * ****************************************/
+    size_t rows() const noexcept;
+
+    /*******************************************
+     * @brief 获取超空间总维数
+     * @return 超空间的总维数
+     * ****************************************/
+    int dims() const noexcept;
+
+    /*******************************************
+     * @brief 获取每行的元素个数(含对齐填充)
+     * @return 每行的元素个数
+     * ****************************************/
+    size_t stride() const noexcept;
+
+    /*******************************************
+     * @brief 获取紧凑存储的数据
+     * @return 数据
+     * ****************************************/
+    const void* data() const noexcept;
+
+    /*******************************************
+     * @brief 获取紧凑存储的总字节数
+     * @return 总字节数
+     * ****************************************/
+    size_t bytes() const noexcept;
+
+    /*******************************************
+     * @brief 计算一个样本与一个float坐标之间欧氏距离的平方
+     * @param[in] row 样本序号
+     * @param[in] center 坐标,长度为dims
+     * @return 欧氏距离的平方
+     * ****************************************/
+    float squaredDistance(size_t row, const float* center) const noexcept;
+
+    /*******************************************
+     * @brief 查找距离样本最近的中心点
+     * @param[in] row 样本序号
+     * @param[in] centers k个中心点,按行连续存放,每行dims个元素
+     * @param[in] norms 各个中心点坐标的平方和
+     * @param[in] k 中心点数量
+     * @param[out] distance 最近距离的平方,可以为nullptr
+     * @return 最近的中心点序号
+     * ****************************************/
+    size_t nearest(size_t row, const float* centers, const float* norms, size_t k, float* distance=nullptr) const noexcept;
+
+    /*******************************************
+     * @brief 将一个样本的坐标累加到向量上
+     * @param[in] row 样本序号
+     * @param[out] sum 累加的目标向量,长度为dims
+     * ****************************************/
+    void accumulate(size_t row, float* sum) const noexcept;
+
+    /*******************************************
+     * @brief float转换为半精度浮点
+     * @param[in] value float值
+     * @return 半精度浮点的位模式
+     * ****************************************/
+    static uint16_t toHalf(float value) noexcept;
+
+    /*******************************************
+     * @brief 半精度浮点转换为float
+     * @param[in] value 半精度浮点的位模式
+     * @return float值
+     * ****************************************/
+    static float fromHalf(uint16_t value) noexcept;
+
+private:
+    Arena m_arena;
+    Format m_format;
+    size_t m_rows;
+    int m_dims;
+    size_t m_stride;
+    void* m_data;
+    std::vector<float> m_norms;     // 各个样本坐标的平方和
+
+    /*******************************************
+     * @brief 计算样本与坐标的点积
+     * @param[in] row 样本序号
+     * @param[in] v 坐标,长度为dims
+     * @return 点积
+     * ****************************************/
+    float m_dot(size_t row, const float* v) const noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_QUANTIZED_SET_H
\ No newline at end of file
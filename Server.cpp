@@ -0,0 +1,527 @@
+#include "Server.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace AutoBug
+{
+
+// 一次读取的字节数
+static const size_t READ_SIZE = 64 * 1024;
+
+// 一行的最大长度,超过时关闭连接
+static const size_t MAX_LINE = 64 * 1024;
+
+// 一个连接尚未写出的输出超过该长度时暂停读取,写出后恢复
+static const size_t MAX_OUTPUT = MAX_LINE * 16;
+
+// 计算分位数时保留的最近请求数量
+static const size_t LATENCY_SAMPLES = 1 << 16;
+
+/*******************************************
+ * @brief 把文件描述符设置为非阻塞
+ * @param[in] fd 文件描述符
+ * @return 是否成功
+ * ****************************************/
+static bool setNonBlock(int fd) noexcept
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+Server::~Server() noexcept
+{
+    for (auto& item : m_connections)
+    {
+        close(item.second.fd);
+    }
+
+    if (m_listen >= 0)
+    {
+        close(m_listen);
+        unlink(m_path.c_str());
+    }
+
+    if (m_wakeup[0] >= 0)
+    {
+        close(m_wakeup[0]);
+        close(m_wakeup[1]);
+    }
+}
+
+Server::Server(const Model& model, const DimMap& dimMap) noexcept :
+    m_model(model),
+    m_dimMap(dimMap),
+    m_maxBatch(256),
+    m_maxWait(std::chrono::microseconds(2000)),
+    m_listen(-1),
+    m_wakeup{-1, -1},
+    m_nextConnection(0),
+    m_start(Clock::now()),
+    m_requestCount(0),
+    m_batchCount(0),
+    m_connectionCount(0),
+    m_latencyNext(0)
+{
+    if (pipe(m_wakeup) != 0 || !setNonBlock(m_wakeup[0]) || !setNonBlock(m_wakeup[1]))
+    {
+        fprintf(stderr, "failed to create wakeup pipe: %s\n", strerror(errno));
+        m_wakeup[0] = m_wakeup[1] = -1;
+    }
+}
+
+/*******************************************
+ * @brief 设置批次大小和延迟预算
+ * @param[in] maxBatch 攒够这么多请求立即分类
+ * @param[in] maxWait 最早的请求最多等待的时间(微秒)
+ * ****************************************/
+void Server::setBatch(size_t maxBatch, int maxWait) noexcept
+{
+    m_maxBatch = maxBatch > 0 ? maxBatch : 1;
+    m_maxWait = std::chrono::microseconds(maxWait > 0 ? maxWait : 0);
+}
+
+/*******************************************
+ * @brief 在Unix域套接字上监听,路径上已有的套接字
+ *        文件会被删除
+ * @param[in] path 套接字路径
+ * @return 是否成功
+ * ****************************************/
+bool Server::listen(const char* path) noexcept
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path is too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    // 只删除上次运行留下的套接字,不删除同名的普通文件
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    m_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listen < 0)
+    {
+        fprintf(stderr, "failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (bind(m_listen, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(m_listen, SOMAXCONN) != 0 || !setNonBlock(m_listen))
+    {
+        fprintf(stderr, "failed to listen on %s: %s\n", path, strerror(errno));
+        close(m_listen);
+        m_listen = -1;
+        return false;
+    }
+
+    m_path = path;
+    return true;
+}
+
+/*******************************************
+ * @brief 运行事件循环,直到stop被调用;有等待的请求时
+ *        poll的超时为最早的请求剩余的延迟预算
+ * @return 是否正常退出
+ * ****************************************/
+bool Server::run() noexcept
+{
+    if (m_listen < 0 || m_wakeup[0] < 0)
+        return false;
+
+    std::vector<pollfd> fds;
+    std::vector<uint64_t> keys;
+    m_start = Clock::now();
+    while (true)
+    {
+        fds.clear();
+        keys.clear();
+        fds.push_back(pollfd{m_wakeup[0], POLLIN, 0});
+        fds.push_back(pollfd{m_listen, POLLIN, 0});
+        for (auto& item : m_connections)
+        {
+            // 已关闭输入且没有输出的连接不再poll,否则POLLHUP会一直返回;
+            // 对端不读取回复时输出积压,暂停读取直到写出
+            const Connection& conn = item.second;
+            short events = conn.closing || conn.output.size() > MAX_OUTPUT ? 0 : POLLIN;
+            if (!conn.output.empty())
+                events |= POLLOUT;
+            fds.push_back(pollfd{events != 0 ? conn.fd : -1, events, 0});
+            keys.push_back(item.first);
+        }
+
+        int timeout = -1;
+        if (!m_requests.empty())
+        {
+            auto left = m_requests.front().arrival + m_maxWait - Clock::now();
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+            timeout = ms > 0 ? static_cast<int>(ms) : 0;
+            // poll只能精确到毫秒,不足1毫秒的剩余时间向上取整
+            if (left > std::chrono::milliseconds(timeout))
+                timeout += 1;
+        }
+
+        int n = poll(fds.data(), fds.size(), timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        if (n > 0 && fds[0].revents != 0)
+        {
+            char buffer[64];
+            while (read(m_wakeup[0], buffer, sizeof(buffer)) > 0)
+            {
+
+            }
+            break;
+        }
+
+        if (n > 0 && fds[1].revents != 0)
+            m_accept();
+
+        for (size_t i = 0; n > 0 && i < keys.size(); i++)
+        {
+            short revents = fds[i + 2].revents;
+            if (revents == 0)
+                continue;
+
+            auto iter = m_connections.find(keys[i]);
+            Connection& conn = iter->second;
+            bool alive = true;
+            if ((revents & (POLLIN | POLLHUP | POLLERR)) && conn.output.size() <= MAX_OUTPUT)
+                alive = m_read(keys[i], conn);
+            if (alive && (revents & POLLOUT))
+                alive = m_write(conn);
+            if (!alive)
+            {
+                m_close(conn);
+                m_connections.erase(iter);
+            }
+        }
+
+        if (m_ready())
+            m_flush();
+
+        // 输出尽早写出,不必等下一次POLLOUT
+        for (auto iter = m_connections.begin(); iter != m_connections.end();)
+        {
+            Connection& conn = iter->second;
+            bool alive = conn.output.empty() || m_write(conn);
+            // 对端已关闭输入,等待中的请求也已回复后关闭
+            if (alive && conn.closing && conn.output.empty())
+                alive = conn.pending > 0;
+
+            if (alive)
+            {
+                ++iter;
+            }
+            else
+            {
+                m_close(conn);
+                iter = m_connections.erase(iter);
+            }
+        }
+    }
+
+    return true;
+}
+
+/*******************************************
+ * @brief 请求事件循环退出,只调用write,可以在信号
+ *        处理函数中调用
+ * ****************************************/
+void Server::stop() noexcept
+{
+    if (m_wakeup[1] >= 0)
+    {
+        char ch = 0;
+        ssize_t ret = write(m_wakeup[1], &ch, 1);
+        (void)ret;
+    }
+}
+
+/*******************************************
+ * @brief 获取统计的JSON格式,延迟为最近的请求从
+ *        收到到结果写入输出缓冲的时间
+ * @return JSON字符串,不含换行
+ * ****************************************/
+std::string Server::stats() const noexcept
+{
+    std::vector<float> latencies(m_latencies);
+    float p50 = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+    if (!latencies.empty())
+    {
+        size_t i50 = latencies.size() / 2;
+        size_t i99 = latencies.size() * 99 / 100;
+        std::nth_element(latencies.begin(), latencies.begin() + i50, latencies.end());
+        p50 = latencies[i50];
+        std::nth_element(latencies.begin(), latencies.begin() + i99, latencies.end());
+        p99 = latencies[i99];
+        max = *std::max_element(latencies.begin() + i99, latencies.end());
+    }
+
+    double uptime = std::chrono::duration<double>(Clock::now() - m_start).count();
+    char buffer[384];
+    snprintf(buffer, sizeof(buffer),
+        "{\"uptime_s\":%.3f,\"requests\":%llu,\"batches\":%llu,\"mean_batch\":%.2f,"
+        "\"connections\":%llu,\"open_connections\":%zu,\"requests_per_s\":%.1f,"
+        "\"latency_samples\":%zu,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}",
+        uptime, static_cast<unsigned long long>(m_requestCount), static_cast<unsigned long long>(m_batchCount),
+        m_batchCount > 0 ? static_cast<double>(m_requestCount) / m_batchCount : 0.0,
+        static_cast<unsigned long long>(m_connectionCount), m_connections.size(),
+        uptime > 0 ? m_requestCount / uptime : 0.0,
+        latencies.size(), p50, p99, max);
+    return buffer;
+}
+
+/*******************************************
+ * @brief 接受所有等待中的新连接
+ * ****************************************/
+void Server::m_accept() noexcept
+{
+    while (true)
+    {
+        int fd = accept(m_listen, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            return;
+        }
+
+        if (!setNonBlock(fd))
+        {
+            close(fd);
+            continue;
+        }
+
+        Connection& conn = m_connections[m_nextConnection++];
+        conn.fd = fd;
+        conn.lineNo = 0;
+        conn.pending = 0;
+        conn.closing = false;
+        m_connectionCount++;
+    }
+}
+
+/*******************************************
+ * @brief 读取连接的输入并拆分成请求,尚未写出的
+ *        输出积压时停止读取
+ * @param[in] key 连接编号
+ * @param[in] conn 连接
+ * @return 连接是否仍然可用
+ * ****************************************/
+bool Server::m_read(uint64_t key, Connection& conn) noexcept
+{
+    char buffer[READ_SIZE];
+    while (!conn.closing && conn.output.size() <= MAX_OUTPUT)
+    {
+        ssize_t n = read(conn.fd, buffer, sizeof(buffer));
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        if (n == 0)
+        {
+            // 对端关闭输入,最后一行可以没有换行
+            conn.closing = true;
+            if (!conn.input.empty())
+                m_handleLine(key, conn, conn.input.data(), conn.input.size());
+            conn.input.clear();
+            break;
+        }
+
+        conn.input.append(buffer, n);
+        size_t pos = 0;
+        while (true)
+        {
+            const char* line = conn.input.data() + pos;
+            const char* newline = static_cast<const char*>(memchr(line, '\n', conn.input.size() - pos));
+            if (newline == nullptr)
+                break;
+            m_handleLine(key, conn, line, newline - line);
+            pos += newline - line + 1;
+        }
+        conn.input.erase(0, pos);
+
+        if (conn.input.size() > MAX_LINE)
+        {
+            fprintf(stderr, "line is longer than %zu bytes, closing connection\n", MAX_LINE);
+            return false;
+        }
+    }
+
+    if (m_requests.size() >= m_maxBatch)
+        m_flush();
+    return true;
+}
+
+/*******************************************
+ * @brief 写出连接的输出,写不完的部分留到下次
+ * @param[in] conn 连接
+ * @return 连接是否仍然可用
+ * ****************************************/
+bool Server::m_write(Connection& conn) noexcept
+{
+    size_t pos = 0;
+    while (pos < conn.output.size())
+    {
+        ssize_t n = send(conn.fd, conn.output.data() + pos, conn.output.size() - pos, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        pos += n;
+    }
+    conn.output.erase(0, pos);
+    return true;
+}
+
+/*******************************************
+ * @brief 处理一行输入,标题加入等待的批次,命令
+ *        立即回复
+ * @param[in] key 连接编号
+ * @param[in] conn 连接
+ * @param[in] line 行
+ * @param[in] len 长度,不含换行
+ * ****************************************/
+void Server::m_handleLine(uint64_t key, Connection& conn, const char* line, size_t len) noexcept
+{
+    conn.lineNo++;
+    if (len > 0 && line[len - 1] == '\r')
+        len--;
+    if (len == 0)
+        return;
+
+    // 先回复等待中的请求,保持同一连接上回复的顺序
+    if (line[0] == '#')
+    {
+        if (!m_requests.empty())
+            m_flush();
+
+        std::string command(line + 1, len - 1);
+        if (command == "stats")
+            conn.output += stats() + "\n";
+        else
+            conn.output += "#error unknown command " + command + "\n";
+        return;
+    }
+
+    const char* tab = static_cast<const char*>(memchr(line, '\t', len));
+    if (tab != nullptr)
+    {
+        m_ids.append(line, tab - line);
+        m_batch.add(tab + 1, line + len - tab - 1, m_dimMap);
+    }
+    else
+    {
+        m_ids += std::to_string(conn.lineNo);
+        m_batch.add(line, len, m_dimMap);
+    }
+    m_requests.push_back(Request{key, m_ids.size(), Clock::now()});
+    conn.pending++;
+    TRACE_COUNT("server.requests", 1);
+}
+
+/*******************************************
+ * @brief 检查是否应该立即分类等待的请求:攒够一批、
+ *        最早的请求用完延迟预算,或者每个连接都在
+ *        等待回复,不会再有新的请求加入这一批
+ * @return 是否立即分类
+ * ****************************************/
+bool Server::m_ready() const noexcept
+{
+    if (m_requests.empty())
+        return false;
+
+    if (m_requests.size() >= m_maxBatch || Clock::now() >= m_requests.front().arrival + m_maxWait)
+        return true;
+
+    for (auto& item : m_connections)
+    {
+        if (!item.second.closing && item.second.pending == 0)
+            return false;
+    }
+    return true;
+}
+
+/*******************************************
+ * @brief 对所有等待的请求分类,结果按请求的顺序追加
+ *        到各连接的输出中
+ * ****************************************/
+void Server::m_flush() noexcept
+{
+    TRACE_SCOPE("Server::flush");
+    size_t n = m_requests.size();
+    m_groups.resize(n);
+    m_distances.resize(n);
+    m_model.classify(m_batch, m_groups.data(), m_distances.data());
+
+    auto now = Clock::now();
+    size_t begin = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const Request& req = m_requests[i];
+        auto iter = m_connections.find(req.connection);
+        if (iter != m_connections.end())
+        {
+            iter->second.pending = 0;
+            char line[48];
+            int len = snprintf(line, sizeof(line), "\t%d\t%.4f\n", m_groups[i], m_distances[i]);
+            iter->second.output.append(m_ids, begin, req.idEnd - begin);
+            iter->second.output.append(line, len);
+        }
+        begin = req.idEnd;
+
+        float latency = std::chrono::duration<float, std::micro>(now - req.arrival).count();
+        if (m_latencies.size() < LATENCY_SAMPLES)
+            m_latencies.push_back(latency);
+        else
+            m_latencies[m_latencyNext] = latency;
+        m_latencyNext = (m_latencyNext + 1) % LATENCY_SAMPLES;
+    }
+
+    m_requestCount += n;
+    m_batchCount += 1;
+    m_batch.clear();
+    m_ids.clear();
+    m_requests.clear();
+}
+
+/*******************************************
+ * @brief 关闭一个连接,它等待中的请求分类后丢弃结果
+ * @param[in] conn 连接
+ * ****************************************/
+void Server::m_close(Connection& conn) noexcept
+{
+    close(conn.fd);
+    conn.fd = -1;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
@@ -0,0 +1,167 @@
+#ifndef AUTO_BUG_SERVER_H
+#define AUTO_BUG_SERVER_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "DimMap.h"
+#include "Model.h"
+
+namespace AutoBug
+{
+
+/* 常驻的分类服务,在Unix域套接字上接收请求,把多个连接
+ * 的请求合并成小批次分类
+ *
+ * 协议与classify命令相同:每行一个标题,或者id<TAB>标题,
+ * 返回id<TAB>分组<TAB>距离;以#开头的行是命令,#stats
+ * 返回一行JSON格式的统计 */
+class Server
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    ~Server() noexcept;
+
+    /*******************************************
+     * @brief 创建服务
+     * @param[in] model 模型,服务运行期间必须有效
+     * @param[in] dimMap 维度映射表
+     * ****************************************/
+    Server(const Model& model, const DimMap& dimMap) noexcept;
+
+    Server(const Server&) = delete;
+    Server& operator = (const Server&) = delete;
+
+    /*******************************************
+     * @brief 设置批次大小和延迟预算
+     * @param[in] maxBatch 攒够这么多请求立即分类
+     * @param[in] maxWait 最早的请求最多等待的时间(微秒)
+     * ****************************************/
+    void setBatch(size_t maxBatch, int maxWait) noexcept;
+
+    /*******************************************
+     * @brief 在Unix域套接字上监听,路径上已有的套接字
+     *        文件会被删除
+     * @param[in] path 套接字路径
+     * @return 是否成功
+     * ****************************************/
+    bool listen(const char* path) noexcept;
+
+    /*******************************************
+     * @brief 运行事件循环,直到stop被调用
+     * @return 是否正常退出
+     * ****************************************/
+    bool run() noexcept;
+
+    /*******************************************
+     * @brief 请求事件循环退出,可以在信号处理函数中调用
+     * ****************************************/
+    void stop() noexcept;
+
+    /*******************************************
+     * @brief 获取统计的JSON格式
+     * @return JSON字符串,不含换行
+     * ****************************************/
+    std::string stats() const noexcept;
+
+private:
+    /* 一个客户端连接 */
+    struct Connection
+    {
+        int fd;
+        std::string input;      // 尚未处理的输入
+        std::string output;     // 尚未写出的输出
+        size_t lineNo;
+        size_t pending;         // 等待分类的请求数量
+        bool closing;           // 对端已关闭输入,写完输出后关闭
+    };
+
+    /* 等待分类的一个请求 */
+    struct Request
+    {
+        uint64_t connection;
+        size_t idEnd;           // 在m_ids中的结束位置
+        Clock::time_point arrival;
+    };
+
+    const Model& m_model;
+    const DimMap& m_dimMap;
+    size_t m_maxBatch;
+    Clock::duration m_maxWait;
+
+    std::string m_path;
+    int m_listen;
+    int m_wakeup[2];            // stop通过管道唤醒poll
+    uint64_t m_nextConnection;
+    std::map<uint64_t, Connection> m_connections;
+
+    SparseBatch m_batch;
+    std::string m_ids;
+    std::vector<Request> m_requests;
+    std::vector<int> m_groups;
+    std::vector<float> m_distances;
+
+    // 统计
+    Clock::time_point m_start;
+    uint64_t m_requestCount;
+    uint64_t m_batchCount;
+    uint64_t m_connectionCount;
+    std::vector<float> m_latencies;    // 最近的请求延迟(微秒),环形
+    size_t m_latencyNext;
+
+    /*******************************************
+     * @brief 接受新的连接
+     * ****************************************/
+    void m_accept() noexcept;
+
+    /*******************************************
+     * @brief 读取连接的输入并拆分成请求,尚未写出的
+     *        输出积压时停止读取
+     * @param[in] key 连接编号
+     * @param[in] conn 连接
+     * @return 连接是否仍然可用
+     * ****************************************/
+    bool m_read(uint64_t key, Connection& conn) noexcept;
+
+    /*******************************************
+     * @brief 写出连接的输出
+     * @param[in] conn 连接
+     * @return 连接是否仍然可用
+     * ****************************************/
+    bool m_write(Connection& conn) noexcept;
+
+    /*******************************************
+     * @brief 处理一行输入
+     * @param[in] key 连接编号
+     * @param[in] conn 连接
+     * @param[in] line 行
+     * @param[in] len 长度,不含换行
+     * ****************************************/
+    void m_handleLine(uint64_t key, Connection& conn, const char* line, size_t len) noexcept;
+
+    /*******************************************
+     * @brief 检查是否应该立即分类等待的请求
+     * @return 是否立即分类
+     * ****************************************/
+    bool m_ready() const noexcept;
+
+    /*******************************************
+     * @brief 对所有等待的请求分类,结果追加到各连接的
+     *        输出中
+     * ****************************************/
+    void m_flush() noexcept;
+
+    /*******************************************
+     * @brief 关闭一个连接
+     * @param[in] conn 连接
+     * ****************************************/
+    void m_close(Connection& conn) noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_SERVER_H
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
@@ -9,44 +10,64 @@
 
 #include "Text.h"
 #include "DimMap.h"
+#include "Trace.h"
 
 namespace AutoBug
 {
 
 Text::~Text() noexcept
 {
-    if (m_pos != nullptr)
-        delete[] m_pos;
+    m_free();
 
     m_dims = 0;
-    m_pos = nullptr;
     m_text = L"";
 }
 
-Text::Text(int dims) noexcept :
-    m_dims(dims),
-    m_pos(dims == 0 ? nullptr : new float[dims]),
-    m_text(L"")
+Text::Text(int dims, Arena* arena) noexcept :
+    m_dims(0),
+    m_pos(nullptr),
+    m_text(L""),
+    m_arena(arena)
 {
+    m_alloc(dims);
     memset(m_pos, 0, sizeof(float) *m_dims);
 }
 
 Text::Text(const Text& src) noexcept :
-    m_dims(src.m_dims),
-    m_pos(new float[m_dims]),
-    m_text(src.m_text)
+    Text(src, nullptr)
 {
+
+}
+
+Text::Text(const Text& src, Arena* arena) noexcept :
+    m_dims(0),
+    m_pos(nullptr),
+    m_text(src.m_text),
+    m_arena(arena)
+{
+    m_alloc(src.m_dims);
     memcpy(m_pos, src.m_pos, sizeof(float) * m_dims);
 }
 
 Text::Text(Text&& src) noexcept :
     m_dims(src.m_dims),
     m_pos(src.m_pos),
-    m_text(src.m_text)
+    m_text(std::move(src.m_text)),
+    m_arena(src.m_arena)
 {
     src.m_dims = 0;
     src.m_pos = nullptr;
     src.m_text = L"";
+    src.m_arena = nullptr;
+}
+
+/*******************************************
+ * @brief 获取坐标所在的内存池
+ * @return 内存池,nullptr表示使用堆内存
+ * ****************************************/
+Arena* Text::arena() const noexcept
+{
+    return m_arena;
 }
 
 /*******************************************
@@ -73,11 +94,8 @@ int Text::dims() const noexcept
  * ****************************************/
 void Text::setDims(int dims) noexcept
 {
-    m_dims = dims;
     m_text = L"";
-    if (m_pos != nullptr)
-        delete[] m_pos;
-    m_pos = new float[m_dims];
+    m_alloc(dims);
 }
 
 /*******************************************
@@ -107,7 +125,7 @@ void Text::fill(float n) noexcept
  * ****************************************/
 Text Text::pow(int n) noexcept
 {
-    Text result{m_dims};
+    Text result{m_dims, m_arena};
     for (int i = 0; i < m_dims; i++)
     {
         result[i] = std::pow(m_pos[i], n);
@@ -136,7 +154,7 @@ void Text::map(std::function<float(float)> fn) noexcept
  * ****************************************/
 Text Text::scalar(const Text& obj, std::function<float(float, float)> fn) const noexcept
 {
-    Text result{m_dims};
+    Text result{m_dims, m_arena};
     for (int i = 0; i < m_dims; i++)
     {
         result.m_pos[i] = fn(m_pos[i], obj.m_pos[i]);
@@ -149,33 +167,66 @@ Text Text::scalar(const Text& obj, std::function<float(float, float)> fn) const
  * @brief 设置文本,采用UTF8解码,扫描并设置超空间坐标
  * @param[in] text 文本原始数据
  * @param[in] dimMap 超空间维度映射
+ * @return 是否成功,非法的UTF-8时文本为空,坐标全为0
  * ****************************************/
-void Text::setText(const char* text, const DimMap& dimMap) noexcept
+bool Text::setText(const char* text, const DimMap& dimMap) noexcept
 {
-    if (m_pos != nullptr)
-        delete[] m_pos;
-
-    m_dims = dimMap.dims();
-    m_pos = new float[m_dims];
+    TRACE_SCOPE("Text::setText");
+    m_alloc(dimMap.dims());
     memset(static_cast<void*>(m_pos), 0, sizeof(float) * m_dims);
 
-    m_text = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(text);
+    // 输入来自外部文件,解码失败的异常不能离开noexcept函数
+    try
+    {
+        m_text = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(text);
+    }
+    catch (const std::range_error&)
+    {
+        m_text = L"";
+        return false;
+    }
+
     for (wchar_t ch : m_text)
     {
         int dim = dimMap.dim(ch);
         if (dim >= 0 && dim < m_dims)
             m_pos[dim] += 1;
     }
+    return true;
 }
 
 /*******************************************
  * @brief 设置文本,采用UTF8解码,扫描并设置超空间坐标
  * @param[in] text 文本原始数据
  * @param[in] dimMap 超空间维度映射
+ * @return 是否成功,非法的UTF-8时文本为空,坐标全为0
  * ****************************************/
-void Text::setText(const std::string& text, const DimMap& dimMap) noexcept
+bool Text::setText(const std::string& text, const DimMap& dimMap) noexcept
 {
-    setText(text.c_str(), dimMap);
+    return setText(text.c_str(), dimMap);
+}
+
+/*******************************************
+ * @brief 设置已经解码的文本和稀疏的超空间坐标,
+ *        用于从特征缓存恢复,不再解码和查表
+ * @param[in] text 文本
+ * @param[in] len 字符数
+ * @param[in] dims 超空间维度
+ * @param[in] indices 非零坐标的维度
+ * @param[in] values 非零坐标的值
+ * @param[in] nnz 非零坐标的数量
+ * ****************************************/
+void Text::setFeatures(const wchar_t* text, size_t len, int dims, const int* indices, const float* values, size_t nnz) noexcept
+{
+    m_alloc(dims);
+    memset(static_cast<void*>(m_pos), 0, sizeof(float) * m_dims);
+
+    m_text.assign(text, len);
+    for (size_t i = 0; i < nnz; i++)
+    {
+        if (indices[i] >= 0 && indices[i] < m_dims)
+            m_pos[indices[i]] = values[i];
+    }
 }
 
 /*******************************************
@@ -218,9 +269,15 @@ float Text::distance(const Text& text) const noexcept
 {
     if (m_dims != text.dims())
         return -1;
-    Text diff = *this - text;
-    diff = diff * diff;
-    return std::sqrt(diff.sum());
+
+    // 直接累加差的平方,避免构造临时向量
+    float sum = 0.0f;
+    for (int i = 0; i < m_dims; i++)
+    {
+        float diff = m_pos[i] - text.m_pos[i];
+        sum += diff * diff;
+    }
+    return std::sqrt(sum);
 }
 
 /*******************************************
@@ -256,11 +313,10 @@ const float& Text::operator [] (int dim) const
  * ****************************************/
 Text& Text::operator = (const Text& src) noexcept
 {
-    if (m_pos != nullptr)
-        delete[] m_pos;
+    if (this == &src)
+        return *this;
 
-    m_dims = src.m_dims;
-    m_pos = new float[m_dims];
+    m_alloc(src.m_dims);
     m_text = src.m_text;
     memcpy(m_pos, src.m_pos, sizeof(float) * m_dims);
     return *this;
@@ -273,16 +329,20 @@ Text& Text::operator = (const Text& src) noexcept
  * ****************************************/
 Text& Text::operator = (Text&& src) noexcept
 {
-    if (m_pos != nullptr)
-        delete[] m_pos;
+    if (this == &src)
+        return *this;
+
+    m_free();
 
     m_dims = src.m_dims;
     m_pos = src.m_pos;
-    m_text = src.m_text;
+    m_text = std::move(src.m_text);
+    m_arena = src.m_arena;
 
     src.m_dims = 0;
     src.m_pos = nullptr;
     src.m_text = L"";
+    src.m_arena = nullptr;
 
     return *this;
 }
@@ -339,4 +399,61 @@ Text Text::operator / (const Text& obj) const
     return scalar(obj, [](float x, float y) -> float {return x/y;});
 }
 
+/*******************************************
+ * @brief 原地标量加法运算,不产生临时对象
+ * @param[in] obj 参与运算的另一个对象
+ * @return 运算后的当前对象
+ * ****************************************/
+Text& Text::operator += (const Text& obj)
+{
+    if (m_dims != obj.m_dims)
+        throw std::runtime_error("different dimensions");
+
+    for (int i = 0; i < m_dims; i++)
+    {
+        m_pos[i] += obj.m_pos[i];
+    }
+    return *this;
+}
+
+/*******************************************
+ * @brief 重新分配坐标内存,维数不变时复用原有内存
+ *        内存池分配失败时改用堆内存
+ * @param[in] dims 超空间的总维数
+ * ****************************************/
+void Text::m_alloc(int dims) noexcept
+{
+    if (dims == m_dims && m_pos != nullptr)
+        return;
+
+    m_free();
+    m_dims = dims;
+    if (m_dims == 0)
+        return;
+
+    if (m_arena != nullptr)
+        m_pos = m_arena->alloc<float>(m_dims);
+
+    // 内存池分配失败时改用堆内存,之后由m_free释放
+    if (m_arena != nullptr && m_pos == nullptr)
+    {
+        fprintf(stderr, "failed to allocate %d dims from arena, using heap\n", m_dims);
+        m_arena = nullptr;
+    }
+
+    if (m_arena == nullptr)
+        m_pos = new float[m_dims];
+}
+
+/*******************************************
+ * @brief 释放坐标内存,内存池中的内存由内存池统一释放
+ * ****************************************/
+void Text::m_free() noexcept
+{
+    if (m_pos != nullptr && m_arena == nullptr)
+        delete[] m_pos;
+
+    m_pos = nullptr;
+}
+
 }; // namespace AutoBug
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <functional>
 
 #include "DimMap.h"
+#include "Arena.h"
 
 namespace AutoBug
 {
@@ -13,10 +14,17 @@ class Text
 {
 public:
     ~Text() noexcept;
-    Text(int dims=0) noexcept;
+    Text(int dims=0, Arena* arena=nullptr) noexcept;
     Text(const Text& src) noexcept;
+    Text(const Text& src, Arena* arena) noexcept;
     Text(Text&& src) noexcept;
 
+    /*******************************************
+     * @brief 获取坐标所在的内存池
+     * @return 内存池,nullptr表示使用堆内存
+     * ****************************************/
+    Arena* arena() const noexcept;
+
     /*******************************************
      * @brief 获取坐标
      * @return 坐标
@@ -72,15 +80,29 @@ public:
      * @brief 设置文本,采用UTF8解码,扫描并设置超空间坐标
      * @param[in] text 文本原始数据
      * @param[in] dimMap 超空间维度映射
+     * @return 是否成功,非法的UTF-8时文本为空,坐标全为0
      * ****************************************/
-    void setText(const char* text, const DimMap& dimMap) noexcept;
+    bool setText(const char* text, const DimMap& dimMap) noexcept;
 
     /*******************************************
      * @brief 设置文本,采用UTF8解码,扫描并设置超空间坐标
      * @param[in] text 文本原始数据
      * @param[in] dimMap 超空间维度映射
+     * @return 是否成功,非法的UTF-8时文本为空,坐标全为0
+     * ****************************************/
+    bool setText(const std::string& text, const DimMap& dimMap) noexcept;
+
+    /*******************************************
+     * @brief 设置已经解码的文本和稀疏的超空间坐标,
+     *        用于从特征缓存恢复,不再解码和查表
+     * @param[in] text 文本
+     * @param[in] len 字符数
+     * @param[in] dims 超空间维度
+     * @param[in] indices 非零坐标的维度
+     * @param[in] values 非零坐标的值
+     * @param[in] nnz 非零坐标的数量
      * ****************************************/
-    void setText(const std::string& text, const DimMap& dimMap) noexcept;
+    void setFeatures(const wchar_t* text, size_t len, int dims, const int* indices, const float* values, size_t nnz) noexcept;
 
     /*******************************************
      * @brief 计算内部向量的元素之和
@@ -157,11 +179,30 @@ public:
      * ****************************************/
     Text operator / (const Text& src) const;
 
+    /*******************************************
+     * @brief 原地标量加法运算,不产生临时对象
+     * @param[in] obj 参与运算的另一个对象
+     * @return 运算后的当前对象
+     * ****************************************/
+    Text& operator += (const Text& src);
 
 private:
     int m_dims;
     float* m_pos;
     std::wstring m_text;
+    Arena* m_arena;
+
+    /*******************************************
+     * @brief 重新分配坐标内存,维数不变时复用原有内存
+     *        内存池分配失败时改用堆内存
+     * @param[in] dims 超空间的总维数
+     * ****************************************/
+    void m_alloc(int dims) noexcept;
+
+    /*******************************************
+     * @brief 释放坐标内存,内存池中的内存由内存池统一释放
+     * ****************************************/
+    void m_free() noexcept;
 };
 
 }; // namespace AutoBug
@@ -0,0 +1,261 @@
+#include "Trace.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace AutoBug
+{
+
+/* 环境变量AUTO_BUG_TRACE非空时启动即打开记录 */
+std::atomic<bool> Trace::m_enabled(getenv("AUTO_BUG_TRACE") != nullptr && getenv("AUTO_BUG_TRACE")[0] != 0);
+
+/* 所有事件的时间起点,实例可能在第一个计时开始之后才创建 */
+static const Trace::Clock::time_point start = Trace::Clock::now();
+
+/*******************************************
+ * @brief 获取一个全局公共实例
+ * @return 对象实例
+ * ****************************************/
+Trace& Trace::instance() noexcept
+{
+    static Trace obj;
+    return obj;
+}
+
+/*******************************************
+ * @brief 打开或关闭记录
+ * @param[in] enable 是否记录
+ * ****************************************/
+void Trace::setEnable(bool enable) noexcept
+{
+    m_enabled.store(enable, std::memory_order_relaxed);
+}
+
+Trace::~Trace() noexcept
+{
+    if (m_file.empty())
+        return;
+
+    exportChrome(m_file.c_str());
+    printSummary(stderr);
+}
+
+Trace::Trace() noexcept :
+    m_start(start),
+    m_capacity(1 << 16)
+{
+    const char* env = getenv("AUTO_BUG_TRACE");
+    if (env != nullptr)
+        m_file = env;
+
+    // 环境变量AUTO_BUG_TRACE_EVENTS可以设置每个线程保留的事件数量
+    env = getenv("AUTO_BUG_TRACE_EVENTS");
+    if (env != nullptr && atoi(env) > 0)
+        m_capacity = atoi(env);
+}
+
+/*******************************************
+ * @brief 记录一段计时
+ * @param[in] name 名称,必须是字符串常量
+ * @param[in] begin 开始时间
+ * @param[in] end 结束时间
+ * ****************************************/
+void Trace::complete(const char* name, Clock::time_point begin, Clock::time_point end) noexcept
+{
+    auto& buffer = m_buffer();
+    int64_t ts = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - m_start).count();
+    int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+
+    auto& stat = m_stat(buffer, name, 'X');
+    stat.calls += 1;
+    stat.total += duration;
+    stat.max = std::max(stat.max, duration);
+    m_push(buffer, Event{name, 'X', ts, duration});
+}
+
+/*******************************************
+ * @brief 计数器累加
+ * @param[in] name 名称,必须是字符串常量
+ * @param[in] n 增加的值
+ * ****************************************/
+void Trace::count(const char* name, int64_t n) noexcept
+{
+    auto& buffer = m_buffer();
+    int64_t ts = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count();
+
+    auto& stat = m_stat(buffer, name, 'C');
+    stat.calls += 1;
+    stat.total += n;
+    stat.max = std::max(stat.max, n);
+    m_push(buffer, Event{name, 'C', ts, stat.total});
+}
+
+/*******************************************
+ * @brief 导出Chrome trace JSON,可以用chrome://tracing
+ *        或Perfetto打开;导出时不能有线程在记录
+ * @param[in] file 文件名
+ * @return 是否成功
+ * ****************************************/
+bool Trace::exportChrome(const char* file) const noexcept
+{
+    FILE* fp = fopen(file, "w");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    for (auto& buffer : m_buffers)
+    {
+        // 写满后从最早未被覆盖的事件开始
+        size_t size = std::min(buffer->next, m_capacity);
+        size_t start = buffer->next - size;
+        for (size_t i = start; i < buffer->next; i++)
+        {
+            const Event& event = buffer->events[i % m_capacity];
+            fprintf(fp, "%s\n", first ? "" : ",");
+            first = false;
+
+            // Chrome trace的时间单位为微秒
+            if (event.phase == 'X')
+            {
+                fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                        event.name, buffer->tid, event.ts / 1e3, event.value / 1e3);
+            }
+            else
+            {
+                fprintf(fp, "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"args\":{\"thread %zu\":%lld}}",
+                        event.name, buffer->tid, event.ts / 1e3, buffer->tid, static_cast<long long>(event.value));
+            }
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    bool success = !ferror(fp);
+    if (fclose(fp) != 0)
+        success = false;
+    return success;
+}
+
+/*******************************************
+ * @brief 输出各计时的次数、总时间、平均和最大时间
+ *        以及各计数器的总和
+ * @param[in] fp 输出文件
+ * ****************************************/
+void Trace::printSummary(FILE* fp) const noexcept
+{
+    // 同一名称在不同线程、不同编译单元中的指针可能不同,按字符串合并
+    std::vector<Stat> stats;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& buffer : m_buffers)
+        {
+            for (auto& stat : buffer->stats)
+            {
+                auto iter = std::find_if(stats.begin(), stats.end(), [&](const Stat& s) {
+                    return s.phase == stat.phase && strcmp(s.name, stat.name) == 0;
+                });
+                if (iter == stats.end())
+                {
+                    stats.push_back(stat);
+                    continue;
+                }
+                iter->calls += stat.calls;
+                iter->total += stat.total;
+                iter->max = std::max(iter->max, stat.max);
+            }
+        }
+    }
+
+    // 按总时间从大到小
+    std::sort(stats.begin(), stats.end(), [](const Stat& x, const Stat& y) {
+        return x.phase != y.phase ? x.phase > y.phase : x.total > y.total;
+    });
+
+    fprintf(fp, "%-32s %10s %12s %12s %12s\n", "scope", "calls", "total ms", "mean us", "max us");
+    for (auto& stat : stats)
+    {
+        if (stat.phase != 'X')
+            continue;
+        fprintf(fp, "%-32s %10zu %12.3f %12.3f %12.3f\n", stat.name, stat.calls,
+                stat.total / 1e6, stat.total / 1e3 / stat.calls, stat.max / 1e3);
+    }
+
+    fprintf(fp, "%-32s %10s %12s\n", "counter", "calls", "total");
+    for (auto& stat : stats)
+    {
+        if (stat.phase != 'C')
+            continue;
+        fprintf(fp, "%-32s %10zu %12lld\n", stat.name, stat.calls, static_cast<long long>(stat.total));
+    }
+}
+
+/*******************************************
+ * @brief 清空所有线程的记录
+ * ****************************************/
+void Trace::reset() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& buffer : m_buffers)
+    {
+        buffer->next = 0;
+        buffer->stats.clear();
+    }
+}
+
+/*******************************************
+ * @brief 获取当前线程的记录,第一次调用时创建;
+ *        线程退出后记录仍然保留到导出
+ * @return 当前线程的记录
+ * ****************************************/
+Trace::Buffer& Trace::m_buffer() noexcept
+{
+    static thread_local Buffer* current = nullptr;
+    if (current != nullptr)
+        return *current;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffers.emplace_back(new Buffer);
+    current = m_buffers.back().get();
+    current->tid = m_buffers.size();
+    current->events.resize(m_capacity);
+    current->next = 0;
+    return *current;
+}
+
+/*******************************************
+ * @brief 查找或添加一个名称的累计值
+ * @param[in] buffer 线程的记录
+ * @param[in] name 名称
+ * @param[in] phase 类型
+ * @return 累计值
+ * ****************************************/
+Trace::Stat& Trace::m_stat(Buffer& buffer, const char* name, char phase) noexcept
+{
+    // 埋点的数量很少,线性查找指针比哈希更快
+    for (auto& stat : buffer.stats)
+    {
+        if (stat.name == name && stat.phase == phase)
+            return stat;
+    }
+
+    buffer.stats.push_back(Stat{name, phase, 0, 0, 0});
+    return buffer.stats.back();
+}
+
+/*******************************************
+ * @brief 向环形缓冲写入一个事件,写满后覆盖最早的事件
+ * @param[in] buffer 线程的记录
+ * @param[in] event 事件
+ * ****************************************/
+void Trace::m_push(Buffer& buffer, const Event& event) noexcept
+{
+    buffer.events[buffer.next % m_capacity] = event;
+    buffer.next += 1;
+}
+
+}; // namespace AutoBug
\ No newline at end of file
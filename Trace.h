@@ -0,0 +1,191 @@
+#ifndef AUTO_BUG_TRACE_H
+#define AUTO_BUG_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* 编译时以-DAUTO_BUG_TRACE=0关闭,所有埋点展开为空 */
+#ifndef AUTO_BUG_TRACE
+#define AUTO_BUG_TRACE 1
+#endif // AUTO_BUG_TRACE
+
+#define AUTO_BUG_TRACE_CONCAT_(x, y) x##y
+#define AUTO_BUG_TRACE_CONCAT(x, y) AUTO_BUG_TRACE_CONCAT_(x, y)
+
+#if AUTO_BUG_TRACE
+/* 计时当前作用域,name必须是字符串常量 */
+#define TRACE_SCOPE(name) AutoBug::Trace::Scope AUTO_BUG_TRACE_CONCAT(traceScope, __LINE__){name}
+/* 计数器累加n,name必须是字符串常量 */
+#define TRACE_COUNT(name, n) do { if (AutoBug::Trace::enabled()) AutoBug::Trace::instance().count(name, static_cast<int64_t>(n)); } while (0)
+#else
+#define TRACE_SCOPE(name) do { } while (0)
+#define TRACE_COUNT(name, n) do { } while (0)
+#endif // AUTO_BUG_TRACE
+
+namespace AutoBug
+{
+
+/* 低开销的计时和计数埋点,每个线程写入自己的环形缓冲,
+ * 关闭时每个埋点只有一次原子读取;环境变量AUTO_BUG_TRACE
+ * 设置为文件名时启动即打开,退出时导出Chrome trace JSON
+ * 并在标准错误输出汇总表 */
+class Trace
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /* 计时当前作用域 */
+    class Scope
+    {
+    public:
+        ~Scope() noexcept
+        {
+            if (m_name != nullptr)
+                Trace::instance().complete(m_name, m_begin, Clock::now());
+        }
+
+        explicit Scope(const char* name) noexcept :
+            m_name(Trace::enabled() ? name : nullptr),
+            m_begin(m_name != nullptr ? Clock::now() : Clock::time_point())
+        {
+
+        }
+
+        Scope(const Scope&) = delete;
+        Scope(Scope&&) = delete;
+
+    private:
+        const char* m_name;
+        Clock::time_point m_begin;
+    };
+
+    /*******************************************
+     * @brief 获取一个全局公共实例
+     * @return 对象实例
+     * ****************************************/
+    static Trace& instance() noexcept;
+
+    /*******************************************
+     * @brief 是否正在记录
+     * @return 是否正在记录
+     * ****************************************/
+    static bool enabled() noexcept
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /*******************************************
+     * @brief 打开或关闭记录
+     * @param[in] enable 是否记录
+     * ****************************************/
+    static void setEnable(bool enable) noexcept;
+
+    ~Trace() noexcept;
+    Trace() noexcept;
+    Trace(const Trace&) = delete;
+    Trace(Trace&&) = delete;
+
+    /*******************************************
+     * @brief 记录一段计时
+     * @param[in] name 名称,必须是字符串常量
+     * @param[in] begin 开始时间
+     * @param[in] end 结束时间
+     * ****************************************/
+    void complete(const char* name, Clock::time_point begin, Clock::time_point end) noexcept;
+
+    /*******************************************
+     * @brief 计数器累加
+     * @param[in] name 名称,必须是字符串常量
+     * @param[in] n 增加的值
+     * ****************************************/
+    void count(const char* name, int64_t n) noexcept;
+
+    /*******************************************
+     * @brief 导出Chrome trace JSON,可以用chrome://tracing
+     *        或Perfetto打开;导出时不能有线程在记录
+     * @param[in] file 文件名
+     * @return 是否成功
+     * ****************************************/
+    bool exportChrome(const char* file) const noexcept;
+
+    /*******************************************
+     * @brief 输出各计时的次数、总时间、平均和最大时间
+     *        以及各计数器的总和
+     * @param[in] fp 输出文件
+     * ****************************************/
+    void printSummary(FILE* fp) const noexcept;
+
+    /*******************************************
+     * @brief 清空所有线程的记录
+     * ****************************************/
+    void reset() noexcept;
+
+private:
+    /* 一个事件,计时为'X',计数器为'C' */
+    struct Event
+    {
+        const char* name;
+        char phase;
+        int64_t ts;         // 距开始的纳秒数
+        int64_t value;      // 计时为持续的纳秒数,计数器为本线程的累计值
+    };
+
+    /* 一个名称的累计值,不受环形缓冲覆盖的影响 */
+    struct Stat
+    {
+        const char* name;
+        char phase;
+        size_t calls;
+        int64_t total;
+        int64_t max;
+    };
+
+    /* 一个线程的记录 */
+    struct Buffer
+    {
+        size_t tid;
+        std::vector<Event> events;  // 环形缓冲
+        size_t next;                // 累计写入的事件数
+        std::vector<Stat> stats;
+    };
+
+    static std::atomic<bool> m_enabled;
+
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+    Clock::time_point m_start;
+    size_t m_capacity;          // 每个线程的环形缓冲容量
+    std::string m_file;         // 退出时导出的文件
+
+    /*******************************************
+     * @brief 获取当前线程的记录,第一次调用时创建
+     * @return 当前线程的记录
+     * ****************************************/
+    Buffer& m_buffer() noexcept;
+
+    /*******************************************
+     * @brief 查找或添加一个名称的累计值
+     * @param[in] buffer 线程的记录
+     * @param[in] name 名称
+     * @param[in] phase 类型
+     * @return 累计值
+     * ****************************************/
+    static Stat& m_stat(Buffer& buffer, const char* name, char phase) noexcept;
+
+    /*******************************************
+     * @brief 向环形缓冲写入一个事件,写满后覆盖最早的事件
+     * @param[in] buffer 线程的记录
+     * @param[in] event 事件
+     * ****************************************/
+    void m_push(Buffer& buffer, const Event& event) noexcept;
+};
+
+}; // namespace AutoBug
+
+#endif // AUTO_BUG_TRACE_H
\ No newline at end of file
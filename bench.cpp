@@ -0,0 +1,539 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "DimMap.h"
+#include "Text.h"
+#include "DataLoader.h"
+#include "Kmeans.h"
+#include "Accelerator.h"
+#include "Dispatcher.h"
+#include "QuantizedSet.h"
+#include "Classifier.h"
+#include "BugGenerator.h"
+#include "Model.h"
+#include "Deduplicator.h"
+#include "FeatureCache.h"
+
+using namespace AutoBug;
+
+/* 命令行参数 */
+struct Options
+{
+    size_t rows;                    // 内存中测试的样本数量
+    size_t clusters;                // 生成的分组数量,也是Kmeans的k
+    float noise;                    // 生成标题的噪声
+    float skew;                     // 分组大小的倾斜程度
+    unsigned long long seed;        // 随机数种子
+    double minTime;                 // 每项测试的最短时间(秒)
+    const char* output;             // 结果文件,nullptr为标准输出
+    const char* filter;             // 只运行名字包含该字符串的测试
+    const char* generate;           // 只生成语料到该文件
+    QuantizedSet::Format storage;   // Kmeans和Classifier的样本存储格式
+};
+
+/* 一项测试的计时结果 */
+struct Timing
+{
+    size_t iterations;
+    double best;
+    double mean;
+};
+
+/*******************************************
+ * @brief 打印用法
+ * @param[in] name 程序名
+ * ****************************************/
+static void usage(const char* name) noexcept
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n rows      samples used by the in-memory benchmarks (default 1000)\n"
+        "  -k clusters  generated clusters and Kmeans k (default 50)\n"
+        "  -e noise     probability of replacing a title part, 0~1 (default 0.1)\n"
+        "  -z skew      cluster size skew, 0 is uniform (default 0)\n"
+        "  -s seed      random seed (default 1)\n"
+        "  -t seconds   minimum time of each benchmark (default 0.5)\n"
+        "  -q storage   none, u8 or f16 (default none)\n"
+        "  -f filter    only run benchmarks whose name contains filter\n"
+        "  -o file      append JSON lines to file instead of stdout\n"
+        "  -g file      only write rows generated titles to file, streaming\n",
+        name);
+}
+
+/*******************************************
+ * @brief 解析命令行参数
+ * @param[in] argc 参数数量
+ * @param[in] argv 参数列表
+ * @param[out] opts 解析结果
+ * @return 是否成功
+ * ****************************************/
+static bool parseArgs(int argc, char* argv[], Options& opts) noexcept
+{
+    opts.rows = 1000;
+    opts.clusters = 50;
+    opts.noise = 0.1f;
+    opts.skew = 0.0f;
+    opts.seed = 1;
+    opts.minTime = 0.5;
+    opts.output = nullptr;
+    opts.filter = nullptr;
+    opts.generate = nullptr;
+    opts.storage = QuantizedSet::NONE;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "n:k:e:z:s:t:q:f:o:g:h")) != -1)
+    {
+        switch (ch)
+        {
+        case 'n':
+            opts.rows = strtoull(optarg, nullptr, 10);
+            break;
+        case 'k':
+            opts.clusters = strtoull(optarg, nullptr, 10);
+            break;
+        case 'e':
+            opts.noise = strtof(optarg, nullptr);
+            break;
+        case 'z':
+            opts.skew = strtof(optarg, nullptr);
+            break;
+        case 's':
+            opts.seed = strtoull(optarg, nullptr, 10);
+            break;
+        case 't':
+            opts.minTime = strtod(optarg, nullptr);
+            break;
+        case 'q':
+            if (strcmp(optarg, "none") == 0)
+                opts.storage = QuantizedSet::NONE;
+            else if (strcmp(optarg, "u8") == 0)
+                opts.storage = QuantizedSet::U8;
+            else if (strcmp(optarg, "f16") == 0)
+                opts.storage = QuantizedSet::F16;
+            else
+                return false;
+            break;
+        case 'f':
+            opts.filter = optarg;
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        case 'g':
+            opts.generate = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return opts.rows > 0 && opts.clusters > 0;
+}
+
+/*******************************************
+ * @brief 转义为JSON字符串
+ * @param[in] str 原字符串
+ * @return 带引号的JSON字符串
+ * ****************************************/
+static std::string jsonString(const std::string& str) noexcept
+{
+    std::string json = "\"";
+    for (char ch : str)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            json += '\\';
+            json += ch;
+        }
+        else if (static_cast<unsigned char>(ch) < 0x20)
+        {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", ch);
+            json += buffer;
+        }
+        else
+        {
+            json += ch;
+        }
+    }
+    json += "\"";
+    return json;
+}
+
+/*******************************************
+ * @brief 重复运行一项测试,直到总时间超过最短时间
+ * @param[in] opts 命令行参数
+ * @param[in] fn 测试的一次迭代
+ * @return 计时结果
+ * ****************************************/
+static Timing measure(const Options& opts, const std::function<void()>& fn) noexcept
+{
+    typedef std::chrono::steady_clock Clock;
+
+    Timing timing{0, 0.0, 0.0};
+    double total = 0.0;
+    do
+    {
+        auto start = Clock::now();
+        fn();
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (timing.iterations == 0 || elapsed < timing.best)
+            timing.best = elapsed;
+        total += elapsed;
+        timing.iterations += 1;
+    }while (total < opts.minTime);
+
+    timing.mean = total / timing.iterations;
+    return timing;
+}
+
+/*******************************************
+ * @brief 输出一项测试的结果,每项一行JSON,包含
+ *        复现结果所需的全部参数
+ * @param[in] fp 输出文件
+ * @param[in] opts 命令行参数
+ * @param[in] name 测试名
+ * @param[in] ops 一次迭代中的操作数
+ * @param[in] timing 计时结果
+ * @param[in] extra 附加的JSON字段,以逗号开头
+ * ****************************************/
+static void report(FILE* fp, const Options& opts, const char* name, size_t ops, const Timing& timing, const std::string& extra="") noexcept
+{
+    static const char* storages[] = {"none", "u8", "f16"};
+    auto& gpu = Accelerator::instance();
+    std::string device = gpu.available() ? gpu.name() : "none";
+
+    fprintf(fp,
+        "{\"bench\":%s,\"timestamp\":%lld,\"rows\":%zu,\"clusters\":%zu,\"noise\":%g,\"skew\":%g,"
+        "\"seed\":%llu,\"storage\":\"%s\",\"threads\":%zu,\"device\":%s,"
+        "\"ops\":%zu,\"iterations\":%zu,\"best_s\":%.9g,\"mean_s\":%.9g,\"ns_per_op\":%.6g%s}\n",
+        jsonString(name).c_str(), static_cast<long long>(time(nullptr)), opts.rows, opts.clusters, opts.noise, opts.skew,
+        opts.seed, storages[opts.storage], Dispatcher::instance().threads(), jsonString(device).c_str(),
+        ops, timing.iterations, timing.best, timing.mean, timing.best * 1e9 / ops, extra.c_str());
+    fflush(fp);
+
+    fprintf(stderr, "%-20s %12.1f ns/op %10zu ops %6zu iterations\n", name, timing.best * 1e9 / ops, ops, timing.iterations);
+}
+
+/*******************************************
+ * @brief 检查一项测试是否要运行
+ * @param[in] opts 命令行参数
+ * @param[in] name 测试名
+ * @return 是否运行
+ * ****************************************/
+static bool selected(const Options& opts, const char* name) noexcept
+{
+    return opts.filter == nullptr || strstr(name, opts.filter) != nullptr;
+}
+
+/*******************************************
+ * @brief 用指定的后端测试Kmeans学习
+ * @param[in] fp 输出文件
+ * @param[in] opts 命令行参数
+ * @param[in] dataset 样本集
+ * @param[in] backend 后端名,nullptr表示由Dispatcher选择
+ * ****************************************/
+static void benchKmeans(FILE* fp, const Options& opts, const std::vector<Text>& dataset, const char* backend) noexcept
+{
+    std::string name = std::string("kmeans.") + (backend == nullptr ? "auto" : backend);
+    if (!selected(opts, name.c_str()))
+        return;
+
+    // 通过Dispatcher的环境变量强制使用某个后端,测试后恢复
+    const char* env = getenv("AUTO_BUG_BACKEND");
+    std::string saved = env == nullptr ? "" : env;
+    if (backend != nullptr)
+        setenv("AUTO_BUG_BACKEND", backend, 1);
+
+    size_t k = opts.clusters < dataset.size() ? opts.clusters : dataset.size();
+    Dispatcher::Backend used = Dispatcher::CPU_SIMD;
+    float inertia = 0.0f;
+    size_t empty = 0;
+    auto timing = measure(opts, [&]() {
+        Kmeans kmeans{dataset, k};
+        kmeans.setStorage(opts.storage);
+        kmeans.learn(10);
+        used = kmeans.decision().backend;
+        inertia = kmeans.inertia();
+        empty = kmeans.emptyGroups();
+    });
+
+    if (env == nullptr)
+        unsetenv("AUTO_BUG_BACKEND");
+    else
+        setenv("AUTO_BUG_BACKEND", saved.c_str(), 1);
+
+    // 后端不可用时Dispatcher会退回到单线程,不记录误导性的结果
+    if (backend != nullptr && strcmp(Dispatcher::name(used), backend) != 0)
+    {
+        fprintf(stderr, "%-20s skipped, backend %s is not available\n", name.c_str(), backend);
+        return;
+    }
+
+    char extra[128];
+    snprintf(extra, sizeof(extra), ",\"backend\":\"%s\",\"k\":%zu,\"inertia\":%.9g,\"empty\":%zu", Dispatcher::name(used), k, inertia, empty);
+    report(fp, opts, name.c_str(), dataset.size(), timing, extra);
+}
+
+int main(int argc, char* argv[])
+{
+    setlocale(LC_ALL, "");
+
+    Options opts;
+    if (!parseArgs(argc, argv, opts))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* fp = stdout;
+    if (opts.output != nullptr)
+    {
+        fp = fopen(opts.output, "a");
+        if (fp == nullptr)
+        {
+            fprintf(stderr, "%s: %s\n", opts.output, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    int ret = EXIT_SUCCESS;
+    auto& dimMap = DimMap::instance();
+    std::vector<std::string> titles;
+    std::vector<Text> dataset;
+    std::wstring chars;
+    char path[] = "/tmp/autobug-bench-XXXXXX";
+    int fd = -1;
+
+    // 只生成语料,一次写完,不受最短时间影响
+    if (opts.generate != nullptr)
+    {
+        BugGenerator generator{opts.clusters, opts.noise, opts.skew, opts.seed};
+        Options once = opts;
+        once.minTime = 0.0;
+        bool success = true;
+        auto timing = measure(once, [&]() {
+            success = generator.write(opts.generate, opts.rows);
+        });
+        if (!success)
+        {
+            ret = EXIT_FAILURE;
+            goto EXIT;
+        }
+        report(fp, opts, "generator.write", opts.rows, timing);
+        goto EXIT;
+    }
+
+    {
+        BugGenerator generator{opts.clusters, opts.noise, opts.skew, opts.seed};
+        titles.resize(opts.rows);
+        for (auto& title : titles)
+        {
+            generator.next(title);
+        }
+        dataset.resize(opts.rows);
+        for (size_t i = 0; i < opts.rows; i++)
+        {
+            dataset[i].setText(titles[i], dimMap);
+            chars += dataset[i].text();
+        }
+    }
+
+    if (selected(opts, "dimmap.dim"))
+    {
+        volatile int sink = 0;
+        auto timing = measure(opts, [&]() {
+            int sum = 0;
+            for (wchar_t ch : chars)
+            {
+                sum += dimMap.dim(ch);
+            }
+            sink = sum;
+        });
+        (void)sink;
+        report(fp, opts, "dimmap.dim", chars.size(), timing);
+    }
+
+    if (selected(opts, "text.setText"))
+    {
+        auto timing = measure(opts, [&]() {
+            for (size_t i = 0; i < opts.rows; i++)
+            {
+                dataset[i].setText(titles[i], dimMap);
+            }
+        });
+        report(fp, opts, "text.setText", opts.rows, timing);
+    }
+
+    if (selected(opts, "text.distance"))
+    {
+        volatile float sink = 0.0f;
+        auto timing = measure(opts, [&]() {
+            float sum = 0.0f;
+            for (size_t i = 0; i < opts.rows; i++)
+            {
+                sum += dataset[i].distance(dataset[(i + 1) % opts.rows]);
+            }
+            sink = sum;
+        });
+        (void)sink;
+        report(fp, opts, "text.distance", opts.rows, timing);
+    }
+
+    if (selected(opts, "generator.write") || selected(opts, "dataloader.load") || selected(opts, "dataloader.cached"))
+    {
+        fd = mkstemp(path);
+        if (fd < 0)
+        {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            ret = EXIT_FAILURE;
+            goto EXIT;
+        }
+
+        bool success = true;
+        auto timing = measure(opts, [&]() {
+            BugGenerator generator{opts.clusters, opts.noise, opts.skew, opts.seed};
+            success = generator.write(path, opts.rows) && success;
+        });
+        if (!success)
+        {
+            ret = EXIT_FAILURE;
+            goto EXIT;
+        }
+        if (selected(opts, "generator.write"))
+            report(fp, opts, "generator.write", opts.rows, timing);
+
+        if (selected(opts, "dataloader.load"))
+        {
+            size_t loaded = 0;
+            timing = measure(opts, [&]() {
+                loaded = DataLoader::load(path, dimMap).size();
+            });
+            char extra[32];
+            snprintf(extra, sizeof(extra), ",\"loaded\":%zu", loaded);
+            report(fp, opts, "dataloader.load", opts.rows, timing, extra);
+        }
+
+        // 第一次加载写入缓存,之后计时的都是命中缓存的加载
+        if (selected(opts, "dataloader.cached"))
+        {
+            size_t loaded = DataLoader::loadCached(path, dimMap).size();
+            timing = measure(opts, [&]() {
+                loaded = DataLoader::loadCached(path, dimMap).size();
+            });
+            remove(FeatureCache().path(path).c_str());
+            char extra[32];
+            snprintf(extra, sizeof(extra), ",\"loaded\":%zu", loaded);
+            report(fp, opts, "dataloader.cached", opts.rows, timing, extra);
+        }
+    }
+
+    benchKmeans(fp, opts, dataset, "simd");
+    benchKmeans(fp, opts, dataset, "threads");
+    benchKmeans(fp, opts, dataset, "opencl");
+    benchKmeans(fp, opts, dataset, nullptr);
+
+    if (selected(opts, "classifier.learn"))
+    {
+        size_t groups = 0;
+        auto timing = measure(opts, [&]() {
+            Classifier classifier;
+            classifier.setStorage(opts.storage);
+            groups = classifier.learn(dataset);
+        });
+        char extra[32];
+        snprintf(extra, sizeof(extra), ",\"groups\":%zu", groups);
+        report(fp, opts, "classifier.learn", opts.rows, timing, extra);
+    }
+
+    // 编码和分类一起计时,与classify命令的每批处理相同;分组树
+    // 分类同时记录计算距离的次数和与精确分类一致的比例
+    if (selected(opts, "model.classify") || selected(opts, "model.route"))
+    {
+        Classifier classifier;
+        classifier.setStorage(opts.storage);
+        classifier.learn(dataset);
+        Model model;
+        model.build(classifier, dimMap);
+
+        SparseBatch batch;
+        std::vector<int> groups(opts.rows);
+        std::vector<float> distances(opts.rows);
+        if (selected(opts, "model.classify"))
+        {
+            auto timing = measure(opts, [&]() {
+                batch.clear();
+                for (size_t i = 0; i < opts.rows; i++)
+                {
+                    batch.add(titles[i].data(), titles[i].size(), dimMap);
+                }
+                model.classify(batch, groups.data(), distances.data());
+            });
+            char extra[32];
+            snprintf(extra, sizeof(extra), ",\"groups\":%zu", model.groupCount());
+            report(fp, opts, "model.classify", opts.rows, timing, extra);
+        }
+
+        if (selected(opts, "model.route"))
+        {
+            uint64_t evaluations = 0;
+            std::vector<int> routed(opts.rows);
+            auto timing = measure(opts, [&]() {
+                batch.clear();
+                for (size_t i = 0; i < opts.rows; i++)
+                {
+                    batch.add(titles[i].data(), titles[i].size(), dimMap);
+                }
+                evaluations = model.route(batch, routed.data(), distances.data());
+            });
+
+            model.classify(batch, groups.data(), distances.data());
+            size_t agreed = 0;
+            for (size_t i = 0; i < opts.rows; i++)
+            {
+                if (groups[i] == routed[i])
+                    agreed++;
+            }
+            char extra[96];
+            snprintf(extra, sizeof(extra), ",\"groups\":%zu,\"distances\":%.1f,\"agreement\":%.4f",
+                     model.groupCount(), opts.rows > 0 ? static_cast<double>(evaluations) / opts.rows : 0.0,
+                     opts.rows > 0 ? static_cast<double>(agreed) / opts.rows : 0.0);
+            report(fp, opts, "model.route", opts.rows, timing, extra);
+        }
+    }
+
+    if (selected(opts, "dedup.find"))
+    {
+        std::vector<std::wstring> texts(opts.rows);
+        for (size_t i = 0; i < opts.rows; i++)
+        {
+            texts[i] = dataset[i].text();
+        }
+
+        Deduplicator deduplicator;
+        size_t pairs = 0;
+        auto timing = measure(opts, [&]() {
+            pairs = deduplicator.find(texts).size();
+        });
+        char extra[64];
+        snprintf(extra, sizeof(extra), ",\"candidates\":%zu,\"pairs\":%zu", deduplicator.candidates(), pairs);
+        report(fp, opts, "dedup.find", opts.rows, timing, extra);
+    }
+
+EXIT:
+    if (fd >= 0)
+    {
+        close(fd);
+        unlink(path);
+    }
+    if (fp != stdout)
+        fclose(fp);
+    return ret;
+}
\ No newline at end of file
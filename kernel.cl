@@ -57,76 +57,146 @@ __kernel void div(__global float* x, __global float* y, __global float* ret)
 
 
 /*******************************************
- * @brief 计算向量元素之和
- * @param[in] input 输入向量
- * @param[out] output 输出元素的和
+ * @brief 组内树形归约,采用顺序寻址,结果放在scratch[0]
+ * @param[in] scratch 局部缓存,每个线程一个元素
+ * @param[in] value 当前线程的值
+ * @return 组内元素之和(仅0号线程有效)
  * ****************************************/
-__kernel void reduction(__global float* input, __global float* output)
+float groupSum(__local float* scratch, float value)
 {
-    size_t globalId = get_global_id(0);   	// 全局id
-    size_t localId = get_local_id(0);     	// 组内id
-    size_t localSize = get_local_size(0); 	// 一组工作的数量(即线程数)
+    const int localId = get_local_id(0);
+    const int localSize = get_local_size(0); 	// 必须是2的幂
 
-    output[globalId] = input[globalId];
+    scratch[localId] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-    // 各个元素同步归并相加
-    for (size_t count = localSize; count > 1; count = (count + 1) / 2)
+    for (int step = localSize / 2; step > 0; step >>= 1)
     {
-        barrier(CLK_LOCAL_MEM_FENCE); // 组内同步
-        size_t step = (count + 1) / 2;
-        if (localId < step && localId + step < count)
+        if (localId < step)
         {
-            output[globalId] += output[globalId + step];
+            scratch[localId] += scratch[localId + step];
         }
+        barrier(CLK_LOCAL_MEM_FENCE);
     }
+    return scratch[0];
 }
 
+/*******************************************
+ * @brief 计算向量元素之和
+          步骤1:
+          每个线程以全局步长累加多个元素,再在组内
+          归约,每组输出一个部分和
+ * @param[in] input 输入向量
+ * @param[out] partial 输出各组的部分和
+ * @param[in] scratch 局部缓存,每个线程一个元素
+ * @param[in] n 向量长度
+ * ****************************************/
+__kernel void reduceStage1(__global const float* input,
+                           __global float* partial,
+                           __local float* scratch,
+                           int n)
+{
+    float sum = 0.0f;
+    for (size_t i = get_global_id(0); i < n; i += get_global_size(0))
+    {
+        sum += input[i];
+    }
+
+    sum = groupSum(scratch, sum);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = sum;
+}
+
+/*******************************************
+ * @brief 计算向量元素之和
+          步骤2:
+          只使用一个工作组,将步骤1的部分和归约为一个
+          标量,直接在设备上完成
+ * @param[in] partial 步骤1输出的部分和
+ * @param[out] output 输出结果,写入output[offset]
+ * @param[in] scratch 局部缓存,每个线程一个元素
+ * @param[in] n 部分和的数量
+ * @param[in] offset 结果的写入位置
+ * @param[in] root 是否对结果开平方
+ * ****************************************/
+__kernel void reduceStage2(__global const float* partial,
+                           __global float* output,
+                           __local float* scratch,
+                           int n,
+                           int offset,
+                           int root)
+{
+    float sum = 0.0f;
+    for (int i = get_local_id(0); i < n; i += get_local_size(0))
+    {
+        sum += partial[i];
+    }
+
+    sum = groupSum(scratch, sum);
+    if (get_local_id(0) == 0)
+        output[offset] = root ? sqrt(sum) : sum;
+}
 
 /*******************************************
  * @brief 计算两个向量之间的欧氏距离
           步骤1:
-          计算两个向量对应元素差的平方,并在各个分组
-          内求和,结果放在各个分组的开头
-          示例: [0] + [1] + [2] + [3] 
+          每个线程累加多个元素差的平方,再在组内归约,
+          每组输出一个部分和,之后由reduceStage2开方
  * @param[in] x 输入向量
  * @param[in] y 输入向量
- * @param[in] ret 输出计算结果
+ * @param[out] partial 输出各组的部分和
+ * @param[in] scratch 局部缓存,每个线程一个元素
+ * @param[in] n 向量长度
  * ****************************************/
-__kernel void distanceStep1(__global float* x, __global float* y, __global float* ret)
+__kernel void distanceStage1(__global const float* x,
+                             __global const float* y,
+                             __global float* partial,
+                             __local float* scratch,
+                             int n)
 {
-    size_t globalId = get_global_id(0);   	// 全局id
-    size_t localId = get_local_id(0);     	// 组内id
-    size_t localSize = get_local_size(0); 	// 一组工作的数量(即线程数)
-
-    ret[globalId] = pow(x[globalId] - y[globalId], 2);
-
-    // 各个元素同步归并相加
-    for (size_t count = localSize; count > 1; count = (count + 1) / 2)
+    float sum = 0.0f;
+    for (size_t i = get_global_id(0); i < n; i += get_global_size(0))
     {
-        barrier(CLK_LOCAL_MEM_FENCE); // 组内同步
-        size_t step = (count + 1) / 2;
-        if (localId < step && localId + step < count)
-        {
-            ret[globalId] += ret[globalId + step];
-        }
+        float diff = x[i] - y[i];
+        sum = mad(diff, diff, sum);
     }
+
+    sum = groupSum(scratch, sum);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = sum;
 }
 
+// 聚类相关的核函数可以通过构建选项-D DIMS=...和-D K=...把维度和
+// 分组数量编译为常量,便于编译器展开循环;未定义时使用运行时参数
+#ifdef DIMS
+#define DIMENSIONS DIMS
+#else
+#define DIMENSIONS dims
+#endif
+
+#ifdef K
+#define GROUPS K
+#else
+#define GROUPS k
+#endif
+
 /*******************************************
- * @brief 计算两个向量之间的欧氏距离
+ * @brief 计算两个向量之间欧氏距离的平方,只用于比较
+ *        远近,因此不需要开方
  * @param[in] x 输入向量
  * @param[in] y 输入向量
  * @param[in] dims 维度
- * @return 两个向量的距离
+ * @return 两个向量距离的平方
  * ****************************************/
 float getDistance(__global float* x, __global float* y, int dims)
 {
     float sum = 0.0f;
-    for (int i = 0; i <dims; i++)
+    for (int i = 0; i <DIMENSIONS; i++)
     {
-        sum += pow(x[i] - y[i], 2);
+        float diff = x[i] - y[i];
+        sum = mad(diff, diff, sum);
     }
-    return sqrt(sum);
+    return sum;
 }
 
 /*******************************************
@@ -134,13 +204,15 @@ float getDistance(__global float* x, __global float* y, int dims)
  * @param[in] items 数据样本
  * @param[in] points 分组中心
  * @param[out] assignment 输出分组索引
+ * @param[out] distances 输出到最近分组中心距离的平方
  * @param[in] dims 维度
  * @param[in] k 分组数量
  * @param[in] n 样本数量
  * ****************************************/
 __kernel void findNearest(__global float* items,
                           __global float* points, 
-                          __global int* assignment, 
+                          __global int* assignment,
+                          __global float* distances,
                           int dims,
                           int k,
                           int n)
@@ -152,14 +224,14 @@ __kernel void findNearest(__global float* items,
         return;
 
     // 找到线程对应的样本
-    __global float* item = items + idx * dims;
+    __global float* item = items + idx * DIMENSIONS;
 
     // 查找最近的分组中心
     int p = 0;
-    float nearest = getDistance(item, points, dims);
-    for (int i = 1; i < k; i++)
+    float nearest = getDistance(item, points, DIMENSIONS);
+    for (int i = 1; i < GROUPS; i++)
     {
-        float n = getDistance(item, points + i * dims, dims);
+        float n = getDistance(item, points + i * DIMENSIONS, DIMENSIONS);
         if (n < nearest)
         {
             p = i;
@@ -167,57 +239,680 @@ __kernel void findNearest(__global float* items,
         }
     }
     assignment[idx] = p;
+    distances[idx] = nearest;
 }
 
 /*******************************************
- * @brief 更新分组中心,每个分组一个线程
- * @param[in] items 数据样本
- * @param[out] points 分组中心
- * @param[in] assignment 分组索引
+ * @brief 计算8位整数样本与float中心点之间欧氏距离的平方
+ * @param[in] x 样本
+ * @param[in] y 中心点
+ * @param[in] dims 维度
+ * @return 距离的平方
+ * ****************************************/
+float getDistanceU8(__global const uchar* x, __global const float* y, int dims)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < DIMENSIONS; i++)
+    {
+        float diff = convert_float(x[i]) - y[i];
+        sum = mad(diff, diff, sum);
+    }
+    return sum;
+}
+
+/*******************************************
+ * @brief 计算半精度样本与float中心点之间欧氏距离的平方
+ * @param[in] x 样本
+ * @param[in] y 中心点
+ * @param[in] dims 维度
+ * @return 距离的平方
+ * ****************************************/
+float getDistanceHalf(__global const half* x, __global const float* y, int dims)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < DIMENSIONS; i++)
+    {
+        float diff = vload_half(i, x) - y[i];
+        sum = mad(diff, diff, sum);
+    }
+    return sum;
+}
+
+/*******************************************
+ * @brief 寻找距离最近的分组,样本为8位整数
+ * @param[in] items 数据样本,每行stride个元素
+ * @param[in] points 分组中心
+ * @param[out] assignment 输出分组索引
+ * @param[out] distances 输出到最近分组中心距离的平方
  * @param[in] dims 维度
  * @param[in] k 分组数量
  * @param[in] n 样本数量
+ * @param[in] stride 样本每行的元素个数
  * ****************************************/
-__kernel void updatePoints(__global float* items,
-                           __global float* points, 
-                           __global int* assignment, 
-                           int dims,
-                           int k,
-                           int n)
+__kernel void findNearestU8(__global const uchar* items,
+                            __global const float* points,
+                            __global int* assignment,
+                            __global float* distances,
+                            int dims,
+                            int k,
+                            int n,
+                            int stride)
 {
     const size_t idx = get_global_id(0);
 
     // 对齐线程,直接返回
-    if (idx >= k)
+    if (idx >= n)
         return;
 
-    // 找到线程对应的分组中心点
-    __global float* point = points + idx * dims;
+    __global const uchar* item = items + idx * stride;
 
-    //清零
-    for (int i = 0; i < dims; i++)
+    // 比较距离的平方即可,不需要开方
+    int p = 0;
+    float nearest = getDistanceU8(item, points, DIMENSIONS);
+    for (int i = 1; i < GROUPS; i++)
     {
-        point[i] = 0.0f;
+        float d = getDistanceU8(item, points + i * DIMENSIONS, DIMENSIONS);
+        if (d < nearest)
+        {
+            p = i;
+            nearest = d;
+        }
     }
+    assignment[idx] = p;
+    distances[idx] = nearest;
+}
 
-    // 计算组内样本的坐标和
-    int count = 0;
-    for (int i = 0; i < n; i++)
+/*******************************************
+ * @brief 寻找距离最近的分组,样本为半精度浮点
+ * @param[in] items 数据样本,每行stride个元素
+ * @param[in] points 分组中心
+ * @param[out] assignment 输出分组索引
+ * @param[out] distances 输出到最近分组中心距离的平方
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] n 样本数量
+ * @param[in] stride 样本每行的元素个数
+ * ****************************************/
+__kernel void findNearestHalf(__global const half* items,
+                              __global const float* points,
+                              __global int* assignment,
+                              __global float* distances,
+                              int dims,
+                              int k,
+                              int n,
+                              int stride)
+{
+    const size_t idx = get_global_id(0);
+
+    // 对齐线程,直接返回
+    if (idx >= n)
+        return;
+
+    __global const half* item = items + idx * stride;
+
+    // 比较距离的平方即可,不需要开方
+    int p = 0;
+    float nearest = getDistanceHalf(item, points, DIMENSIONS);
+    for (int i = 1; i < GROUPS; i++)
+    {
+        float d = getDistanceHalf(item, points + i * DIMENSIONS, DIMENSIONS);
+        if (d < nearest)
+        {
+            p = i;
+            nearest = d;
+        }
+    }
+    assignment[idx] = p;
+    distances[idx] = nearest;
+}
+
+/*******************************************
+ * @brief 计算一个坐标与多个坐标之间的欧氏距离,每个
+ *        坐标一个线程,组内分段共享查询坐标
+ * @param[in] query 查询坐标
+ * @param[in] matrix 坐标矩阵,每行dims个元素
+ * @param[out] ret 输出距离
+ * @param[in] tile 局部缓存,大小与组内工作项数量相同
+ * @param[in] dims 维度
+ * @param[in] rows 坐标数量
+ * ****************************************/
+__kernel void distanceBatch(__global const float* query,
+                            __global const float* matrix,
+                            __global float* ret,
+                            __local float* tile,
+                            int dims,
+                            int rows)
+{
+    const size_t idx = get_global_id(0);
+    const int localId = get_local_id(0);
+    const int localSize = get_local_size(0);
+
+    float sum = 0.0f;
+    for (int d = 0; d < dims; d += localSize)
+    {
+        // 组内协作加载一段查询坐标
+        tile[localId] = (d + localId < dims) ? query[d + localId] : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (idx < rows)
+        {
+            __global const float* item = matrix + idx * dims + d;
+            int end = min(localSize, dims - d);
+            for (int j = 0; j < end; j++)
+            {
+                float diff = item[j] - tile[j];
+                sum = mad(diff, diff, sum);
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (idx < rows)
+        ret[idx] = sqrt(sum);
+}
+
+/*******************************************
+ * @brief 计算两组坐标两两之间的欧氏距离,二维分块,
+ *        每个线程计算一对坐标
+ * @param[in] a 坐标矩阵,每行dims个元素
+ * @param[in] b 坐标矩阵,每行dims个元素
+ * @param[out] ret 输出距离,na行nb列
+ * @param[in] tileA 局部缓存,tile*(tile+1)个元素
+ * @param[in] tileB 局部缓存,tile*(tile+1)个元素
+ * @param[in] dims 维度
+ * @param[in] na a的坐标数量
+ * @param[in] nb b的坐标数量
+ * ****************************************/
+__kernel void distanceMatrix(__global const float* a,
+                             __global const float* b,
+                             __global float* ret,
+                             __local float* tileA,
+                             __local float* tileB,
+                             int dims,
+                             int na,
+                             int nb)
+{
+    const int tile = get_local_size(0);
+    const int pitch = tile + 1;
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int col = get_global_id(0);     // b的序号
+    const int row = get_global_id(1);     // a的序号
+    const int colBase = get_group_id(0) * tile;
+    const int rowBase = get_group_id(1) * tile;
+
+    float sum = 0.0f;
+    for (int d = 0; d < dims; d += tile)
+    {
+        // 每个线程加载a和b各一个元素,越界部分补0
+        int dim = d + lx;
+        int ra = rowBase + ly;
+        int rb = colBase + ly;
+        tileA[ly * pitch + lx] = (ra < na && dim < dims) ? a[ra * dims + dim] : 0.0f;
+        tileB[ly * pitch + lx] = (rb < nb && dim < dims) ? b[rb * dims + dim] : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int j = 0; j < tile; j++)
+        {
+            float diff = tileA[ly * pitch + j] - tileB[lx * pitch + j];
+            sum = mad(diff, diff, sum);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (row < na && col < nb)
+        ret[row * nb + col] = sqrt(sum);
+}
+
+#ifndef TILE_K
+#define TILE_K 8                // 每次放入局部内存的中心点数量
+#endif
+
+#ifndef TILE_DIMS
+#define TILE_DIMS 128           // 每次放入局部内存的维度数量,必须是4的倍数
+#endif
+
+#ifndef SAMPLES_PER_ITEM
+#define SAMPLES_PER_ITEM 4      // 每个线程处理的样本数量
+#endif
+
+/*******************************************
+ * @brief 寻找距离最近的分组,分块版本
+ *        中心点按TILE_K个一组、TILE_DIMS维一段放入
+ *        局部内存,组内所有线程共享;每个线程处理
+ *        SAMPLES_PER_ITEM个样本,样本坐标读入寄存器后
+ *        与一组中心点逐个比较
+ *        全局工作数量为ceil(n/SAMPLES_PER_ITEM)
+ * @param[in] items 数据样本
+ * @param[in] points 分组中心
+ * @param[out] assignment 输出分组索引
+ * @param[out] distances 输出到最近分组中心距离的平方
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] n 样本数量
+ * ****************************************/
+__kernel void findNearestTiled(__global const float* items,
+                               __global const float* points,
+                               __global int* assignment,
+                               __global float* distances,
+                               int dims,
+                               int k,
+                               int n)
+{
+    __local float tile[TILE_K * TILE_DIMS];
+
+    const int localId = get_local_id(0);
+    const int localSize = get_local_size(0);
+
+    // 组内的样本连续分布,第s个样本为base + s * localSize
+    const size_t base = get_group_id(0) * localSize * SAMPLES_PER_ITEM + localId;
+
+    float best[SAMPLES_PER_ITEM];
+    int bestId[SAMPLES_PER_ITEM];
+    for (int s = 0; s < SAMPLES_PER_ITEM; s++)
     {
-        if (assignment[i] != idx)
+        best[s] = INFINITY;
+        bestId[s] = 0;
+    }
+
+    for (int c0 = 0; c0 < GROUPS; c0 += TILE_K)
+    {
+        float acc[SAMPLES_PER_ITEM][TILE_K];
+        for (int s = 0; s < SAMPLES_PER_ITEM; s++)
+        {
+            for (int c = 0; c < TILE_K; c++)
+            {
+                acc[s][c] = 0.0f;
+            }
+        }
+
+        for (int d0 = 0; d0 < DIMENSIONS; d0 += TILE_DIMS)
+        {
+            // 组内协作加载一块中心点,越界部分补0
+            for (int i = localId; i < TILE_K * TILE_DIMS; i += localSize)
+            {
+                int c = c0 + i / TILE_DIMS;
+                int d = d0 + i % TILE_DIMS;
+                tile[i] = (c < GROUPS && d < DIMENSIONS) ? points[c * DIMENSIONS + d] : 0.0f;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            int len = min(TILE_DIMS, DIMENSIONS - d0);
+            for (int s = 0; s < SAMPLES_PER_ITEM; s++)
+            {
+                size_t idx = base + s * localSize;
+                if (idx >= n)
+                    break;
+
+                __global const float* item = items + idx * DIMENSIONS + d0;
+                int j = 0;
+                for (; j + 4 <= len; j += 4)
+                {
+                    float4 x = vload4(0, item + j);
+                    for (int c = 0; c < TILE_K; c++)
+                    {
+                        float4 diff = x - vload4(0, tile + c * TILE_DIMS + j);
+                        acc[s][c] += dot(diff, diff);
+                    }
+                }
+                for (; j < len; j++)
+                {
+                    for (int c = 0; c < TILE_K; c++)
+                    {
+                        float diff = item[j] - tile[c * TILE_DIMS + j];
+                        acc[s][c] = mad(diff, diff, acc[s][c]);
+                    }
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // 与之前的最近距离比较,比较距离的平方即可
+        for (int s = 0; s < SAMPLES_PER_ITEM; s++)
+        {
+            for (int c = 0; c < TILE_K && c0 + c < GROUPS; c++)
+            {
+                if (acc[s][c] < best[s])
+                {
+                    best[s] = acc[s][c];
+                    bestId[s] = c0 + c;
+                }
+            }
+        }
+    }
+
+    for (int s = 0; s < SAMPLES_PER_ITEM; s++)
+    {
+        size_t idx = base + s * localSize;
+        if (idx < n)
+        {
+            assignment[idx] = bestId[s];
+            distances[idx] = best[s];
+        }
+    }
+}
+
+/*******************************************
+ * @brief 修复空分组,在findNearest之后、sumPoints之前执行
+          统计各分组的样本数量,每个空分组依次取走当前
+          距离最大的样本,该样本原来的分组至少还剩一个
+          样本;距离相同时序号小的优先,与主机上的
+          Kmeans::m_reseed结果一致。之后sumPoints按新的
+          分组索引求和,空分组的中心就是这个样本
+          只使用一个工作组,工作项数量必须是2的幂
+ * @param[in,out] assignment 分组索引
+ * @param[in,out] distances 各样本到所属中心距离的平方,取走的样本置0
+ * @param[out] counts 各分组的样本数量
+ * @param[in] values 局部缓存,每个线程一个元素
+ * @param[in] indices 局部缓存,每个线程一个元素
+ * @param[in] k 分组数量
+ * @param[in] n 样本数量
+ * ****************************************/
+__kernel void reseedPoints(__global int* assignment,
+                           __global float* distances,
+                           __global int* counts,
+                           __local float* values,
+                           __local int* indices,
+                           int k,
+                           int n)
+{
+    const int localId = get_local_id(0);
+    const int localSize = get_local_size(0);
+
+    for (int c = localId; c < GROUPS; c += localSize)
+    {
+        counts[c] = 0;
+    }
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    for (int i = localId; i < n; i += localSize)
+    {
+        atomic_inc(counts + assignment[i]);
+    }
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    // 取走样本只会把非空分组减到不小于1,尚未处理的空分组
+    // 保持为空,所有线程对counts[c]的判断一致
+    for (int c = 0; c < GROUPS; c++)
+    {
+        if (counts[c] > 0)
             continue;
 
-        __global float* item = items + i * dims;
-        for (int j = 0; j < dims; j++)
+        float best = -1.0f;
+        int index = -1;
+        for (int i = localId; i < n; i += localSize)
         {
-            point[j] += item[j];
+            float d = distances[i];
+            if (d > best && counts[assignment[i]] > 1)
+            {
+                best = d;
+                index = i;
+            }
         }
-        count += 1;
+
+        values[localId] = best;
+        indices[localId] = index;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int step = localSize / 2; step > 0; step >>= 1)
+        {
+            if (localId < step)
+            {
+                float v = values[localId + step];
+                int j = indices[localId + step];
+                int i = indices[localId];
+                if (j >= 0 && (i < 0 || v > values[localId] || (v == values[localId] && j < i)))
+                {
+                    values[localId] = v;
+                    indices[localId] = j;
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // 没有可以取走的样本时,该分组在mergePoints中保留原来的中心
+        if (localId == 0 && indices[0] >= 0)
+        {
+            int i = indices[0];
+            counts[assignment[i]] -= 1;
+            counts[c] = 1;
+            assignment[i] = c;
+            distances[i] = 0.0f;
+        }
+        barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+/*******************************************
+ * @brief 更新分组中心
+          步骤1:
+          样本分为parts段,每个线程负责一段样本的一个
+          维度,把该维度累加到所属分组的部分和中;每个
+          部分和只有一个线程写入,不需要原子操作;每段
+          的0号维度线程同时统计各分组的样本数量
+          二维工作项:(dims, parts)
+ * @param[in] items 数据样本
+ * @param[in] assignment 分组索引
+ * @param[out] partial 部分和,parts*k*dims个元素
+ * @param[out] partialCounts 各段内各分组的样本数量,parts*k个元素
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] n 样本数量
+ * @param[in] parts 样本分段数量
+ * ****************************************/
+__kernel void sumPoints(__global const float* items,
+                        __global const int* assignment,
+                        __global float* partial,
+                        __global int* partialCounts,
+                        int dims,
+                        int k,
+                        int n,
+                        int parts)
+{
+    const int d = get_global_id(0);
+    const int part = get_global_id(1);
+
+    // 对齐线程,直接返回
+    if (d >= DIMENSIONS || part >= parts)
+        return;
+
+    __global float* sum = partial + part * GROUPS * DIMENSIONS;
+    for (int c = 0; c < GROUPS; c++)
+    {
+        sum[c * DIMENSIONS + d] = 0.0f;
+        if (d == 0)
+            partialCounts[part * GROUPS + c] = 0;
+    }
+
+    const int size = (n + parts - 1) / parts;
+    const int end = min(n, (part + 1) * size);
+    for (int i = part * size; i < end; i++)
+    {
+        int c = assignment[i];
+        sum[c * DIMENSIONS + d] += items[i * DIMENSIONS + d];
+        if (d == 0)
+            partialCounts[part * GROUPS + c] += 1;
+    }
+}
+
+/*******************************************
+ * @brief 更新分组中心,样本为8位整数
+          步骤1,参见sumPoints
+ * @param[in] items 数据样本,每行stride个元素
+ * @param[in] assignment 分组索引
+ * @param[out] partial 部分和,parts*k*dims个元素
+ * @param[out] partialCounts 各段内各分组的样本数量,parts*k个元素
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] n 样本数量
+ * @param[in] parts 样本分段数量
+ * @param[in] stride 样本每行的元素个数
+ * ****************************************/
+__kernel void sumPointsU8(__global const uchar* items,
+                          __global const int* assignment,
+                          __global float* partial,
+                          __global int* partialCounts,
+                          int dims,
+                          int k,
+                          int n,
+                          int parts,
+                          int stride)
+{
+    const int d = get_global_id(0);
+    const int part = get_global_id(1);
+
+    // 对齐线程,直接返回
+    if (d >= DIMENSIONS || part >= parts)
+        return;
+
+    __global float* sum = partial + part * GROUPS * DIMENSIONS;
+    for (int c = 0; c < GROUPS; c++)
+    {
+        sum[c * DIMENSIONS + d] = 0.0f;
+        if (d == 0)
+            partialCounts[part * GROUPS + c] = 0;
+    }
+
+    const int size = (n + parts - 1) / parts;
+    const int end = min(n, (part + 1) * size);
+    for (int i = part * size; i < end; i++)
+    {
+        int c = assignment[i];
+        sum[c * DIMENSIONS + d] += convert_float(items[i * stride + d]);
+        if (d == 0)
+            partialCounts[part * GROUPS + c] += 1;
+    }
+}
+
+/*******************************************
+ * @brief 更新分组中心,样本为半精度浮点
+          步骤1,参见sumPoints
+ * @param[in] items 数据样本,每行stride个元素
+ * @param[in] assignment 分组索引
+ * @param[out] partial 部分和,parts*k*dims个元素
+ * @param[out] partialCounts 各段内各分组的样本数量,parts*k个元素
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] n 样本数量
+ * @param[in] parts 样本分段数量
+ * @param[in] stride 样本每行的元素个数
+ * ****************************************/
+__kernel void sumPointsHalf(__global const half* items,
+                            __global const int* assignment,
+                            __global float* partial,
+                            __global int* partialCounts,
+                            int dims,
+                            int k,
+                            int n,
+                            int parts,
+                            int stride)
+{
+    const int d = get_global_id(0);
+    const int part = get_global_id(1);
+
+    // 对齐线程,直接返回
+    if (d >= DIMENSIONS || part >= parts)
+        return;
+
+    __global float* sum = partial + part * GROUPS * DIMENSIONS;
+    for (int c = 0; c < GROUPS; c++)
+    {
+        sum[c * DIMENSIONS + d] = 0.0f;
+        if (d == 0)
+            partialCounts[part * GROUPS + c] = 0;
+    }
+
+    const int size = (n + parts - 1) / parts;
+    const int end = min(n, (part + 1) * size);
+    for (int i = part * size; i < end; i++)
+    {
+        int c = assignment[i];
+        sum[c * DIMENSIONS + d] += vload_half(i * stride + d, items);
+        if (d == 0)
+            partialCounts[part * GROUPS + c] += 1;
     }
+}
 
-    // 除以样本数量获得平均坐标
-    for (int i = 0; i < dims; i++)
+/*******************************************
+ * @brief 更新分组中心
+          步骤2:
+          每个线程负责一个分组的一个维度,合并各段的
+          部分和并除以样本数量;空分组保留原来的中心,
+          不会产生NaN
+          二维工作项:(dims, k)
+ * @param[in,out] points 分组中心
+ * @param[out] counts 各分组的样本数量
+ * @param[in] partial 部分和,parts*k*dims个元素
+ * @param[in] partialCounts 各段内各分组的样本数量,parts*k个元素
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] parts 样本分段数量
+ * ****************************************/
+__kernel void mergePoints(__global float* points,
+                          __global int* counts,
+                          __global const float* partial,
+                          __global const int* partialCounts,
+                          int dims,
+                          int k,
+                          int parts)
+{
+    const int d = get_global_id(0);
+    const int c = get_global_id(1);
+
+    // 对齐线程,直接返回
+    if (d >= DIMENSIONS || c >= GROUPS)
+        return;
+
+    float sum = 0.0f;
+    int count = 0;
+    for (int part = 0; part < parts; part++)
     {
-        point[i] /= count;
+        sum += partial[(part * GROUPS + c) * DIMENSIONS + d];
+        count += partialCounts[part * GROUPS + c];
     }
+
+    if (count > 0)
+        points[c * DIMENSIONS + d] = sum / count;
+    if (d == 0)
+        counts[c] = count;
+}
+
+/*******************************************
+ * @brief 合并各段的部分和,不求平均,用于多个设备
+          分别计算后在主机上汇总
+          二维工作项:(dims, k)
+ * @param[out] sums 各分组的坐标和
+ * @param[out] counts 各分组的样本数量
+ * @param[in] partial 部分和,parts*k*dims个元素
+ * @param[in] partialCounts 各段内各分组的样本数量,parts*k个元素
+ * @param[in] dims 维度
+ * @param[in] k 分组数量
+ * @param[in] parts 样本分段数量
+ * ****************************************/
+__kernel void foldPoints(__global float* sums,
+                         __global int* counts,
+                         __global const float* partial,
+                         __global const int* partialCounts,
+                         int dims,
+                         int k,
+                         int parts)
+{
+    const int d = get_global_id(0);
+    const int c = get_global_id(1);
+
+    // 对齐线程,直接返回
+    if (d >= DIMENSIONS || c >= GROUPS)
+        return;
+
+    float sum = 0.0f;
+    int count = 0;
+    for (int part = 0; part < parts; part++)
+    {
+        sum += partial[(part * GROUPS + c) * DIMENSIONS + d];
+        count += partialCounts[part * GROUPS + c];
+    }
+
+    sums[c * DIMENSIONS + d] = sum;
+    if (d == 0)
+        counts[c] = count;
 }
\ No newline at end of file
@@ -1,148 +1,694 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <codecvt>
+#include <locale>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <unistd.h>
 #include "DimMap.h"
 #include "Text.h"
 #include "DataLoader.h"
 #include "Kmeans.h"
 #include "Accelerator.h"
+#include "Arena.h"
+#include "QuantizedSet.h"
+#include "Classifier.h"
+#include "Model.h"
+#include "Server.h"
+#include "Deduplicator.h"
+#include "FeatureCache.h"
+#include "Follower.h"
 
 using namespace AutoBug;
 
-class Classifier
+// 读写缓冲区的大小
+static const size_t IO_BUFFER_SIZE = 1 << 20;
+
+// follow每次最多解析的标题数量,样本是稠密的,限制一次占用的内存
+static const size_t FOLLOW_BATCH = 4096;
+
+/*******************************************
+ * @brief 打印用法
+ * @param[in] name 程序名
+ * ****************************************/
+static void usage(const char* name) noexcept
+{
+    fprintf(stderr,
+        "usage: %s                                 learn bug.csv and print the groups\n"
+        "       %s train [-q storage] <csv> <model>\n"
+        "           learn the titles in csv and save the group centers to model\n"
+        "           -q storage   none, u8 or f16 (default none)\n"
+        "       %s classify [-b batch] [-t] <model> [file]\n"
+        "           read titles from file or stdin, one per line, optionally as\n"
+        "           id<TAB>title, and write id<TAB>group<TAB>distance lines;\n"
+        "           lines without an id use the line number\n"
+        "           -b batch     titles classified per batch (default 4096)\n"
+        "           -t           route top-down through the group tree instead of\n"
+        "                        comparing with every group\n"
+        "       %s evaluate [-b batch] <model> <file>\n"
+        "           classify the titles in file both ways and report the cost and\n"
+        "           accuracy of tree routing against the exact scan\n"
+        "       %s serve [-s socket] [-b batch] [-w us] <model>\n"
+        "           keep the model loaded and answer the classify protocol on a\n"
+        "           unix socket, #stats returns latency and throughput as JSON\n"
+        "           -s socket    socket path (default autobug.sock)\n"
+        "           -b batch     classify as soon as this many requests wait (default 256)\n"
+        "           -w us        latency budget of the oldest waiting request (default 2000)\n"
+        "       %s dedup [-j similarity] [-n chars] <file>\n"
+        "           find near-duplicate titles and write id<TAB>id<TAB>similarity lines\n"
+        "           -j similarity  minimum Jaccard similarity of n-gram sets (default 0.8)\n"
+        "           -n chars       characters per n-gram (default 2)\n"
+        "           buckets of more than 256 matching titles only compare each title with\n"
+        "           the next 64, the number of pairs skipped this way is reported\n"
+        "       %s follow [-i ms] <csv>\n"
+        "           keep the feature cache of an append-only csv current, reading\n"
+        "           only the lines appended since the last run\n"
+        "           -i ms        longest wait between checks, inotify wakes up earlier (default 1000)\n",
+        name, name, name, name, name, name, name);
+}
+
+/*******************************************
+ * @brief 学习数据集并保存模型
+ * @param[in] argc 参数数量,argv[0]为子命令
+ * @param[in] argv 参数
+ * @return 退出码
+ * ****************************************/
+static int train(int argc, char* argv[]) noexcept
+{
+    QuantizedSet::Format storage = QuantizedSet::NONE;
+    int ch;
+    while ((ch = getopt(argc, argv, "q:")) != -1)
+    {
+        if (ch == 'q' && strcmp(optarg, "none") == 0)
+            storage = QuantizedSet::NONE;
+        else if (ch == 'q' && strcmp(optarg, "u8") == 0)
+            storage = QuantizedSet::U8;
+        else if (ch == 'q' && strcmp(optarg, "f16") == 0)
+            storage = QuantizedSet::F16;
+        else
+            return -1;
+    }
+    if (argc - optind != 2)
+        return -1;
+
+    auto& dimMap = DimMap::instance();
+    auto dataset = DataLoader::loadCached(argv[optind], dimMap);
+    if (dataset.empty())
+    {
+        fprintf(stderr, "%s has no titles\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    Classifier classifier;
+    classifier.setStorage(storage);
+    classifier.learn(dataset);
+
+    Model model;
+    if (!model.build(classifier, dimMap) || !model.save(argv[optind + 1]))
+        return EXIT_FAILURE;
+
+    fprintf(stderr, "%zu titles, %zu groups\n", dataset.size(), model.groupCount());
+    return EXIT_SUCCESS;
+}
+
+/* 一批待分类的标题,标题只保存稀疏坐标,id复制出来以便
+ * 读缓冲区被复用 */
+struct Batch
+{
+    SparseBatch samples;
+    std::string ids;
+    std::vector<size_t> idEnds;
+    std::vector<int> groups;
+    std::vector<float> distances;
+    uint64_t evaluations;   // 累计计算距离的次数
+};
+
+/*******************************************
+ * @brief 对一批标题分类并把结果追加到输出缓冲区,
+ *        缓冲区满时写出
+ * @param[in] model 模型
+ * @param[in] batch 一批标题,处理后清空
+ * @param[out] out 输出缓冲区
+ * @param[in] fp 输出文件
+ * @param[in] tree 是否沿分组树分类
+ * @return 是否成功
+ * ****************************************/
+static bool flushBatch(const Model& model, Batch& batch, std::string& out, FILE* fp, bool tree) noexcept
 {
-public:
-    ~Classifier() noexcept = default;
-    Classifier() noexcept = default;
-
-    /*******************************************
-     * @brief 输入数据集进行学习,会清空以前的数据
-     * @param[in] dataset 数据集
-     * @param[in] n 要计算的样本数量,0表示全部
-     * @return 最终分类数量
-     * ****************************************/
-    size_t learn(std::vector<Text> dataset, size_t n=0) noexcept
-    {
-        if (n != 0 && n < dataset.size())
+    size_t n = batch.samples.size();
+    batch.groups.resize(n);
+    batch.distances.resize(n);
+    if (tree)
+    {
+        batch.evaluations += model.route(batch.samples, batch.groups.data(), batch.distances.data());
+    }
+    else
+    {
+        model.classify(batch.samples, batch.groups.data(), batch.distances.data());
+        batch.evaluations += static_cast<uint64_t>(n) * model.groupCount();
+    }
+
+    size_t begin = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        char line[48];
+        int len = snprintf(line, sizeof(line), "\t%d\t%.4f\n", batch.groups[i], batch.distances[i]);
+        out.append(batch.ids, begin, batch.idEnds[i] - begin);
+        out.append(line, len);
+        begin = batch.idEnds[i];
+
+        if (out.size() >= IO_BUFFER_SIZE)
         {
-            dataset.resize(n);
+            if (fwrite(out.data(), 1, out.size(), fp) != out.size())
+                return false;
+            out.clear();
         }
-        size_t preferSize = (dataset.size() / 20);
-        if (preferSize < 3)
-            preferSize = 3;
-        if (preferSize > 10)
-            preferSize = 10;
-        size_t k = (dataset.size() + 4) / preferSize;   // 初始分组数量
-        Kmeans kmeans{dataset, k};
-        kmeans.learn(10);
-
-        for (size_t idx = 0; idx < k; idx++)
+    }
+
+    batch.samples.clear();
+    batch.ids.clear();
+    batch.idEnds.clear();
+    return true;
+}
+
+/*******************************************
+ * @brief 加载模型,逐批分类输入的标题
+ * @param[in] argc 参数数量,argv[0]为子命令
+ * @param[in] argv 参数
+ * @return 退出码
+ * ****************************************/
+static int classify(int argc, char* argv[]) noexcept
+{
+    typedef std::chrono::steady_clock Clock;
+
+    size_t batchSize = 4096;
+    bool tree = false;
+    int ch;
+    while ((ch = getopt(argc, argv, "b:t")) != -1)
+    {
+        if (ch == 'b' && atol(optarg) > 0)
+            batchSize = atol(optarg);
+        else if (ch == 't')
+            tree = true;
+        else
+            return -1;
+    }
+    if (argc - optind != 1 && argc - optind != 2)
+        return -1;
+
+    auto& dimMap = DimMap::instance();
+    Model model;
+    if (!model.load(argv[optind], dimMap))
+        return EXIT_FAILURE;
+
+    FILE* in = stdin;
+    const char* name = "stdin";
+    if (argc - optind == 2)
+    {
+        name = argv[optind + 1];
+        in = fopen(name, "rb");
+        if (in == nullptr)
         {
-            auto group = kmeans.group(idx);
-            m_groupCenters.push_back(kmeans.groupCenter(idx));
-            m_groups.push_back(group);
+            fprintf(stderr, "%s: %s\n", name, strerror(errno));
+            return EXIT_FAILURE;
         }
+    }
 
-        // 数量超限，进行拆分，可能存在高度相似导致拆分失败，则跳过
-        for (size_t idx = 0; idx < m_groups.size();)
+    auto start = Clock::now();
+    int ret = EXIT_SUCCESS;
+    Batch batch;
+    batch.evaluations = 0;
+    std::string out;
+    out.reserve(IO_BUFFER_SIZE + 256);
+    std::vector<char> buffer(IO_BUFFER_SIZE);
+    size_t used = 0;
+    size_t lineNo = 0;
+    size_t count = 0;
+    bool eof = false;
+
+    // 按块读取,一次处理缓冲区中所有完整的行,剩余的部分移到开头
+    while (!eof)
+    {
+        if (used == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        size_t n = fread(buffer.data() + used, 1, buffer.size() - used, in);
+        used += n;
+        if (n == 0)
         {
-            if (m_groups[idx].size() <= preferSize || m_split(idx) == 1)
+            if (ferror(in))
             {
-                idx++;
+                fprintf(stderr, "%s: %s\n", name, strerror(errno));
+                ret = EXIT_FAILURE;
+                goto EXIT;
             }
+            eof = true;
         }
 
-        return m_groups.size();
+        size_t pos = 0;
+        while (pos < used)
+        {
+            const char* line = buffer.data() + pos;
+            const char* newline = static_cast<const char*>(memchr(line, '\n', used - pos));
+            if (newline == nullptr && !eof)
+                break;
+
+            size_t len = newline != nullptr ? newline - line : used - pos;
+            pos += len + 1;
+            lineNo++;
+            if (len > 0 && line[len - 1] == '\r')
+                len--;
+            if (len == 0)
+                continue;
+
+            const char* tab = static_cast<const char*>(memchr(line, '\t', len));
+            if (tab != nullptr)
+            {
+                batch.ids.append(line, tab - line);
+                batch.samples.add(tab + 1, line + len - tab - 1, dimMap);
+            }
+            else
+            {
+                batch.ids += std::to_string(lineNo);
+                batch.samples.add(line, len, dimMap);
+            }
+            batch.idEnds.push_back(batch.ids.size());
+            count++;
+
+            if (batch.samples.size() >= batchSize && !flushBatch(model, batch, out, stdout, tree))
+            {
+                fprintf(stderr, "failed to write output: %s\n", strerror(errno));
+                ret = EXIT_FAILURE;
+                goto EXIT;
+            }
+        }
+
+        used = pos < used ? used - pos : 0;
+        if (used > 0)
+            memmove(buffer.data(), buffer.data() + pos, used);
+    }
+
+    if (!flushBatch(model, batch, out, stdout, tree) || fwrite(out.data(), 1, out.size(), stdout) != out.size() || fflush(stdout) != 0)
+    {
+        fprintf(stderr, "failed to write output: %s\n", strerror(errno));
+        ret = EXIT_FAILURE;
+        goto EXIT;
+    }
+
+    {
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        fprintf(stderr, "classified %zu titles into %zu groups in %.3fs (%.0f titles/s, %.1f distances/title)\n",
+                count, model.groupCount(), seconds, seconds > 0 ? count / seconds : 0.0,
+                count > 0 ? static_cast<double>(batch.evaluations) / count : 0.0);
+    }
+
+EXIT:
+    if (in != stdin)
+        fclose(in);
+    return ret;
+}
+
+/*******************************************
+ * @brief 用两种方式对文件中的标题分类,比较分组树
+ *        自顶向下分类与精确扫描的开销和结果
+ * @param[in] argc 参数数量,argv[0]为子命令
+ * @param[in] argv 参数
+ * @return 退出码
+ * ****************************************/
+static int evaluate(int argc, char* argv[]) noexcept
+{
+    typedef std::chrono::steady_clock Clock;
+
+    size_t batchSize = 4096;
+    int ch;
+    while ((ch = getopt(argc, argv, "b:")) != -1)
+    {
+        if (ch == 'b' && atol(optarg) > 0)
+            batchSize = atol(optarg);
+        else
+            return -1;
     }
+    if (argc - optind != 2)
+        return -1;
+
+    auto& dimMap = DimMap::instance();
+    Model model;
+    if (!model.load(argv[optind], dimMap))
+        return EXIT_FAILURE;
+    if (model.nodeCount() == 0)
+        fprintf(stderr, "%s has no group tree, routing falls back to the exact scan\n", argv[optind]);
 
-    /*******************************************
-     * @brief 打印学习后的各个分组
-     * ****************************************/
-    void print() noexcept
+    auto lines = DataLoader::loadLines(argv[optind + 1]);
+    SparseBatch samples;
+    std::vector<int> exactGroups(batchSize);
+    std::vector<float> exactDistances(batchSize);
+    std::vector<int> treeGroups(batchSize);
+    std::vector<float> treeDistances(batchSize);
+    Clock::duration exactTime{0};
+    Clock::duration treeTime{0};
+    uint64_t evaluations = 0;
+    size_t count = 0;
+    size_t agreed = 0;
+    double exactSum = 0;
+    double treeSum = 0;
+
+    for (size_t begin = 0; begin < lines.size(); begin += batchSize)
     {
-        for (size_t i = 0; i < m_groups.size(); i++)
+        size_t end = begin + batchSize < lines.size() ? begin + batchSize : lines.size();
+        samples.clear();
+        for (size_t i = begin; i < end; i++)
         {
-            printf("Group %zu:\n", i);
-            for (auto& item : m_groups[i])
-            {
-                printf("\t%ls\n", item.text().c_str());
-            }
+            const std::string& line = lines[i];
+            if (line.empty())
+                continue;
+
+            size_t tab = line.find('\t');
+            size_t offset = tab != std::string::npos ? tab + 1 : 0;
+            samples.add(line.data() + offset, line.size() - offset, dimMap);
+        }
+
+        size_t n = samples.size();
+        auto start = Clock::now();
+        model.classify(samples, exactGroups.data(), exactDistances.data());
+        auto middle = Clock::now();
+        evaluations += model.route(samples, treeGroups.data(), treeDistances.data());
+        auto finish = Clock::now();
+        exactTime += middle - start;
+        treeTime += finish - middle;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (exactGroups[i] == treeGroups[i])
+                agreed++;
+            exactSum += exactDistances[i];
+            treeSum += treeDistances[i];
         }
+        count += n;
     }
 
-    /*******************************************
-     * @brief 获取分组数量
-     * @return 分组数量
-     * ****************************************/
-    size_t groupCount() const noexcept
+    if (count == 0)
+    {
+        fprintf(stderr, "%s has no titles\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    double exactSeconds = std::chrono::duration<double>(exactTime).count();
+    double treeSeconds = std::chrono::duration<double>(treeTime).count();
+    printf("titles              %zu\n", count);
+    printf("groups              %zu\n", model.groupCount());
+    printf("tree nodes          %zu (depth %zu)\n", model.nodeCount(), model.depth());
+    printf("exact distances     %.1f per title, %.3fs (%.0f titles/s)\n",
+           static_cast<double>(model.groupCount()), exactSeconds, exactSeconds > 0 ? count / exactSeconds : 0.0);
+    printf("tree distances      %.1f per title, %.3fs (%.0f titles/s)\n",
+           static_cast<double>(evaluations) / count, treeSeconds, treeSeconds > 0 ? count / treeSeconds : 0.0);
+    printf("same group          %.2f%%\n", 100.0 * agreed / count);
+    printf("mean distance       exact %.4f, tree %.4f (+%.2f%%)\n", exactSum / count, treeSum / count,
+           exactSum > 0 ? 100.0 * (treeSum - exactSum) / exactSum : 0.0);
+    return EXIT_SUCCESS;
+}
+
+// 收到SIGINT或SIGTERM时停止的服务
+static Server* runningServer = nullptr;
+
+// 收到SIGINT或SIGTERM时置位,follow据此退出
+static volatile sig_atomic_t stopRequested = 0;
+
+/*******************************************
+ * @brief 信号处理函数,通知服务或跟踪退出
+ * @param[in] sig 信号
+ * ****************************************/
+static void onSignal(int sig) noexcept
+{
+    (void)sig;
+    stopRequested = 1;
+    if (runningServer != nullptr)
+        runningServer->stop();
+}
+
+/*******************************************
+ * @brief 安装SIGINT和SIGTERM的处理函数,不自动重启
+ *        被打断的系统调用,以便等待提前返回
+ * ****************************************/
+static void installSignals() noexcept
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+/*******************************************
+ * @brief 加载模型,作为常驻服务运行
+ * @param[in] argc 参数数量,argv[0]为子命令
+ * @param[in] argv 参数
+ * @return 退出码
+ * ****************************************/
+static int serve(int argc, char* argv[]) noexcept
+{
+    const char* path = "autobug.sock";
+    size_t batchSize = 256;
+    int wait = 2000;
+    int ch;
+    while ((ch = getopt(argc, argv, "s:b:w:")) != -1)
     {
-        return m_groups.size();
+        if (ch == 's')
+            path = optarg;
+        else if (ch == 'b' && atol(optarg) > 0)
+            batchSize = atol(optarg);
+        else if (ch == 'w' && atoi(optarg) >= 0)
+            wait = atoi(optarg);
+        else
+            return -1;
     }
+    if (argc - optind != 1)
+        return -1;
+
+    auto& dimMap = DimMap::instance();
+    Model model;
+    if (!model.load(argv[optind], dimMap))
+        return EXIT_FAILURE;
+
+    Server server{model, dimMap};
+    server.setBatch(batchSize, wait);
+    if (!server.listen(path))
+        return EXIT_FAILURE;
 
-    /*******************************************
-     * @brief 获取指定的分组中心
-     * @param[in] idx 分组序号
-     * @return 分组的中心
-     * ****************************************/
-    Text groupCenter(size_t idx) const noexcept
+    runningServer = &server;
+    installSignals();
+
+    fprintf(stderr, "serving %zu groups on %s\n", model.groupCount(), path);
+    bool success = server.run();
+    runningServer = nullptr;
+    fprintf(stderr, "%s\n", server.stats().c_str());
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*******************************************
+ * @brief 跟踪只在末尾追加的文件,把新追加的标题解析后
+ *        追加到它的特征缓存,之后的train等直接使用缓存
+ * @param[in] argc 参数数量,argv[0]为子命令
+ * @param[in] argv 参数
+ * @return 退出码
+ * ****************************************/
+static int follow(int argc, char* argv[]) noexcept
+{
+    int interval = 1000;
+    int ch;
+    while ((ch = getopt(argc, argv, "i:")) != -1)
     {
-        return m_groupCenters[idx];
+        if (ch == 'i' && atoi(optarg) > 0)
+            interval = atoi(optarg);
+        else
+            return -1;
     }
+    if (argc - optind != 1)
+        return -1;
 
-    /*******************************************
-     * @brief 获取指定的分组
-     * @param[in] idx 分组序号
-     * @return 分组的数据
-     * ****************************************/
-    std::vector<Text> group(size_t idx) const noexcept
+    const char* file = argv[optind];
+    auto& dimMap = DimMap::instance();
+    FeatureCache cache;
+    if (cache.directory().empty())
     {
-        return m_groups[idx];
+        fprintf(stderr, "the feature cache is disabled by AUTO_BUG_CACHE_DIR\n");
+        return EXIT_FAILURE;
     }
 
-private:
-    std::vector<Text> m_groupCenters;
-    std::vector<std::vector<Text>> m_groups;
+    // 缓存已经验证过它覆盖的内容,跟踪器直接使用它的哈希
+    uint64_t offset = cache.open(file, dimMap) ? cache.offset() : 0;
+    Follower follower{file};
+    follower.seek(offset, cache.hash());
+    installSignals();
+    fprintf(stderr, "following %s from byte %llu\n", file, static_cast<unsigned long long>(offset));
 
-    /*******************************************
-     * @brief 对一个分组进行拆分,分成多个新的分组,会
-     *        在末尾添加新的分组,并删除当前分组,因此
-     *        当前索引会引用到下一个分组
-     * @param[in] idx 要拆分的分组都序号
-     * @param[in] n 期望的平均分组大小,默认为3
-     * @return 拆分成了几个组
-     * ****************************************/
-    size_t m_split(size_t idx, int n=3)
+    std::vector<Text> texts;
+    size_t total = 0;
+    while (!stopRequested)
     {
-        auto dataset = m_groups[idx];
-        size_t k = (dataset.size() + n - 1) / n;
-        Kmeans kmeans{dataset, k};
-        kmeans.learn(10);
+        texts.clear();
+        int n = follower.read(dimMap, texts, FOLLOW_BATCH);
+        if (n < 0)
+        {
+            fprintf(stderr, "%s was truncated, replaced or rewritten, starting over\n", file);
+            offset = 0;
+            continue;
+        }
 
-        size_t count = 0;
-        for (size_t i = 0; i < k; i++)
+        if (follower.offset() == offset)
         {
-            auto group = kmeans.group(i);
-            if (group.size() ==0)
-                continue;
-            m_groupCenters.push_back(kmeans.groupCenter(i));
-            m_groups.push_back(group);
-            count++;
+            follower.wait(interval);
+            continue;
+        }
+
+        // 其他进程(例如train)也会追加缓存,此时从缓存的位置继续
+        if (!cache.append(file, dimMap, texts, offset, follower.offset()))
+        {
+            uint64_t cached = cache.open(file, dimMap) ? cache.offset() : 0;
+            if (cached == offset)
+            {
+                fprintf(stderr, "failed to update the feature cache of %s\n", file);
+                return EXIT_FAILURE;
+            }
+            fprintf(stderr, "the feature cache of %s changed, continuing from byte %llu\n", file, static_cast<unsigned long long>(cached));
+            offset = cached;
+            follower.seek(offset, cache.hash());
+            continue;
         }
 
-        m_groupCenters.erase(m_groupCenters.begin() + idx);
-        m_groups.erase(m_groups.begin() + idx);
-        return count;
+        offset = follower.offset();
+        total += n;
+        fprintf(stderr, "%d new titles, %zu since start, %llu bytes cached\n", n, total, static_cast<unsigned long long>(offset));
     }
-};
 
-int main()
+    return EXIT_SUCCESS;
+}
+
+/*******************************************
+ * @brief 查找文件中近似重复的标题
+ * @param[in] argc 参数数量,argv[0]为子命令
+ * @param[in] argv 参数
+ * @return 退出码
+ * ****************************************/
+static int dedup(int argc, char* argv[]) noexcept
+{
+    typedef std::chrono::steady_clock Clock;
+
+    float threshold = 0.8f;
+    int shingle = 2;
+    int ch;
+    while ((ch = getopt(argc, argv, "j:n:")) != -1)
+    {
+        if (ch == 'j' && atof(optarg) > 0 && atof(optarg) <= 1)
+            threshold = static_cast<float>(atof(optarg));
+        else if (ch == 'n' && atoi(optarg) > 0)
+            shingle = atoi(optarg);
+        else
+            return -1;
+    }
+    if (argc - optind != 1)
+        return -1;
+
+    // 非法的UTF-8解码为空字符串,不抛出异常
+    auto start = Clock::now();
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> convert{"", L""};
+    auto lines = DataLoader::loadLines(argv[optind]);
+    std::vector<std::string> ids;
+    std::vector<std::wstring> texts;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        const std::string& line = lines[i];
+        if (line.empty())
+            continue;
+
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos)
+        {
+            ids.push_back(line.substr(0, tab));
+            texts.push_back(convert.from_bytes(line.substr(tab + 1)));
+        }
+        else
+        {
+            ids.push_back(std::to_string(i + 1));
+            texts.push_back(convert.from_bytes(line));
+        }
+    }
+    std::vector<std::string>().swap(lines);
+
+    Deduplicator deduplicator{shingle};
+    deduplicator.setThreshold(threshold);
+    auto pairs = deduplicator.find(texts);
+
+    std::string out;
+    out.reserve(IO_BUFFER_SIZE + 256);
+    for (auto& pair : pairs)
+    {
+        char line[24];
+        int len = snprintf(line, sizeof(line), "\t%.4f\n", pair.similarity);
+        out += ids[pair.first];
+        out += '\t';
+        out += ids[pair.second];
+        out.append(line, len);
+        if (out.size() >= IO_BUFFER_SIZE)
+        {
+            if (fwrite(out.data(), 1, out.size(), stdout) != out.size())
+            {
+                fprintf(stderr, "failed to write output: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
+            out.clear();
+        }
+    }
+    if (fwrite(out.data(), 1, out.size(), stdout) != out.size() || fflush(stdout) != 0)
+    {
+        fprintf(stderr, "failed to write output: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    fprintf(stderr, "%zu titles, %zu candidates, %zu pairs, %zu skipped in %.3fs\n", texts.size(), deduplicator.candidates(), pairs.size(), deduplicator.skipped(), seconds);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
 {
     setlocale(LC_ALL, "");
+
+    if (argc > 1)
+    {
+        int ret = -1;
+        if (strcmp(argv[1], "train") == 0)
+            ret = train(argc - 1, argv + 1);
+        else if (strcmp(argv[1], "classify") == 0)
+            ret = classify(argc - 1, argv + 1);
+        else if (strcmp(argv[1], "evaluate") == 0)
+            ret = evaluate(argc - 1, argv + 1);
+        else if (strcmp(argv[1], "serve") == 0)
+            ret = serve(argc - 1, argv + 1);
+        else if (strcmp(argv[1], "dedup") == 0)
+            ret = dedup(argc - 1, argv + 1);
+        else if (strcmp(argv[1], "follow") == 0)
+            ret = follow(argc - 1, argv + 1);
+
+        if (ret < 0)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return ret;
+    }
+
     // Accelerator::instance().setEnable(false);
     if (Accelerator::instance().available())
     {
         printf("Use GPU: %s\n", Accelerator::instance().name().c_str());
         printf("Max Work Size: %zu\n", Accelerator::instance().maxLocalSize());
     }
-    auto dataset = DataLoader::load("bug.csv", DimMap::instance());
+    auto dataset = DataLoader::loadCached("bug.csv", DimMap::instance());
     Classifier classifier;
     classifier.learn(dataset);
     classifier.print();